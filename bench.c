@@ -0,0 +1,15 @@
+#include "core_src/sys.h"
+
+#include "./gc_src/bench.h"
+
+int main(int argc, const char **argv) {
+    init_core_state(8);
+
+    int c = gc_bench_main(argc, argv);
+
+    // NOTE this is needed.
+    safe_exit(c);
+
+    // Should never make it here.
+    return 1;
+}
@@ -6,6 +6,7 @@
 #include <sys/_types/_sigset_t.h>
 #include <unistd.h>
 #include <stdarg.h>
+#include <sys/stat.h>
 
 void safe_printf(const char *fmt, ...) {
     sigset_t old;
@@ -98,3 +99,21 @@ int safe_close(int fd) {
 
     return 0;
 }
+
+int safe_bytes_left(int fd, size_t *bytes) {
+    struct stat st;
+
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        return -1;
+    }
+
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+
+    if (offset == -1 || offset > st.st_size) {
+        return -1;
+    }
+
+    *bytes = (size_t)(st.st_size - offset);
+
+    return 0;
+}
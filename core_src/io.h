@@ -21,4 +21,11 @@ int safe_write(int fd, const void *buf, size_t cnt);
 int safe_read(int fd, void *buf, size_t cnt);
 int safe_close(int fd);
 
+// Writes the number of bytes between fd's offset and the end of its
+// file into bytes. Useful for checking sizes read from a file before 
+// trusting them.
+//
+// Returns -1 on error or if fd is not a regular file, 0 on success.
+int safe_bytes_left(int fd, size_t *bytes);
+
 #endif
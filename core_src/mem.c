@@ -7,17 +7,25 @@
 
 #include <inttypes.h>
 
+// Every pointer given out is preceded by this many bytes, the last of
+// which holds the pointer's channel. (See get_chnl)
+//
+// NOTE: This must keep the pointer as aligned as malloc's. Locks and
+// atomics are placed inside these allocations, and futexes on a 
+// misaligned address fail. 
+#define MEM_HEADER_SIZE 16
+
 void *try_safe_malloc(uint8_t chnl, size_t size) {
-    uint8_t *raw_ptr = malloc(size + 1);
+    uint8_t *raw_ptr = malloc(size + MEM_HEADER_SIZE);
 
     if (raw_ptr) {
-        raw_ptr[0] = chnl;
+        raw_ptr[MEM_HEADER_SIZE - 1] = chnl;
 
         _wrlock_core_state();
         _core_state->mem_chnls[chnl]++;
         _unlock_core_state();
 
-        return (void *)(raw_ptr + 1);
+        return (void *)(raw_ptr + MEM_HEADER_SIZE);
     }
 
     return NULL;
@@ -38,11 +46,11 @@ void *safe_malloc(uint8_t chnl, size_t size) {
 }
 
 void *try_safe_realloc(void *ptr, size_t size) {
-    uint8_t *raw_ptr = ((uint8_t *)ptr) - 1;
-    uint8_t *new_raw_ptr = realloc(raw_ptr, size + 1);
+    uint8_t *raw_ptr = ((uint8_t *)ptr) - MEM_HEADER_SIZE;
+    uint8_t *new_raw_ptr = realloc(raw_ptr, size + MEM_HEADER_SIZE);
 
     if (new_raw_ptr) {
-        return (void *)(new_raw_ptr + 1);
+        return (void *)(new_raw_ptr + MEM_HEADER_SIZE);
     }
 
     return NULL;
@@ -63,8 +71,8 @@ void *safe_realloc(void *ptr, size_t size) {
 }
 
 void safe_free(void *ptr) {
-    uint8_t *raw_ptr = ((uint8_t *)ptr) - 1;
-    uint8_t chnl = raw_ptr[0];
+    uint8_t *raw_ptr = ((uint8_t *)ptr) - MEM_HEADER_SIZE;
+    uint8_t chnl = raw_ptr[MEM_HEADER_SIZE - 1];
 
     _wrlock_core_state();
     _core_state->mem_chnls[chnl]--;
@@ -0,0 +1,283 @@
+#include "./bench.h"
+
+#include "../core_src/io.h"
+#include "../core_src/mem.h"
+
+#include "./virt.h"
+#include "./mb.h"
+#include "./ms.h"
+#include "./cs.h"
+
+#include "../util_src/thread.h"
+
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#define GC_BENCH_CHANNEL 5
+
+// Size of the block filled by the overhead benchmarks.
+static const uint64_t BENCH_MB_BYTES = 1 << 20;
+
+// Fill a fresh block with requests of the given size and report how
+// many bytes each piece really costs. (Tags and vaddr header included)
+static void bench_piece_overhead(uint64_t req_bytes) {
+    addr_book *adb = new_addr_book(GC_BENCH_CHANNEL, 1000);
+    mem_block *mb = new_mem_block(GC_BENCH_CHANNEL, adb, BENCH_MB_BYTES);
+
+    uint64_t pieces = 0;
+    while (!null_adb_addr(mb_malloc(mb, req_bytes))) {
+        pieces++;
+    }
+
+    mem_stats stats = mb_get_stats(mb);
+
+    safe_printf("mb %3" PRIu64 " B requests: %" PRIu64 " pieces, "
+            "%" PRIu64 " B per piece\n", req_bytes, pieces, 
+            stats.live_bytes / pieces);
+
+    delete_mem_block(mb);
+    delete_addr_book(adb);
+}
+
+// Same as above, but with objects of a collected space. This includes
+// the object headers and the space's per piece bookkeeping.
+static void bench_object_overhead(uint64_t da_size, uint8_t shaped) {
+    collected_space *cs = new_collected_space(GC_BENCH_CHANNEL, 1000, 
+            BENCH_MB_BYTES);
+
+    const uint64_t objs = 10000;
+    cs_shape_id shape_id = CS_NO_SHAPE;
+
+    if (shaped) {
+        shape_id = cs_register_shape(0, da_size, 0);
+    }
+
+    uint64_t i;
+    for (i = 0; i < objs; i++) {
+        if (shaped) {
+            cs_malloc_shaped_object(cs, shape_id);
+        } else {
+            cs_malloc_object(cs, 0, da_size);
+        }
+    }
+
+    mem_stats stats = cs_get_stats(cs);
+
+    safe_printf("cs %3" PRIu64 " B objects%s: %" PRIu64 " B per object\n",
+            da_size, shaped ? " (shaped)" : "", 
+            stats.live_bytes / stats.live_count);
+
+    delete_collected_space(cs);
+}
+
+static uint64_t bench_now_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+// Fixed seed, so every run sees the same pattern.
+static uint64_t bench_rand(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+
+    return *state;
+}
+
+// Size of the block used by the fragmentation benchmark.
+static const uint64_t BENCH_FRAG_MB_BYTES = 1 << 23;
+
+// Number of timed operations. (Half frees, half mallocs)
+static const uint64_t BENCH_FRAG_OPS = 1 << 18;
+
+// Fill a large block with small pieces, then free every other one. This
+// leaves the block full of small holes. Then time random frees paired
+// with random small mallocs.
+static void bench_fragmented(void) {
+    addr_book *adb = new_addr_book(GC_BENCH_CHANNEL, 1000);
+    mem_block *mb = new_mem_block(GC_BENCH_CHANNEL, adb, 
+            BENCH_FRAG_MB_BYTES);
+
+    uint64_t cap = BENCH_FRAG_MB_BYTES / 16;
+    addr_book_vaddr *live = safe_malloc(GC_BENCH_CHANNEL, 
+            sizeof(addr_book_vaddr) * cap);
+
+    uint64_t len = 0;
+    addr_book_vaddr v;
+    while (len < cap && !null_adb_addr(v = mb_malloc(mb, 24))) {
+        live[len++] = v;
+    }
+
+    uint64_t holes = 0;
+    uint64_t i;
+    for (i = 0; i < len; i += 2) {
+        mb_free(mb, live[i]);
+        holes++;
+    }
+
+    // Pack the survivors to the front.
+    uint64_t kept = 0;
+    for (i = 1; i < len; i += 2) {
+        live[kept++] = live[i];
+    }
+
+    len = kept;
+
+    uint64_t state = 88172645463325252ULL;
+    uint64_t failed = 0;
+
+    uint64_t start = bench_now_ns();
+
+    for (i = 0; i < BENCH_FRAG_OPS / 2; i++) {
+        uint64_t victim = bench_rand(&state) % len;
+        mb_free(mb, live[victim]);
+
+        v = mb_malloc(mb, 8 + (bench_rand(&state) % 57));
+
+        if (null_adb_addr(v)) {
+            // Keep the array dense.
+            live[victim] = live[--len];
+            failed++;
+        } else {
+            live[victim] = v;
+        }
+    }
+
+    uint64_t elapsed = bench_now_ns() - start;
+
+    safe_printf("mb fragmented: %" PRIu64 " holes, %" PRIu64 " ns per op, "
+            "%" PRIu64 " failed mallocs\n", holes, 
+            elapsed / BENCH_FRAG_OPS, failed);
+
+    safe_free(live);
+    delete_mem_block(mb);
+    delete_addr_book(adb);
+}
+
+// Size of each block of the find entry benchmark. Small, so that the
+// space's block index is long.
+static const uint64_t BENCH_FIND_MB_BYTES = 1 << 14;
+
+static const uint64_t BENCH_FIND_PIECES = 1 << 16;
+
+// Number of pin/unpin pairs timed per thread.
+static const uint64_t BENCH_FIND_OPS = 1 << 18;
+
+typedef struct {
+    mem_space *ms;
+    addr_book_vaddr *live;
+} bench_find_ctx;
+
+static void *bench_find_worker(void *arg) {
+    util_thread_spray_context *s_context = arg;
+    bench_find_ctx *fc = s_context->context;
+
+    uint64_t state = 88172645463325252ULL + s_context->index;
+
+    uint64_t i;
+    for (i = 0; i < BENCH_FIND_OPS; i++) {
+        addr_book_vaddr v = fc->live[bench_rand(&state) % BENCH_FIND_PIECES];
+
+        ms_pin(fc->ms, v);
+        ms_unpin(fc->ms, v);
+    }
+
+    return NULL;
+}
+
+// Pieces don't store their block, so every pin, unpin and free looks it 
+// up in the space's block index under a shared lock. (See ms_find_entry) 
+// Time random pin/unpin pairs over many blocks from a few threads at 
+// once.
+static void bench_find_entry(uint64_t threads) {
+    mem_space *ms = new_mem_space(GC_BENCH_CHANNEL, 1000, 
+            BENCH_FIND_MB_BYTES);
+
+    addr_book_vaddr *live = safe_malloc(GC_BENCH_CHANNEL, 
+            sizeof(addr_book_vaddr) * BENCH_FIND_PIECES);
+
+    // Too big for a slab, so these spread over many normal blocks.
+    uint64_t i;
+    for (i = 0; i < BENCH_FIND_PIECES; i++) {
+        live[i] = ms_malloc(ms, 100);
+    }
+
+    bench_find_ctx fc = {
+        .ms = ms,
+        .live = live,
+    };
+
+    uint64_t start = bench_now_ns();
+
+    util_thread_spray_info *spray = util_thread_spray(GC_BENCH_CHANNEL, 
+            threads, bench_find_worker, &fc);
+    util_thread_collect(spray);
+
+    uint64_t elapsed = bench_now_ns() - start;
+
+    safe_printf("ms find entry: %" PRIu64 " blocks, %" PRIu64 " threads, "
+            "%" PRIu64 " ns per pin/unpin\n", ms_get_stats(ms).blocks, 
+            threads, elapsed / BENCH_FIND_OPS);
+
+    safe_free(live);
+    delete_mem_space(ms);
+}
+
+static void bench_overhead(void) {
+    bench_piece_overhead(24);
+    bench_piece_overhead(48);
+    bench_object_overhead(24, 0);
+    bench_object_overhead(24, 1);
+}
+
+static void bench_find_entries(void) {
+    bench_find_entry(1);
+    bench_find_entry(4);
+}
+
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} gc_bench;
+
+#define GC_BENCHES_LEN 3
+
+static const gc_bench GC_BENCHES[GC_BENCHES_LEN] = {
+    { .name = "overhead", .run = bench_overhead },
+    { .name = "fragmented", .run = bench_fragmented },
+    { .name = "find_entry", .run = bench_find_entries },
+};
+
+int gc_bench_main(int argc, const char **argv) {
+    uint64_t i;
+    int a;
+
+    if (argc <= 1) {
+        for (i = 0; i < GC_BENCHES_LEN; i++) {
+            GC_BENCHES[i].run();
+        }
+
+        return 0;
+    }
+
+    for (a = 1; a < argc; a++) {
+        for (i = 0; i < GC_BENCHES_LEN; i++) {
+            if (strcmp(argv[a], GC_BENCHES[i].name) == 0) {
+                break;
+            }
+        }
+
+        if (i == GC_BENCHES_LEN) {
+            safe_printf("Unknown benchmark %s\n", argv[a]);
+            return 1;
+        }
+
+        GC_BENCHES[i].run();
+    }
+
+    return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef GC_BENCH_H
+#define GC_BENCH_H
+
+// Small benchmarks of the memory structures. Results are printed, 
+// nothing is asserted. 
+//
+// argv names the benchmarks to run, (overhead, fragmented or find_entry)
+// all of them are run when none are given. Returns 1 if a name is 
+// unknown. Run with `make run_bench` or `make run_bench BENCH=fragmented`.
+int gc_bench_main(int argc, const char **argv);
+
+#endif
@@ -14,6 +14,7 @@
 #include <stdint.h>
 #include <sys/_pthread/_pthread_rwlock_t.h>
 #include <time.h>
+#include <fcntl.h>
 
 // NOTE: Rigorous GC Notes:
 // 
@@ -76,8 +77,15 @@
 // the object will be visited then and there by the user thread. That is all of the object's
 // references will be place on the in-progress stack, and the object will be marked "visited".
 //
-// The "paint black" phase ends when the GC thread is free and both the in-progress-stack 
-// and visit-stack are empty.
+// The GC thread never blocks on an object lock while it has other work to do. If a user
+// holds the lock of an object popped off either stack, the object is placed on the 
+// retry-stack instead. Objects on the retry-stack are retried once both other stacks 
+// are drained, and are treated as if they were still on the stack they came from. 
+// (A retried object which turns out to be "unvisited" or "in-progress" is visited right
+// away) Only when every retry fails and no other work was done does the GC thread block.
+//
+// The "paint black" phase ends when the GC thread is free and the in-progress-stack,
+// visit-stack and retry-stack are all empty.
 //
 // Does this exit condition guarantee all reachable objects have been marked "viisted"?
 // 
@@ -133,9 +141,112 @@ typedef enum {
 } gc_status_code;
 
 typedef struct {
-    gc_status_code gc_status;
+    // Always a gc_status_code.
+    uint8_t gc_status;
+
+    // 1 if the object has been frozen. (See cs_freeze)
+    // Once set, this is never unset.
+    //
+    // NOTE: this can be read without a lock, so only access it
+    // using atomics.
+    uint8_t frozen;
+
+    // 1 if the object was allocated in a region. (See cs_region_begin)
+    uint8_t region;
+
+    // If this is CS_NO_SHAPE, the object's sizes are held in an obj_sizes
+    // right after the pre header. Otherwise, the reference table starts 
+    // right after the pre header.
+    cs_shape_id shape;
 } obj_pre_header;
 
+typedef struct {
+    uint64_t rt_len;
+    uint64_t da_size;
+} obj_sizes;
+
+const cs_shape_id CS_NO_SHAPE = 0;
+
+#define CS_SHAPES_CAP 4096
+
+// The global shape table. Entries are never modified once registered, so
+// they can be read without the lock.
+static pthread_mutex_t cs_shapes_lock = PTHREAD_MUTEX_INITIALIZER;
+static cs_shape cs_shapes[CS_SHAPES_CAP];
+
+// The number of entries in cs_shapes. (Including the unused CS_NO_SHAPE
+// entry) Only grows while holding cs_shapes_lock, and is always stored 
+// with release semantics so new entries are visible before their ids.
+static uint32_t cs_shapes_len = 1;
+
+static inline uint32_t cs_shapes_count(void) {
+    return __atomic_load_n(&cs_shapes_len, __ATOMIC_ACQUIRE);
+}
+
+cs_shape_id cs_register_shape(uint64_t rt_len, uint64_t da_size, 
+        uint64_t flags) {
+    safe_mutex_lock(&cs_shapes_lock);
+
+    if (cs_shapes_len == CS_SHAPES_CAP) {
+        safe_mutex_unlock(&cs_shapes_lock);
+        error_logf(1, 1, "cs_register_shape: shape table full");
+    }
+
+    cs_shape_id shape_id = cs_shapes_len;
+
+    cs_shapes[shape_id].rt_len = rt_len;
+    cs_shapes[shape_id].da_size = da_size;
+    cs_shapes[shape_id].flags = flags;
+
+    __atomic_store_n(&cs_shapes_len, shape_id + 1, __ATOMIC_RELEASE);
+
+    safe_mutex_unlock(&cs_shapes_lock);
+
+    return shape_id;
+}
+
+cs_shape cs_get_shape(cs_shape_id shape_id) {
+    if (shape_id == CS_NO_SHAPE || shape_id >= cs_shapes_count()) {
+        error_logf(1, 1, "cs_get_shape: unknown shape %" PRIu32, shape_id);
+    }
+
+    return cs_shapes[shape_id];
+}
+
+// shape_id is given seperately so that callers which race writers can
+// bounds check it first. (See cs_opt_read_range)
+static inline obj_index obj_p_h_to_index(obj_pre_header *obj_p_h, 
+        cs_shape_id shape_id) {
+    obj_index obj_i;
+
+    obj_i.h = (obj_header *)(obj_p_h + 1);
+
+    if (shape_id == CS_NO_SHAPE) {
+        obj_sizes *sizes = (obj_sizes *)(obj_p_h + 1);
+
+        obj_i.rt_len = sizes->rt_len;
+        obj_i.da_size = sizes->da_size;
+        obj_i.rt = (addr_book_vaddr *)(sizes + 1);
+    } else {
+        obj_i.rt_len = cs_shapes[shape_id].rt_len;
+        obj_i.da_size = cs_shapes[shape_id].da_size;
+        obj_i.rt = (addr_book_vaddr *)(obj_p_h + 1);
+    }
+
+    obj_i.da = (uint8_t *)(obj_i.rt + obj_i.rt_len);
+
+    return obj_i;
+}
+
+obj_index obj_h_to_index(obj_header *h) {
+    obj_pre_header *obj_p_h = (obj_pre_header *)h - 1;
+    return obj_p_h_to_index(obj_p_h, obj_p_h->shape);
+}
+
+cs_shape_id obj_h_shape(obj_header *h) {
+    return ((obj_pre_header *)h - 1)->shape;
+}
+
 static const uint64_t GC_STAT_STRINGS_LEN = 4;
 
 static const char *GC_STAT_STRINGS[GC_STAT_STRINGS_LEN] = {
@@ -164,6 +275,10 @@ typedef enum {
 struct collected_space_struct {
     mem_space * const ms;
 
+    // Write locked for the whole of a collection, and while a region
+    // ends. (See cs_region_end)
+    pthread_rwlock_t gc_lock;
+
     // Lock for accessing the progress fields.
     pthread_rwlock_t gc_stat_lock;
     struct {
@@ -173,6 +288,11 @@ struct collected_space_struct {
         uint8_t gc_in_progress : 1;
         uint8_t paint_black_in_progress : 1;
     };
+
+    // Number of finished collections. (See cs_tlab)
+    //
+    // NOTE: this should only be accessed using atomics!
+    uint64_t gc_count;
     
     // Thread ID used when gc worker is on. 
     // Otherwise it has an undefined value.
@@ -184,6 +304,21 @@ struct collected_space_struct {
     // No need for a lock on this guy.
     util_bc *visit_stack;
 
+    // Objects the GC couldn't lock without blocking. (See cs_collect_garbage)
+    // Only ever touched by the GC, so no lock needed here either.
+    util_bc *retry_stack;
+
+    // Number of times the GC skipped a busy object to come back later.
+    // (See cs_gc_deferred)
+    //
+    // NOTE: this should only be accessed using atomics!
+    uint64_t deferred;
+
+    // While a region ends, the sorted vaddrs of its objects. These are 
+    // not treated as roots by cs_mark. (Protected by gc_lock)
+    const addr_book_vaddr *ending;
+    uint64_t ending_len;
+
     pthread_rwlock_t root_set_lock;
 
     // Fields for the root set.
@@ -195,24 +330,42 @@ struct collected_space_struct {
 };
 
 
-collected_space *new_collected_space_seed(uint64_t chnl, uint64_t seed, 
-        uint64_t adb_t_cap, uint64_t mb_m_bytes) {
+// Create a collected space around an existing memory space.
+// The root set is left uninitialized.
+static collected_space *new_collected_space_from_ms(uint64_t chnl, 
+        mem_space *ms) {
     collected_space *cs = safe_malloc(chnl, sizeof(collected_space));
 
-    // Create our underlying memory space.
-    *(mem_space **)&(cs->ms) = 
-        new_mem_space_seed(chnl, seed, adb_t_cap, mb_m_bytes);
+    *(mem_space **)&(cs->ms) = ms;
+
+    safe_rwlock_init(&(cs->gc_lock), NULL);
 
     safe_rwlock_init(&(cs->gc_stat_lock), NULL);
     cs->gc_worker_stat = GC_WORKER_OFF;
     cs->gc_in_progress = 0;
     cs->paint_black_in_progress = 0;
+    cs->gc_count = 0;
 
     safe_mutex_init(&(cs->in_progress_stack_lock), NULL);
     cs->in_progress_stack = new_broken_collection(chnl, sizeof(addr_book_vaddr), 100, 0);
     cs->visit_stack = new_broken_collection(chnl, sizeof(addr_book_vaddr), 100, 0);
+    cs->retry_stack = new_broken_collection(chnl, sizeof(addr_book_vaddr), 100, 0);
+    cs->deferred = 0;
+
+    cs->ending = NULL;
+    cs->ending_len = 0;
 
     safe_rwlock_init(&(cs->root_set_lock), NULL);
+
+    return cs;
+}
+
+collected_space *new_collected_space(uint64_t chnl, uint64_t adb_t_cap, 
+        uint64_t mb_m_bytes) {
+    // Create our underlying memory space.
+    collected_space *cs = new_collected_space_from_ms(chnl,
+        new_mem_space(chnl, adb_t_cap, mb_m_bytes));
+
     cs->root_set = safe_malloc(chnl, sizeof(root_set_entry) * 1);
     cs->root_set_cap = 1;
     cs->free_head = 0;
@@ -223,12 +376,14 @@ collected_space *new_collected_space_seed(uint64_t chnl, uint64_t seed,
 }
 
 void delete_collected_space(collected_space *cs) {
+    safe_rwlock_destroy(&(cs->gc_lock));
     safe_rwlock_destroy(&(cs->gc_stat_lock));
     safe_mutex_destroy(&(cs->in_progress_stack_lock));
     safe_rwlock_destroy(&(cs->root_set_lock));
 
     delete_broken_collection(cs->in_progress_stack);
     delete_broken_collection(cs->visit_stack);
+    delete_broken_collection(cs->retry_stack);
 
     safe_free(cs->root_set);
     delete_mem_space(cs->ms);
@@ -236,25 +391,35 @@ void delete_collected_space(collected_space *cs) {
     safe_free(cs);
 }
 
-malloc_res cs_malloc_p(collected_space *cs, uint64_t rt_len,
-        uint64_t da_size, uint8_t hold) {
-    malloc_res res = ms_malloc_and_hold(cs->ms, 
-            sizeof(obj_pre_header) +
-            sizeof(obj_header) +
-            (sizeof(addr_book_vaddr) * rt_len) +
-            (sizeof(uint8_t) * da_size));
+static inline uint64_t cs_obj_size(cs_shape_id shape_id, uint64_t rt_len, 
+        uint64_t da_size) {
+    return sizeof(obj_pre_header) +
+        (shape_id == CS_NO_SHAPE ? sizeof(obj_sizes) : 0) +
+        (sizeof(addr_book_vaddr) * rt_len) +
+        (sizeof(uint8_t) * da_size);
+}
 
-    // Set up headers...
+// res must be a held malloc result from the underlying memory space.
+static malloc_res cs_init_obj(collected_space *cs, malloc_res res, 
+        cs_shape_id shape_id, uint64_t rt_len, uint64_t da_size, 
+        uint8_t hold, uint8_t region) {
+    // Set up Pre Header.
     obj_pre_header *obj_p_h = res.paddr;
-    obj_header *obj_h = (obj_header *)(obj_p_h + 1);
-    addr_book_vaddr *rt = (addr_book_vaddr *)(obj_h + 1);
 
-    // Set up Pre Header.
     obj_p_h->gc_status = GC_NEWLY_ADDED;
+    obj_p_h->frozen = 0;
+    obj_p_h->region = region;
+    obj_p_h->shape = shape_id;
+
+    // Set up sizes. (Only for unshaped objects)
+    if (shape_id == CS_NO_SHAPE) {
+        obj_sizes *sizes = (obj_sizes *)(obj_p_h + 1);
+
+        sizes->rt_len = rt_len;
+        sizes->da_size = da_size;
+    }
 
-    // Set up normal Header.
-    *(uint64_t *)&(obj_h->rt_len) = rt_len;
-    *(uint64_t *)&(obj_h->da_size) = da_size;
+    addr_book_vaddr *rt = obj_p_h_to_index(obj_p_h, shape_id).rt;
 
     uint64_t i;
     for (i = 0; i < rt_len; i++) {
@@ -271,14 +436,21 @@ malloc_res cs_malloc_p(collected_space *cs, uint64_t rt_len,
     return res;
 }
 
-malloc_obj_res cs_malloc_object_p(collected_space *cs, uint64_t rt_len, 
+malloc_res cs_malloc_p(collected_space *cs, uint64_t rt_len,
         uint64_t da_size, uint8_t hold) {
-    malloc_res mr = cs_malloc_p(cs, rt_len, da_size, hold);
+    malloc_res res = ms_malloc_and_hold(cs->ms, 
+            cs_obj_size(CS_NO_SHAPE, rt_len, da_size));
 
+    return cs_init_obj(cs, res, CS_NO_SHAPE, rt_len, da_size, hold, 0);
+}
+
+static malloc_obj_res cs_malloc_res_to_obj_res(malloc_res mr) {
     malloc_obj_res mor = {
         .vaddr = mr.vaddr,
         .i = {
             .h = NULL,
+            .rt_len = 0,
+            .da_size = 0,
             .rt = NULL,
             .da = NULL,
         },
@@ -293,6 +465,22 @@ malloc_obj_res cs_malloc_object_p(collected_space *cs, uint64_t rt_len,
     return mor;
 }
 
+malloc_obj_res cs_malloc_object_p(collected_space *cs, uint64_t rt_len, 
+        uint64_t da_size, uint8_t hold) {
+    return cs_malloc_res_to_obj_res(cs_malloc_p(cs, rt_len, da_size, hold));
+}
+
+malloc_obj_res cs_malloc_shaped_object_p(collected_space *cs, 
+        cs_shape_id shape_id, uint8_t hold) {
+    cs_shape shape = cs_get_shape(shape_id);
+
+    malloc_res res = ms_malloc_and_hold(cs->ms, 
+            cs_obj_size(shape_id, shape.rt_len, shape.da_size));
+
+    return cs_malloc_res_to_obj_res(cs_init_obj(cs, res, shape_id, 
+                shape.rt_len, shape.da_size, hold, 0));
+}
+
 uint8_t cs_allocated(collected_space *cs, addr_book_vaddr vaddr) {
     return ms_allocated(cs->ms, vaddr);
 }
@@ -419,27 +607,61 @@ cs_get_root_res cs_get_root_vaddr(collected_space *cs, cs_root_id root_id) {
     return res;
 }
 
-obj_header *cs_get_read(collected_space *cs, addr_book_vaddr vaddr) {
-    return (obj_header *)((obj_pre_header *)ms_get_read(cs->ms, vaddr) + 1);    
+// Returns the pre header of vaddr if it is frozen, NULL otherwise.
+// No locks are acquired.
+//
+// NOTE: All frozen objects are pinned, so if the object is frozen, we 
+// know the pre header will never move.
+static inline obj_pre_header *cs_get_frozen(collected_space *cs, 
+        addr_book_vaddr vaddr) {
+    obj_pre_header *obj_p_h = ms_get_pinned(cs->ms, vaddr);
+
+    if (obj_p_h && __atomic_load_n(&(obj_p_h->frozen), __ATOMIC_ACQUIRE)) {
+        return obj_p_h;
+    }
+
+    return NULL;
 }
 
-static inline void cs_visit_obj(collected_space *cs, obj_pre_header *obj_p_h) {
-    obj_header *obj_h = (obj_header *)(obj_p_h + 1);
-    addr_book_vaddr *rt = (addr_book_vaddr *)(obj_h + 1);
+obj_header *cs_get_read(collected_space *cs, addr_book_vaddr vaddr) {
+    obj_pre_header *obj_p_h = cs_get_frozen(cs, vaddr);
 
-    safe_mutex_lock(&(cs->in_progress_stack_lock));
+    // Frozen objects are read without a lock.
+    if (obj_p_h) {
+        return (obj_header *)(obj_p_h + 1);
+    }
+
+    obj_p_h = ms_get_read(cs->ms, vaddr);
+
+    // The object may have been frozen while we waited for the lock. 
+    // cs_unlock won't release a lock on a frozen object, so release it 
+    // here.
+    if (__atomic_load_n(&(obj_p_h->frozen), __ATOMIC_ACQUIRE)) {
+        ms_unlock(cs->ms, vaddr);
+    }
+
+    return (obj_header *)(obj_p_h + 1);
+}
+
+// NOTE: the in progress stack lock must be held when calling this.
+static inline void cs_visit_obj_unsafe(collected_space *cs, 
+        obj_pre_header *obj_p_h) {
+    obj_index ind = obj_p_h_to_index(obj_p_h, obj_p_h->shape);
 
     uint64_t ref_i;
-    for (ref_i = 0; ref_i < obj_h->rt_len; ref_i++) {
-        if (!null_adb_addr(rt[ref_i])) {
-            bc_push_back(cs->in_progress_stack, rt + ref_i); 
+    for (ref_i = 0; ref_i < ind.rt_len; ref_i++) {
+        if (!null_adb_addr(ind.rt[ref_i])) {
+            bc_push_back(cs->in_progress_stack, ind.rt + ref_i); 
         }
     }
 
-    safe_mutex_unlock(&(cs->in_progress_stack_lock));
-
     obj_p_h->gc_status = GC_VISITED;
+}
 
+static inline void cs_visit_obj(collected_space *cs, obj_pre_header *obj_p_h) {
+    safe_mutex_lock(&(cs->in_progress_stack_lock));
+    cs_visit_obj_unsafe(cs, obj_p_h);
+    safe_mutex_unlock(&(cs->in_progress_stack_lock));
 }
 
 obj_header *cs_get_write(collected_space *cs, addr_book_vaddr vaddr) {
@@ -449,6 +671,13 @@ obj_header *cs_get_write(collected_space *cs, addr_book_vaddr vaddr) {
     obj_pre_header *obj_p_h = (obj_pre_header *)ms_get_write(cs->ms, vaddr);
     obj_header *obj_h = (obj_header *)(obj_p_h + 1);
 
+    if (obj_p_h->frozen) {
+        ms_unlock(cs->ms, vaddr);
+
+        error_logf(1, 1, "cs_get_write: frozen vaddr given (%" PRIu64 ", %" PRIu64 ")",
+                (uint64_t)vaddr.table_index, (uint64_t)vaddr.cell_index);
+    }
+
     if (obj_p_h->gc_status == GC_VISITED || obj_p_h == GC_NEWLY_ADDED) {
         return obj_h;
     }
@@ -465,197 +694,768 @@ obj_header *cs_get_write(collected_space *cs, addr_book_vaddr vaddr) {
     return (obj_header *)(obj_p_h + 1);
 }
 
-void cs_unlock(collected_space *cs, addr_book_vaddr vaddr) {
-    ms_unlock(cs->ms, vaddr);
-}
+uint8_t cs_resize_object(collected_space *cs, addr_book_vaddr vaddr, 
+        uint64_t rt_len, uint64_t da_size) {
+    // cs_get_write also runs the write barrier, so the old references are
+    // seen by the GC before any of them are dropped.
+    obj_pre_header *obj_p_h = (obj_pre_header *)cs_get_write(cs, vaddr) - 1;
 
-static void obj_print(addr_book_vaddr v, void *paddr, void *ctx) {
-    obj_pre_header *obj_p_h = paddr;
-    obj_header *obj_h = (obj_header *)(obj_p_h + 1);
+    if (obj_p_h->shape != CS_NO_SHAPE) {
+        cs_unlock(cs, vaddr);
 
-    safe_printf("--\n");
+        error_logf(1, 1, "cs_resize_object: shaped vaddr given (%" PRIu64 ", %" PRIu64 ")",
+                (uint64_t)vaddr.table_index, (uint64_t)vaddr.cell_index);
+    }
 
-    safe_printf("Object @ Vaddr (%"PRIu64", %"PRIu64")\n",
-            v.table_index, v.cell_index);
+    obj_index old_i = obj_p_h_to_index(obj_p_h, CS_NO_SHAPE);
 
-    safe_printf("Status: %s, RT Length: %"PRIu64", DA Size: %"PRIu64"\n",
-            GC_STAT_STRINGS[obj_p_h->gc_status], obj_h->rt_len, obj_h->da_size);
+    uint64_t old_size = cs_obj_size(CS_NO_SHAPE, old_i.rt_len, old_i.da_size);
+    uint64_t new_size = cs_obj_size(CS_NO_SHAPE, rt_len, da_size);
 
-    addr_book_vaddr *rt = (addr_book_vaddr *)(obj_h + 1);
+    // Grow before moving anything around, so a failed grow leaves the 
+    // object as is.
+    if (new_size > old_size) {
+        obj_p_h = ms_realloc_held(cs->ms, vaddr, obj_p_h, new_size);
 
-    uint64_t i;
-    for (i = 0; i < obj_h->rt_len; i++) {
-        if (null_adb_addr(rt[i])) {
-            safe_printf("rt[%"PRIu64"] = NULL\n", i);
-        } else {
-            safe_printf("rt[%"PRIu64"] = (%"PRIu64", %"PRIu64")\n", i,
-                    rt[i].table_index, rt[i].cell_index);
+        if (!obj_p_h) {
+            cs_unlock(cs, vaddr);
+            return 1;
         }
     }
 
-    uint8_t *da = (uint8_t *)(rt + obj_h->rt_len);
-
-    static const uint64_t ROW_LEN = 8;
-
-    uint64_t j;
-    for (i = 0; i < obj_h->da_size; ) {
-        // Find Inclusive end index for this row.
-        uint64_t end = i + ROW_LEN - 1;
-        if (end >= obj_h->da_size) {
-            end = obj_h->da_size - 1;
-        }
+    obj_index i = obj_p_h_to_index(obj_p_h, CS_NO_SHAPE);
+    uint8_t *da = (uint8_t *)(i.rt + rt_len);
 
-        if (i == end) {
-            safe_printf("da[%"PRIu64"] =", i);
-        } else {
-            safe_printf("da[%"PRIu64"...%"PRIu64"] =", i, end);
-        }
+    uint64_t kept = da_size < i.da_size ? da_size : i.da_size;
 
-        for (j = 0; j < ROW_LEN && i < obj_h->da_size; j++, i++) {
-            safe_printf(" 0x%02X", da[i]);
-        }
+    // The data bytes always sit right after the reference table, so 
+    // they shift whenever rt_len changes.
+    memmove(da, i.da, kept);
+    memset(da + kept, 0, da_size - kept);
 
-        safe_printf("\n");
+    uint64_t ref_i;
+    for (ref_i = i.rt_len; ref_i < rt_len; ref_i++) {
+        i.rt[ref_i] = NULL_VADDR;
     }
-}
 
-static inline void root_set_entry_print_unsafe(root_set_entry *entry) {
-    if (!(entry->allocated)) {
-        if (entry->next_free == UINT64_MAX) {
-            safe_printf("(Free, Next: NULL)\n");
-        } else {
-            safe_printf("(Free, Next: %"PRIu64")\n", entry->next_free);
-        }
+    obj_sizes *sizes = (obj_sizes *)(obj_p_h + 1);
+    sizes->rt_len = rt_len;
+    sizes->da_size = da_size;
 
-        return;
+    // Shrinking never fails. (See ms_realloc_held)
+    if (new_size < old_size) {
+        ms_realloc_held(cs->ms, vaddr, obj_p_h, new_size);
     }
 
-    // Allocated case.
-
-    if (null_adb_addr(entry->vaddr)) {
-        // Shouldn't really happen.
-        safe_printf("(Allocated, Vaddr: NULL)\n");
-    } else {
-        safe_printf("(Allocated, Vaddr: (%"PRIu64", %"PRIu64"))\n",
-                entry->vaddr.table_index, entry->vaddr.cell_index);
-    }
-}
+    cs_unlock(cs, vaddr);
 
-uint64_t cs_count(collected_space *cs) {
-    return ms_count(cs->ms);
+    return 0;
 }
 
-void cs_print(collected_space *cs) {
+// Writes the canonical lock order of vaddrs into order.
+// (i.e. vaddrs[order[0]] <= vaddrs[order[1]] <= ...)
+//
+// Insertion sort is used since these sets are expected to be small.
+static void cs_lock_order(const addr_book_vaddr *vaddrs, uint64_t len, 
+        uint64_t *order) {
+    uint64_t i, j, ind;
 
-    safe_rdlock(&(cs->root_set_lock));
-    
-    if (cs->free_head == UINT64_MAX) {
-        safe_printf("Root Set (Cap: %"PRIu64", Free Head: NULL)\n",
-                cs->root_set_cap);
-    } else {
-        safe_printf("Root Set (Cap: %"PRIu64", Free Head: %"PRIu64")\n",
-                cs->root_set_cap, cs->free_head);
-    }
+    for (i = 0; i < len; i++) {
+        ind = i;
 
-    uint64_t i;
-    root_set_entry *entry;
+        for (j = i; j > 0 && cmp_adb_addr(vaddrs[order[j - 1]], vaddrs[ind]) > 0; j--) {
+            order[j] = order[j - 1];
+        }
 
-    for (i = 0; i < cs->root_set_cap; i++) {
-        safe_printf("rs[%"PRIu64"] = ", i);
-        root_set_entry_print_unsafe(cs->root_set + i);
+        order[j] = ind;
     }
+}
 
-    safe_rwlock_unlock(&(cs->root_set_lock));
+// Sets of this size or smaller are ordered on the stack.
+static const uint64_t CS_MANY_STACK_LEN = 16;
 
-    // NOTE: probs shouldn't call this function in parallel with anything else,
-    // Nothing will break, but the results might be funky.
+static inline uint64_t *cs_new_lock_order(collected_space *cs, 
+        const addr_book_vaddr *vaddrs, uint64_t len, uint64_t *buf) {
+    uint64_t *order = len <= CS_MANY_STACK_LEN 
+        ? buf 
+        : safe_malloc(get_chnl(cs), len * sizeof(uint64_t));
 
-    ms_foreach(cs->ms, obj_print, NULL, 0);
+    cs_lock_order(vaddrs, len, order);
+
+    return order;
 }
 
-void cs_print_ms(collected_space *cs) {
-    ms_print(cs->ms);
+static inline void cs_delete_lock_order(uint64_t *order, uint64_t *buf) {
+    if (order != buf) {
+        safe_free(order);
+    }
 }
 
-static void obj_unvisit(addr_book_vaddr v, void *paddr, void *ctx) {
-    obj_pre_header *obj_p_h = paddr;
+void cs_get_write_many(collected_space *cs, const addr_book_vaddr *vaddrs, 
+        uint64_t len, obj_header **hs) {
+    uint64_t buf[CS_MANY_STACK_LEN];
+    uint64_t *order = cs_new_lock_order(cs, vaddrs, len, buf);
 
-    obj_p_h->gc_status = GC_UNVISITED;
-}
+    uint64_t i, j;
+    obj_pre_header *obj_p_h;
 
-static uint8_t obj_reachable(addr_book_vaddr v, void *paddr, void *ctx) {
-    obj_pre_header *obj_p_h = paddr;
-    return obj_p_h->gc_status != GC_UNVISITED;
-}
+    for (i = 0; i < len; i++) {
+        // Duplicates are only locked once.
+        if (i > 0 && eq_adb_addr(vaddrs[order[i - 1]], vaddrs[order[i]])) {
+            hs[order[i]] = hs[order[i - 1]];
 
-uint64_t cs_collect_garbage(collected_space *cs) {
-    safe_wrlock(&(cs->gc_stat_lock));
+            continue;
+        }
 
-    if (cs->gc_in_progress) {
-        safe_rwlock_unlock(&(cs->gc_stat_lock));
+        obj_p_h = ms_get_write(cs->ms, vaddrs[order[i]]);
 
-        return 0;
-    }
+        if (obj_p_h->frozen) {
+            addr_book_vaddr frozen_v = vaddrs[order[i]];
 
-    cs->gc_in_progress = 1;
+            for (j = 0; j <= i; j++) {
+                if (j == 0 || !eq_adb_addr(vaddrs[order[j - 1]], vaddrs[order[j]])) {
+                    ms_unlock(cs->ms, vaddrs[order[j]]);
+                }
+            }
 
-    safe_rwlock_unlock(&(cs->gc_stat_lock));
+            cs_delete_lock_order(order, buf);
 
-    // Paint White.
-    ms_foreach(cs->ms, obj_unvisit, NULL, 1);  
+            error_logf(1, 1, "cs_get_write_many: frozen vaddr given (%" PRIu64 ", %" PRIu64 ")",
+                    (uint64_t)frozen_v.table_index, 
+                    (uint64_t)frozen_v.cell_index);
+        }
 
-    safe_rdlock(&(cs->root_set_lock)); 
-    // Once we have acquired the root set lock.
-    // The "paint black" phase has officially started.
-    // The roots at this point in time will be the only roots considered.
+        hs[order[i]] = (obj_header *)(obj_p_h + 1);
+    }
+
+    // Write barrier. (See cs_get_write)
     //
-    // NOTE: If a root is added after this point in the paint black phase,
-    // it is implied that it was reachable when paint black started.
-    // Thus it will not be GC'd.
-    cs_set_paint_black_in_progress(cs, 1);
+    // Since we hold every lock, paint black cannot end while we are here. 
+    // So, we only need to check once, and only need to acquire the in 
+    // progress stack lock once.
+    if (cs_paint_black_in_progress(cs)) {
+        safe_mutex_lock(&(cs->in_progress_stack_lock));
 
-    safe_mutex_lock(&(cs->in_progress_stack_lock));
-    uint64_t root_i;
-    root_set_entry entry;
-    for (root_i = 0; root_i < cs->root_set_cap; root_i++) {
-        entry = cs->root_set[root_i];
+        for (i = 0; i < len; i++) {
+            if (i > 0 && eq_adb_addr(vaddrs[order[i - 1]], vaddrs[order[i]])) {
+                continue;
+            }
 
-        if (entry.allocated) {
-            bc_push_back(cs->in_progress_stack, &(entry.vaddr));
+            obj_p_h = (obj_pre_header *)(hs[order[i]]) - 1;
+
+            if (obj_p_h->gc_status != GC_VISITED && 
+                    obj_p_h->gc_status != GC_NEWLY_ADDED) {
+                cs_visit_obj_unsafe(cs, obj_p_h);
+            }
         }
+
+        safe_mutex_unlock(&(cs->in_progress_stack_lock));
     }
-    safe_mutex_unlock(&(cs->in_progress_stack_lock));
-    
-    safe_rwlock_unlock(&(cs->root_set_lock));
 
-    // Now, time for DFS...
-    
-    // We stop when an iteration which did no work occurs.
-    uint8_t productive_iteration = 1;
+    cs_delete_lock_order(order, buf);
+}
 
-    addr_book_vaddr vaddr;
+void cs_unlock_many(collected_space *cs, const addr_book_vaddr *vaddrs, 
+        uint64_t len) {
+    uint64_t buf[CS_MANY_STACK_LEN];
+    uint64_t *order = cs_new_lock_order(cs, vaddrs, len, buf);
 
-    obj_pre_header *obj_p_h;
-    obj_header *obj_h;
-    addr_book_vaddr *rt;
+    uint64_t i;
+    for (i = 0; i < len; i++) {
+        if (i > 0 && eq_adb_addr(vaddrs[order[i - 1]], vaddrs[order[i]])) {
+            continue;
+        }
 
-    while (productive_iteration) {
-        productive_iteration = 0;
+        ms_unlock(cs->ms, vaddrs[order[i]]);
+    }
 
-        while (1) {
-            safe_mutex_lock(&(cs->in_progress_stack_lock));
-            if (bc_empty(cs->in_progress_stack)) {
-                safe_mutex_unlock(&(cs->in_progress_stack_lock));
+    cs_delete_lock_order(order, buf);
+}
 
-                break;
-            }
+void cs_unlock(collected_space *cs, addr_book_vaddr vaddr) {
+    // NOTE: if the caller holds a lock on vaddr, vaddr cannot be frozen 
+    // while they hold it. (Freezing requires the write lock) If the
+    // object was frozen while the caller waited for its lock, 
+    // cs_get_read has already released it.
+    if (cs_get_frozen(cs, vaddr)) {
+        return;
+    }
 
-            bc_pop_back(cs->in_progress_stack, &vaddr);
-            safe_mutex_unlock(&(cs->in_progress_stack_lock));
+    ms_unlock(cs->ms, vaddr);
+}
 
-            obj_p_h = ms_get_write(cs->ms, vaddr);
+void cs_freeze(collected_space *cs, addr_book_vaddr vaddr) {
+    // Pin before the object is marked frozen. This way, whoever sees 
+    // the frozen flag knows the object won't move.
+    ms_pin(cs->ms, vaddr);
 
-            // Transfer to visit stack if needed.
+    obj_pre_header *obj_p_h = ms_get_write(cs->ms, vaddr);
+
+    if (obj_p_h->frozen) {
+        // Someone beat us to it, our pin isn't needed.
+        ms_unlock(cs->ms, vaddr);
+        ms_unpin(cs->ms, vaddr);
+
+        return;
+    }
+
+    __atomic_store_n(&(obj_p_h->frozen), 1, __ATOMIC_RELEASE);
+
+    ms_unlock(cs->ms, vaddr);
+}
+
+uint8_t cs_frozen(collected_space *cs, addr_book_vaddr vaddr) {
+    return cs_get_frozen(cs, vaddr) != NULL;
+}
+
+obj_header *cs_pin(collected_space *cs, addr_book_vaddr vaddr) {
+    return (obj_header *)((obj_pre_header *)ms_pin(cs->ms, vaddr) + 1);
+}
+
+void cs_unpin(collected_space *cs, addr_book_vaddr vaddr) {
+    ms_unpin(cs->ms, vaddr);
+}
+
+// Atomic field operations.
+//
+// Each operation runs inside an atomic section on the object's cell. If
+// a writer currently holds the cell, we fall back to the read lock. 
+// Either way, the object can't be moved or written to by a lock holder
+// until cs_atomic_exit is called.
+static inline obj_pre_header *cs_atomic_enter(collected_space *cs, 
+        addr_book_vaddr vaddr, uint8_t *locked) {
+    obj_pre_header *obj_p_h = ms_atomic_begin(cs->ms, vaddr);
+
+    *locked = obj_p_h == NULL;
+
+    if (*locked) {
+        obj_p_h = ms_get_read(cs->ms, vaddr);
+    }
+
+    return obj_p_h;
+}
+
+static inline void cs_atomic_exit(collected_space *cs, 
+        addr_book_vaddr vaddr, uint8_t locked) {
+    if (locked) {
+        ms_unlock(cs->ms, vaddr);
+    } else {
+        ms_atomic_end(cs->ms, vaddr);
+    }
+}
+
+// Returns the u64 at da_offset of the object, exits if the offset is bad.
+static inline uint64_t *cs_atomic_da_field(collected_space *cs,
+        addr_book_vaddr vaddr, obj_pre_header *obj_p_h, uint8_t locked,
+        uint64_t da_offset, const char *tag) {
+    obj_index ind = obj_p_h_to_index(obj_p_h, obj_p_h->shape);
+
+    if (da_offset % sizeof(uint64_t) != 0 || 
+            da_offset > ind.da_size || 
+            ind.da_size - da_offset < sizeof(uint64_t)) {
+        cs_atomic_exit(cs, vaddr, locked);
+
+        error_logf(1, 1, "%s: bad da_offset given (%" PRIu64 ")", 
+                tag, da_offset);
+    }
+
+    return (uint64_t *)(ind.da + da_offset);
+}
+
+static inline addr_book_vaddr *cs_atomic_rt_field(collected_space *cs,
+        addr_book_vaddr vaddr, obj_pre_header *obj_p_h, uint8_t locked,
+        uint64_t rt_index, const char *tag) {
+    obj_index ind = obj_p_h_to_index(obj_p_h, obj_p_h->shape);
+
+    if (rt_index >= ind.rt_len) {
+        cs_atomic_exit(cs, vaddr, locked);
+
+        error_logf(1, 1, "%s: bad rt_index given (%" PRIu64 ")", 
+                tag, rt_index);
+    }
+
+    return ind.rt + rt_index;
+}
+
+static inline void cs_atomic_check_frozen(collected_space *cs,
+        addr_book_vaddr vaddr, obj_pre_header *obj_p_h, uint8_t locked,
+        const char *tag) {
+    if (__atomic_load_n(&(obj_p_h->frozen), __ATOMIC_RELAXED)) {
+        cs_atomic_exit(cs, vaddr, locked);
+
+        error_logf(1, 1, "%s: frozen vaddr given (%" PRIu64 ", %" PRIu64 ")",
+                tag, (uint64_t)vaddr.table_index, (uint64_t)vaddr.cell_index);
+    }
+}
+
+uint64_t cs_atomic_load_u64(collected_space *cs, addr_book_vaddr vaddr,
+        uint64_t da_offset) {
+    uint8_t locked;
+    obj_pre_header *obj_p_h = cs_atomic_enter(cs, vaddr, &locked);
+
+    uint64_t *field = cs_atomic_da_field(cs, vaddr, obj_p_h, locked, 
+            da_offset, "cs_atomic_load_u64");
+    uint64_t val = __atomic_load_n(field, __ATOMIC_SEQ_CST);
+
+    cs_atomic_exit(cs, vaddr, locked);
+
+    return val;
+}
+
+uint64_t cs_atomic_add_u64(collected_space *cs, addr_book_vaddr vaddr,
+        uint64_t da_offset, uint64_t delta) {
+    uint8_t locked;
+    obj_pre_header *obj_p_h = cs_atomic_enter(cs, vaddr, &locked);
+
+    cs_atomic_check_frozen(cs, vaddr, obj_p_h, locked, "cs_atomic_add_u64");
+
+    uint64_t *field = cs_atomic_da_field(cs, vaddr, obj_p_h, locked, 
+            da_offset, "cs_atomic_add_u64");
+    uint64_t val = __atomic_add_fetch(field, delta, __ATOMIC_SEQ_CST);
+
+    cs_atomic_exit(cs, vaddr, locked);
+
+    return val;
+}
+
+uint8_t cs_atomic_cas_u64(collected_space *cs, addr_book_vaddr vaddr,
+        uint64_t da_offset, uint64_t expected, uint64_t desired) {
+    uint8_t locked;
+    obj_pre_header *obj_p_h = cs_atomic_enter(cs, vaddr, &locked);
+
+    cs_atomic_check_frozen(cs, vaddr, obj_p_h, locked, "cs_atomic_cas_u64");
+
+    uint64_t *field = cs_atomic_da_field(cs, vaddr, obj_p_h, locked, 
+            da_offset, "cs_atomic_cas_u64");
+    uint8_t res = __atomic_compare_exchange_n(field, &expected, desired, 0,
+            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+    cs_atomic_exit(cs, vaddr, locked);
+
+    return res;
+}
+
+addr_book_vaddr cs_atomic_load_ref(collected_space *cs, 
+        addr_book_vaddr vaddr, uint64_t rt_index) {
+    uint8_t locked;
+    obj_pre_header *obj_p_h = cs_atomic_enter(cs, vaddr, &locked);
+
+    addr_book_vaddr *field = cs_atomic_rt_field(cs, vaddr, obj_p_h, locked, 
+            rt_index, "cs_atomic_load_ref");
+
+    addr_book_vaddr ref;
+    __atomic_load(field, &ref, __ATOMIC_SEQ_CST);
+
+    cs_atomic_exit(cs, vaddr, locked);
+
+    return ref;
+}
+
+uint8_t cs_cas_ref(collected_space *cs, addr_book_vaddr vaddr, 
+        uint64_t rt_index, addr_book_vaddr expected, 
+        addr_book_vaddr desired) {
+    uint8_t locked;
+    obj_pre_header *obj_p_h = cs_atomic_enter(cs, vaddr, &locked);
+
+    // NOTE: No writer holds the cell, so gc_status can't change under us.
+    //
+    // Swapping out a reference is a write as far as the GC is concerned. 
+    // If the object hasn't been visited yet, we take the slow path so 
+    // cs_get_write can run the write barrier for us. 
+    uint8_t slow = obj_p_h->gc_status != GC_VISITED &&
+        obj_p_h->gc_status != GC_NEWLY_ADDED;
+
+    if (slow) {
+        cs_atomic_exit(cs, vaddr, locked);
+
+        obj_p_h = (obj_pre_header *)cs_get_write(cs, vaddr) - 1;
+        locked = 1;
+    } else {
+        cs_atomic_check_frozen(cs, vaddr, obj_p_h, locked, "cs_cas_ref");
+    }
+
+    addr_book_vaddr *field = cs_atomic_rt_field(cs, vaddr, obj_p_h, locked, 
+            rt_index, "cs_cas_ref");
+    uint8_t res = __atomic_compare_exchange(field, &expected, &desired, 0,
+            __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+
+    cs_atomic_exit(cs, vaddr, locked);
+
+    return res;
+}
+
+cs_opt_read_res cs_opt_read_begin(collected_space *cs, 
+        addr_book_vaddr vaddr) {
+    adt_opt_read_res opt_res = ms_opt_read_begin(cs->ms, vaddr);
+
+    cs_opt_read_res res = {
+        .version = opt_res.version,
+        .h = opt_res.paddr 
+            ? (obj_header *)((obj_pre_header *)opt_res.paddr + 1) 
+            : NULL,
+    };
+
+    return res;
+}
+
+uint8_t cs_opt_read_validate(collected_space *cs, addr_book_vaddr vaddr,
+        uint64_t version) {
+    return ms_opt_read_validate(cs->ms, vaddr, version);
+}
+
+// The number of optimistic reads to attempt before giving up and
+// using the read lock.
+static const uint64_t CS_OPT_READ_TRIES = 8;
+
+// Copies len bytes from offset bytes after the start of the object's
+// header into dest. (Only if said range lies in the object's data array
+// or reference table as specified by da)
+//
+// Returns 1 on success, 0 if a writer raced us.
+// If the range is out of bounds, 1 is returned and *oob is set.
+static uint8_t cs_opt_read_range(collected_space *cs, addr_book_vaddr vaddr, 
+        uint8_t da, uint64_t offset, void *dest, uint64_t len, uint8_t *oob) {
+    cs_opt_read_res res = cs_opt_read_begin(cs, vaddr);
+
+    if (!(res.h)) {
+        return 0;
+    }
+
+    // A racing writer could leave any value here, so the shape id must be 
+    // bounds checked before it is used to index the shape table.
+    cs_shape_id shape_id = ((obj_pre_header *)res.h - 1)->shape;
+
+    if (shape_id >= cs_shapes_count()) {
+        return 0;
+    }
+
+    obj_index ind = obj_p_h_to_index((obj_pre_header *)res.h - 1, shape_id);
+
+    // The sizes must be validated before they are used to index!
+    if (!cs_opt_read_validate(cs, vaddr, res.version)) {
+        return 0;
+    }
+
+    uint64_t bound = da ? ind.da_size : ind.rt_len * sizeof(addr_book_vaddr);
+
+    if (offset > bound || len > bound - offset) {
+        *oob = 1;
+        return 1;
+    }
+
+    uint8_t *start = da ? ind.da : (uint8_t *)(ind.rt);
+
+    memcpy(dest, start + offset, len);
+
+    return cs_opt_read_validate(cs, vaddr, res.version);
+}
+
+static void cs_read_range(collected_space *cs, addr_book_vaddr vaddr,
+        uint8_t da, uint64_t offset, void *dest, uint64_t len, 
+        const char *tag) {
+    uint8_t oob = 0;
+
+    uint64_t try;
+    for (try = 0; try < CS_OPT_READ_TRIES; try++) {
+        if (cs_opt_read_range(cs, vaddr, da, offset, dest, len, &oob)) {
+            break;
+        }
+    }
+
+    if (try < CS_OPT_READ_TRIES && !oob) {
+        return;
+    }
+
+    // Here we either kept getting raced or our range was out of bounds.
+    // Either way, acquire the read lock to be sure.
+    obj_index obj_i = cs_get_read_ind(cs, vaddr);
+
+    uint64_t bound = da 
+        ? obj_i.da_size 
+        : obj_i.rt_len * sizeof(addr_book_vaddr);
+
+    if (offset > bound || len > bound - offset) {
+        cs_unlock(cs, vaddr);
+
+        error_logf(1, 1, "%s: range out of bounds (%" PRIu64 ", %" PRIu64 ")",
+                tag, offset, len);
+    }
+
+    memcpy(dest, (da ? obj_i.da : (uint8_t *)(obj_i.rt)) + offset, len);
+
+    cs_unlock(cs, vaddr);
+}
+
+void cs_read_da(collected_space *cs, addr_book_vaddr vaddr, 
+        uint64_t offset, void *dest, uint64_t len) {
+    cs_read_range(cs, vaddr, 1, offset, dest, len, "cs_read_da");
+}
+
+addr_book_vaddr cs_read_rt(collected_space *cs, addr_book_vaddr vaddr,
+        uint64_t rt_index) {
+    addr_book_vaddr ref;
+
+    cs_read_range(cs, vaddr, 0, rt_index * sizeof(addr_book_vaddr), 
+            &ref, sizeof(addr_book_vaddr), "cs_read_rt");
+
+    return ref;
+}
+
+static void obj_print(addr_book_vaddr v, void *paddr, void *ctx) {
+    obj_pre_header *obj_p_h = paddr;
+    obj_index obj_i = obj_p_h_to_index(obj_p_h, obj_p_h->shape);
+
+    safe_printf("--\n");
+
+    safe_printf("Object @ Vaddr (%"PRIu64", %"PRIu64")\n",
+            (uint64_t)v.table_index, (uint64_t)v.cell_index);
+
+    safe_printf("Status: %s%s%s, RT Length: %"PRIu64", DA Size: %"PRIu64"\n",
+            GC_STAT_STRINGS[obj_p_h->gc_status], 
+            obj_p_h->frozen ? " (Frozen)" : "",
+            obj_p_h->region ? " (Region)" : "",
+            obj_i.rt_len, obj_i.da_size);
+
+    if (obj_p_h->shape != CS_NO_SHAPE) {
+        safe_printf("Shape: %"PRIu32"\n", obj_p_h->shape);
+    }
+
+    addr_book_vaddr *rt = obj_i.rt;
+
+    uint64_t i;
+    for (i = 0; i < obj_i.rt_len; i++) {
+        if (null_adb_addr(rt[i])) {
+            safe_printf("rt[%"PRIu64"] = NULL\n", i);
+        } else {
+            safe_printf("rt[%"PRIu64"] = (%"PRIu64", %"PRIu64")\n", i,
+                    (uint64_t)rt[i].table_index, 
+                    (uint64_t)rt[i].cell_index);
+        }
+    }
+
+    uint8_t *da = obj_i.da;
+
+    static const uint64_t ROW_LEN = 8;
+
+    uint64_t j;
+    for (i = 0; i < obj_i.da_size; ) {
+        // Find Inclusive end index for this row.
+        uint64_t end = i + ROW_LEN - 1;
+        if (end >= obj_i.da_size) {
+            end = obj_i.da_size - 1;
+        }
+
+        if (i == end) {
+            safe_printf("da[%"PRIu64"] =", i);
+        } else {
+            safe_printf("da[%"PRIu64"...%"PRIu64"] =", i, end);
+        }
+
+        for (j = 0; j < ROW_LEN && i < obj_i.da_size; j++, i++) {
+            safe_printf(" 0x%02X", da[i]);
+        }
+
+        safe_printf("\n");
+    }
+}
+
+static inline void root_set_entry_print_unsafe(root_set_entry *entry) {
+    if (!(entry->allocated)) {
+        if (entry->next_free == UINT64_MAX) {
+            safe_printf("(Free, Next: NULL)\n");
+        } else {
+            safe_printf("(Free, Next: %"PRIu64")\n", entry->next_free);
+        }
+
+        return;
+    }
+
+    // Allocated case.
+
+    if (null_adb_addr(entry->vaddr)) {
+        // Shouldn't really happen.
+        safe_printf("(Allocated, Vaddr: NULL)\n");
+    } else {
+        safe_printf("(Allocated, Vaddr: (%"PRIu64", %"PRIu64"))\n",
+                (uint64_t)entry->vaddr.table_index, 
+                (uint64_t)entry->vaddr.cell_index);
+    }
+}
+
+uint64_t cs_count(collected_space *cs) {
+    return ms_count(cs->ms);
+}
+
+mem_stats cs_get_stats(collected_space *cs) {
+    return ms_get_stats(cs->ms);
+}
+
+void cs_print(collected_space *cs) {
+
+    safe_rdlock(&(cs->root_set_lock));
+    
+    if (cs->free_head == UINT64_MAX) {
+        safe_printf("Root Set (Cap: %"PRIu64", Free Head: NULL)\n",
+                cs->root_set_cap);
+    } else {
+        safe_printf("Root Set (Cap: %"PRIu64", Free Head: %"PRIu64")\n",
+                cs->root_set_cap, cs->free_head);
+    }
+
+    uint64_t i;
+    root_set_entry *entry;
+
+    for (i = 0; i < cs->root_set_cap; i++) {
+        safe_printf("rs[%"PRIu64"] = ", i);
+        root_set_entry_print_unsafe(cs->root_set + i);
+    }
+
+    safe_rwlock_unlock(&(cs->root_set_lock));
+
+    // NOTE: probs shouldn't call this function in parallel with anything else,
+    // Nothing will break, but the results might be funky.
+
+    ms_foreach(cs->ms, obj_print, NULL, 0);
+}
+
+void cs_print_ms(collected_space *cs) {
+    ms_print(cs->ms);
+}
+
+static int cs_vaddr_cmp(const void *v1, const void *v2) {
+    return cmp_adb_addr(*(const addr_book_vaddr *)v1, 
+            *(const addr_book_vaddr *)v2);
+}
+
+// Whether v belongs to the region which is ending right now.
+static inline uint8_t cs_ending(collected_space *cs, addr_book_vaddr v) {
+    return cs->ending_len > 0 && bsearch(&v, cs->ending, cs->ending_len, 
+            sizeof(addr_book_vaddr), cs_vaddr_cmp) != NULL;
+}
+
+static void obj_unvisit(addr_book_vaddr v, void *paddr, void *ctx) {
+    collected_space *cs = ctx;
+    obj_pre_header *obj_p_h = paddr;
+
+    obj_p_h->gc_status = GC_UNVISITED;
+
+    // Pinned objects and region objects are treated as roots.
+    // (The pin held by a frozen object doesn't count)
+    //
+    // NOTE: The user can only pin objects which are reachable. So, an object
+    // pinned after this point must have been reachable when "paint black"
+    // started, it doesn't need to be pushed here.
+    //
+    // Region objects are never collected one by one. (See cs_region_end)
+    // Still, they must keep the objects they reference alive. (Unless 
+    // their region is ending)
+    if ((obj_p_h->region && !cs_ending(cs, v)) || 
+            ms_pinned(cs->ms, v) > obj_p_h->frozen) {
+        safe_mutex_lock(&(cs->in_progress_stack_lock));
+        bc_push_back(cs->in_progress_stack, &v);
+        safe_mutex_unlock(&(cs->in_progress_stack_lock));
+    }
+}
+
+static void obj_unvisit_busy(addr_book_vaddr v, void *ctx) {
+    collected_space *cs = ctx;
+
+    // A user has this object, paint the rest white first.
+    __atomic_add_fetch(&(cs->deferred), 1, __ATOMIC_RELEASE);
+}
+
+static uint8_t obj_reachable(addr_book_vaddr v, void *paddr, void *ctx) {
+    obj_pre_header *obj_p_h = paddr;
+    return obj_p_h->gc_status != GC_UNVISITED;
+}
+
+static void obj_collect_frozen(addr_book_vaddr v, void *paddr, void *ctx) {
+    obj_pre_header *obj_p_h = paddr;
+
+    if (obj_p_h->frozen) {
+        bc_push_back((util_bc *)ctx, &v);
+    }
+}
+
+static void obj_collect_unreachable_frozen(addr_book_vaddr v, void *paddr, 
+        void *ctx) {
+    if (!obj_reachable(v, paddr, NULL)) {
+        obj_collect_frozen(v, paddr, ctx);
+    }
+}
+
+// Only declared for tests. (See test/cs.h)
+uint64_t cs_gc_deferred(collected_space *cs) {
+    return __atomic_load_n(&(cs->deferred), __ATOMIC_ACQUIRE);
+}
+
+// Paint every object white, then black the ones which are reachable.
+//
+// NOTE: gc_lock must be write locked when calling this.
+static void cs_mark(collected_space *cs) {
+    // Paint White.
+    ms_foreach_defer(cs->ms, obj_unvisit, obj_unvisit_busy, cs);  
+
+    safe_rdlock(&(cs->root_set_lock)); 
+    // Once we have acquired the root set lock.
+    // The "paint black" phase has officially started.
+    // The roots at this point in time will be the only roots considered.
+    //
+    // NOTE: If a root is added after this point in the paint black phase,
+    // it is implied that it was reachable when paint black started.
+    // Thus it will not be GC'd.
+    cs_set_paint_black_in_progress(cs, 1);
+
+    safe_mutex_lock(&(cs->in_progress_stack_lock));
+    uint64_t root_i;
+    root_set_entry entry;
+    for (root_i = 0; root_i < cs->root_set_cap; root_i++) {
+        entry = cs->root_set[root_i];
+
+        if (entry.allocated) {
+            bc_push_back(cs->in_progress_stack, &(entry.vaddr));
+        }
+    }
+    safe_mutex_unlock(&(cs->in_progress_stack_lock));
+    
+    safe_rwlock_unlock(&(cs->root_set_lock));
+
+    // Now, time for DFS...
+    
+    // We stop when an iteration which did no work occurs.
+    uint8_t productive_iteration = 1;
+
+    addr_book_vaddr vaddr;
+
+    obj_pre_header *obj_p_h;
+    obj_header *obj_h;
+    addr_book_vaddr *rt;
+
+    while (productive_iteration || !bc_empty(cs->retry_stack)) {
+        productive_iteration = 0;
+
+        while (1) {
+            safe_mutex_lock(&(cs->in_progress_stack_lock));
+            if (bc_empty(cs->in_progress_stack)) {
+                safe_mutex_unlock(&(cs->in_progress_stack_lock));
+
+                break;
+            }
+
+            bc_pop_back(cs->in_progress_stack, &vaddr);
+            safe_mutex_unlock(&(cs->in_progress_stack_lock));
+
+            obj_p_h = ms_try_get_write(cs->ms, vaddr);
+
+            if (!obj_p_h) {
+                // A user has this object, come back to it later.
+                bc_push_back(cs->retry_stack, &vaddr);
+                __atomic_add_fetch(&(cs->deferred), 1, __ATOMIC_RELEASE);
+
+                continue;
+            }
+
+            // Transfer to visit stack if needed.
             if (obj_p_h->gc_status == GC_UNVISITED) {
                 obj_p_h->gc_status = GC_IN_PROGRESS; 
                 bc_push_back(cs->visit_stack, &vaddr);
@@ -669,7 +1469,14 @@ uint64_t cs_collect_garbage(collected_space *cs) {
         while (!bc_empty(cs->visit_stack)) {
             bc_pop_back(cs->visit_stack, &vaddr);
 
-            obj_p_h = ms_get_write(cs->ms, vaddr);
+            obj_p_h = ms_try_get_write(cs->ms, vaddr);
+
+            if (!obj_p_h) {
+                bc_push_back(cs->retry_stack, &vaddr);
+                __atomic_add_fetch(&(cs->deferred), 1, __ATOMIC_RELEASE);
+
+                continue;
+            }
 
             if (obj_p_h->gc_status == GC_IN_PROGRESS) {
                 // ... as oppposed to already being visited
@@ -682,17 +1489,92 @@ uint64_t cs_collect_garbage(collected_space *cs) {
 
             productive_iteration = 1;
         }
+
+        // Now for the deferred objects.
+        uint64_t retries = bc_len(cs->retry_stack);
+
+        while (retries > 0) {
+            retries--;
+
+            bc_pop_front(cs->retry_stack, &vaddr);
+
+            obj_p_h = ms_try_get_write(cs->ms, vaddr);
+
+            if (!obj_p_h) {
+                if (productive_iteration || retries > 0) {
+                    bc_push_back(cs->retry_stack, &vaddr);
+
+                    continue;
+                }
+
+                // Nothing else got done this iteration, so there is 
+                // nothing better to do than wait.
+                obj_p_h = ms_get_write(cs->ms, vaddr);
+            }
+
+            // We skip the visit stack here, as we already have the lock.
+            if (obj_p_h->gc_status == GC_UNVISITED || 
+                    obj_p_h->gc_status == GC_IN_PROGRESS) {
+                cs_visit_obj(cs, obj_p_h);
+            }
+
+            ms_unlock(cs->ms, vaddr);
+
+            productive_iteration = 1;
+        }
     }
 
     cs_set_paint_black_in_progress(cs, 0);
+}
+
+uint64_t cs_collect_garbage(collected_space *cs) {
+    // Someone else is collecting, or a region is ending.
+    if (safe_try_wrlock(&(cs->gc_lock))) {
+        return 0;
+    }
+
+    safe_wrlock(&(cs->gc_stat_lock));
+    cs->gc_in_progress = 1;
+    safe_rwlock_unlock(&(cs->gc_stat_lock));
+
+    cs_mark(cs);
 
     // Finally time for "sweep" phase.
+    //
+    // Frozen objects hold a pin which must be dropped before they can
+    // be freed. Since these objects are unreachable, no one else should
+    // be able to see them.
+    util_bc *frozen_stack = new_broken_collection(get_chnl(cs), 
+            sizeof(addr_book_vaddr), 30, 0);
+
+    ms_foreach(cs->ms, obj_collect_unreachable_frozen, frozen_stack, 0);
+
+    addr_book_vaddr frozen_v;
+    while (!bc_empty(frozen_stack)) {
+        bc_pop_back(frozen_stack, &frozen_v);
+        ms_unpin(cs->ms, frozen_v);
+    }
+
+    delete_broken_collection(frozen_stack);
+
     uint64_t filtered = ms_filter(cs->ms, obj_reachable, NULL);
 
+    // Garbage inside tlab buffers is only given back once the buffer is
+    // flushed. Tlabs which are in use flush themselves. (See cs_tlab)
+    ms_flush_idle_tlabs(cs->ms);
+
+    // No optimistic read from before the last collection can still be 
+    // running, so old idle large blocks can be unmapped.
+    ms_trim_idle_large(cs->ms);
+
+    __atomic_add_fetch(&(cs->gc_count), 1, __ATOMIC_RELAXED);
+
     safe_wrlock(&(cs->gc_stat_lock));
     cs->gc_in_progress = 0;
     safe_rwlock_unlock(&(cs->gc_stat_lock));
 
+    safe_rwlock_unlock(&(cs->gc_lock));
+
     return filtered;
 }
 
@@ -724,9 +1606,19 @@ static void *cs_gc_worker(void *arg) {
 
         free_count += cs_collect_garbage(cs);
 
-        if (spec->shift && free_count >= spec->shift_trigger) {
+        uint8_t shifted = 0;
+
+        if (spec->shift && spec->min_frag) {
+            shifted = cs_try_compact(cs, spec->min_frag, 
+                    spec->shift_budget) > 0;
+        } else if (spec->shift && free_count >= spec->shift_trigger) {
             free_count = 0;
-            cs_try_full_shift(cs);
+            cs_try_parallel_shift(cs, spec->shift_threads);
+            shifted = 1;
+        }
+
+        if (shifted && spec->evacuate) {
+            cs_try_evacuate(cs);
         }
 
         if (spec->delay) {
@@ -795,3 +1687,456 @@ void cs_try_full_shift(collected_space *cs) {
     ms_try_full_shift(cs->ms);
 }
 
+void cs_try_parallel_shift(collected_space *cs, uint64_t threads) {
+    ms_try_parallel_shift(cs->ms, threads);
+}
+
+uint64_t cs_try_compact(collected_space *cs, uint64_t min_frag, 
+        const struct timespec *budget) {
+    return ms_try_compact(cs->ms, min_frag, budget);
+}
+
+uint64_t cs_try_evacuate(collected_space *cs) {
+    return ms_try_evacuate(cs->ms);
+}
+
+struct cs_tlab_struct {
+    collected_space * const cs;
+    mem_tlab * const tl;
+
+    // Value of cs->gc_count when the tlab was last flushed.
+    uint64_t gc_count;
+};
+
+cs_tlab *cs_tlab_begin(collected_space *cs) {
+    cs_tlab *t = safe_malloc(get_chnl(cs), sizeof(cs_tlab));
+
+    *(collected_space **)&(t->cs) = cs;
+    *(mem_tlab **)&(t->tl) = ms_tlab_begin(cs->ms);
+    t->gc_count = __atomic_load_n(&(cs->gc_count), __ATOMIC_RELAXED);
+
+    return t;
+}
+
+// Objects freed by the GC inside of the current buffer only give back
+// their space once the buffer is flushed.
+static inline void cs_tlab_check_gc(cs_tlab *t) {
+    uint64_t gc_count = __atomic_load_n(&(t->cs->gc_count), __ATOMIC_RELAXED);
+
+    if (gc_count != t->gc_count) {
+        ms_tlab_flush(t->tl);
+        t->gc_count = gc_count;
+    }
+}
+
+malloc_obj_res cs_tlab_malloc_object_p(cs_tlab *t, uint64_t rt_len,
+        uint64_t da_size, uint8_t hold) {
+    cs_tlab_check_gc(t);
+
+    malloc_res res = ms_tlab_malloc_p(t->tl, 
+            cs_obj_size(CS_NO_SHAPE, rt_len, da_size), 1);
+
+    return cs_malloc_res_to_obj_res(
+            cs_init_obj(t->cs, res, CS_NO_SHAPE, rt_len, da_size, hold, 0));
+}
+
+malloc_obj_res cs_tlab_malloc_shaped_object_p(cs_tlab *t, 
+        cs_shape_id shape_id, uint8_t hold) {
+    cs_shape shape = cs_get_shape(shape_id);
+
+    cs_tlab_check_gc(t);
+
+    malloc_res res = ms_tlab_malloc_p(t->tl, 
+            cs_obj_size(shape_id, shape.rt_len, shape.da_size), 1);
+
+    return cs_malloc_res_to_obj_res(cs_init_obj(t->cs, res, shape_id, 
+                shape.rt_len, shape.da_size, hold, 0));
+}
+
+void cs_tlab_flush(cs_tlab *t) {
+    ms_tlab_flush(t->tl);
+}
+
+void cs_tlab_end(cs_tlab *t) {
+    ms_tlab_end(t->tl);
+    safe_free(t);
+}
+
+struct cs_region_struct {
+    collected_space * const cs;
+    mem_region * const mr;
+};
+
+cs_region *cs_region_begin(collected_space *cs) {
+    cs_region *r = safe_malloc(get_chnl(cs), sizeof(cs_region));
+
+    *(collected_space **)&(r->cs) = cs;
+    *(mem_region **)&(r->mr) = ms_region_begin(cs->ms);
+
+    return r;
+}
+
+malloc_obj_res cs_region_malloc_object_p(cs_region *r, uint64_t rt_len,
+        uint64_t da_size, uint8_t hold) {
+    malloc_res res = ms_region_malloc_p(r->mr, 
+            cs_obj_size(CS_NO_SHAPE, rt_len, da_size), 1);
+
+    return cs_malloc_res_to_obj_res(
+            cs_init_obj(r->cs, res, CS_NO_SHAPE, rt_len, da_size, hold, 1));
+}
+
+// A sorted array of all vaddrs in a region.
+typedef struct {
+    uint64_t len;
+    uint64_t cap;
+    addr_book_vaddr *arr;
+
+    // The first reference found into the region from outside.
+    // NULL_VADDR if there is no such reference.
+    addr_book_vaddr escaped;
+} cs_region_set;
+
+static void cs_region_set_add(addr_book_vaddr v, void *ctx) {
+    cs_region_set *set = ctx;
+
+    if (set->len == set->cap) {
+        set->cap *= 2;
+        set->arr = safe_realloc(set->arr, sizeof(addr_book_vaddr) * set->cap);
+    }
+
+    set->arr[(set->len)++] = v;
+}
+
+static inline uint8_t cs_region_set_contains(cs_region_set *set, 
+        addr_book_vaddr v) {
+    return bsearch(&v, set->arr, set->len, sizeof(addr_book_vaddr), 
+            cs_vaddr_cmp) != NULL;
+}
+
+// Only objects marked by cs_mark are checked. An unreachable object is
+// garbage, it can point wherever it likes.
+static void obj_check_escape(addr_book_vaddr v, void *paddr, void *ctx) {
+    cs_region_set *set = ctx;
+    obj_pre_header *obj_p_h = paddr;
+
+    if (!null_adb_addr(set->escaped) || obj_p_h->gc_status == GC_UNVISITED ||
+            cs_region_set_contains(set, v)) {
+        return;
+    }
+    obj_index ind = obj_p_h_to_index(obj_p_h, obj_p_h->shape);
+
+    uint64_t i;
+    for (i = 0; i < ind.rt_len; i++) {
+        if (!null_adb_addr(ind.rt[i]) && 
+                cs_region_set_contains(set, ind.rt[i])) {
+            set->escaped = ind.rt[i];
+
+            return;
+        }
+    }
+}
+
+void cs_region_end(cs_region *r) {
+    collected_space *cs = r->cs;
+
+    // Region objects are about to be freed out from under the GC.
+    // So, we wait for any collection to finish, and keep new ones out.
+    safe_wrlock(&(cs->gc_lock));
+
+    cs_region_set set = {
+        .len = 0,
+        .cap = 16,
+        .arr = safe_malloc(get_chnl(cs), sizeof(addr_book_vaddr) * 16),
+        .escaped = NULL_VADDR,
+    };
+
+    ms_region_foreach(r->mr, cs_region_set_add, &set);
+    qsort(set.arr, set.len, sizeof(addr_book_vaddr), cs_vaddr_cmp);
+
+    // Make sure nothing outside of the region can still see it.
+    safe_rdlock(&(cs->root_set_lock));
+
+    uint64_t root_i;
+    for (root_i = 0; root_i < cs->root_set_cap; root_i++) {
+        if (cs->root_set[root_i].allocated && 
+                cs_region_set_contains(&set, cs->root_set[root_i].vaddr)) {
+            set.escaped = cs->root_set[root_i].vaddr;
+
+            break;
+        }
+    }
+
+    safe_rwlock_unlock(&(cs->root_set_lock));
+
+    // Only what is reachable without this region counts. 
+    if (null_adb_addr(set.escaped)) {
+        cs->ending = set.arr;
+        cs->ending_len = set.len;
+
+        cs_mark(cs);
+
+        cs->ending = NULL;
+        cs->ending_len = 0;
+
+        ms_foreach(cs->ms, obj_check_escape, &set, 0);
+    }
+
+    if (!null_adb_addr(set.escaped)) {
+        safe_rwlock_unlock(&(cs->gc_lock));
+
+        safe_free(set.arr);
+
+        error_logf(1, 1, "cs_region_end: region object referenced from "
+                "outside its region (%" PRIu64 ", %" PRIu64 ")",
+                (uint64_t)set.escaped.table_index, 
+                (uint64_t)set.escaped.cell_index);
+    }
+
+    safe_free(set.arr);
+
+    ms_region_end(r->mr);
+    safe_free(r);
+
+    safe_rwlock_unlock(&(cs->gc_lock));
+}
+
+// Image format :
+//
+// cs_image_header
+// root_set_cap * root_set_entry
+// Memory Space Image
+
+static const uint64_t CS_IMAGE_MAGIC = 0x4348564D43530003;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t root_set_cap;
+    cs_root_id free_head;
+
+    // Includes the unused CS_NO_SHAPE entry. (See cs_shapes_len)
+    uint64_t shapes_len;
+} cs_image_header;
+
+uint8_t cs_save_image(collected_space *cs, const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd == -1) {
+        return 1;
+    }
+
+    int res;
+
+    safe_rdlock(&(cs->root_set_lock));
+
+    cs_image_header cs_ih = {
+        .magic = CS_IMAGE_MAGIC,
+        .root_set_cap = cs->root_set_cap,
+        .free_head = cs->free_head,
+        .shapes_len = cs_shapes_count(),
+    };
+
+    res = safe_write(fd, &cs_ih, sizeof(cs_image_header));
+
+    if (!res) {
+        res = safe_write(fd, cs->root_set, 
+                sizeof(root_set_entry) * cs->root_set_cap);
+    }
+
+    if (!res) {
+        res = safe_write(fd, cs_shapes, sizeof(cs_shape) * cs_ih.shapes_len);
+    }
+
+    safe_rwlock_unlock(&(cs->root_set_lock));
+
+    if (!res) {
+        res = ms_save_image(cs->ms, fd);
+    }
+
+    if (safe_close(fd)) {
+        res = -1;
+    }
+
+    return res ? 1 : 0;
+}
+
+// Every root must be a live object, and the free list must only go 
+// through free entries.
+static uint8_t cs_valid_root_set(mem_space *ms, root_set_entry *root_set, 
+        uint64_t root_set_cap, cs_root_id free_head) {
+    uint64_t i;
+    for (i = 0; i < root_set_cap; i++) {
+        if (root_set[i].allocated > 1 || (root_set[i].allocated && 
+                    !ms_allocated(ms, root_set[i].vaddr))) {
+            return 0;
+        }
+    }
+
+    // There can't be more free entries than entries. (No cycles)
+    cs_root_id iter = free_head;
+
+    for (i = 0; iter != UINT64_MAX; i++, iter = root_set[iter].next_free) {
+        if (i == root_set_cap || iter >= root_set_cap || 
+                root_set[iter].allocated) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+typedef struct {
+    mem_space *ms;
+    uint64_t shapes_len;
+
+    // Set to 0 once an invalid object is found.
+    uint8_t valid;
+} cs_valid_objs_context;
+
+// Confirm an object's header fits its piece, and that all of its 
+// references are NULL or live.
+static void obj_check_valid(addr_book_vaddr v, void *paddr, void *ctx) {
+    cs_valid_objs_context *vo_ctx = ctx;
+
+    if (!(vo_ctx->valid)) {
+        return;
+    }
+
+    obj_pre_header *obj_p_h = paddr;
+    uint64_t bytes = ms_piece_bytes(vo_ctx->ms, paddr);
+
+    if (bytes < sizeof(obj_pre_header) || (obj_p_h->shape == CS_NO_SHAPE &&
+                bytes < sizeof(obj_pre_header) + sizeof(obj_sizes))) {
+        vo_ctx->valid = 0;
+        return;
+    }
+
+    // Region objects are never saved.
+    if (obj_p_h->gc_status > GC_VISITED || obj_p_h->frozen > 1 || 
+            obj_p_h->region || obj_p_h->shape >= vo_ctx->shapes_len) {
+        vo_ctx->valid = 0;
+        return;
+    }
+
+    obj_index ind = obj_p_h_to_index(obj_p_h, obj_p_h->shape);
+
+    // Checked one at a time so that cs_obj_size can't overflow.
+    if (ind.rt_len > bytes / sizeof(addr_book_vaddr) || 
+            ind.da_size > bytes || 
+            cs_obj_size(obj_p_h->shape, ind.rt_len, ind.da_size) > bytes) {
+        vo_ctx->valid = 0;
+        return;
+    }
+
+    uint64_t i;
+    for (i = 0; i < ind.rt_len; i++) {
+        if (!null_adb_addr(ind.rt[i]) && 
+                !ms_allocated(vo_ctx->ms, ind.rt[i])) {
+            vo_ctx->valid = 0;
+            return;
+        }
+    }
+}
+
+static uint8_t cs_valid_objs(mem_space *ms, uint64_t shapes_len) {
+    cs_valid_objs_context vo_ctx = {
+        .ms = ms,
+        .shapes_len = shapes_len,
+        .valid = 1,
+    };
+
+    ms_foreach(ms, obj_check_valid, &vo_ctx, 0);
+
+    return vo_ctx.valid;
+}
+
+collected_space *cs_load_image(uint64_t chnl, const char *path) {
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
+        return NULL;
+    }
+
+    cs_image_header cs_ih;
+    size_t left;
+
+    if (safe_read(fd, &cs_ih, sizeof(cs_image_header)) ||
+            cs_ih.magic != CS_IMAGE_MAGIC || cs_ih.root_set_cap == 0 ||
+            (cs_ih.free_head != UINT64_MAX && 
+             cs_ih.free_head >= cs_ih.root_set_cap) ||
+            cs_ih.shapes_len == 0 || cs_ih.shapes_len > cs_shapes_count() ||
+            safe_bytes_left(fd, &left) || 
+            cs_ih.root_set_cap > left / sizeof(root_set_entry)) {
+        safe_close(fd);
+        return NULL;
+    }
+
+    root_set_entry *root_set = 
+        safe_malloc(chnl, sizeof(root_set_entry) * cs_ih.root_set_cap);
+
+    if (safe_read(fd, root_set, sizeof(root_set_entry) * cs_ih.root_set_cap)) {
+        safe_free(root_set);
+        safe_close(fd);
+
+        return NULL;
+    }
+
+    // Every saved shape must match the registered shape with the same id.
+    cs_shape *shapes = safe_malloc(chnl, sizeof(cs_shape) * cs_ih.shapes_len);
+
+    uint8_t shapes_match = 
+        !safe_read(fd, shapes, sizeof(cs_shape) * cs_ih.shapes_len);
+
+    uint64_t i;
+    for (i = 1; shapes_match && i < cs_ih.shapes_len; i++) {
+        shapes_match = shapes[i].rt_len == cs_shapes[i].rt_len &&
+            shapes[i].da_size == cs_shapes[i].da_size &&
+            shapes[i].flags == cs_shapes[i].flags;
+    }
+
+    safe_free(shapes);
+
+    if (!shapes_match) {
+        safe_free(root_set);
+        safe_close(fd);
+
+        return NULL;
+    }
+
+    mem_space *ms = ms_load_image(chnl, fd);
+    safe_close(fd);
+
+    if (!ms) {
+        safe_free(root_set);
+        return NULL;
+    }
+
+    if (!cs_valid_root_set(ms, root_set, cs_ih.root_set_cap, 
+                cs_ih.free_head) || !cs_valid_objs(ms, cs_ih.shapes_len)) {
+        delete_mem_space(ms);
+        safe_free(root_set);
+
+        return NULL;
+    }
+
+    collected_space *cs = new_collected_space_from_ms(chnl, ms);
+
+    // Pins aren't saved, so frozen objects must be pinned again.
+    util_bc *frozen_stack = new_broken_collection(chnl, 
+            sizeof(addr_book_vaddr), 30, 0);
+
+    ms_foreach(ms, obj_collect_frozen, frozen_stack, 0);
+
+    addr_book_vaddr v;
+    while (!bc_empty(frozen_stack)) {
+        bc_pop_back(frozen_stack, &v);
+        ms_pin(ms, v);
+    }
+
+    delete_broken_collection(frozen_stack);
+
+    cs->root_set = root_set;
+    cs->root_set_cap = cs_ih.root_set_cap;
+    cs->free_head = cs_ih.free_head;
+
+    return cs;
+}
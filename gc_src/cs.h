@@ -22,40 +22,29 @@
 
 typedef struct collected_space_struct collected_space;
 
+// The header of an object. An object's fields are found using 
+// obj_h_to_index.
+typedef struct obj_header_struct obj_header;
+
 typedef struct {
+    obj_header *h;
+
     // The number of references in the reference table.
-    const uint64_t rt_len;
+    uint64_t rt_len;
 
     // The number of bytes in the data array.
-    const uint64_t da_size;
-} obj_header;
+    uint64_t da_size;
 
-typedef struct {
-    obj_header *h;
     addr_book_vaddr *rt;
     uint8_t *da;
 } obj_index;
 
-static inline obj_index obj_h_to_index(obj_header *h) {
-    obj_index obj_i;
-
-    obj_i.h = h;
-    obj_i.rt = (addr_book_vaddr *)(h + 1);
-    obj_i.da = (uint8_t *)(obj_i.rt + h->rt_len);
-
-    return obj_i;
-}
+obj_index obj_h_to_index(obj_header *h);
 
 // Here we provide information to set up the underlying memory space.
 // NOTE: No root objects will be created at first.
-collected_space *new_collected_space_seed(uint64_t chnl, uint64_t seed, 
-        uint64_t adb_t_cap, uint64_t mb_m_bytes);
-
-static inline collected_space *new_collected_space(uint64_t chnl,
-        uint64_t adb_t_cap, uint64_t mb_m_bytes) {
-    return new_collected_space_seed(chnl, time(NULL), adb_t_cap, 
-            mb_m_bytes);
-}
+collected_space *new_collected_space(uint64_t chnl, uint64_t adb_t_cap, 
+        uint64_t mb_m_bytes);
 
 // Make sure no GC Thread is running while this is called.
 // GC Background thread must be stopped before calling this.
@@ -93,6 +82,142 @@ static inline malloc_obj_res cs_malloc_object_and_hold(collected_space *cs,
     return cs_malloc_object_p(cs, rt_len, da_size, 1);
 }
 
+// Shapes.
+//
+// Most objects share one of a small number of layouts. Registering a 
+// layout as a shape lets objects of that layout store a 4 byte shape id 
+// in place of their sizes, which saves 16 bytes per object.
+//
+// The shape table is global, a shape id can be used with any collected 
+// space. Shapes can never be unregistered.
+
+typedef uint32_t cs_shape_id;
+
+// The shape id of objects created without a shape.
+extern const cs_shape_id CS_NO_SHAPE;
+
+typedef struct {
+    uint64_t rt_len;
+    uint64_t da_size;
+
+    // Never read by cs, these are for the user. (e.g. a type tag)
+    uint64_t flags;
+} cs_shape;
+
+// Exits if the shape table is full.
+cs_shape_id cs_register_shape(uint64_t rt_len, uint64_t da_size, 
+        uint64_t flags);
+
+// Exits if shape_id has not been registered.
+cs_shape cs_get_shape(cs_shape_id shape_id);
+
+// Returns CS_NO_SHAPE if the object was created without a shape.
+cs_shape_id obj_h_shape(obj_header *h);
+
+// Same as cs_malloc_object_p, but the object's sizes come from the shape
+// with id shape_id. Exits if shape_id has not been registered.
+malloc_obj_res cs_malloc_shaped_object_p(collected_space *cs, 
+        cs_shape_id shape_id, uint8_t hold);
+
+static inline addr_book_vaddr cs_malloc_shaped_object(collected_space *cs,
+        cs_shape_id shape_id) {
+    return cs_malloc_shaped_object_p(cs, shape_id, 0).vaddr;
+}
+
+static inline malloc_obj_res cs_malloc_shaped_object_and_hold(
+        collected_space *cs, cs_shape_id shape_id) {
+    return cs_malloc_shaped_object_p(cs, shape_id, 1);
+}
+
+// Change the sizes of vaddr's object. Existing references and data
+// bytes are kept, up to the new sizes. New references are NULL_VADDR 
+// and new data bytes are 0. 
+//
+// The object is resized in place when possible. Otherwise, it is moved
+// and keeps its vaddr. (See ms_realloc_held) Pinned and region objects 
+// are never moved.
+//
+// Returns 0 on success, 1 if the object could not be resized. 
+// (In which case it is left as is)
+//
+// Exits if the object is frozen or was created with a shape.
+//
+// NOTE: Do not call this while holding a lock on vaddr.
+uint8_t cs_resize_object(collected_space *cs, addr_book_vaddr vaddr, 
+        uint64_t rt_len, uint64_t da_size);
+
+// Regions.
+//
+// Objects allocated in a region live in memory blocks private to the 
+// region. cs_region_end frees all of them at once, so short lived batches
+// of objects never need to be swept one by one.
+//
+// Region objects are never collected by the GC. Instead, they are treated
+// as roots until their region ends. Region objects can reference any
+// object, but once a region ends, no object outside of the region may 
+// reference an object inside of it. (Roots count too) If this is not the 
+// case, cs_region_end exits.
+//
+// Only reachable objects are checked for outside references. Ending a 
+// region marks every object reachable without it, the same way a 
+// collection does, then visits every object in cs. So, end regions 
+// sparingly.
+//
+// NOTE: A region should only be used by one thread at a time, and no 
+// region object can be in use when its region ends.
+typedef struct cs_region_struct cs_region;
+
+cs_region *cs_region_begin(collected_space *cs);
+
+malloc_obj_res cs_region_malloc_object_p(cs_region *r, uint64_t rt_len,
+        uint64_t da_size, uint8_t hold);
+
+static inline addr_book_vaddr cs_region_malloc_object(cs_region *r,
+        uint64_t rt_len, uint64_t da_size) {
+    return cs_region_malloc_object_p(r, rt_len, da_size, 0).vaddr;
+}
+
+static inline malloc_obj_res cs_region_malloc_object_and_hold(cs_region *r,
+        uint64_t rt_len, uint64_t da_size) {
+    return cs_region_malloc_object_p(r, rt_len, da_size, 1);
+}
+
+void cs_region_end(cs_region *r);
+
+// Thread local allocation buffers. (See ms_tlab_begin)
+//
+// Objects allocated with a tlab are normal objects. They are just placed
+// without any block locks being acquired. Space freed by the GC inside
+// the tlab's current buffer is reclaimed at the end of the collection.
+// (See ms_flush_idle_tlabs) If the tlab was in use at that moment, it is
+// reclaimed the first time the tlab is used after the collection.
+//
+// NOTE: A tlab should only be used by one thread at a time. End all 
+// tlabs before saving or deleting cs.
+typedef struct cs_tlab_struct cs_tlab;
+
+cs_tlab *cs_tlab_begin(collected_space *cs);
+
+malloc_obj_res cs_tlab_malloc_object_p(cs_tlab *t, uint64_t rt_len,
+        uint64_t da_size, uint8_t hold);
+
+static inline addr_book_vaddr cs_tlab_malloc_object(cs_tlab *t,
+        uint64_t rt_len, uint64_t da_size) {
+    return cs_tlab_malloc_object_p(t, rt_len, da_size, 0).vaddr;
+}
+
+static inline malloc_obj_res cs_tlab_malloc_object_and_hold(cs_tlab *t,
+        uint64_t rt_len, uint64_t da_size) {
+    return cs_tlab_malloc_object_p(t, rt_len, da_size, 1);
+}
+
+// Exits if shape_id has not been registered.
+malloc_obj_res cs_tlab_malloc_shaped_object_p(cs_tlab *t, 
+        cs_shape_id shape_id, uint8_t hold);
+
+void cs_tlab_flush(cs_tlab *t);
+void cs_tlab_end(cs_tlab *t);
+
 uint8_t cs_allocated(collected_space *cs, addr_book_vaddr vaddr);
 
 typedef uint64_t cs_root_id;
@@ -149,7 +274,144 @@ static inline obj_index cs_get_write_ind(collected_space *cs,
 
 void cs_unlock(collected_space *cs, addr_book_vaddr vaddr);
 
+// Locking many objects at once.
+//
+// Acquiring more than one write lock with cs_get_write is deadlock prone
+// unless every thread agrees on an order. cs_get_write_many always locks
+// in the canonical order (See cmp_adb_addr), so it is safe to call from
+// many threads with overlapping sets.
+//
+// The header of vaddrs[i] is written to hs[i]. vaddrs may contain 
+// duplicates, each unique object is only locked once.
+//
+// Exits if any of the objects are frozen.
+//
+// NOTE: Do not call this while already holding a lock on any object.
+void cs_get_write_many(collected_space *cs, const addr_book_vaddr *vaddrs, 
+        uint64_t len, obj_header **hs);
+
+// Release all locks acquired by cs_get_write_many.
+// vaddrs must contain the same objects given to cs_get_write_many.
+void cs_unlock_many(collected_space *cs, const addr_book_vaddr *vaddrs, 
+        uint64_t len);
+
+// Freezing.
+//
+// A frozen object can never be written to again, calling cs_get_write on
+// a frozen object results in an exit. In return, cs_get_read on a frozen
+// object never acquires a lock. (cs_unlock is then a no-op)
+//
+// This is meant for data which is built once and then only read. 
+// (e.g. config and lookup tables)
+//
+// Freezing an object pins it. Unlike cs_pin though, freezing an object
+// does not make it a root.
+//
+// NOTE: Freezing twice does nothing.
+void cs_freeze(collected_space *cs, addr_book_vaddr vaddr);
+uint8_t cs_frozen(collected_space *cs, addr_book_vaddr vaddr);
+
+// Pinning. (See mb_pin)
+//
+// A pinned object will never be moved by a shift, so the header returned
+// by cs_pin can be used directly until the matching cs_unpin. This skips
+// the address book entirely, which is nice for very hot objects.
+//
+// Pinned objects are treated as roots by the GC.
+//
+// NOTE: No lock is held on a pinned object. The user must provide their
+// own synchronization when using the returned header. Also, references
+// should only ever be written to a pinned object through cs_get_write, 
+// otherwise the GC may miss them.
+obj_header *cs_pin(collected_space *cs, addr_book_vaddr vaddr);
+
+static inline obj_index cs_pin_ind(collected_space *cs, 
+        addr_book_vaddr vaddr) {
+    return obj_h_to_index(cs_pin(cs, vaddr));
+}
+
+void cs_unpin(collected_space *cs, addr_book_vaddr vaddr);
+
+// Atomic field operations. (See adt_atomic_begin)
+//
+// These update a single field of an object using hardware atomics without
+// acquiring the object's lock. Many threads can then update the same
+// object at once (e.g. a shared counter) without serializing on its lock.
+//
+// If another thread holds the write lock on the object, these wait on the
+// read lock instead. A thread holding the write lock will never see one
+// of these updates mid write.
+//
+// Exits if the offset/index is out of bounds, if da_offset is not 8 byte
+// aligned, or if a frozen object is written to.
+//
+// NOTE: A field updated using these calls may change while other threads
+// hold the read lock. Such fields should only be read using the atomic
+// load calls below.
+//
+// NOTE: Do not call these while holding the lock of the same object.
+
+uint64_t cs_atomic_load_u64(collected_space *cs, addr_book_vaddr vaddr,
+        uint64_t da_offset);
+
+// Returns the value after delta is added.
+uint64_t cs_atomic_add_u64(collected_space *cs, addr_book_vaddr vaddr,
+        uint64_t da_offset, uint64_t delta);
+
+// Returns 1 if the u64 at da_offset equaled expected and was replaced
+// with desired. 0 otherwise.
+uint8_t cs_atomic_cas_u64(collected_space *cs, addr_book_vaddr vaddr,
+        uint64_t da_offset, uint64_t expected, uint64_t desired);
+
+addr_book_vaddr cs_atomic_load_ref(collected_space *cs, 
+        addr_book_vaddr vaddr, uint64_t rt_index);
+
+// Same as cs_atomic_cas_u64, but for a reference.
+//
+// NOTE: While the GC is running, this may need the write lock in order
+// to run the write barrier. (See cs_get_write)
+uint8_t cs_cas_ref(collected_space *cs, addr_book_vaddr vaddr, 
+        uint64_t rt_index, addr_book_vaddr expected, 
+        addr_book_vaddr desired);
+
+// Optimistic reads. (See adt_opt_read_begin)
+//
+// These calls never acquire a lock, so hot objects which are mostly
+// read can be read from many threads at once without bouncing the
+// cell lock between cores.
+//
+// h will be NULL if the read should be retried.
+//
+// NOTE: The GC and shifts count as writers, so validation can fail
+// even if the user never writes to the object.
+typedef struct {
+    uint64_t version;
+    obj_header *h;
+} cs_opt_read_res;
+
+cs_opt_read_res cs_opt_read_begin(collected_space *cs, addr_book_vaddr vaddr);
+uint8_t cs_opt_read_validate(collected_space *cs, addr_book_vaddr vaddr,
+        uint64_t version);
+
+// Helpers for reading small objects.
+//
+// These try an optimistic read a few times before falling back to
+// the read lock. An out of bounds offset/index results in an exit.
+
+// Copy len bytes starting at offset of vaddr's data array into dest.
+void cs_read_da(collected_space *cs, addr_book_vaddr vaddr, 
+        uint64_t offset, void *dest, uint64_t len);
+
+// Read the reference at rt_index of vaddr's reference table.
+addr_book_vaddr cs_read_rt(collected_space *cs, addr_book_vaddr vaddr,
+        uint64_t rt_index);
+
+// Number of objects in the space. (See ms_count)
 uint64_t cs_count(collected_space *cs);
+
+// Stats of the underlying memory space. (See ms_get_stats)
+mem_stats cs_get_stats(collected_space *cs);
+
 void cs_print(collected_space *cs);
 void cs_print_ms(collected_space *cs);
 
@@ -168,7 +430,27 @@ typedef struct {
 
     // If shifting is on, this will equal the total number of
     // frees which must occur before a full shift triggers.
+    // (Only used when min_frag is 0)
     uint64_t shift_trigger;
+
+    // If non-zero, every cycle shifts only the blocks whose 
+    // fragmentation is at least min_frag percent, instead of 
+    // shifting everything after shift_trigger frees.
+    // (See ms_try_compact)
+    uint64_t min_frag;
+
+    // Max time spent shifting fragmented blocks each cycle.
+    // (Only used when min_frag is non-zero, NULL for no limit)
+    const struct timespec *shift_budget;
+
+    // 1 if sparse memory blocks should be evacuated after
+    // each full shift. (Only used when shifting is on)
+    uint8_t evacuate;
+
+    // Number of threads used by each full shift. 
+    // 0 or 1 means the GC thread shifts alone. 
+    // (See ms_try_parallel_shift)
+    uint64_t shift_threads;
 } gc_worker_spec;
 
 // This will run a gc cycle every delay period.
@@ -194,4 +476,45 @@ uint8_t cs_stop_gc(collected_space *cs);
 // Run try full shift on the underlying memory space.
 void cs_try_full_shift(collected_space *cs);
 
+// Run try parallel shift on the underlying memory space.
+void cs_try_parallel_shift(collected_space *cs, uint64_t threads);
+
+// Run try compact on the underlying memory space.
+uint64_t cs_try_compact(collected_space *cs, uint64_t min_frag, 
+        const struct timespec *budget);
+
+// Evacuate the sparse blocks of the underlying memory space.
+// (See ms_try_evacuate)
+//
+// Returns the number of objects moved.
+//
+// NOTE: Don't call this while a GC worker which evacuates is running.
+uint64_t cs_try_evacuate(collected_space *cs);
+
+// Heap images.
+//
+// cs_save_image writes all objects and the root set of cs to the file at
+// path. cs_load_image creates a new collected space from such a file.
+// All vaddrs and root ids from the saved space are valid in the loaded
+// space.
+//
+// Loading copies each memory block directly from the file, then fixes up
+// the physical addresses held in the address book with a single pass
+// over each block. No objects are allocated one by one.
+//
+// NOTE: Make sure no GC thread is running and no other thread is using 
+// cs while saving.
+//
+// NOTE: Region objects are not saved. End all regions before saving.
+//
+// NOTE: The shape table is saved with the image, but shapes are not
+// registered on load. Every shape in the image must already be 
+// registered, in the same order, otherwise loading fails.
+
+// Returns 0 on success, 1 on failure.
+uint8_t cs_save_image(collected_space *cs, const char *path);
+
+// Returns NULL on failure.
+collected_space *cs_load_image(uint64_t chnl, const char *path);
+
 #endif
@@ -1,15 +1,18 @@
 #include "./mb.h"
 #include "virt.h"
 #include <stdlib.h>
+#include <string.h>
 
 #include "../core_src/io.h"
 #include "../core_src/mem.h"
 #include "../core_src/thread.h"
-#include "../core_src/io.h"
+#include "../core_src/sys.h"
 
 #include "../util_src/data.h"
 
 #include <inttypes.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <sys/_pthread/_pthread_rwlock_t.h>
 
 // New Memory Block Concept and Notes:
@@ -30,8 +33,8 @@
 //
 // Memory Blocks will be large. (Probs >= 100kb)
 // This way, shifting only needs to be done on a per Memory Block
-// basis. As of now, data will never be shifted from
-// one block to another.
+// basis. Shifting never moves data from one block to another, 
+// only evacuation does. (See mb_evacuate)
 //
 // If the user wants a piece of memory larger than the default
 // block size, a custom size block will be created.
@@ -46,28 +49,51 @@
 //
 // Pieces of Memory will have the following structure:
 //
-// size will always be divisible by two. 
+// size will always be divisible by eight. 
 // (size will include the Header and Footer)
-// alloc will reside in the first bit. (Whether or not the piece ic occupied)
+// alloc will reside in the first bit. (Whether or not the piece is occupied)
+// prev_alloc will reside in the second bit. (Whether or not the piece 
+// directly before this one is occupied, always 1 for the first piece)
 //
-// size_t size | alloc; (Header)
+// size_t size | prev_alloc | alloc; (Header)
 //
 // ... size - (2 * sizeof(size_t)) bytes ... (Body)
 //
-// size_t size | alloc; (Footer)
+// size_t size | prev_alloc | alloc; (Footer)
+//
+// Only free pieces have a footer. The footer is only ever needed to find 
+// the start of a free piece from the piece after it, and prev_alloc tells 
+// us when this is possible. An occupied piece uses the space instead.
+//
+// The free space at the end of the block is special. It is not a piece
+// at all, just a bump pointer. Everything from the bump pointer to the
+// end of the block is free, has no tags written, and is not in any free
+// list. Mallocing from it only moves the bump pointer and writes one 
+// header. Any free piece which would touch it is merged into it instead.
+// So, after a full shift, a block is nothing but occupied pieces 
+// followed by the bump region.
 
 typedef struct {} mem_piece;
 
 static const uint64_t MP_ALLOC_MASK = 0x1;
-static const uint64_t MP_SIZE_MASK = ~MP_ALLOC_MASK;
+static const uint64_t MP_PREV_ALLOC_MASK = 0x2;
+// Set on pieces which are inside of an unflushed buffer. 
+// (See Buffer Notes below)
+static const uint64_t MP_BUFFERED_MASK = 0x4;
+static const uint64_t MP_SIZE_MASK = ~0x7ULL;
 
-static const uint64_t MP_PADDING = 2 * sizeof(uint64_t);
+// Header of an occupied piece.
+static const uint64_t MP_PADDING = sizeof(uint64_t);
 
-static inline void mp_init(mem_piece *mp, uint64_t size, uint8_t alloc) {
-    uint64_t tag = size | alloc;
+static inline void mp_init(mem_piece *mp, uint64_t size, uint8_t alloc, 
+        uint8_t prev_alloc) {
+    uint64_t tag = size | alloc | (prev_alloc ? MP_PREV_ALLOC_MASK : 0);
 
     *(uint64_t *)mp = tag;
-    ((uint64_t *)((uint8_t *)mp + size))[-1] = tag;
+
+    if (!alloc) {
+        ((uint64_t *)((uint8_t *)mp + size))[-1] = tag;
+    }
 }
 
 static inline uint64_t mp_size(mem_piece *mp) {
@@ -78,6 +104,18 @@ static inline uint8_t mp_alloc(mem_piece *mp) {
     return (uint8_t)(*(uint64_t *)mp & MP_ALLOC_MASK);
 }
 
+static inline uint8_t mp_buffered(mem_piece *mp) {
+    return (*(uint64_t *)mp & MP_BUFFERED_MASK) ? 1 : 0;
+}
+
+static inline uint8_t mp_prev_alloc(mem_piece *mp) {
+    return (*(uint64_t *)mp & MP_PREV_ALLOC_MASK) ? 1 : 0;
+}
+
+static inline void mp_set_prev_alloc(mem_piece *mp, uint8_t prev_alloc) {
+    mp_init(mp, mp_size(mp), mp_alloc(mp), prev_alloc);
+}
+
 static inline void *mp_body(mem_piece *mp) {
     return (void *)((uint64_t *)mp + 1);
 }
@@ -90,10 +128,12 @@ static inline mem_piece *mp_next(mem_piece *mp) {
     return (mem_piece *)((uint8_t *)mp + mp_size(mp));
 }
 
+// NOTE: Only call when the previous piece is free! (See mp_prev_alloc)
 static inline uint64_t mp_prev_size(mem_piece *mp) {
     return ((uint64_t *)mp)[-1] & MP_SIZE_MASK; 
 }
 
+// NOTE: Only call when the previous piece is free! (See mp_prev_alloc)
 static inline mem_piece *mp_prev(mem_piece *mp) {
     return (mem_piece *)((uint8_t *)mp - mp_prev_size(mp));
 }
@@ -103,7 +143,9 @@ typedef struct mem_free_piece_header_struct {
     struct mem_free_piece_header_struct *size_free_next;
 } mem_free_piece_header;
 
-static const uint64_t MFP_PADDING = MP_PADDING + sizeof(mem_free_piece_header);
+// Header, free list links, and footer.
+static const uint64_t MFP_PADDING = MP_PADDING + 
+    sizeof(mem_free_piece_header) + sizeof(uint64_t);
 
 // This is a little confusing.
 // Returns the amount of user accessible memory which can be allocated in
@@ -126,20 +168,72 @@ static inline void *mp_to_map_b(mem_piece *mp) {
 
 static const uint64_t MAP_PADDING = MP_PADDING + sizeof(mem_alloc_piece_header);
 
-// NOTE: The value of this constant MUST be even.
-// Also note, that this value depends on what is stored in 
-// the alloc_piece_header. 
-//
-// NOTE: right now we have the plus 2 since MFP_PADDING = MAP_PADDING.
-// A free block should be mallocable for at least 1 byte. (Also must
-// have an even size).
+// Returns 1 if the given occupied piece is a reserved buffer.
+// (See Buffer Notes below)
+static inline uint8_t mp_is_buffer(mem_piece *mp) {
+    return null_adb_addr(*(mem_alloc_piece_header *)mp_body(mp));
+}
+
+// Every occupied piece must be able to become a free piece later.
 //
-// This should always store whichever padding value is larger.
-static const uint64_t MP_MIN_SIZE = MFP_PADDING + 2;
+// NOTE: MFP_PADDING > MAP_PADDING, this should always store whichever 
+// padding value is larger.
+static const uint64_t MP_MIN_SIZE = MFP_PADDING;
 
-// Round the given number of bytes to be divisible by two.
+// Round the given number of bytes to be divisible by eight.
+// (This leaves the low bits of every tag free for flags)
 static inline uint64_t round_num_bytes(uint64_t num_bytes) {
-    return num_bytes % 2 ? num_bytes + 1 : num_bytes;
+    return (num_bytes + 7) & ~7ULL;
+}
+
+// Size classes.
+//
+// Free pieces are kept in segregated lists, one per size class.
+// Pieces smaller than MB_SMALL_LIMIT get one class per possible size 
+// (Remember sizes are multiples of 8). Larger pieces are grouped by 
+// power of two, each power being split into 1 << MB_SPLIT_BITS classes.
+// Everything past the last power goes into the final class.
+//
+// A bitmap of which classes are non-empty lets malloc jump straight
+// to the smallest class which could hold a request.
+#define MB_SMALL_BITS 8
+#define MB_SMALL_LIMIT (1ULL << MB_SMALL_BITS)
+#define MB_NUM_SMALL_CLASSES (MB_SMALL_LIMIT / 8)
+#define MB_SPLIT_BITS 2
+#define MB_MAX_BITS 40
+#define MB_NUM_CLASSES \
+    (MB_NUM_SMALL_CLASSES + ((MB_MAX_BITS - MB_SMALL_BITS) << MB_SPLIT_BITS))
+#define MB_CLASS_WORDS ((MB_NUM_CLASSES + 63) / 64)
+
+// Max number of pieces looked at when searching a single class for
+// the best fit. This keeps malloc constant time even when one class
+// holds thousands of pieces.
+#define MB_FIT_SCAN 16
+
+static inline uint64_t mb_size_class(uint64_t size) {
+    if (size < MB_SMALL_LIMIT) {
+        return size >> 3;
+    }
+
+    uint64_t e = 63 - (uint64_t)__builtin_clzll(size);
+    uint64_t split = (size >> (e - MB_SPLIT_BITS)) & 
+        ((1ULL << MB_SPLIT_BITS) - 1);
+    uint64_t c = MB_NUM_SMALL_CLASSES + 
+        ((e - MB_SMALL_BITS) << MB_SPLIT_BITS) + split;
+
+    return c < MB_NUM_CLASSES ? c : MB_NUM_CLASSES - 1;
+}
+
+// Smallest piece size which falls into class c.
+static inline uint64_t mb_class_min_size(uint64_t c) {
+    if (c < MB_NUM_SMALL_CLASSES) {
+        return c << 3;
+    }
+
+    uint64_t e = MB_SMALL_BITS + ((c - MB_NUM_SMALL_CLASSES) >> MB_SPLIT_BITS);
+    uint64_t split = (c - MB_NUM_SMALL_CLASSES) & ((1ULL << MB_SPLIT_BITS) - 1);
+
+    return (1ULL << e) + (split << (e - MB_SPLIT_BITS));
 }
 
 // Pad number of bytes by the allocated piece padding, and round.
@@ -171,7 +265,56 @@ typedef struct {
     // to block or even deadlock.
     pthread_rwlock_t mem_lck;
 
-    mem_free_piece_header *size_free_list; 
+    // Free pieces by size class. (See mb_size_class)
+    mem_free_piece_header *free_lists[MB_NUM_CLASSES];
+
+    // Bit c is set iff free_lists[c] is non-empty.
+    uint64_t free_classes[MB_CLASS_WORDS];
+
+    // Total number of free pieces. (Not counting the bump region)
+    uint64_t free_count;
+
+    // Total size of all free pieces. (Not counting the bump region)
+    uint64_t free_bytes;
+
+    // Number of occupied pieces. Pieces in buffers are only counted 
+    // once their buffer is flushed. (Buffers themselves never are)
+    uint64_t live_count;
+
+    // Start of the bump region. (See notes at the top of this file)
+    //
+    // The piece before the bump region, if any, is always occupied.
+    // The bump region is either empty or at least MP_MIN_SIZE bytes.
+    mem_piece *bump;
+
+    // Number of reserved buffers which are yet to be flushed.
+    uint64_t buffers;
+
+    // Number of bytes given back to the OS while the block was empty.
+    // (See mb_release) Goes back to 0 once the block is malloc'd into.
+    uint64_t released;
+
+    // Number of pinned pieces in this block. (See mb_pin)
+    //
+    // NOTE: this should only be accessed using atomics!
+    uint64_t pinned;
+
+    // Slab blocks only. (See Slab Notes below)
+    //
+    // Size of each cell, vaddr included. This is 0 for all other blocks.
+    const uint64_t cell_size;
+    const uint64_t num_cells;
+
+    // Bit i is set iff cell i is occupied. Bits past num_cells are 
+    // always set, so a full word is always ~0.
+    uint64_t * const cell_bits;
+
+    // Every word of cell_bits before this one is full.
+    uint64_t cell_hint;
+
+    // Number of bytes mapped for a large block, header included. 
+    // (See new_mem_block_large) 0 for all other blocks.
+    const uint64_t map_size;
 } mem_block_header;
 
 // NOTE: Notes on Deadlock and Memory Blocks.
@@ -195,87 +338,142 @@ typedef struct {
 // We used to have a foreach mechanism, this has since been removed for this reason!
 
 
-mem_block *new_mem_block(uint8_t chnl, addr_book *adb, uint64_t min_bytes) {
-    uint64_t padded_cap = pad_num_bytes(min_bytes);
-    mem_block *mb = safe_malloc(chnl, sizeof(mem_block_header) + padded_cap);
+// Slab Notes:
+//
+// A slab block is made by new_mem_block_arr. It is cut into num_cells 
+// cells of cell_size bytes. Each cell holds a vaddr followed by the body
+// of at most one piece. Cells have no tags, whether or not a cell is
+// occupied is kept in the cell_bits bitmap instead. So, malloc and free
+// only ever flip a single bit.
+//
+// A slab block has no free pieces, and its bump region is always empty.
+// This way it is never shifted and never holds buffers, all without any 
+// extra checks. Its free_bytes is the total size of its free cells.
+
+static inline uint8_t mb_is_slab(mem_block *mb) {
+    return ((mem_block_header *)mb)->cell_size != 0;
+}
 
+static inline uint64_t mb_cell_words(uint64_t num_cells) {
+    return (num_cells + 63) / 64;
+}
+
+static inline uint8_t *mb_cell(mem_block *mb, uint64_t i) {
     mem_block_header *mb_h = (mem_block_header *)mb;
 
-    *(uint64_t *)&(mb_h->cap) = padded_cap;
-    *(addr_book **)&(mb_h->adb) = adb;
+    return (uint8_t *)(mb_h + 1) + (i * mb_h->cell_size);
+}
 
-    safe_rwlock_init(&(mb_h->mem_lck), NULL);
+static inline void *mb_cell_body(mem_block *mb, uint64_t i) {
+    return (mem_alloc_piece_header *)mb_cell(mb, i) + 1;
+}
 
-    // Get the first memory piece.
-    mem_piece *mp = (mem_piece *)(mb_h + 1);
-    mp_init(mp, padded_cap, 0);
+// paddr must point into one of the block's cells.
+static inline uint64_t mb_cell_index(mem_block *mb, const void *paddr) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
 
-    mem_free_piece_header *mfp_h = (mem_free_piece_header *)mp_body(mp);
+    return (uint64_t)((const uint8_t *)paddr - (const uint8_t *)(mb_h + 1)) /
+        mb_h->cell_size;
+}
 
-    mfp_h->size_free_next = NULL;
-    mfp_h->size_free_prev = NULL;
+// Returns the first occupied cell >= i, num_cells if there is none.
+static uint64_t mb_next_cell_unsafe(mem_block *mb, uint64_t i) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    if (i >= mb_h->num_cells) {
+        return mb_h->num_cells;
+    }
 
-    mb_h->size_free_list = mfp_h;
+    uint64_t w = i / 64;
+    uint64_t bits = mb_h->cell_bits[w] & (~0ULL << (i % 64));
 
-    return mb;
+    while (!bits) {
+        if (++w == mb_cell_words(mb_h->num_cells)) {
+            return mb_h->num_cells;
+        }
+
+        bits = mb_h->cell_bits[w];
+    }
+
+    i = (w * 64) + (uint64_t)__builtin_ctzll(bits);
+
+    // Don't forget the bits past the last cell are always set.
+    return i < mb_h->num_cells ? i : mb_h->num_cells;
 }
 
-mem_block *new_mem_block_arr(uint8_t chnl, addr_book *adb, 
-        uint64_t cell_size, uint64_t min_cells) {
-    return new_mem_block(chnl, adb, (cell_size + MAP_PADDING) * min_cells);
+// Largest malloc which would succeed in the slab block.
+static inline uint64_t mb_slab_free_space_unsafe(mem_block *mb) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    return mb_h->live_count < mb_h->num_cells 
+        ? mb_h->cell_size - sizeof(mem_alloc_piece_header) : 0;
 }
 
-void delete_mem_block(mem_block *mb) {
+static void mb_init_free_lists_unsafe(mem_block *mb) {
     mem_block_header *mb_h = (mem_block_header *)mb;
 
-    mem_piece *start  = (mem_piece *)(mb_h + 1);
-    mem_piece *end = (mem_piece *)((uint8_t *)start + mb_h->cap);
+    uint64_t c;
+    for (c = 0; c < MB_NUM_CLASSES; c++) {
+        mb_h->free_lists[c] = NULL;
+    }
 
-    // Again, we lock here, but really, this call should never be
-    // called in parallel with any other call to the same mem
-    // block.
-    safe_wrlock(&(mb_h->mem_lck));
+    for (c = 0; c < MB_CLASS_WORDS; c++) {
+        mb_h->free_classes[c] = 0;
+    }
 
-    mem_piece *iter = start;
+    mb_h->free_count = 0;
+    mb_h->free_bytes = 0;
+}
 
-    // Here we free all virtual addresses used by the
-    // memory block.
-    while (iter < end) {
-        // Only free vaddrs from allocated blocks.
-        if (mp_alloc(iter)) {
-            mem_alloc_piece_header *map_h = 
-                (mem_alloc_piece_header *)mp_body(iter);
+// Number of bytes in the bump region.
+static inline uint64_t mb_bump_size_unsafe(mem_block *mb) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
 
-            adb_free(mb_h->adb, *map_h);
-        }
+    return (uint64_t)(((uint8_t *)(mb_h + 1) + mb_h->cap) - (uint8_t *)(mb_h->bump));
+}
 
-        iter = mp_next(iter);
+// Returns the first non-empty class >= c, MB_NUM_CLASSES if there is none.
+static uint64_t mb_next_class_unsafe(mem_block *mb, uint64_t c) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    if (c >= MB_NUM_CLASSES) {
+        return MB_NUM_CLASSES;
     }
 
-    safe_rwlock_unlock(&(mb_h->mem_lck));
+    uint64_t w = c / 64;
+    uint64_t bits = mb_h->free_classes[w] & (~0ULL << (c % 64));
+
+    while (!bits) {
+        if (++w == MB_CLASS_WORDS) {
+            return MB_NUM_CLASSES;
+        }
+
+        bits = mb_h->free_classes[w];
+    }
 
-    safe_free(mb);
+    return (w * 64) + (uint64_t)__builtin_ctzll(bits);
 }
 
-uint64_t mb_free_space(mem_block *mb) {
+// Returns the last non-empty class, MB_NUM_CLASSES if there is none.
+static uint64_t mb_last_class_unsafe(mem_block *mb) {
     mem_block_header *mb_h = (mem_block_header *)mb;
-    uint64_t space = 0;
 
-    safe_rdlock(&(mb_h->mem_lck));
+    uint64_t w = MB_CLASS_WORDS;
 
-    if (mb_h->size_free_list) {
-        uint64_t big_free_size = 
-            mp_size(mp_b_to_mp(mb_h->size_free_list)); 
+    while (w > 0) {
+        w--;
 
-        space = big_free_size - MAP_PADDING;
+        if (mb_h->free_classes[w]) {
+            return (w * 64) + 63 - (uint64_t)__builtin_clzll(mb_h->free_classes[w]);
+        }
     }
 
-    safe_rwlock_unlock(&(mb_h->mem_lck));
-
-    return space;
+    return MB_NUM_CLASSES;
 }
 
-// Remove piece from size free list only.
+// Remove piece from its size free list only.
+//
+// NOTE: The piece's header must still hold the size it was added with.
 static void mb_remove_from_size_unsafe(mem_block *mb, mem_free_piece_header *mfp_h) {
     mem_block_header *mb_h = (mem_block_header *)mb;
 
@@ -286,221 +484,635 @@ static void mb_remove_from_size_unsafe(mem_block *mb, mem_free_piece_header *mfp
     if (mfp_h->size_free_prev) {
         mfp_h->size_free_prev->size_free_next = mfp_h->size_free_next;
     } else {
-        mb_h->size_free_list = mfp_h->size_free_next;
+        uint64_t c = mb_size_class(mp_size(mp_b_to_mp(mfp_h)));
+        mb_h->free_lists[c] = mfp_h->size_free_next;
+
+        if (!(mfp_h->size_free_next)) {
+            mb_h->free_classes[c / 64] &= ~(1ULL << (c % 64));
+        }
     }
+
+    mb_h->free_count--;
+    mb_h->free_bytes -= mp_size(mp_b_to_mp(mfp_h));
 }
 
-// Add a piece which does not currently reside in the size free list into the
-// size free list.
+// Add a piece which does not currently reside in a size free list into 
+// the free list of its class.
 static void mb_add_to_size_unsafe(mem_block *mb, mem_piece *mp) {
     mem_block_header *mb_h = (mem_block_header *)mb;
 
-    uint64_t size = mp_size(mp); 
+    uint64_t c = mb_size_class(mp_size(mp));
     mem_free_piece_header *mfp_h = (mem_free_piece_header *)mp_body(mp);
+    mem_free_piece_header *head = mb_h->free_lists[c];
 
-    mem_free_piece_header *iter = mb_h->size_free_list;
-    mem_free_piece_header *next_iter = NULL;
-
-    if (!iter) {
-        mb_h->size_free_list = mfp_h;
-
-        mfp_h->size_free_prev = NULL;
-        mfp_h->size_free_next = NULL;
+    mfp_h->size_free_prev = NULL;
+    mfp_h->size_free_next = head;
 
-        return;
+    if (head) {
+        head->size_free_prev = mfp_h;
+    } else {
+        mb_h->free_classes[c / 64] |= 1ULL << (c % 64);
     }
 
-    // Go until our iterator has a size <= mp.
-    while (mp_size(mp_b_to_mp(iter)) > size) {
-        next_iter = iter->size_free_next;
+    mb_h->free_lists[c] = mfp_h;
+    mb_h->free_count++;
+    mb_h->free_bytes += mp_size(mp);
+}
+
+// Look at no more than max_scan pieces of class c, returning the
+// smallest one with size >= min_size. NULL if none is found.
+static mem_free_piece_header *mb_best_in_class_unsafe(mem_block *mb, 
+        uint64_t c, uint64_t min_size, uint64_t max_scan) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
 
-        // Here we have made it to the end of 
-        // our list.
-        if (!next_iter) {
-            iter->size_free_next = mfp_h; 
+    mem_free_piece_header *iter = mb_h->free_lists[c];
+    mem_free_piece_header *best = NULL;
+    uint64_t best_size = 0;
+    uint64_t size;
 
-            mfp_h->size_free_prev = iter;
-            mfp_h->size_free_next = NULL;
+    for (; iter && max_scan > 0; iter = iter->size_free_next, max_scan--) {
+        size = mp_size(mp_b_to_mp(iter));
 
-            return;
+        if (size < min_size || (best && size >= best_size)) {
+            continue;
         }
 
-        iter = next_iter;
+        best = iter;
+        best_size = size;
+
+        if (size == min_size) {
+            break;
+        }
     }
 
-    if (iter->size_free_prev) {
-        iter->size_free_prev->size_free_next = mfp_h;
-    } else {
-        mb_h->size_free_list = mfp_h;
+    return best;
+}
+
+// Find a free piece with size >= min_size. NULL if there is none.
+//
+// The class of min_size is searched first, then the next non-empty
+// classes above it. Only when nothing larger exists is the class of 
+// min_size searched in full.
+static mem_free_piece_header *mb_find_fit_unsafe(mem_block *mb, 
+        uint64_t min_size) {
+    uint64_t min_c = mb_size_class(min_size);
+    mem_free_piece_header *fit = 
+        mb_best_in_class_unsafe(mb, min_c, min_size, MB_FIT_SCAN);
+
+    uint64_t c = mb_next_class_unsafe(mb, min_c + 1);
+
+    while (!fit && c < MB_NUM_CLASSES) {
+        fit = mb_best_in_class_unsafe(mb, c, min_size, MB_FIT_SCAN);
+        c = mb_next_class_unsafe(mb, c + 1);
     }
 
-    // Insert mp just before iter.
-    mfp_h->size_free_next = iter;
-    mfp_h->size_free_prev = iter->size_free_prev;
+    if (!fit) {
+        fit = mb_best_in_class_unsafe(mb, min_c, min_size, UINT64_MAX);
+    }
 
-    iter->size_free_prev = mfp_h;
+    return fit;
 }
 
-// mp will be a newly freed piece which is not part of any free lists yet.
-static void mb_coalesce_unsafe(mem_block *mb, mem_piece *mp) {
+// Set up the header of a new block with cap bytes. The whole block 
+// starts as the bump region.
+static void mb_init_header(mem_block *mb, addr_book *adb, uint64_t cap) {
     mem_block_header *mb_h = (mem_block_header *)mb;
 
-    mem_piece *start = (mem_piece *)(mb_h + 1);
-    mem_piece *end = (mem_piece *)((uint8_t *)(mb_h + 1) + mb_h->cap);
+    *(uint64_t *)&(mb_h->cap) = cap;
+    *(addr_book **)&(mb_h->adb) = adb;
 
-    // No matter the situation, the new free block must be newly added
-    // into the size free list. 
-    
-    mem_piece *prev = NULL;
-    uint8_t prev_free = 0;
+    safe_rwlock_init(&(mb_h->mem_lck), NULL);
+    mb_h->live_count = 0;
+    mb_h->buffers = 0;
+    mb_h->released = 0;
+    mb_h->pinned = 0;
 
-    if (mp > start) {
-        // Only calculate prev if it is in bounds.
-        prev = mp_prev(mp); 
+    *(uint64_t *)&(mb_h->cell_size) = 0;
+    *(uint64_t *)&(mb_h->num_cells) = 0;
+    *(uint64_t **)&(mb_h->cell_bits) = NULL;
+    mb_h->cell_hint = 0;
 
-        prev_free = !mp_alloc(prev);
-    }
+    *(uint64_t *)&(mb_h->map_size) = 0;
 
-    mem_piece *next = mp_next(mp);
-    uint8_t next_free = 0;
+    mb_init_free_lists_unsafe(mb);
+    mb_h->bump = (mem_piece *)(mb_h + 1);
+}
 
-    if (next < end) {
-        next_free = !mp_alloc(next); 
-    } else {
-        // void the next pointer if it is out of bounds.
-        next = NULL;     
-    }
+mem_block *new_mem_block(uint8_t chnl, addr_book *adb, uint64_t min_bytes) {
+    uint64_t padded_cap = pad_num_bytes(min_bytes);
+    mem_block *mb = safe_malloc(chnl, sizeof(mem_block_header) + padded_cap);
 
-    // Now, get needed free piece headers and remove pieces
-    // from size free list.
-    mem_piece *new_free = mp;
-    uint64_t new_size = mp_size(mp);
-    
-    mem_free_piece_header *prev_mfp_h;
-    if (prev_free) {
-        prev_mfp_h = (mem_free_piece_header *)mp_body(prev);
-        mb_remove_from_size_unsafe(mb, prev_mfp_h);
+    mb_init_header(mb, adb, padded_cap);
 
-        new_free = prev;
-        new_size += mp_size(prev);
-    }
+    return mb;
+}
 
-    mem_free_piece_header *next_mfp_h;
-    if (next_free) {
-        next_mfp_h = (mem_free_piece_header *)mp_body(next);
-        mb_remove_from_size_unsafe(mb, next_mfp_h);
+// Map a large block with exactly cap bytes.
+static mem_block *mb_map_large(addr_book *adb, uint64_t cap) {
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t map_size = (sizeof(mem_block_header) + cap + page - 1) & ~(page - 1);
 
-        new_size += mp_size(next);
+    void *mem = mmap(NULL, map_size, PROT_READ | PROT_WRITE, 
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (mem == MAP_FAILED) {
+        error_logf(1, 1, "mb_map_large: failed to map %" PRIu64 " bytes", 
+                map_size);
     }
 
-    mp_init(new_free, new_size, 0);
-    mb_add_to_size_unsafe(mb, new_free);
+    mem_block *mb = mem;
+
+    mb_init_header(mb, adb, cap);
+    *(uint64_t *)&(((mem_block_header *)mb)->map_size) = map_size;
+
+    return mb;
+}
+
+mem_block *new_mem_block_large(addr_book *adb, uint64_t min_bytes) {
+    return mb_map_large(adb, pad_num_bytes(min_bytes));
 }
 
-static void mb_free_unsafe(mem_block *mb, addr_book_vaddr vaddr) {
+uint8_t mb_is_large(mem_block *mb) {
+    return ((mem_block_header *)mb)->map_size != 0;
+}
+
+mem_block *new_mem_block_arr(uint8_t chnl, addr_book *adb, 
+        uint64_t cell_size, uint64_t min_cells) {
+    // Each cell is just the body plus its vaddr. (See Slab Notes)
+    uint64_t slab_cell_size = round_num_bytes(cell_size == 0 ? 1 : cell_size) + 
+        sizeof(mem_alloc_piece_header);
+    uint64_t num_cells = min_cells == 0 ? 1 : min_cells;
+    uint64_t cap = slab_cell_size * num_cells;
+
+    mem_block *mb = safe_malloc(chnl, sizeof(mem_block_header) + cap);
     mem_block_header *mb_h = (mem_block_header *)mb;
 
-    // After acquring mem_lck, we know we cannot be mid shift.
-    // Thus, physical addresses will be constant.
+    mb_init_header(mb, adb, cap);
 
-    // We get our physical address in an arbitrary manner.
-    //
-    // NOTE: We assume that no one is reading or writing to vaddr
-    // at the time of this call. The only exception being during a 
-    // shift... However, this is the purpose of the mem_lck.
-    void *paddr = adb_get_read(mb_h->adb, vaddr);
-    adb_unlock(mb_h->adb, vaddr);
+    uint64_t words = mb_cell_words(num_cells);
+    uint64_t *cell_bits = safe_malloc(chnl, sizeof(uint64_t) * words);
+    memset(cell_bits, 0, sizeof(uint64_t) * words);
 
-    // Discard vaddr entirely.
-    //
-    // NOTE: This line adds a vulnrability. 
-    // This call can block if another thread has a lock on vaddr.
-    // (note: there would never be a reason to do such a thing)
-    //
-    // If this free call does block, then other calls to this memory
-    // block will block when trying to acquire mem_lck... BAD!!!!!
-    adb_free(mb_h->adb, vaddr);
+    if (num_cells % 64) {
+        cell_bits[words - 1] = ~0ULL << (num_cells % 64);
+    }
 
-    // Get corresponding mem_piece pointer.
-    mem_piece *mp = map_b_to_mp(paddr);
+    *(uint64_t *)&(mb_h->cell_size) = slab_cell_size;
+    *(uint64_t *)&(mb_h->num_cells) = num_cells;
+    *(uint64_t **)&(mb_h->cell_bits) = cell_bits;
 
-    mb_coalesce_unsafe(mb, mp);
+    mb_h->free_bytes = cap;
+    mb_h->bump = (mem_piece *)((uint8_t *)(mb_h + 1) + cap);
+
+    return mb;
 }
 
-void mb_free(mem_block *mb, addr_book_vaddr vaddr) {
+uint64_t mb_cell_bytes(mem_block *mb) {
     mem_block_header *mb_h = (mem_block_header *)mb;
 
-    safe_wrlock(&(mb_h->mem_lck));
-    mb_free_unsafe(mb, vaddr);  
-    safe_rwlock_unlock(&(mb_h->mem_lck)); 
+    return mb_is_slab(mb) ? mb_h->cell_size - sizeof(mem_alloc_piece_header) : 0;
 }
 
-malloc_res mb_malloc_p(mem_block *mb, uint64_t min_bytes, uint8_t hold) {
-    malloc_res res = {
-        .paddr = NULL,
-        .vaddr = NULL_VADDR,
-    };
-
-    // Never allocate an empty piece!
-    if (min_bytes == 0) {
-        return res;
-    } 
-
+void delete_mem_block(mem_block *mb) {
     mem_block_header *mb_h = (mem_block_header *)mb;
 
-    // Must account for a lot for headers and vaddr.
-    uint64_t min_size = pad_num_bytes(min_bytes);
-
-    safe_wrlock(&(mb_h->mem_lck)); 
+    mem_piece *start  = (mem_piece *)(mb_h + 1);
 
-    mem_free_piece_header *big_free_h = mb_h->size_free_list;
+    // Again, we lock here, but really, this call should never be
+    // called in parallel with any other call to the same mem
+    // block.
+    safe_wrlock(&(mb_h->mem_lck));
 
-    if (!big_free_h) {
+    // The pieces inside of a buffer can't be found by the block.
+    if (mb_h->buffers > 0) {
         safe_rwlock_unlock(&(mb_h->mem_lck));
-
-        return res;
+        error_logf(1, 1, "delete_mem_block: %" PRIu64 " unflushed buffers", 
+                mb_h->buffers);
     }
 
-    mem_piece *big_free = mp_b_to_mp(big_free_h);
-    uint64_t big_free_size = mp_size(big_free);
+    if (mb_is_slab(mb)) {
+        uint64_t i = mb_next_cell_unsafe(mb, 0);
 
-    if (big_free_size < min_size) {
-        safe_rwlock_unlock(&(mb_h->mem_lck));
+        for (; i < mb_h->num_cells; i = mb_next_cell_unsafe(mb, i + 1)) {
+            adb_free(mb_h->adb, *(mem_alloc_piece_header *)mb_cell(mb, i));
+        }
 
-        return res;
+        safe_free(mb_h->cell_bits);
     }
 
-    // As we must have enough space, we pop our big free block
-    // off the front of the size free list.
-    mb_h->size_free_list = big_free_h->size_free_next;
+    // A slab block has no pieces at all.
+    mem_piece *end = mb_is_slab(mb) ? start : mb_h->bump;
 
-    if (big_free_h->size_free_next) {
-        big_free_h->size_free_next->size_free_prev = NULL;
-    }
+    mem_piece *iter = start;
 
-    addr_book_vaddr vaddr;
-    uint64_t cut_size = big_free_size - min_size;
+    // Here we free all virtual addresses used by the
+    // memory block.
+    while (iter < end) {
+        // Only free vaddrs from allocated blocks.
+        if (mp_alloc(iter)) {
+            mem_alloc_piece_header *map_h = 
+                (mem_alloc_piece_header *)mp_body(iter);
 
-    // Here we check to see if we should divide our big free block.
-    // This is only done when there are enough remaining bytes 
-    // to malloc at least once. 
-    if (cut_size < MP_MIN_SIZE) {
-        // Here there will be no division.
-        // Simply remove big free from corresponding free
-        // lists.             
+            adb_free(mb_h->adb, *map_h);
+        }
 
-        mp_init(big_free, big_free_size, 1);
+        iter = mp_next(iter);
+    }
+
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+
+    if (mb_is_large(mb)) {
+        munmap(mb, mb_h->map_size);
     } else {
-        // Here we cut!
-        mem_piece *new_free = (mem_piece *)((uint8_t *)big_free + min_size);
-        mp_init(new_free, cut_size, 0);
+        safe_free(mb);
+    }
+}
 
-        // Add new cut to size free list.
-        mb_add_to_size_unsafe(mb, new_free);
+uint64_t mb_free_space(mem_block *mb) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+    uint64_t space = 0;
 
-        // Finally, init our new allocated block.
-        mp_init(big_free, min_size, 1);
+    safe_rdlock(&(mb_h->mem_lck));
+
+    if (mb_is_slab(mb)) {
+        space = mb_slab_free_space_unsafe(mb);
+        safe_rwlock_unlock(&(mb_h->mem_lck));
+
+        return space;
+    }
+
+    uint64_t big_free_size = mb_bump_size_unsafe(mb);
+
+    // The biggest free piece must be in the last non-empty class.
+    uint64_t c = mb_last_class_unsafe(mb);
+
+    if (c < MB_NUM_CLASSES) {
+        uint64_t size;
+
+        mem_free_piece_header *iter = mb_h->free_lists[c];
+        for (; iter; iter = iter->size_free_next) {
+            size = mp_size(mp_b_to_mp(iter));
+
+            if (size > big_free_size) {
+                big_free_size = size;
+            }
+        }
+    }
+
+    if (big_free_size) {
+        space = big_free_size - MAP_PADDING;
+    }
+
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+
+    return space;
+}
+
+// A lower bound of the size of the largest free piece, bump region 
+// included.
+static uint64_t mb_largest_free_bound_unsafe(mem_block *mb) {
+    uint64_t big_free_size = mb_bump_size_unsafe(mb);
+
+    // Every piece in the last non-empty class is at least as large as
+    // the class's smallest size.
+    uint64_t c = mb_last_class_unsafe(mb);
+
+    if (c < MB_NUM_CLASSES && mb_class_min_size(c) > big_free_size) {
+        big_free_size = mb_class_min_size(c);
+    }
+
+    return big_free_size;
+}
+
+uint64_t mb_free_space_bound(mem_block *mb) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+    uint64_t space = 0;
+
+    safe_rdlock(&(mb_h->mem_lck));
+
+    uint64_t big_free_size = mb_largest_free_bound_unsafe(mb);
+
+    if (mb_is_slab(mb)) {
+        // Always exact for a slab block.
+        space = mb_slab_free_space_unsafe(mb);
+    } else if (big_free_size) {
+        space = big_free_size - MAP_PADDING;
+    }
+
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+
+    return space;
+}
+
+uint64_t mb_fragmentation(mem_block *mb) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    // Every free cell is as good as any other.
+    if (mb_is_slab(mb)) {
+        return 0;
+    }
+
+    safe_rdlock(&(mb_h->mem_lck));
+
+    uint64_t free_bytes = mb_h->free_bytes + mb_bump_size_unsafe(mb);
+    uint64_t big_free_size = mb_largest_free_bound_unsafe(mb);
+
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+
+    if (free_bytes == 0) {
+        return 0;
+    }
+
+    return 100 - ((100 * big_free_size) / free_bytes);
+}
+
+uint64_t mb_capacity(mem_block *mb) {
+    return ((mem_block_header *)mb)->cap;
+}
+
+uint64_t mb_used_space(mem_block *mb) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    safe_rdlock(&(mb_h->mem_lck));
+
+    // Every byte is either in an occupied piece, a free piece, or the 
+    // bump region.
+    uint64_t used = mb_h->cap - mb_h->free_bytes - mb_bump_size_unsafe(mb);
+
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+
+    return used;
+}
+
+mem_stats mb_get_stats(mem_block *mb) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+    mem_stats stats;
+
+    safe_rdlock(&(mb_h->mem_lck));
+
+    uint64_t bump_size = mb_bump_size_unsafe(mb);
+    uint64_t big_free_size = mb_largest_free_bound_unsafe(mb);
+
+    stats.blocks = 1;
+    stats.live_count = mb_h->live_count;
+    stats.live_bytes = mb_h->cap - mb_h->free_bytes - bump_size;
+    stats.free_bytes = mb_h->free_bytes + bump_size;
+    stats.max_free = big_free_size ? big_free_size - MAP_PADDING : 0;
+    stats.released_bytes = mb_h->released;
+
+    if (mb_is_slab(mb)) {
+        stats.max_free = mb_slab_free_space_unsafe(mb);
+    }
+
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+
+    return stats;
+}
+
+static inline uint8_t mb_is_empty_unsafe(mem_block *mb) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    if (mb_is_slab(mb)) {
+        return mb_h->live_count == 0;
+    }
+
+    // Free pieces never touch the bump region, so an empty block is
+    // all bump region.
+    return mb_h->bump == (mem_piece *)(mb_h + 1);
+}
+
+uint8_t mb_is_empty(mem_block *mb) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    safe_rdlock(&(mb_h->mem_lck));
+    uint8_t empty = mb_is_empty_unsafe(mb);
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+
+    return empty;
+}
+
+// macOS only takes MADV_DONTNEED as a hint, and keeps counting the pages
+// against us. MADV_FREE is what actually gives them back there.
+#ifdef __APPLE__
+#define MB_MADV_RELEASE MADV_FREE
+#else
+#define MB_MADV_RELEASE MADV_DONTNEED
+#endif
+
+uint64_t mb_release(mem_block *mb) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+    uint64_t released = 0;
+
+    safe_wrlock(&(mb_h->mem_lck));
+
+    uint8_t *start = (uint8_t *)(mb_h + 1);
+
+    if (mb_h->released == 0 && mb_is_empty_unsafe(mb)) {
+        // Only whole pages inside the block can be given back. The 
+        // header must stay put.
+        uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+        uintptr_t lo = ((uintptr_t)start + page - 1) & ~(page - 1);
+        uintptr_t hi = ((uintptr_t)start + mb_h->cap) & ~(page - 1);
+
+        // The bump region has no tags, (Nor do free cells) so we don't 
+        // care what its pages hold when they come back.
+        if (lo < hi && !madvise((void *)lo, hi - lo, MB_MADV_RELEASE)) {
+            released = hi - lo;
+            mb_h->released = released;
+        }
+    }
+
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+
+    return released;
+}
+
+uint64_t mb_released_bytes(mem_block *mb) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    safe_rdlock(&(mb_h->mem_lck));
+    uint64_t released = mb_h->released;
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+
+    return released;
+}
+
+// mp will be a newly freed piece which is not part of any free lists yet.
+static void mb_coalesce_unsafe(mem_block *mb, mem_piece *mp) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    mem_piece *end = mb_h->bump;
+
+    // No matter the situation, the new free block must be newly added
+    // into the size free list. 
+    
+    mem_piece *prev = NULL;
+    uint8_t prev_free = !mp_prev_alloc(mp);
+
+    if (prev_free) {
+        // Only calculate prev if it is free. (Otherwise it has no footer)
+        prev = mp_prev(mp); 
+    }
+
+    mem_piece *next = mp_next(mp);
+    uint8_t next_free = 0;
+
+    if (next < end) {
+        next_free = !mp_alloc(next); 
+    } else {
+        // void the next pointer if it is out of bounds.
+        next = NULL;     
+    }
+
+    // Now, get needed free piece headers and remove pieces
+    // from size free list.
+    mem_piece *new_free = mp;
+    uint64_t new_size = mp_size(mp);
+    
+    mem_free_piece_header *prev_mfp_h;
+    if (prev_free) {
+        prev_mfp_h = (mem_free_piece_header *)mp_body(prev);
+        mb_remove_from_size_unsafe(mb, prev_mfp_h);
+
+        new_free = prev;
+        new_size += mp_size(prev);
+    }
+
+    mem_free_piece_header *next_mfp_h;
+    if (next_free) {
+        next_mfp_h = (mem_free_piece_header *)mp_body(next);
+        mb_remove_from_size_unsafe(mb, next_mfp_h);
+
+        new_size += mp_size(next);
+    }
+
+    // Our new free piece touches the bump region, just give it back.
+    if (mp_next(mp) == end) {
+        mb_h->bump = new_free;
+        return;
+    }
+
+    // Two free pieces are never adjacent, so the piece before new_free
+    // must be occupied.
+    mp_init(new_free, new_size, 0, 1);
+    mb_add_to_size_unsafe(mb, new_free);
+
+    mem_piece *new_next = mp_next(new_free);
+
+    if (new_next < end) {
+        mp_set_prev_alloc(new_next, 0);
+    }
+}
+
+uint8_t mb_contains(mem_block *mb, const void *paddr) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    const uint8_t *start = (const uint8_t *)(mb_h + 1);
+
+    return start <= (const uint8_t *)paddr && 
+        (const uint8_t *)paddr < start + mb_h->cap;
+}
+
+// Give the piece at paddr back to the block. Its vaddr is not touched.
+static void mb_free_paddr_unsafe(mem_block *mb, void *paddr) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    if (mb_is_slab(mb)) {
+        uint64_t i = mb_cell_index(mb, paddr);
+
+        mb_h->cell_bits[i / 64] &= ~(1ULL << (i % 64));
+
+        if (i / 64 < mb_h->cell_hint) {
+            mb_h->cell_hint = i / 64;
+        }
+
+        mb_h->free_bytes += mb_h->cell_size;
+        mb_h->live_count--;
+
+        return;
+    }
+
+    // Get corresponding mem_piece pointer.
+    mem_piece *mp = map_b_to_mp(paddr);
+
+    // The piece is in a buffer which is still being used, it will be
+    // freed for real when the buffer is flushed.
+    if (mp_buffered(mp)) {
+        *(mem_alloc_piece_header *)mp_body(mp) = NULL_VADDR;
+        return;
+    }
+
+    mb_coalesce_unsafe(mb, mp);
+    mb_h->live_count--;
+}
+
+// Returns 1 without freeing anything if vaddr's piece is not in mb.
+static uint8_t mb_free_unsafe(mem_block *mb, addr_book_vaddr vaddr) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    // After acquring mem_lck, we know we cannot be mid shift.
+    // Thus, physical addresses will be constant.
+
+    // We get our physical address in an arbitrary manner.
+    //
+    // NOTE: We assume that no one is reading or writing to vaddr
+    // at the time of this call. The only exception being during a 
+    // shift... However, this is the purpose of the mem_lck.
+    void *paddr = adb_get_read(mb_h->adb, vaddr);
+    adb_unlock(mb_h->adb, vaddr);
+
+    // The piece may have been evacuated before we got the mem_lck.
+    if (!mb_contains(mb, paddr)) {
+        return 1;
+    }
+
+    // Discard vaddr entirely.
+    //
+    // NOTE: This line adds a vulnrability. 
+    // This call can block if another thread has a lock on vaddr.
+    // (note: there would never be a reason to do such a thing)
+    //
+    // If this free call does block, then other calls to this memory
+    // block will block when trying to acquire mem_lck... BAD!!!!!
+    adb_free(mb_h->adb, vaddr);
+
+    mb_free_paddr_unsafe(mb, paddr);
+
+    return 0;
+}
+
+uint8_t mb_free_if_owner(mem_block *mb, addr_book_vaddr vaddr) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    // Someone may still be using the piece's physical address.
+    if (adb_pinned(mb_h->adb, vaddr)) {
+        error_logf(1, 1, "mb_free: pinned vaddr given (%" PRIu64 ", %" PRIu64 ")",
+                (uint64_t)vaddr.table_index, (uint64_t)vaddr.cell_index);
+    }
+
+    safe_wrlock(&(mb_h->mem_lck));
+    uint8_t res = mb_free_unsafe(mb, vaddr);  
+    safe_rwlock_unlock(&(mb_h->mem_lck)); 
+
+    return res;
+}
+
+void mb_free(mem_block *mb, addr_book_vaddr vaddr) {
+    if (mb_free_if_owner(mb, vaddr)) {
+        error_logf(1, 1, "mb_free: vaddr (%" PRIu64 ", %" PRIu64 ") is not in the block",
+                (uint64_t)vaddr.table_index, (uint64_t)vaddr.cell_index);
     }
+}
+
+// Give a vaddr to the newly occupied piece mp, then release mem_lck.
+static malloc_res mb_malloc_finish_unsafe(mem_block *mb, mem_piece *mp, 
+        uint8_t hold) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    malloc_res res = {
+        .paddr = NULL,
+        .vaddr = NULL_VADDR,
+    };
 
     // I am just going to keep this the way it is.
     //
@@ -511,45 +1123,568 @@ malloc_res mb_malloc_p(mem_block *mb, uint64_t min_bytes, uint8_t hold) {
     // This is somewhat inconsistent with Memory Space.
     // But it is ok for now.
     //
-    vaddr = adb_put_p(mb_h->adb, mp_to_map_b(big_free), hold);
-    *(mem_alloc_piece_header *)mp_body(big_free) = vaddr;
+    addr_book_vaddr vaddr = adb_put_p(mb_h->adb, mp_to_map_b(mp), hold);
+    *(mem_alloc_piece_header *)mp_body(mp) = vaddr;
+    mb_h->live_count++;
     
     safe_rwlock_unlock(&(mb_h->mem_lck));
 
-    res.vaddr = vaddr;
+    res.vaddr = vaddr;
+
+    if (hold) {
+        res.paddr = mp_to_map_b(mp);
+    }
+
+    return res;
+}
+
+// Find space for a piece of min_size bytes, and mark it as occupied.
+// The returned piece may be larger than min_size.
+// Returns NULL if there isn't enough space.
+//
+// NOTE: mem_lck must be write locked when calling this.
+static mem_piece *mb_carve_unsafe(mem_block *mb, uint64_t min_size) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    mem_piece *end = mb_h->bump;
+    mem_piece *big_free;
+    mem_free_piece_header *big_free_h = NULL;
+
+    // Holes are always filled before the bump region is used.
+    // (After a full shift there are none, so we go right to bumping)
+    if (mb_h->free_count > 0) {
+        big_free_h = mb_find_fit_unsafe(mb, min_size);
+    }
+
+    if (!big_free_h) {
+        uint64_t bump_size = mb_bump_size_unsafe(mb);
+
+        if (bump_size < min_size) {
+            return NULL;
+        }
+
+        // A released block is all bump region. The pages we touch 
+        // now will be brought back.
+        mb_h->released = 0;
+
+        // Never leave behind a bump region too small to malloc from.
+        if (bump_size - min_size < MP_MIN_SIZE) {
+            min_size = bump_size;
+        }
+
+        big_free = end;
+        mb_h->bump = (mem_piece *)((uint8_t *)big_free + min_size);
+
+        // The bump region only ever follows an occupied piece.
+        mp_init(big_free, min_size, 1, 1);
+
+        return big_free;
+    }
+
+    big_free = mp_b_to_mp(big_free_h);
+    uint64_t big_free_size = mp_size(big_free);
+
+    // As we must have enough space, we remove our free piece
+    // from its size free list.
+    mb_remove_from_size_unsafe(mb, big_free_h);
+
+    uint64_t cut_size = big_free_size - min_size;
+
+    // Here we check to see if we should divide our big free block.
+    // This is only done when there are enough remaining bytes 
+    // to malloc at least once. 
+    if (cut_size < MP_MIN_SIZE) {
+        // Here there will be no division.
+        // Simply remove big free from corresponding free
+        // lists.             
+
+        mp_init(big_free, big_free_size, 1, 1);
+
+        mem_piece *next = mp_next(big_free);
+
+        if (next < end) {
+            mp_set_prev_alloc(next, 1);
+        }
+    } else {
+        // Here we cut!
+        mem_piece *new_free = (mem_piece *)((uint8_t *)big_free + min_size);
+        mp_init(new_free, cut_size, 0, 1);
+
+        // Add new cut to size free list.
+        mb_add_to_size_unsafe(mb, new_free);
+
+        // Finally, init our new allocated block.
+        mp_init(big_free, min_size, 1, 1);
+    }
+
+    return big_free;
+}
+
+// Mark the first free cell of a slab block as occupied, and return its 
+// index. num_cells if the block is full.
+//
+// NOTE: mem_lck must be write locked when calling this.
+static uint64_t mb_slab_take_unsafe(mem_block *mb) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    if (mb_h->live_count == mb_h->num_cells) {
+        return mb_h->num_cells;
+    }
+
+    // There must be a free cell at or after the hint.
+    uint64_t w = mb_h->cell_hint;
+
+    while (mb_h->cell_bits[w] == ~0ULL) {
+        w++;
+    }
+
+    uint64_t i = (w * 64) + (uint64_t)__builtin_ctzll(~(mb_h->cell_bits[w]));
+
+    mb_h->cell_bits[w] |= 1ULL << (i % 64);
+    mb_h->cell_hint = w;
+
+    mb_h->free_bytes -= mb_h->cell_size;
+    mb_h->live_count++;
+
+    // See mb_carve_unsafe.
+    mb_h->released = 0;
+
+    return i;
+}
+
+// Take the first free cell of a slab block.
+static malloc_res mb_slab_malloc_p(mem_block *mb, uint64_t min_bytes, 
+        uint8_t hold) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    malloc_res res = {
+        .paddr = NULL,
+        .vaddr = NULL_VADDR,
+    };
+
+    if (round_num_bytes(min_bytes) > mb_cell_bytes(mb)) {
+        return res;
+    }
+
+    safe_wrlock(&(mb_h->mem_lck));
+
+    uint64_t i = mb_slab_take_unsafe(mb);
+
+    if (i == mb_h->num_cells) {
+        safe_rwlock_unlock(&(mb_h->mem_lck));
+
+        return res;
+    }
+
+    addr_book_vaddr vaddr = adb_put_p(mb_h->adb, mb_cell_body(mb, i), hold);
+    *(mem_alloc_piece_header *)mb_cell(mb, i) = vaddr;
+
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+
+    res.vaddr = vaddr;
+
+    if (hold) {
+        res.paddr = mb_cell_body(mb, i);
+    }
+
+    return res;
+}
+
+malloc_res mb_malloc_p(mem_block *mb, uint64_t min_bytes, uint8_t hold) {
+    malloc_res res = {
+        .paddr = NULL,
+        .vaddr = NULL_VADDR,
+    };
+
+    // Never allocate an empty piece!
+    if (min_bytes == 0) {
+        return res;
+    } 
+
+    if (mb_is_slab(mb)) {
+        return mb_slab_malloc_p(mb, min_bytes, hold);
+    }
+
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    // Must account for a lot for headers and vaddr.
+    uint64_t min_size = pad_num_bytes(min_bytes);
+
+    safe_wrlock(&(mb_h->mem_lck)); 
+
+    mem_piece *mp = mb_carve_unsafe(mb, min_size);
+
+    if (!mp) {
+        safe_rwlock_unlock(&(mb_h->mem_lck));
+
+        return res;
+    }
+
+    return mb_malloc_finish_unsafe(mb, mp, hold);
+}
+
+uint64_t mb_piece_bytes(mem_block *mb, const void *paddr) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    if (mb_is_slab(mb)) {
+        return mb_cell_bytes(mb);
+    }
+
+    safe_rdlock(&(mb_h->mem_lck));
+    uint64_t bytes = mp_size(map_b_to_mp((void *)paddr)) - MAP_PADDING;
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+
+    return bytes;
+}
+
+// Shrink the occupied piece mp to new_size, giving the rest back to the
+// block. Nothing is done when the rest would be too small to be a piece.
+static void mb_shrink_unsafe(mem_block *mb, mem_piece *mp, uint64_t new_size) {
+    uint64_t size = mp_size(mp);
+
+    if (size - new_size < MP_MIN_SIZE) {
+        return;
+    }
+
+    mp_init(mp, new_size, 1, mp_prev_alloc(mp));
+
+    // The rest is made into an occupied piece, then freed like any other.
+    mem_piece *rest = mp_next(mp);
+    mp_init(rest, size - new_size, 1, 1);
+    mb_coalesce_unsafe(mb, rest);
+}
+
+// Grow the occupied piece mp to at least new_size using the free space
+// right after it. Returns 1 if there isn't enough.
+static uint8_t mb_grow_unsafe(mem_block *mb, mem_piece *mp, uint64_t new_size) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    uint64_t size = mp_size(mp);
+    uint64_t need = new_size - size;
+    mem_piece *next = mp_next(mp);
+
+    if (next == mb_h->bump) {
+        uint64_t bump_size = mb_bump_size_unsafe(mb);
+
+        if (bump_size < need) {
+            return 1;
+        }
+
+        // Same as in mb_carve_unsafe, never leave a tiny bump region.
+        if (bump_size - need < MP_MIN_SIZE) {
+            new_size = size + bump_size;
+        }
+
+        mb_h->released = 0;
+
+        mp_init(mp, new_size, 1, mp_prev_alloc(mp));
+        mb_h->bump = mp_next(mp);
+
+        return 0;
+    }
+
+    if (mp_alloc(next) || mp_size(next) < need) {
+        return 1;
+    }
+
+    uint64_t next_size = mp_size(next);
+    mb_remove_from_size_unsafe(mb, (mem_free_piece_header *)mp_body(next));
+
+    if (next_size - need < MP_MIN_SIZE) {
+        // Take all of next.
+        mp_init(mp, size + next_size, 1, mp_prev_alloc(mp));
+
+        // Free pieces never touch the bump region, so there must be a
+        // piece after next.
+        mp_set_prev_alloc(mp_next(mp), 1);
+    } else {
+        mp_init(mp, new_size, 1, mp_prev_alloc(mp));
+
+        mem_piece *rest = mp_next(mp);
+        mp_init(rest, next_size - need, 0, 1);
+        mb_add_to_size_unsafe(mb, rest);
+    }
+
+    return 0;
+}
+
+uint8_t mb_realloc(mem_block *mb, void *paddr, uint64_t min_bytes) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    if (min_bytes == 0 || !mb_contains(mb, paddr)) {
+        return 1;
+    }
+
+    // A cell can't change size, but it may be large enough already.
+    if (mb_is_slab(mb)) {
+        return round_num_bytes(min_bytes) > mb_cell_bytes(mb);
+    }
+
+    uint64_t new_size = pad_num_bytes(min_bytes);
+    uint8_t res = 0;
+
+    safe_wrlock(&(mb_h->mem_lck));
+
+    mem_piece *mp = map_b_to_mp(paddr);
+
+    if (mp_buffered(mp)) {
+        // Whatever is after a buffer piece is owned by the buffer.
+        // (See Buffer Notes below)
+        res = new_size > mp_size(mp);
+    } else if (new_size <= mp_size(mp)) {
+        mb_shrink_unsafe(mb, mp, new_size);
+    } else {
+        res = mb_grow_unsafe(mb, mp, new_size);
+    }
+
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+
+    return res;
+}
+
+void *mb_malloc_into(mem_block *mb, addr_book_vaddr vaddr, 
+        uint64_t min_bytes, uint64_t copy_bytes) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    if (min_bytes == 0) {
+        return NULL;
+    }
+
+    void *paddr;
+
+    safe_wrlock(&(mb_h->mem_lck));
+
+    if (mb_is_slab(mb)) {
+        uint64_t i = round_num_bytes(min_bytes) > mb_cell_bytes(mb) 
+            ? mb_h->num_cells : mb_slab_take_unsafe(mb);
+
+        if (i == mb_h->num_cells) {
+            safe_rwlock_unlock(&(mb_h->mem_lck));
+            return NULL;
+        }
+
+        paddr = mb_cell_body(mb, i);
+    } else {
+        mem_piece *mp = mb_carve_unsafe(mb, pad_num_bytes(min_bytes));
+
+        if (!mp) {
+            safe_rwlock_unlock(&(mb_h->mem_lck));
+            return NULL;
+        }
+
+        mb_h->live_count++;
+        paddr = mp_to_map_b(mp);
+    }
+
+    // The caller holds the lock on vaddr, so this copies from the old 
+    // piece without it moving under us. vaddr is also written in front 
+    // of paddr.
+    adb_move_p(0, mb_h->adb, vaddr, paddr, copy_bytes, 1);
+
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+
+    return paddr;
+}
+
+void mb_free_moved(mem_block *mb, void *paddr) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    safe_wrlock(&(mb_h->mem_lck));
+    mb_free_paddr_unsafe(mb, paddr);
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+}
+
+// Buffer Notes:
+//
+// A reserved buffer is a single occupied piece of the block. In place of
+// a vaddr, it holds NULL_VADDR, this is how the block knows to skip it.
+// The first MP_MIN_SIZE bytes of the buffer belong to the block. The 
+// rest is filled with pieces by the buffer's thread.
+//
+// Pieces inside a buffer are normal occupied pieces, except they are 
+// tagged with MP_BUFFERED_MASK. The block never reads past the header
+// of such a piece, as the piece after it may not exist yet. Freeing 
+// one only overwrites its vaddr with NULL_VADDR, its tag is left as is.
+//
+// On flush, every piece of the buffer is made into a normal piece, and
+// the first MP_MIN_SIZE bytes, the freed pieces, and the unused end of 
+// the buffer are all freed into the block.
+
+uint8_t mb_buffer_reserve(mem_block *mb, uint64_t min_bytes, mb_buffer *buf) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    // The space after the last piece of a full buffer must be able to 
+    // become a free piece. (See mb_buffer_flush)
+    uint64_t min_size = round_num_bytes(min_bytes);
+    min_size = (min_size < MP_MIN_SIZE ? MP_MIN_SIZE : min_size) + MP_MIN_SIZE;
+
+    safe_wrlock(&(mb_h->mem_lck)); 
+
+    mem_piece *mp = mb_carve_unsafe(mb, min_size);
+
+    if (!mp) {
+        safe_rwlock_unlock(&(mb_h->mem_lck));
+
+        return 1;
+    }
+
+    *(mem_alloc_piece_header *)mp_body(mp) = NULL_VADDR;
+    mb_h->buffers++;
+
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+
+    buf->mb = mb;
+    buf->start = (uint8_t *)mp;
+    buf->top = (uint8_t *)mp + MP_MIN_SIZE;
+    buf->end = (uint8_t *)mp + mp_size(mp);
+
+    return 0;
+}
+
+malloc_res mb_buffer_malloc_p(mb_buffer *buf, uint64_t min_bytes, 
+        uint8_t hold) {
+    malloc_res res = {
+        .paddr = NULL,
+        .vaddr = NULL_VADDR,
+    };
+
+    if (min_bytes == 0) {
+        return res;
+    }
+
+    uint64_t min_size = pad_num_bytes(min_bytes);
+    uint64_t left = (uint64_t)(buf->end - buf->top);
+
+    if (left < min_size) {
+        return res;
+    }
+
+    // Same as with the bump region, never leave less than a piece behind.
+    if (left - min_size < MP_MIN_SIZE) {
+        min_size = left;
+    }
+
+    mem_piece *mp = (mem_piece *)(buf->top);
+    buf->top += min_size;
+
+    // No one else can see this piece until its vaddr is given out.
+    *(uint64_t *)mp = min_size | MP_BUFFERED_MASK | MP_PREV_ALLOC_MASK | 
+        MP_ALLOC_MASK;
+
+    mem_block_header *mb_h = (mem_block_header *)(buf->mb);
+
+    addr_book_vaddr vaddr = adb_put_p(mb_h->adb, mp_to_map_b(mp), hold);
+    *(mem_alloc_piece_header *)mp_body(mp) = vaddr;
+
+    res.vaddr = vaddr;
+
+    if (hold) {
+        res.paddr = mp_to_map_b(mp);
+    }
+
+    return res;
+}
+
+void mb_buffer_flush(mb_buffer *buf) {
+    if (!(buf->mb)) {
+        return;
+    }
+
+    mem_block_header *mb_h = (mem_block_header *)(buf->mb);
+
+    mem_piece *buffer = (mem_piece *)(buf->start);
+    mem_piece *top = (mem_piece *)(buf->top);
+    mem_piece *end = (mem_piece *)(buf->end);
+
+    safe_wrlock(&(mb_h->mem_lck));
+
+    // First, split the buffer into normal occupied pieces. Pieces which
+    // are to be freed are given NULL_VADDR.
+    mp_init(buffer, MP_MIN_SIZE, 1, mp_prev_alloc(buffer));
+
+    mem_piece *iter;
+    for (iter = mp_next(buffer); iter < top; iter = mp_next(iter)) {
+        mp_init(iter, mp_size(iter), 1, 1);
+    }
+
+    if (top < end) {
+        mp_init(top, (uint64_t)((uint8_t *)end - (uint8_t *)top), 1, 1);
+        *(mem_alloc_piece_header *)mp_body(top) = NULL_VADDR;
+    }
+
+    // Now free them in order. Each piece only ever coalesces with pieces
+    // before it, so the next piece is always found from the original.
+    mem_piece *next;
+    for (iter = buffer; iter < end; iter = next) {
+        next = mp_next(iter);
+
+        if (mp_is_buffer(iter)) {
+            mb_coalesce_unsafe(buf->mb, iter);
+        } else {
+            mb_h->live_count++;
+        }
+    }
+
+    mb_h->buffers--;
+
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+
+    buf->mb = NULL;
+    buf->start = NULL;
+    buf->top = NULL;
+    buf->end = NULL;
+}
 
-    if (hold) {
-        res.paddr = mp_to_map_b(big_free);
+// Try to write lock an occupied piece so that it can be moved.
+// Returns 1 on success, in which case the caller must unlock the
+// piece's vaddr once done.
+//
+// Locked, pinned and buffer pieces can never be moved.
+static uint8_t mb_try_lock_movable_unsafe(mem_block *mb, mem_piece *mp) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    if (mp_is_buffer(mp)) {
+        return 0;
     }
 
-    return res;
+    addr_book_vaddr vaddr = *(mem_alloc_piece_header *)mp_body(mp);
+
+    // Remember try get lock returns NULL if the lock is not
+    // acquired.
+    if (!adb_try_get_write(mb_h->adb, vaddr)) {
+        return 0;
+    }
+
+    // Pinned pieces are skipped just like locked ones.
+    // (No one can pin while we hold the write lock)
+    if (adb_pinned(mb_h->adb, vaddr)) {
+        adb_unlock(mb_h->adb, vaddr);
+        return 0;
+    }
+
+    return 1;
 }
 
 mb_shift_res mb_try_shift(mem_block *mb) {
     mem_block_header *mb_h = (mem_block_header *)mb;
-    
-    mem_piece *start = (mem_piece *)(mb_h + 1);
-    mem_piece *end = (mem_piece *)((uint8_t *)start + mb_h->cap);
 
     safe_wrlock(&(mb_h->mem_lck));
 
+    mem_piece *end = mb_h->bump;
+
     // NOTE: we will traverse the free list once for a shiftable piece
     // with an unlocked write lock.
 
-    mem_free_piece_header *og_free_h = mb_h->size_free_list;
-
-    // The case where there are no free pieces.
-    if (!og_free_h) {
+    // The case where there are no free pieces. (i.e. all free space
+    // is already at the end of the block in the bump region)
+    if (mb_h->free_count == 0) {
         safe_rwlock_unlock(&(mb_h->mem_lck));
         return MB_NOT_NEEDED;
     }
 
-    // The case where there is only one free piece, but it 
-    // is already at the end of the block.
-    if (!(og_free_h->size_free_next) && mp_next(mp_b_to_mp(og_free_h)) >= end) {
-        safe_rwlock_unlock(&(mb_h->mem_lck));
-        return MB_NOT_NEEDED;
-    }
+    // Classes are visited from largest to smallest.
+    uint64_t c = mb_last_class_unsafe(mb);
+    mem_free_piece_header *og_free_h = mb_h->free_lists[c];
 
     // Otherwise, a shiftable piece must exist... let's find it.
 
@@ -567,23 +1702,22 @@ mb_shift_res mb_try_shift(mem_block *mb) {
         // First, check if next is a valid piece.
         // Second, check if next is allocated (indicating a shift is possible)
         // Lastly, try to acquire the write lock on next.
-        if (og_next < end && mp_alloc(og_next)) {
+        if (og_next < end && mp_alloc(og_next) && 
+                mb_try_lock_movable_unsafe(mb, og_next)) {
+            // i.e. we have found our shiftable piece and 
+            // locked on it.
             vaddr = *(mem_alloc_piece_header *)mp_body(og_next);
-
-            // Remember try get lock returns NULL if the lock is not
-            // acquired.
-            if (adb_try_get_write(mb_h->adb, vaddr)) {
-                // We make it in here if the lock is acquired.
-                // i.e. we have found our shiftable piece and 
-                // locked on it.
-
-                break;
-            }
+            break;
         }
 
         // Otherwise, next didn't work out... let's just keep moving
         // here...
         og_free_h = og_free_h->size_free_next;
+
+        // Move down to the next non-empty class when this one runs out.
+        while (!og_free_h && c > 0) {
+            og_free_h = mb_h->free_lists[--c];
+        }
     } 
 
     // This is means we made it all the way to the end of our free
@@ -605,10 +1739,6 @@ mb_shift_res mb_try_shift(mem_block *mb) {
     // Might need to use this.
     mem_piece *og_next_next = mp_next(og_next);
 
-    // May need to use these later as well.
-    mem_free_piece_header *og_free_h_next_h = og_free_h->size_free_next;
-    mem_free_piece_header *og_free_h_prev_h = og_free_h->size_free_prev;
-
     // Let's remove our og_free from the free list.
     mb_remove_from_size_unsafe(mb, og_free_h);
 
@@ -618,7 +1748,7 @@ mb_shift_res mb_try_shift(mem_block *mb) {
     adb_move_p(0, mb_h->adb, vaddr, new_paddr, og_next_size - MAP_PADDING, 1);
     adb_unlock(mb_h->adb, vaddr); // Done with our move, unlock.
 
-    mp_init(og_free, og_next_size, 1);
+    mp_init(og_free, og_next_size, 1, 1);
 
     // Now we move our allocated block into the og_free.
     // The original free pointers are no more.
@@ -633,54 +1763,543 @@ mb_shift_res mb_try_shift(mem_block *mb) {
         mb_remove_from_size_unsafe(mb, 
                 (mem_free_piece_header *)mp_body(og_next_next));
 
-        mp_init(new_free, og_free_size + og_next_next_size, 0);
-
+        mp_init(new_free, og_free_size + og_next_next_size, 0, 1);
         mb_add_to_size_unsafe(mb, new_free);
+    } else if (og_next_next == end) {
+        // Our shifted piece was the last one, the freed space joins
+        // the bump region.
+        mb_h->bump = new_free;
     } else {
-        mp_init(new_free, og_free_size, 0);
+        mp_init(new_free, og_free_size, 0, 1);
+        mp_set_prev_alloc(og_next_next, 0);
+        mb_add_to_size_unsafe(mb, new_free);
+    }
+
+    safe_rwlock_unlock(&(mb_h->mem_lck));
 
-        mem_free_piece_header *new_free_h = 
-            (mem_free_piece_header *)mp_body(new_free);
+    return MB_SHIFT_SUCCESS;
+}
+
+// Move the run of locked pieces [run, run_end) down to dest with a 
+// single memmove, then point each piece's cell at its new home and 
+// unlock it. Returns the end of the moved run.
+//
+// NOTE: dest <= run, and everything in [dest, run) must be free space.
+static mem_piece *mb_slide_run_unsafe(mem_block *mb, mem_piece *dest, 
+        mem_piece *run, mem_piece *run_end) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
 
-        new_free_h->size_free_prev = og_free_h_prev_h;
-        new_free_h->size_free_next = og_free_h_next_h;
+    uint64_t len = (uint64_t)((uint8_t *)run_end - (uint8_t *)run);
+    mem_piece *dest_end = (mem_piece *)((uint8_t *)dest + len);
 
-        if (og_free_h_prev_h) {
-            og_free_h_prev_h->size_free_next = new_free_h;
-        } else {
-            mb_h->size_free_list = new_free_h;
+    if (len == 0) {
+        return dest_end;
+    }
+
+    memmove(dest, run, len);
+
+    // Whatever precedes dest is occupied. (Or dest is the first piece)
+    mp_set_prev_alloc(dest, 1);
+
+    mem_piece *iter;
+    addr_book_vaddr vaddr;
+
+    for (iter = dest; iter < dest_end; iter = mp_next(iter)) {
+        vaddr = *(mem_alloc_piece_header *)mp_body(iter);
+
+        // The bytes have already been moved with the rest of the run,
+        // so only the cell's physical address is updated.
+        adb_move_p(0, mb_h->adb, vaddr, mp_to_map_b(iter), 0, 0);
+        adb_unlock(mb_h->adb, vaddr);
+    }
+
+    return dest_end;
+}
+
+mb_shift_res mb_try_full_shift(mem_block *mb) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    safe_wrlock(&(mb_h->mem_lck));
+
+    if (mb_h->free_count == 0) {
+        safe_rwlock_unlock(&(mb_h->mem_lck));
+        return MB_NOT_NEEDED;
+    }
+
+    mem_piece *end = mb_h->bump;
+
+    // Pieces are visited in address order.
+    //
+    // dest is where the next movable piece belongs.
+    // [run, iter) are the locked pieces waiting to be moved to dest.
+    mem_piece *iter = (mem_piece *)(mb_h + 1);
+    mem_piece *dest = iter;
+    mem_piece *run = iter;
+    mem_piece *next;
+
+    uint8_t busy = 0;
+
+    // Every free piece is absorbed by the slide, the only holes left
+    // are the ones we create in front of unmovable pieces.
+    mb_init_free_lists_unsafe(mb);
+
+    while (iter < end) {
+        next = mp_next(iter);
+
+        if (!mp_alloc(iter)) {
+            dest = mb_slide_run_unsafe(mb, dest, run, iter);
+            run = next;
+        } else if (dest == iter) {
+            // No free space has been seen yet, nothing to move.
+            dest = next;
+            run = next;
+        } else if (!mb_try_lock_movable_unsafe(mb, iter)) {
+            dest = mb_slide_run_unsafe(mb, dest, run, iter);
+
+            if (dest < iter) {
+                mp_init(dest, (uint64_t)((uint8_t *)iter - (uint8_t *)dest), 0, 1);
+                mb_add_to_size_unsafe(mb, dest);
+                mp_set_prev_alloc(iter, 0);
+
+                busy = 1;
+            }
+
+            dest = next;
+            run = next;
+        }
+
+        // Otherwise, iter was locked and joins the current run.
+
+        iter = next;
+    }
+
+    dest = mb_slide_run_unsafe(mb, dest, run, end);
+
+    // All space after the last occupied piece joins the bump region.
+    mb_h->bump = dest;
+
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+
+    return busy ? MB_BUSY : MB_SHIFT_SUCCESS;
+}
+
+uint64_t mb_evacuate(mem_block *src, mem_block *dest, uint8_t *full) {
+    mem_block_header *src_h = (mem_block_header *)src;
+    mem_block_header *dest_h = (mem_block_header *)dest;
+
+    // Cells and pieces can't be swapped for one another.
+    if (src == dest || mb_is_slab(src) || mb_is_slab(dest)) {
+        if (full) {
+            *full = 0;
+        }
+
+        return 0;
+    }
+
+    safe_wrlock(&(src_h->mem_lck));
+    safe_wrlock(&(dest_h->mem_lck));
+
+    uint64_t moved = 0;
+
+    if (full) {
+        *full = 0;
+    }
+
+    mem_piece *iter = (mem_piece *)(src_h + 1);
+    mem_piece *next;
+    mem_piece *dest_mp;
+
+    addr_book_vaddr vaddr;
+    uint64_t size;
+
+    // NOTE: src's bump pointer moves down when its last piece is 
+    // evacuated, so it must be reread every iteration.
+    while (iter < src_h->bump) {
+        next = mp_next(iter);
+
+        if (mp_alloc(iter) && mb_try_lock_movable_unsafe(src, iter)) {
+            vaddr = *(mem_alloc_piece_header *)mp_body(iter);
+            size = mp_size(iter);
+
+            dest_mp = mb_carve_unsafe(dest, size);
+
+            if (dest_mp) {
+                // Copy the piece's data and write its vaddr into the new 
+                // piece. Our lock on the cell is already held.
+                adb_move_p(0, src_h->adb, vaddr, mp_to_map_b(dest_mp), 
+                        size - MAP_PADDING, 1);
+                adb_unlock(src_h->adb, vaddr);
+
+                // The old piece is freed without touching its vaddr.
+                //
+                // NOTE: if next is free, it is absorbed here. Its tag is
+                // left as is though, so it is still safe to visit.
+                mb_coalesce_unsafe(src, iter);
+
+                src_h->live_count--;
+                dest_h->live_count++;
+
+                moved++;
+            } else {
+                adb_unlock(src_h->adb, vaddr);
+
+                if (full) {
+                    *full = 1;
+                }
+            }
+        }
+
+        iter = next;
+    }
+
+    safe_rwlock_unlock(&(dest_h->mem_lck));
+    safe_rwlock_unlock(&(src_h->mem_lck));
+
+    return moved;
+}
+
+void *mb_pin(mem_block *mb, addr_book_vaddr vaddr) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    void *paddr = adb_pin(mb_h->adb, vaddr);
+    __atomic_add_fetch(&(mb_h->pinned), 1, __ATOMIC_RELAXED);
+
+    return paddr;
+}
+
+void mb_unpin(mem_block *mb, addr_book_vaddr vaddr) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    adb_unpin(mb_h->adb, vaddr);
+    __atomic_sub_fetch(&(mb_h->pinned), 1, __ATOMIC_RELAXED);
+}
+
+uint64_t mb_pinned_count(mem_block *mb) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    return __atomic_load_n(&(mb_h->pinned), __ATOMIC_RELAXED);
+}
+
+// A normal block's capacity is always a multiple of 8, so a saved slab 
+// block is told apart by its first word having this bit set. That word 
+// is the cell size, followed by the number of cells, the bitmap, and the 
+// raw cells.
+static const uint64_t MB_SLAB_IMAGE_FLAG = 0x1;
+
+// Same idea, a large block is saved as a normal block with this bit set
+// in its capacity. (See new_mem_block_large)
+static const uint64_t MB_LARGE_IMAGE_FLAG = 0x2;
+
+static int mb_save_slab_unsafe(mem_block *mb, int fd) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    uint64_t head[2] = {
+        mb_h->cell_size | MB_SLAB_IMAGE_FLAG,
+        mb_h->num_cells,
+    };
+
+    int res = safe_write(fd, head, sizeof(head));
+
+    if (!res) {
+        res = safe_write(fd, mb_h->cell_bits, 
+                sizeof(uint64_t) * mb_cell_words(mb_h->num_cells));
+    }
+
+    if (!res) {
+        res = safe_write(fd, mb_h + 1, mb_h->cap);
+    }
+
+    return res;
+}
+
+int mb_save(mem_block *mb, int fd) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+    int res;
+
+    safe_rdlock(&(mb_h->mem_lck));
+
+    if (mb_is_slab(mb)) {
+        res = mb_save_slab_unsafe(mb, fd);
+        safe_rwlock_unlock(&(mb_h->mem_lck));
+
+        return res;
+    }
+
+    if (mb_h->buffers > 0) {
+        safe_rwlock_unlock(&(mb_h->mem_lck));
+        error_logf(1, 1, "mb_save: %" PRIu64 " unflushed buffers", 
+                mb_h->buffers);
+    }
+
+    uint64_t bump_size = mb_bump_size_unsafe(mb);
+    uint64_t cap = mb_h->cap | (mb_is_large(mb) ? MB_LARGE_IMAGE_FLAG : 0);
+
+    res = safe_write(fd, &cap, sizeof(uint64_t));
+
+    if (!res) {
+        res = safe_write(fd, mb_h + 1, mb_h->cap - bump_size);
+    }
+
+    // The bump region is written out as a normal free piece.
+    // The tags are written from here as it has none in memory.
+    if (!res && bump_size) {
+        uint64_t tag = bump_size | MP_PREV_ALLOC_MASK;
+
+        res = safe_write(fd, &tag, sizeof(uint64_t));
+
+        if (!res) {
+            res = safe_write(fd, mp_body(mb_h->bump), 
+                    bump_size - (2 * sizeof(uint64_t)));
         }
 
-        if (og_free_h_next_h) {
-            og_free_h_next_h->size_free_prev = new_free_h;
+        if (!res) {
+            res = safe_write(fd, &tag, sizeof(uint64_t));
         }
     }
 
     safe_rwlock_unlock(&(mb_h->mem_lck));
 
-    return MB_SHIFT_SUCCESS;
+    return res;
+}
+
+// Confirm the pieces of a loaded block tile the block exactly.
+static uint8_t mb_valid_structure_unsafe(mem_block *mb) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    mem_piece *start  = (mem_piece *)(mb_h + 1);
+    mem_piece *end = (mem_piece *)((uint8_t *)start + mb_h->cap);
+
+    mem_piece *iter = start;
+    uint64_t size;
+
+    // The first piece has no previous piece.
+    uint8_t prev_alloc = 1;
+
+    while (iter < end) {
+        size = mp_size(iter);
+
+        if (size < MP_MIN_SIZE || size > (uint64_t)((uint8_t *)end - (uint8_t *)iter)) {
+            return 0;
+        }
+
+        if (mp_prev_alloc(iter) != prev_alloc || mp_buffered(iter)) {
+            return 0;
+        }
+
+        prev_alloc = mp_alloc(iter);
+
+        // Footer must match header. (Free pieces only)
+        if (!prev_alloc && 
+                ((uint64_t *)((uint8_t *)iter + size))[-1] != *(uint64_t *)iter) {
+            return 0;
+        }
+
+        iter = mp_next(iter);
+    }
+
+    return 1;
+}
+
+// Free a block which failed to load. Its vaddrs are left as is, so the
+// address book it was loading into should be thrown away. (See mb_load)
+static void mb_load_abort(mem_block *mb) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    safe_rwlock_destroy(&(mb_h->mem_lck));
+
+    if (mb_is_slab(mb)) {
+        safe_free(mb_h->cell_bits);
+    }
+
+    if (mb_is_large(mb)) {
+        munmap(mb, mb_h->map_size);
+    } else {
+        safe_free(mb);
+    }
+}
+
+// The rest of a slab block image, cell_size has already been read.
+// (See MB_SLAB_IMAGE_FLAG)
+static mem_block *mb_load_slab(uint8_t chnl, addr_book *adb, int fd, 
+        uint64_t cell_size, mb_load_consumer c, void *ctx) {
+    uint64_t num_cells;
+    size_t left;
+
+    // The cells alone must fit in what is left of the file.
+    if (safe_read(fd, &num_cells, sizeof(uint64_t)) || num_cells == 0 || 
+            cell_size <= sizeof(mem_alloc_piece_header) || 
+            cell_size != round_num_bytes(cell_size) ||
+            safe_bytes_left(fd, &left) || num_cells > left / cell_size) {
+        return NULL;
+    }
+
+    mem_block *mb = new_mem_block_arr(chnl, adb, 
+            cell_size - sizeof(mem_alloc_piece_header), num_cells);
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    uint64_t words = mb_cell_words(num_cells);
+
+    // The bits past the last cell must match what new_mem_block_arr set.
+    uint64_t past_bits = mb_h->cell_bits[words - 1] & 
+        (num_cells % 64 ? ~0ULL << (num_cells % 64) : 0);
+
+    if (safe_read(fd, mb_h->cell_bits, sizeof(uint64_t) * words) ||
+            (mb_h->cell_bits[words - 1] & past_bits) != past_bits ||
+            safe_read(fd, mb_h + 1, mb_h->cap)) {
+        mb_load_abort(mb);
+        return NULL;
+    }
+
+    uint64_t i = mb_next_cell_unsafe(mb, 0);
+
+    for (; i < num_cells; i = mb_next_cell_unsafe(mb, i + 1)) {
+        addr_book_vaddr vaddr = *(mem_alloc_piece_header *)mb_cell(mb, i);
+
+        if (adb_restore(adb, vaddr, mb_cell_body(mb, i))) {
+            mb_load_abort(mb);
+            return NULL;
+        }
+
+        mb_h->live_count++;
+        mb_h->free_bytes -= cell_size;
+
+        if (c) {
+            c(mb, vaddr, mb_cell_body(mb, i), ctx);
+        }
+    }
+
+    return mb;
+}
+
+mem_block *mb_load(uint8_t chnl, addr_book *adb, int fd, 
+        mb_load_consumer c, void *ctx) {
+    uint64_t cap;
+    size_t left;
+
+    if (safe_read(fd, &cap, sizeof(uint64_t)) || safe_bytes_left(fd, &left)) {
+        return NULL;
+    }
+
+    if (cap & MB_SLAB_IMAGE_FLAG) {
+        return mb_load_slab(chnl, adb, fd, cap & ~MB_SLAB_IMAGE_FLAG, c, ctx);
+    }
+
+    uint8_t large = (cap & MB_LARGE_IMAGE_FLAG) ? 1 : 0;
+    cap &= ~MB_LARGE_IMAGE_FLAG;
+
+    if (cap < MP_MIN_SIZE || cap != round_num_bytes(cap) || cap > left) {
+        return NULL;
+    }
+
+    mem_block *mb;
+
+    if (large) {
+        mb = mb_map_large(adb, cap);
+    } else {
+        mb = safe_malloc(chnl, sizeof(mem_block_header) + cap);
+        mb_init_header(mb, adb, cap);
+    }
+
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    if (safe_read(fd, mb_h + 1, cap) || !mb_valid_structure_unsafe(mb)) {
+        mb_load_abort(mb);
+        return NULL;
+    }
+
+    mem_piece *start  = (mem_piece *)(mb_h + 1);
+    mem_piece *end = (mem_piece *)((uint8_t *)start + cap);
+
+    mb_h->bump = end;
+
+    // One pass over the pieces to fix up all physical addresses.
+    mem_piece *iter;
+    for (iter = start; iter < end; iter = mp_next(iter)) {
+        if (!mp_alloc(iter)) {
+            // A free piece at the very end becomes the bump region.
+            if (mp_next(iter) == end) {
+                mb_h->bump = iter;
+            } else {
+                mb_add_to_size_unsafe(mb, iter);
+            }
+
+            continue;
+        }
+
+        addr_book_vaddr vaddr = *(mem_alloc_piece_header *)mp_body(iter);
+
+        if (adb_restore(adb, vaddr, mp_to_map_b(iter))) {
+            mb_load_abort(mb);
+            return NULL;
+        }
+
+        mb_h->live_count++;
+
+        if (c) {
+            c(mb, vaddr, mp_to_map_b(iter), ctx);
+        }
+    }
+
+    return mb;
 }
 
 uint64_t mb_count(mem_block *mb) {
     mem_block_header *mb_h = (mem_block_header *)mb;
 
-    uint64_t count = 0;
+    safe_rdlock(&(mb_h->mem_lck));
+    uint64_t count = mb_h->live_count;
+    safe_rwlock_unlock(&(mb_h->mem_lck));
+
+    return count;
+}
+
+void mb_foreach_vaddr(mem_block *mb, mb_vaddr_consumer c, void *ctx) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
 
     safe_rdlock(&(mb_h->mem_lck));
 
+    if (mb_is_slab(mb)) {
+        uint64_t i = mb_next_cell_unsafe(mb, 0);
+
+        for (; i < mb_h->num_cells; i = mb_next_cell_unsafe(mb, i + 1)) {
+            c(*(mem_alloc_piece_header *)mb_cell(mb, i), ctx);
+        }
+
+        safe_rwlock_unlock(&(mb_h->mem_lck));
+
+        return;
+    }
+
     mem_piece *start  = (mem_piece *)(mb_h + 1);
-    mem_piece *end = (mem_piece *)((uint8_t *)start + mb_h->cap);
+    mem_piece *end = mb_h->bump;
 
     mem_piece *iter = start;
     for (; iter < end; iter = mp_next(iter)) {
-        if (mp_alloc(iter)) {
-            count++;
+        if (mp_alloc(iter) && !mp_is_buffer(iter)) {
+            c(*(mem_alloc_piece_header *)mp_body(iter), ctx);
         }
     }
 
     safe_rwlock_unlock(&(mb_h->mem_lck));
+}
 
-    return count;
+// Only occupied cells are printed.
+static void mb_print_slab_unsafe(mem_block *mb) {
+    mem_block_header *mb_h = (mem_block_header *)mb;
+
+    safe_printf("Slab : %" PRIu64 " Cells : Size %" PRIu64 " : %" PRIu64 
+            " Occupied\n", mb_h->num_cells, mb_h->cell_size, mb_h->live_count);
+
+    uint64_t i = mb_next_cell_unsafe(mb, 0);
+
+    for (; i < mb_h->num_cells; i = mb_next_cell_unsafe(mb, i + 1)) {
+        mem_alloc_piece_header *vaddr = 
+            (mem_alloc_piece_header *)mb_cell(mb, i);
+
+        safe_printf("%" PRIu64 " : %p : Allocated : Vaddr (%" PRIu64 
+                ", %" PRIu64 ")\n", i, mb_cell(mb, i), 
+                (uint64_t)vaddr->table_index, (uint64_t)vaddr->cell_index);
+    }
 }
 
 void mb_print(mem_block *mb) {
@@ -688,8 +2307,15 @@ void mb_print(mem_block *mb) {
 
     safe_rdlock(&(mb_h->mem_lck));
 
+    if (mb_is_slab(mb)) {
+        mb_print_slab_unsafe(mb);
+        safe_rwlock_unlock(&(mb_h->mem_lck));
+
+        return;
+    }
+
     mem_piece *start  = (mem_piece *)(mb_h + 1);
-    mem_piece *end = (mem_piece *)((uint8_t *)start + mb_h->cap);
+    mem_piece *end = mb_h->bump;
 
     uint64_t piece_num = 0;
     mem_piece *iter = start;
@@ -698,12 +2324,14 @@ void mb_print(mem_block *mb) {
         safe_printf("%" PRIu64 " : %p : Size %" PRIu64 " : ", 
                 piece_num, iter, mp_size(iter)); 
 
-        if (mp_alloc(iter)) {
+        if (mp_alloc(iter) && mp_is_buffer(iter)) {
+            safe_printf("Buffer\n");
+        } else if (mp_alloc(iter)) {
             mem_alloc_piece_header *vaddr = 
                 (mem_alloc_piece_header *)mp_body(iter);
 
             safe_printf("Allocated : Vaddr (%" PRIu64  ", %" PRIu64 ")\n",
-                    vaddr->table_index, vaddr->cell_index);
+                    (uint64_t)vaddr->table_index, (uint64_t)vaddr->cell_index);
         } else {
             safe_printf("Free\n");
 
@@ -723,6 +2351,9 @@ void mb_print(mem_block *mb) {
         iter = mp_next(iter);
     }
 
+    safe_printf("%" PRIu64 " : %p : Size %" PRIu64 " : Bump\n", 
+            piece_num, end, mb_bump_size_unsafe(mb)); 
+
     safe_rwlock_unlock(&(mb_h->mem_lck));
 }
 
@@ -8,9 +8,31 @@ typedef struct {} mem_block;
 
 mem_block *new_mem_block(uint8_t chnl, addr_book *adb, uint64_t min_bytes);
 
+// A large block. Its memory is mapped straight from the OS instead of
+// coming from safe_malloc, and is unmapped by delete_mem_block. 
+// It is meant to hold a single piece of at least min_bytes, so nothing 
+// is ever shifted in it. (All calls still work on it as usual though)
+mem_block *new_mem_block_large(addr_book *adb, uint64_t min_bytes);
+
+// Whether or not the block was made by new_mem_block_large.
+uint8_t mb_is_large(mem_block *mb);
+
+// A slab block. It holds exactly min_cells pieces of up to cell_size 
+// bytes each. Pieces of a slab block have no boundary tags, just their
+// vaddr, and whether or not a cell is used is kept in a bitmap. 
+// So, malloc and free never search or coalesce anything.
+//
+// All calls work on slab blocks as usual, except:
+// - A malloc larger than the cell size always fails.
+// - A slab block never needs to be shifted, and can't hold buffers.
+// - mb_evacuate never moves pieces into or out of a slab block.
 mem_block *new_mem_block_arr(uint8_t chnl, addr_book *adb, 
         uint64_t cell_size, uint64_t min_cells);
 
+// Largest malloc possible for each cell of a slab block. 
+// 0 if the block is not a slab block.
+uint64_t mb_cell_bytes(mem_block *mb);
+
 // NOTE: this will also free all vaddrs in this block's corresponding 
 // address book.
 // 
@@ -22,6 +44,65 @@ void delete_mem_block(mem_block *mb);
 // for the given memory block at the given time.
 uint64_t mb_free_space(mem_block *mb);
 
+// A lower bound of mb_free_space which never walks a free list.
+// It is never more than about 20% below mb_free_space.
+uint64_t mb_free_space_bound(mem_block *mb);
+
+// Percentage of the block's free bytes which are outside of its largest
+// free piece. (0 to 100) 0 means all free space is in one piece, higher
+// means a shift would likely make more room.
+//
+// Free bytes are counted as pieces come and go, so this never walks the 
+// block. The largest piece is estimated the same way as in
+// mb_free_space_bound, so this can be a bit high.
+uint64_t mb_fragmentation(mem_block *mb);
+
+// Total number of bytes in the block, and the number of those bytes 
+// taken up by occupied pieces. (Headers included)
+uint64_t mb_capacity(mem_block *mb);
+uint64_t mb_used_space(mem_block *mb);
+
+// A snapshot of the state of one or more blocks.
+typedef struct {
+    uint64_t blocks;
+
+    // Number of occupied pieces. (Same as mb_count)
+    uint64_t live_count;
+
+    // Bytes taken up by occupied pieces, and bytes which are not. 
+    // (Headers included, so these add up to the capacity)
+    uint64_t live_bytes;
+    uint64_t free_bytes;
+
+    // A lower bound of the largest malloc which would succeed.
+    // (See mb_free_space_bound)
+    uint64_t max_free;
+
+    // Bytes given back to the OS. (See mb_release) These are counted
+    // in free_bytes too.
+    uint64_t released_bytes;
+} mem_stats;
+
+// All stats are kept up to date as the block changes, so this never
+// walks the block.
+mem_stats mb_get_stats(mem_block *mb);
+
+// Whether or not paddr points into the block.
+uint8_t mb_contains(mem_block *mb, const void *paddr);
+
+// Whether or not the block holds no pieces at all.
+uint8_t mb_is_empty(mem_block *mb);
+
+// Give the pages of an empty block back to the OS. The block stays 
+// valid, its pages are just brought back once it is malloc'd into.
+//
+// Returns the number of bytes released. This is 0 if the block isn't
+// empty or has already been released.
+uint64_t mb_release(mem_block *mb);
+
+// Number of bytes currently released. (0 once the block is used again)
+uint64_t mb_released_bytes(mem_block *mb);
+
 typedef struct {
     void *paddr;
     addr_book_vaddr vaddr;
@@ -55,8 +136,84 @@ static inline malloc_res mb_malloc_and_hold(mem_block *mb,
     return mb_malloc_p(mb, min_bytes, 1);
 }
 
+// NOTE: vaddr must live in mb, otherwise an exit occurs.
 void mb_free(mem_block *mb, addr_book_vaddr vaddr);
 
+// Like mb_free, however nothing is freed if vaddr does not live in mb.
+// This is for when vaddr may have been evacuated out of mb after mb
+// was looked up. (See mb_evacuate)
+//
+// Returns 0 if the piece was freed, 1 otherwise.
+uint8_t mb_free_if_owner(mem_block *mb, addr_book_vaddr vaddr);
+
+// Resizing.
+//
+// NOTE: For all the calls below, the caller must hold the write lock of 
+// the piece's vaddr.
+
+// Number of bytes which can be used in the piece at paddr. 
+// This can be more than what was asked for when it was malloc'd.
+uint64_t mb_piece_bytes(mem_block *mb, const void *paddr);
+
+// Resize the piece at paddr to hold at least min_bytes, without moving it.
+// A piece grows into the free piece or bump region right after it. 
+// A shrunk piece gives its tail back to the block.
+//
+// Returns 0 on success, 1 if the piece is not in mb or can't be
+// resized in place. (Cells of a slab block never change size)
+uint8_t mb_realloc(mem_block *mb, void *paddr, uint64_t min_bytes);
+
+// Malloc a new piece of at least min_bytes for an existing vaddr. 
+// The first copy_bytes of the vaddr's current piece are copied over,
+// and the vaddr is moved to the new piece. 
+// The old piece is NOT freed. (See mb_free_moved)
+//
+// Returns the new piece's paddr, NULL if there isn't enough space.
+void *mb_malloc_into(mem_block *mb, addr_book_vaddr vaddr, 
+        uint64_t min_bytes, uint64_t copy_bytes);
+
+// Free the piece at paddr after its vaddr was moved out of it.
+// (See mb_malloc_into)
+void mb_free_moved(mem_block *mb, void *paddr);
+
+// Allocation buffers.
+//
+// A buffer is a chunk of a block reserved by a single thread. Pieces
+// malloc'd from a buffer are placed without ever acquiring mem_lck, 
+// only the address book is used. The buffer's unused space is given
+// back to the block by mb_buffer_flush.
+//
+// Until its buffer is flushed, a piece malloc'd from a buffer is never 
+// shifted and is not seen by mb_count or mb_foreach_vaddr. It can be 
+// freed as usual, however its space is only reclaimed by the flush.
+//
+// NOTE: A buffer should only be used by one thread at a time.
+// Every buffer of a block must be flushed before the block is saved
+// or deleted. (Otherwise an exit occurs)
+typedef struct {
+    // NULL when the buffer is not reserved.
+    mem_block *mb;
+
+    uint8_t *start;
+
+    // Next free byte of the buffer and the end of the buffer.
+    uint8_t *top;
+    uint8_t *end;
+} mb_buffer;
+
+// Reserve a buffer of at least min_bytes from the block.
+// Returns 0 on success, 1 if the block didn't have space.
+uint8_t mb_buffer_reserve(mem_block *mb, uint64_t min_bytes, mb_buffer *buf);
+
+// Returns NULL_VADDR if the buffer doesn't have enough space left.
+// (See mb_malloc_p for hold)
+malloc_res mb_buffer_malloc_p(mb_buffer *buf, uint64_t min_bytes, 
+        uint8_t hold);
+
+// Give the unused space of the buffer back to its block.
+// After this call, buf is empty, but can be reserved again.
+void mb_buffer_flush(mb_buffer *buf);
+
 typedef enum {
     // This is returned when a shift is executed 
     // successfully on a single piece.
@@ -85,14 +242,88 @@ typedef enum {
 // no unlocked pieces to shift. 
 mb_shift_res mb_try_shift(mem_block *mb);
 
-// Shift while there are unlocked blocks to shift.
-static inline void mb_try_full_shift(mem_block *mb) {
-    while (mb_try_shift(mb) == MB_SHIFT_SUCCESS);
-}
+// Slide every unlocked piece towards the beginning of the block in
+// a single pass. Runs of adjacent pieces are moved with one memmove.
+//
+// Locked, pinned and buffer pieces stay where they are, the free space
+// before each of them is left as a hole. In this case MB_BUSY is 
+// returned. Otherwise, all free space ends up at the end of the block.
+mb_shift_res mb_try_full_shift(mem_block *mb);
+
+// Evacuation.
+//
+// Move every unlocked piece of src which fits into dest. A moved piece
+// keeps its vaddr, only its physical address changes. Locked, pinned 
+// and buffer pieces stay in src. (Just like shifting)
+//
+// Returns the number of pieces moved. (Always 0 if either block is a 
+// slab block) If full is given, *full is set to 1 if an unlocked piece 
+// of src didn't fit in dest, 0 otherwise.
+//
+// NOTE: Both blocks are locked at once. Never call mb_evacuate in 
+// parallel with another mb_evacuate, as this could deadlock.
+uint64_t mb_evacuate(mem_block *src, mem_block *dest, uint8_t *full);
+
+// Pinning. (See adt_pin)
+//
+// A pinned piece is never moved by mb_try_shift. Pinned pieces are
+// treated like locked pieces, they are skipped during a shift.
+//
+// mb_pin returns the same physical address as adb_get_read would.
+// It stays valid until the matching mb_unpin.
+//
+// NOTE: Freeing a pinned piece results in an exit.
+void *mb_pin(mem_block *mb, addr_book_vaddr vaddr);
+void mb_unpin(mem_block *mb, addr_book_vaddr vaddr);
+
+// Number of pins held on pieces in this block.
+uint64_t mb_pinned_count(mem_block *mb);
+
+// Image calls.
+//
+// A memory block is saved as its capacity followed by its raw bytes.
+// Physical pointers stored inside the block (free list links) are
+// discarded and rebuilt on load. Virtual addresses are kept as is, thus
+// a loaded block must be given an address book which has not yet
+// used any of the block's virtual addresses. (See adb_restore)
+//
+// NOTE: These calls should never be called in parallel with any
+// other call to the given memory block.
+
+// Returns 0 on success, -1 on error.
+int mb_save(mem_block *mb, int fd);
+
+// Consumer called on every allocated piece of a block which was just
+// loaded. paddr is the same physical address stored in the address book.
+typedef void (*mb_load_consumer)(mem_block *mb, addr_book_vaddr v,
+        void *paddr, void *ctx);
+
+// Returns NULL if the block could not be read or if the data read was
+// not a valid memory block. c can be NULL.
+//
+// fd must be a regular file, sizes read from it are checked against
+// the number of bytes left in the file before anything is allocated.
+//
+// NOTE: On failure, some of the block's vaddrs may already be restored
+// in adb, so adb should be discarded.
+//
+// NOTE: adb_restore_finish must be called on adb after all blocks 
+// have been loaded.
+mem_block *mb_load(uint8_t chnl, addr_book *adb, int fd, 
+        mb_load_consumer c, void *ctx);
 
 // Number of allocated pieces in the memory block.
+// Pieces in buffers are only counted once their buffer is flushed.
 uint64_t mb_count(mem_block *mb);
 
+typedef void (*mb_vaddr_consumer)(addr_book_vaddr v, void *ctx);
+
+// Call c on the virtual address of every allocated piece in the block.
+//
+// NOTE: The block is read locked while c runs, so c should never call
+// into the same block or acquire the lock of any of its pieces.
+void mb_foreach_vaddr(mem_block *mb, mb_vaddr_consumer c, void *ctx);
+
 // This command will safely print the structure of the 
 // memory block in an easy to read way.
 // Mainly for easy debugging.
@@ -8,8 +8,85 @@
 #include "../core_src/io.h"
 
 #include "../util_src/data.h"
+#include "../util_src/thread.h"
 
 #include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Blocks are bucketed by how much they can hold. A block sits in bucket b 
+// when its mb_free_space_bound is in [1 << b, 1 << (b + 1)). Full blocks
+// and region blocks sit in no bucket.
+#define MS_NUM_BUCKETS 64
+#define MS_NO_BUCKET MS_NUM_BUCKETS
+
+// Threads are hashed onto one of MS_NUM_HOMES home slots. 
+// (See ms_home_slot)
+#define MS_HOME_BITS 4
+#define MS_NUM_HOMES (1 << MS_HOME_BITS)
+
+// Small mallocs are served by slab blocks. (See new_mem_block_arr)
+// Slab class c holds cells of (c + 1) * 8 bytes, so every malloc of at
+// most MS_SLAB_MAX_BYTES has a class.
+#define MS_NUM_SLAB_CLASSES 8
+#define MS_SLAB_MAX_BYTES (MS_NUM_SLAB_CLASSES * 8)
+#define MS_NO_SLAB MS_NUM_SLAB_CLASSES
+
+// Cells of the first slab of each class. A space may only ever use a
+// few of its classes, and only lightly, so a class starts out small. 
+// Every new slab of a class then gets twice as many cells as the last, 
+// up to about a default block's worth. (See ms_slab_place)
+#define MS_SLAB_FIRST_CELLS 32
+
+// Mallocs larger than both the space's default block size and this get
+// a large block of their own. (See new_mem_block_large) Smaller ones 
+// would waste most of a page.
+#define MS_LARGE_MIN_BYTES (1ULL << 12)
+
+// Most idle large blocks kept around for reuse. Past this, the oldest
+// idle block is doomed. (See ms_trim_idle_large)
+#define MS_IDLE_LARGE_MAX 4
+
+typedef struct ms_mb_entry_struct ms_mb_entry;
+
+// What the space knows about each of its blocks.
+struct ms_mb_entry_struct {
+    mem_block * const mb;
+
+    // Region blocks are never malloc'd into by the space.
+    const uint8_t region;
+
+    // Slab class of the block. MS_NO_SLAB if it isn't a slab block.
+    const uint64_t slab;
+
+    // Large blocks are never in a bucket, they are in the space's large 
+    // list instead. (See ms_large_malloc_p)
+    const uint8_t large;
+
+    // A slab block is never in a bucket, it is in the list of its slab
+    // class instead. Any bucket other than MS_NO_BUCKET just means the 
+    // block is in that list.
+    //
+    // NOTE: This should only be written with bucket_lck held, and only
+    // read with atomics when bucket_lck isn't held.
+    uint64_t bucket;
+
+    // Bucket and slab lists are circular. (Protected by bucket_lck)
+    //
+    // The large list reuses these, it is protected by mb_list_lck.
+    ms_mb_entry *prev;
+    ms_mb_entry *next;
+
+    // The block's stats as of the last ms_restat. The space's totals are
+    // the sum of these. (Protected by stat_lck)
+    pthread_mutex_t stat_lck;
+    mem_stats stats;
+
+    // Value of the space's trims when this large block was doomed.
+    // (Protected by mb_list_lck)
+    uint64_t doomed_at;
+};
 
 // For sorting... we want a linked list!
 struct mem_space_struct {
@@ -19,240 +96,1698 @@ struct mem_space_struct {
     // Classic arraylist construction
     // below for mb_list. 
 
-    // Data used for simple thread safe pseudo random number
-    // generation. May want to take this out of here at some point.
-    // Also nice for custom rng tho...
-    pthread_mutex_t rnd_lck;
-    uint64_t seed;
-
     pthread_rwlock_t mb_list_lck;
 
     uint64_t mb_list_len;
     uint64_t mb_list_cap;
 
     // NOTE: this never ever ever shrinks!
+    // Empty blocks give their pages back instead. (See ms_release_empty)
     mem_block **mb_list;
+
+    // An entry for every block owned by this space or by one of its 
+    // regions, sorted by block address. This is how the block which owns 
+    // a piece is found, so pieces never need to store their block. 
+    // (See ms_find_entry)
+    //
+    // NOTE: This is protected by mb_list_lck.
+    uint64_t mb_index_len;
+    uint64_t mb_index_cap;
+    ms_mb_entry **mb_index;
+
+    // This is how ms_malloc_p finds a block with enough space. 
+    // (See ms_pick_entry)
+    //
+    // Bit b of bucket_bits is set iff buckets[b] is non-empty.
+    pthread_mutex_t bucket_lck;
+    uint64_t bucket_bits;
+    ms_mb_entry *buckets[MS_NUM_BUCKETS];
+
+    // The block each home slot mallocs into until it fills. This way
+    // objects made together by one thread sit together, and threads
+    // don't all fight over the same block. (NULL if the slot has no
+    // home yet)
+    //
+    // NOTE: These should only be accessed using atomics!
+    ms_mb_entry *homes[MS_NUM_HOMES];
+
+    // Slab blocks which have free cells, by class. (Protected by 
+    // bucket_lck) Small mallocs never look at the buckets or homes.
+    ms_mb_entry *slabs[MS_NUM_SLAB_CLASSES];
+
+    // Number of cells the next new slab of each class gets. 
+    // (See ms_slab_place)
+    //
+    // NOTE: These should only be accessed using atomics!
+    uint64_t slab_cells[MS_NUM_SLAB_CLASSES];
+
+    // Every large block of the space, each holding one large piece.
+    // These are not in mb_list, so they are never picked, shifted, 
+    // evacuated or released. (Protected by mb_list_lck)
+    uint64_t large_len;
+    ms_mb_entry *large;
+
+    // Large blocks which no longer hold a piece. Their pages are given
+    // back, but they stay mapped and indexed until they are trimmed.
+    // (See ms_trim_idle_large) This way, a reader racing a free or a 
+    // move out of a large block only ever fails its validation, and an 
+    // entry found by ms_find_entry is never freed out from under its 
+    // user. (Protected by mb_list_lck)
+    //
+    // Later large mallocs which fit reuse these first. There are never 
+    // more than MS_IDLE_LARGE_MAX, oldest first.
+    uint64_t idle_large_len;
+    ms_mb_entry *idle_large;
+
+    // Idle large blocks pushed out of idle_large. These are never reused,
+    // they wait for ms_trim_idle_large to unmap them. 
+    // (Protected by mb_list_lck)
+    uint64_t doomed_large_len;
+    ms_mb_entry *doomed_large;
+
+    // Number of calls to ms_trim_idle_large so far. 
+    // (Protected by mb_list_lck)
+    uint64_t trims;
+
+    // The stats of every indexed block added up. (See ms_restat) 
+    // max_free isn't kept here, it comes from the buckets instead, and
+    // live_count comes from the address book. (See ms_get_stats)
+    //
+    // NOTE: These should only be accessed using atomics!
+    mem_stats totals;
+
+    // Every tlab which has begun but not ended. (See ms_flush_idle_tlabs)
+    pthread_mutex_t tlabs_lck;
+    mem_tlab *tlabs;
 };
 
-mem_space *new_mem_space_seed(uint64_t chnl, uint64_t seed, 
-        uint64_t adb_t_cap, uint64_t mb_m_bytes) {
-    if (mb_m_bytes == 0) {
-        return NULL;   
+// Which home slot the calling thread mallocs from.
+static inline uint64_t ms_home_slot(void) {
+    uint64_t t = (uint64_t)(uintptr_t)pthread_self();
+
+    // Thread handles are aligned pointers on most systems, so their
+    // low bits can't be used as is.
+    return (t * 0x9E3779B97F4A7C15ULL) >> (64 - MS_HOME_BITS);
+}
+
+// Returns the position of the last block in the index which starts at or 
+// before paddr. Returns mb_index_len if there is no such block.
+//
+// NOTE: mb_list_lck must be held when calling this.
+static uint64_t ms_index_search_unsafe(mem_space *ms, const void *paddr) {
+    uint64_t lo = 0;
+    uint64_t hi = ms->mb_index_len;
+
+    // Find the first block which starts after paddr.
+    while (lo < hi) {
+        uint64_t mid = lo + ((hi - lo) / 2);
+
+        if ((uintptr_t)(ms->mb_index[mid]->mb) <= (uintptr_t)paddr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo == 0 ? ms->mb_index_len : lo - 1;
+}
+
+// Create an entry for mb and add it to the index.
+//
+// NOTE: mb_list_lck must be write locked when calling this.
+static ms_mb_entry *ms_index_add_unsafe(mem_space *ms, mem_block *mb, 
+        uint8_t region) {
+    ms_mb_entry *e = safe_malloc(get_chnl(ms), sizeof(ms_mb_entry));
+
+    *(mem_block **)&(e->mb) = mb;
+    *(uint8_t *)&(e->region) = region;
+    *(uint8_t *)&(e->large) = mb_is_large(mb);
+
+    uint64_t cell_bytes = mb_cell_bytes(mb);
+    *(uint64_t *)&(e->slab) = cell_bytes > 0 && cell_bytes <= MS_SLAB_MAX_BYTES 
+        ? (cell_bytes / 8) - 1 : MS_NO_SLAB;
+
+    e->bucket = MS_NO_BUCKET;
+    e->prev = NULL;
+    e->next = NULL;
+    e->doomed_at = 0;
+
+    // Nothing is counted until the first ms_restat.
+    safe_mutex_init(&(e->stat_lck), NULL);
+    memset(&(e->stats), 0, sizeof(mem_stats));
+
+    if (ms->mb_index_len == ms->mb_index_cap) {
+        ms->mb_index_cap *= 2;
+        ms->mb_index = safe_realloc(ms->mb_index, 
+                sizeof(ms_mb_entry *) * ms->mb_index_cap);
+    }
+
+    uint64_t i = ms_index_search_unsafe(ms, mb);
+    i = i == ms->mb_index_len ? 0 : i + 1;
+
+    memmove(ms->mb_index + i + 1, ms->mb_index + i, 
+            sizeof(ms_mb_entry *) * (ms->mb_index_len - i));
+
+    ms->mb_index[i] = e;
+    ms->mb_index_len++;
+
+    return e;
+}
+
+// Add (add - sub) to the space's totals.
+static void ms_totals_shift(mem_space *ms, const mem_stats *add, 
+        const mem_stats *sub) {
+    mem_stats *t = &(ms->totals);
+
+    // Unsigned wrap around makes this work even when a stat shrinks.
+    __atomic_add_fetch(&(t->blocks), add->blocks - sub->blocks, 
+            __ATOMIC_RELAXED);
+    __atomic_add_fetch(&(t->live_count), add->live_count - sub->live_count, 
+            __ATOMIC_RELAXED);
+    __atomic_add_fetch(&(t->live_bytes), add->live_bytes - sub->live_bytes, 
+            __ATOMIC_RELAXED);
+    __atomic_add_fetch(&(t->free_bytes), add->free_bytes - sub->free_bytes, 
+            __ATOMIC_RELAXED);
+    __atomic_add_fetch(&(t->released_bytes), 
+            add->released_bytes - sub->released_bytes, __ATOMIC_RELAXED);
+}
+
+// Bring the space's totals up to date with e's block. This should be 
+// called after every change to a block. (ms_reindex does this too)
+//
+// NOTE: Blocks keep their own stats up to date, (See mb_get_stats) so 
+// this is O(1).
+static void ms_restat(mem_space *ms, ms_mb_entry *e) {
+    safe_mutex_lock(&(e->stat_lck));
+
+    mem_stats stats = mb_get_stats(e->mb);
+    ms_totals_shift(ms, &stats, &(e->stats));
+    e->stats = stats;
+
+    safe_mutex_unlock(&(e->stat_lck));
+}
+
+// Remove mb's entry from the index and delete it.
+//
+// NOTE: mb_list_lck must be write locked when calling this.
+// NOTE: The entry must not be in a bucket.
+static void ms_index_remove_unsafe(mem_space *ms, mem_block *mb) {
+    uint64_t i = ms_index_search_unsafe(ms, mb);
+    ms_mb_entry *e = ms->mb_index[i];
+
+    // The block no longer counts towards the space.
+    mem_stats none;
+    memset(&none, 0, sizeof(mem_stats));
+    ms_totals_shift(ms, &none, &(e->stats));
+
+    safe_mutex_destroy(&(e->stat_lck));
+    safe_free(e);
+
+    memmove(ms->mb_index + i, ms->mb_index + i + 1, 
+            sizeof(ms_mb_entry *) * (ms->mb_index_len - i - 1));
+
+    ms->mb_index_len--;
+}
+
+// Find the entry of the block which owns the piece at paddr.
+//
+// Blocks come in many sizes (See ms_malloc_p), so the owner can't be
+// found by rounding paddr down to some alignment. Blocks never overlap
+// though, so the owner is the last block which starts before paddr.
+static ms_mb_entry *ms_find_entry(mem_space *ms, const void *paddr) {
+    safe_rdlock(&(ms->mb_list_lck));
+    ms_mb_entry *e = ms->mb_index[ms_index_search_unsafe(ms, paddr)];
+    safe_rwlock_unlock(&(ms->mb_list_lck));
+
+    return e;
+}
+
+static inline uint64_t ms_bucket_of(uint64_t free_bound) {
+    return free_bound == 0 
+        ? MS_NO_BUCKET : 63 - (uint64_t)__builtin_clzll(free_bound);
+}
+
+// The head of the list e is in when its bucket is b.
+static inline ms_mb_entry **ms_list_head(mem_space *ms, ms_mb_entry *e, 
+        uint64_t b) {
+    return e->slab == MS_NO_SLAB ? &(ms->buckets[b]) : &(ms->slabs[e->slab]);
+}
+
+// NOTE: bucket_lck must be held when calling this.
+static void ms_bucket_remove_unsafe(mem_space *ms, ms_mb_entry *e) {
+    uint64_t b = e->bucket;
+    ms_mb_entry **head = ms_list_head(ms, e, b);
+
+    if (e->next == e) {
+        *head = NULL;
+
+        if (e->slab == MS_NO_SLAB) {
+            ms->bucket_bits &= ~(1ULL << b);
+        }
+    } else {
+        e->prev->next = e->next;
+        e->next->prev = e->prev;
+
+        if (*head == e) {
+            *head = e->next;
+        }
+    }
+
+    e->prev = NULL;
+    e->next = NULL;
+}
+
+// Add e to the back of bucket b. 
+//
+// NOTE: bucket_lck must be held when calling this.
+static void ms_bucket_add_unsafe(mem_space *ms, ms_mb_entry *e, uint64_t b) {
+    ms_mb_entry **head = ms_list_head(ms, e, b);
+
+    if (*head) {
+        e->next = *head;
+        e->prev = (*head)->prev;
+        (*head)->prev->next = e;
+        (*head)->prev = e;
+    } else {
+        e->next = e;
+        e->prev = e;
+
+        *head = e;
+
+        if (e->slab == MS_NO_SLAB) {
+            ms->bucket_bits |= 1ULL << b;
+        }
+    }
+}
+
+// Move e to the bucket which matches its block's current free space,
+// and update the space's totals. (See ms_restat) This should be called 
+// after every change to a block's structure.
+//
+// NOTE: The buckets are only a hint. Two racing calls can leave a block
+// in a stale bucket until the next call on it. A block which is in too
+// high of a bucket is fixed when a malloc into it fails.
+static void ms_reindex(mem_space *ms, ms_mb_entry *e) {
+    ms_restat(ms, e);
+
+    // Slab blocks without a class (From an older image maybe) can't 
+    // be used by the space at all.
+    if (e->region || e->large || 
+            (e->slab == MS_NO_SLAB && mb_cell_bytes(e->mb) > 0)) {
+        return;
+    }
+
+    uint64_t b = ms_bucket_of(mb_free_space_bound(e->mb));
+
+    if (b == __atomic_load_n(&(e->bucket), __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    safe_mutex_lock(&(ms->bucket_lck));
+
+    // The block may have changed again while we waited.
+    b = ms_bucket_of(mb_free_space_bound(e->mb));
+
+    if (b != e->bucket) {
+        if (e->bucket != MS_NO_BUCKET) {
+            ms_bucket_remove_unsafe(ms, e);
+        }
+
+        if (b != MS_NO_BUCKET) {
+            ms_bucket_add_unsafe(ms, e, b);
+        }
+
+        __atomic_store_n(&(e->bucket), b, __ATOMIC_RELAXED);
+    }
+
+    safe_mutex_unlock(&(ms->bucket_lck));
+}
+
+// Pick a block which should be able to hold min_bytes. NULL if there
+// is none.
+//
+// Blocks in the smallest bucket which guarantees a fit are preferred,
+// this way full blocks are filled before emptier ones. Blocks within a 
+// bucket are taken in turns to spread out concurrent mallocs.
+static ms_mb_entry *ms_pick_entry(mem_space *ms, uint64_t min_bytes) {
+    // Smallest b such that (1 << b) >= min_bytes.
+    uint64_t b = min_bytes <= 1 
+        ? 0 : 64 - (uint64_t)__builtin_clzll(min_bytes - 1);
+
+    ms_mb_entry *e = NULL;
+
+    safe_mutex_lock(&(ms->bucket_lck));
+
+    uint64_t bits = b < MS_NUM_BUCKETS ? ms->bucket_bits & (~0ULL << b) : 0;
+
+    // Nothing is sure to fit, blocks of the bucket below still might.
+    if (!bits && b > 0) {
+        bits = ms->bucket_bits & (1ULL << (b - 1));
+    }
+
+    if (bits) {
+        b = (uint64_t)__builtin_ctzll(bits);
+        e = ms->buckets[b];
+        ms->buckets[b] = e->next;
+    }
+
+    safe_mutex_unlock(&(ms->bucket_lck));
+
+    return e;
+}
+
+// Create a memory space with an empty mb_list.
+// Returns NULL if adb_t_cap is not a valid table cap. (See new_addr_book)
+static mem_space *new_mem_space_empty(uint64_t chnl, 
+        uint64_t adb_t_cap, uint64_t mb_m_bytes, uint64_t mb_list_cap) {
+    addr_book *adb = new_addr_book(chnl, adb_t_cap);
+
+    if (!adb) {
+        return NULL;
     }
 
     mem_space *ms = safe_malloc(chnl, sizeof(mem_space));
 
-    *(addr_book **)&(ms->adb) = new_addr_book(chnl, adb_t_cap);;
+    *(addr_book **)&(ms->adb) = adb;
     *(uint64_t *)&(ms->mb_min_bytes) = mb_m_bytes;
 
-    safe_mutex_init(&(ms->rnd_lck), NULL);
-    ms->seed = seed;
+    safe_rwlock_init(&(ms->mb_list_lck), NULL);
+
+    ms->mb_list_cap = mb_list_cap;
+    ms->mb_list = safe_malloc(chnl, sizeof(mem_block *) * ms->mb_list_cap);   
+
+    ms->mb_list_len = 0;
+
+    ms->mb_index_cap = mb_list_cap;
+    ms->mb_index = safe_malloc(chnl, sizeof(ms_mb_entry *) * ms->mb_index_cap);
+
+    ms->mb_index_len = 0;
+
+    safe_mutex_init(&(ms->bucket_lck), NULL);
+
+    safe_mutex_init(&(ms->tlabs_lck), NULL);
+    ms->tlabs = NULL;
+    ms->bucket_bits = 0;
+
+    uint64_t b;
+    for (b = 0; b < MS_NUM_BUCKETS; b++) {
+        ms->buckets[b] = NULL;
+    }
+
+    uint64_t h;
+    for (h = 0; h < MS_NUM_HOMES; h++) {
+        ms->homes[h] = NULL;
+    }
+
+    uint64_t sc;
+    for (sc = 0; sc < MS_NUM_SLAB_CLASSES; sc++) {
+        ms->slabs[sc] = NULL;
+        ms->slab_cells[sc] = MS_SLAB_FIRST_CELLS;
+    }
+
+    ms->large_len = 0;
+    ms->large = NULL;
+
+    ms->idle_large_len = 0;
+    ms->idle_large = NULL;
+
+    ms->doomed_large_len = 0;
+    ms->doomed_large = NULL;
+    ms->trims = 0;
+
+    memset(&(ms->totals), 0, sizeof(mem_stats));
+
+    return ms;
+}
+
+mem_space *new_mem_space(uint64_t chnl, uint64_t adb_t_cap, 
+        uint64_t mb_m_bytes) {
+    if (mb_m_bytes == 0) {
+        return NULL;   
+    }
+
+    mem_space *ms = new_mem_space_empty(chnl, adb_t_cap, mb_m_bytes, 2);
+
+    if (!ms) {
+        return NULL;
+    }
 
     // Create our memory space with one single empty memory block.
-    safe_rwlock_init(&(ms->mb_list_lck), NULL);
+    ms->mb_list_len = 1;
+    ms->mb_list[0] = new_mem_block(chnl, ms->adb, mb_m_bytes);
+
+    ms_reindex(ms, ms_index_add_unsafe(ms, ms->mb_list[0], 0));
+
+    return ms;
+}
+
+void delete_mem_space(mem_space *ms) {
+    // Not gonna delete the adb as it was given to us!
+
+    // Again, this is just for consistency.
+    // delete mem space should never be called in parallel
+    // with any other calls to the given ms. 
+    safe_wrlock(&(ms->mb_list_lck));
+
+    uint64_t i;
+    for (i = 0; i < ms->mb_list_len; i++) {
+        delete_mem_block(ms->mb_list[i]);
+    }
+
+    // Entries of live regions are left in the index too.
+    for (i = 0; i < ms->mb_index_len; i++) {
+        if (ms->mb_index[i]->large) {
+            delete_mem_block(ms->mb_index[i]->mb);
+        }
+
+        safe_mutex_destroy(&(ms->mb_index[i]->stat_lck));
+        safe_free(ms->mb_index[i]);
+    }
+
+    safe_free(ms->mb_list);
+    safe_free(ms->mb_index);
+
+    ms->mb_list_cap = 0;
+    ms->mb_list_len = 0;
+    ms->mb_list = NULL;
+
+    ms->mb_index_cap = 0;
+    ms->mb_index_len = 0;
+    ms->mb_index = NULL;
+
+    ms->large_len = 0;
+    ms->large = NULL;
+
+    ms->idle_large_len = 0;
+    ms->idle_large = NULL;
+
+    ms->doomed_large_len = 0;
+    ms->doomed_large = NULL;
+
+    safe_rwlock_unlock(&(ms->mb_list_lck));
+
+    // Must do this after deleting blocks.
+    delete_addr_book(ms->adb);
+
+    safe_rwlock_destroy(&(ms->mb_list_lck));
+    safe_mutex_destroy(&(ms->bucket_lck));
+    safe_mutex_destroy(&(ms->tlabs_lck));
+
+    // finally, delete the memory space itself.
+    safe_free(ms);
+}
+
+// This assumes the malloc succeeded and is holding the corresponding paddr.
+static inline malloc_res ms_interpret_malloc_res(mem_space *ms, 
+        malloc_res res, uint8_t hold) {
+    if (!hold) {
+        res.paddr = NULL;
+        adb_unlock(ms->adb, res.vaddr);
+    }
+
+    return res;
+}
+
+// Max number of blocks picked once the home block is full, before a
+// new block is created.
+static const uint64_t MS_MAX_PICKS = 4;
+
+// Add a new block to the index and to the end of the mb_list.
+// Returns the block's entry.
+//
+// NOTE: The block must be indexed before its first piece is given out.
+// (See ms_find_entry)
+static ms_mb_entry *ms_add_mb(mem_space *ms, mem_block *mb) {
+    safe_wrlock(&(ms->mb_list_lck));
+
+    ms_mb_entry *e = ms_index_add_unsafe(ms, mb, 0);
+
+    if (ms->mb_list_len == ms->mb_list_cap) {
+        // NOTE: One day we may want to check for overflow...
+        // However, I think we'd run out of memory before this occurs.
+        ms->mb_list_cap *= 2;
+        ms->mb_list = safe_realloc(ms->mb_list, sizeof(mem_block *) * ms->mb_list_cap);
+    }
+
+    // Add our memory block to the end of the list.
+    ms->mb_list[(ms->mb_list_len)++] = mb;
+    
+    safe_rwlock_unlock(&(ms->mb_list_lck));
+
+    ms_reindex(ms, e);
+
+    return e;
+}
+
+// Places a piece of min_bytes into mb. (See ms_place) Returns 0 on 
+// success, 1 if mb doesn't have the space.
+//
+// NOTE: The piece must be held, so that no one can use it until 
+// ms_place is done with its block.
+typedef uint8_t (*ms_placer)(mem_block *mb, uint64_t min_bytes, void *ctx);
+
+// Place into the first slab block of min_bytes's class which has 
+// a free cell, or into a new one.
+static void ms_slab_place(mem_space *ms, uint64_t min_bytes, 
+        ms_placer place, void *ctx) {
+    uint64_t sc = (min_bytes - 1) / 8;
+    uint64_t pick;
+    ms_mb_entry *e;
+
+    // Slabs at the front of the list are filled first. A full slab
+    // leaves the list on its reindex, so the loop only goes on when
+    // racing with other threads.
+    for (pick = 0; pick < MS_MAX_PICKS; pick++) {
+        safe_mutex_lock(&(ms->bucket_lck));
+        e = ms->slabs[sc];
+        safe_mutex_unlock(&(ms->bucket_lck));
+
+        if (!e) {
+            break;
+        }
+
+        uint8_t failed = place(e->mb, min_bytes, ctx);
+        ms_reindex(ms, e);
+
+        if (!failed) {
+            return;
+        }
+    }
+
+    // A slab is at most about as large as a default block. 
+    // (Each cell also holds a vaddr)
+    uint64_t cell_bytes = (sc + 1) * 8;
+    uint64_t max_cells = ms->mb_min_bytes / (cell_bytes + sizeof(addr_book_vaddr));
+
+    // NOTE: Racing threads may both make a slab of the same size, 
+    // that's fine.
+    uint64_t cells = __atomic_load_n(&(ms->slab_cells[sc]), __ATOMIC_RELAXED);
+
+    if (cells >= max_cells) {
+        cells = max_cells;
+    } else {
+        __atomic_store_n(&(ms->slab_cells[sc]), cells * 2, __ATOMIC_RELAXED);
+    }
+
+    if (cells == 0) {
+        cells = 1;
+    }
+
+    mem_block *mb = new_mem_block_arr(get_chnl(ms), ms->adb, cell_bytes, 
+            cells);
+
+    // NOTE: this should always work! (See ms_place)
+    place(mb, min_bytes, ctx);
+    ms_add_mb(ms, mb);
+}
+
+// Push e onto the end of the circular list at head.
+//
+// NOTE: mb_list_lck must be write locked when calling this.
+static void ms_large_link_unsafe(ms_mb_entry **head, ms_mb_entry *e) {
+    if (*head) {
+        e->next = *head;
+        e->prev = (*head)->prev;
+        (*head)->prev->next = e;
+        (*head)->prev = e;
+    } else {
+        e->next = e;
+        e->prev = e;
+
+        *head = e;
+    }
+}
+
+// Remove e from the circular list at head.
+//
+// NOTE: mb_list_lck must be write locked when calling this.
+static void ms_large_unlink_unsafe(ms_mb_entry **head, ms_mb_entry *e) {
+    if (e->next == e) {
+        *head = NULL;
+    } else {
+        e->prev->next = e->next;
+        e->next->prev = e->prev;
+
+        if (*head == e) {
+            *head = e->next;
+        }
+    }
+}
+
+// Add a large block to the index and the large list.
+// Returns the block's entry.
+//
+// NOTE: mb_list_lck must be write locked when calling this.
+static ms_mb_entry *ms_large_add_unsafe(mem_space *ms, mem_block *mb) {
+    ms_mb_entry *e = ms_index_add_unsafe(ms, mb, 0);
+
+    ms_large_link_unsafe(&(ms->large), e);
+    ms->large_len++;
+
+    return e;
+}
+
+// Move a large block which no longer holds a piece to the idle list,
+// and give its pages back to the OS. If the idle list is full, its 
+// oldest block is doomed.
+//
+// NOTE: The block is never unmapped here. (See idle_large)
+static void ms_large_retire(mem_space *ms, ms_mb_entry *e) {
+    safe_wrlock(&(ms->mb_list_lck));
+
+    ms_large_unlink_unsafe(&(ms->large), e);
+    ms->large_len--;
+
+    ms_large_link_unsafe(&(ms->idle_large), e);
+    ms->idle_large_len++;
+
+    if (ms->idle_large_len > MS_IDLE_LARGE_MAX) {
+        ms_mb_entry *oldest = ms->idle_large;
+
+        ms_large_unlink_unsafe(&(ms->idle_large), oldest);
+        ms->idle_large_len--;
+
+        oldest->doomed_at = ms->trims;
+
+        ms_large_link_unsafe(&(ms->doomed_large), oldest);
+        ms->doomed_large_len++;
+    }
+
+    safe_rwlock_unlock(&(ms->mb_list_lck));
+
+    // If the block was already picked up again, this does nothing.
+    mb_release(e->mb);
+    ms_restat(ms, e);
+}
+
+// Take an idle large block which can hold min_bytes without wasting
+// more than half of itself. Returns NULL if there is none.
+static ms_mb_entry *ms_large_take_idle(mem_space *ms, uint64_t min_bytes) {
+    ms_mb_entry *res = NULL;
+
+    safe_wrlock(&(ms->mb_list_lck));
+
+    ms_mb_entry *e = ms->idle_large;
+    uint64_t i;
+    for (i = 0; i < ms->idle_large_len; i++, e = e->next) {
+        uint64_t cap = mb_capacity(e->mb);
+
+        if (cap >= min_bytes && cap / 2 <= min_bytes) {
+            ms_large_unlink_unsafe(&(ms->idle_large), e);
+            ms->idle_large_len--;
+
+            res = e;
+            break;
+        }
+    }
+
+    safe_rwlock_unlock(&(ms->mb_list_lck));
+
+    return res;
+}
+
+// Give min_bytes a large block of its own.
+static void ms_large_place(mem_space *ms, uint64_t min_bytes, 
+        ms_placer place, void *ctx) {
+    ms_mb_entry *e = ms_large_take_idle(ms, min_bytes);
+
+    // An idle block is still indexed, it just goes back in the large 
+    // list.
+    if (e && !place(e->mb, min_bytes, ctx)) {
+        safe_wrlock(&(ms->mb_list_lck));
+        ms_large_link_unsafe(&(ms->large), e);
+        ms->large_len++;
+        safe_rwlock_unlock(&(ms->mb_list_lck));
+
+        ms_restat(ms, e);
+
+        return;
+    }
+
+    if (e) {
+        // Too small after all, (Capacity counts the headers) back it goes.
+        // It goes through the large list so the idle list stays bounded.
+        safe_wrlock(&(ms->mb_list_lck));
+        ms_large_link_unsafe(&(ms->large), e);
+        ms->large_len++;
+        safe_rwlock_unlock(&(ms->mb_list_lck));
+
+        ms_large_retire(ms, e);
+    }
+
+    mem_block *mb = new_mem_block_large(ms->adb, min_bytes);
+
+    // NOTE: this should always work! (See ms_place)
+    place(mb, min_bytes, ctx);
+
+    safe_wrlock(&(ms->mb_list_lck));
+    e = ms_large_add_unsafe(ms, mb);
+    safe_rwlock_unlock(&(ms->mb_list_lck));
+
+    ms_restat(ms, e);
+}
+
+// Find a block for a piece of min_bytes, and have place put the piece 
+// there. This never fails, a new block is made when no block has space.
+static void ms_place(mem_space *ms, uint64_t min_bytes, ms_placer place, 
+        void *ctx) {
+    if (min_bytes <= MS_SLAB_MAX_BYTES) {
+        ms_slab_place(ms, min_bytes, place, ctx);
+        return;
+    }
+
+    if (min_bytes > ms->mb_min_bytes && min_bytes >= MS_LARGE_MIN_BYTES) {
+        ms_large_place(ms, min_bytes, place, ctx);
+        return;
+    }
+
+    uint64_t pick;
+    ms_mb_entry *e;
+    mem_block *mb;
+    uint8_t failed;
+
+    ms_mb_entry **home = &(ms->homes[ms_home_slot()]);
+
+    // Always try our home block first.
+    e = __atomic_load_n(home, __ATOMIC_ACQUIRE);
+
+    if (e) {
+        failed = place(e->mb, min_bytes, ctx);
+        ms_reindex(ms, e);
+
+        if (!failed) {
+            return;
+        }
+    }
+
+    for (pick = 0; pick < MS_MAX_PICKS; pick++) {
+        e = ms_pick_entry(ms, min_bytes);
+
+        if (!e) {
+            break;
+        }
+
+        failed = place(e->mb, min_bytes, ctx);
+        ms_reindex(ms, e);
+
+        // Here, our malloc was a success!
+        // The block we found becomes our new home.
+        if (!failed) {
+            __atomic_store_n(home, e, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+
+    // This is when we never founnd space for
+    // our malloc.
+    // Determine if we request a size greater than the default
+    // mem block size.
+    uint64_t req_bytes = min_bytes > ms->mb_min_bytes 
+        ? min_bytes : ms->mb_min_bytes;
+
+    mb = new_mem_block(get_chnl(ms), ms->adb, req_bytes);
+
+    // NOTE: this should always work!
+    // Our piece is held, so no one can use it until after the block is 
+    // added.
+    place(mb, min_bytes, ctx);
+    e = ms_add_mb(ms, mb);
+
+    // Blocks made for one large piece are mostly full, so they make 
+    // poor homes.
+    if (req_bytes == ms->mb_min_bytes) {
+        __atomic_store_n(home, e, __ATOMIC_RELEASE);
+    }
+}
+
+// ctx is the malloc_res to write to.
+static uint8_t ms_malloc_placer(mem_block *mb, uint64_t min_bytes, 
+        void *ctx) {
+    malloc_res *res = ctx;
+    *res = mb_malloc_and_hold(mb, min_bytes);
+
+    return null_adb_addr(res->vaddr);
+}
+
+malloc_res ms_malloc_p(mem_space *ms, uint64_t min_bytes, uint8_t hold) {
+    malloc_res res = {
+        .vaddr = NULL_VADDR,
+        .paddr = NULL,
+    };
+
+    if (min_bytes == 0) {
+        return res;
+    }
+
+    ms_place(ms, min_bytes, ms_malloc_placer, &res);
+
+    return ms_interpret_malloc_res(ms, res, hold);
+}
+
+struct mem_tlab_struct {
+    mem_space * const ms;
+
+    // Max number of bytes which will be malloc'd from the buffer in one 
+    // call.
+    const uint64_t max_bytes;
+
+    mb_buffer buf;
+
+    // Write locked while the buffer is in use, either by the tlab's 
+    // thread or by ms_flush_idle_tlabs. (See ms_tlab_acquire)
+    pthread_rwlock_t buf_lck;
+
+    // The space's list of tlabs. (Protected by tlabs_lck)
+    mem_tlab *prev;
+    mem_tlab *next;
+};
+
+// Size of each tlab buffer. Buffers are never larger than a 
+// (1 / TLAB_DIV) of the space's default block size.
+static const uint64_t TLAB_BYTES = 1 << 15;
+static const uint64_t TLAB_DIV = 8;
+
+// Requests larger than (1 / TLAB_LARGE_DIV) of a buffer skip the tlab. 
+static const uint64_t TLAB_LARGE_DIV = 4;
+
+static inline uint64_t ms_tlab_bytes(mem_space *ms) {
+    uint64_t bytes = ms->mb_min_bytes / TLAB_DIV;
+    return bytes < TLAB_BYTES ? bytes : TLAB_BYTES;
+}
+
+mem_tlab *ms_tlab_begin(mem_space *ms) {
+    mem_tlab *tl = safe_malloc(get_chnl(ms), sizeof(mem_tlab));
+
+    *(mem_space **)&(tl->ms) = ms;
+    *(uint64_t *)&(tl->max_bytes) = ms_tlab_bytes(ms) / TLAB_LARGE_DIV;
+
+    tl->buf.mb = NULL;
+    tl->buf.start = NULL;
+    tl->buf.top = NULL;
+    tl->buf.end = NULL;
+
+    safe_rwlock_init(&(tl->buf_lck), NULL);
+
+    safe_mutex_lock(&(ms->tlabs_lck));
+
+    tl->prev = NULL;
+    tl->next = ms->tlabs;
+
+    if (ms->tlabs) {
+        ms->tlabs->prev = tl;
+    }
+
+    ms->tlabs = tl;
+
+    safe_mutex_unlock(&(ms->tlabs_lck));
+
+    return tl;
+}
+
+// Take the tlab's buffer. Only ms_flush_idle_tlabs can have it, and only
+// for a single flush, so this is almost never contended.
+static inline void ms_tlab_acquire(mem_tlab *tl) {
+    safe_wrlock(&(tl->buf_lck));
+}
+
+static inline void ms_tlab_release(mem_tlab *tl) {
+    safe_rwlock_unlock(&(tl->buf_lck));
+}
+
+// Give the tlab's buffer back to its block, if it has one.
+static void ms_tlab_flush_and_reindex(mem_tlab *tl) {
+    mem_block *mb = tl->buf.mb;
+
+    if (!mb) {
+        return;
+    }
+
+    mb_buffer_flush(&(tl->buf));
+    ms_reindex(tl->ms, ms_find_entry(tl->ms, mb));
+}
+
+// Flush the current buffer and reserve a new one.
+static void ms_tlab_refill(mem_tlab *tl) {
+    mem_space *ms = tl->ms;
+    uint64_t bytes = ms_tlab_bytes(ms);
+
+    ms_tlab_flush_and_reindex(tl);
+
+    uint64_t pick;
+    ms_mb_entry *e;
+
+    for (pick = 0; pick < MS_MAX_PICKS; pick++) {
+        e = ms_pick_entry(ms, bytes);
+
+        if (!e) {
+            break;
+        }
+
+        uint8_t failed = mb_buffer_reserve(e->mb, bytes, &(tl->buf));
+        ms_reindex(ms, e);
+
+        if (!failed) {
+            return;
+        }
+    }
+
+    mem_block *mb = new_mem_block(get_chnl(ms), ms->adb, ms->mb_min_bytes);
+
+    // NOTE: this should always work! 
+    // (No pieces of the buffer exist yet, so order doesn't matter here)
+    mb_buffer_reserve(mb, bytes, &(tl->buf));
+    ms_add_mb(ms, mb);
+}
+
+malloc_res ms_tlab_malloc_p(mem_tlab *tl, uint64_t min_bytes, uint8_t hold) {
+    if (min_bytes > tl->max_bytes) {
+        return ms_malloc_p(tl->ms, min_bytes, hold);
+    }
+
+    ms_tlab_acquire(tl);
+
+    malloc_res res = mb_buffer_malloc_p(&(tl->buf), min_bytes, hold);
+
+    // (A 0 byte malloc always fails)
+    uint8_t failed = null_adb_addr(res.vaddr) && min_bytes > 0;
+
+    if (failed) {
+        ms_tlab_refill(tl);
+        res = mb_buffer_malloc_p(&(tl->buf), min_bytes, hold);
+        failed = null_adb_addr(res.vaddr);
+    }
+
+    ms_tlab_release(tl);
+
+    // Only possible when the space's blocks are too small to hold a 
+    // buffer at all.
+    if (failed) {
+        return ms_malloc_p(tl->ms, min_bytes, hold);
+    }
+
+    return res;
+}
+
+void ms_tlab_flush(mem_tlab *tl) {
+    ms_tlab_acquire(tl);
+    ms_tlab_flush_and_reindex(tl);
+    ms_tlab_release(tl);
+}
+
+void ms_tlab_end(mem_tlab *tl) {
+    mem_space *ms = tl->ms;
+
+    ms_tlab_flush(tl);
+
+    safe_mutex_lock(&(ms->tlabs_lck));
+
+    if (tl->prev) {
+        tl->prev->next = tl->next;
+    } else {
+        ms->tlabs = tl->next;
+    }
+
+    if (tl->next) {
+        tl->next->prev = tl->prev;
+    }
+
+    safe_mutex_unlock(&(ms->tlabs_lck));
+
+    safe_rwlock_destroy(&(tl->buf_lck));
+    safe_free(tl);
+}
+
+uint64_t ms_flush_idle_tlabs(mem_space *ms) {
+    uint64_t flushed = 0;
+
+    safe_mutex_lock(&(ms->tlabs_lck));
+
+    mem_tlab *tl;
+    for (tl = ms->tlabs; tl; tl = tl->next) {
+        // A tlab in use will be flushed by its own thread. 
+        if (safe_try_wrlock(&(tl->buf_lck))) {
+            continue;
+        }
+
+        if (tl->buf.mb) {
+            ms_tlab_flush_and_reindex(tl);
+            flushed++;
+        }
+
+        ms_tlab_release(tl);
+    }
+
+    safe_mutex_unlock(&(ms->tlabs_lck));
+
+    return flushed;
+}
+
+struct mem_region_struct {
+    mem_space * const ms;
+
+    // Blocks owned by this region. Only the last block is ever 
+    // malloc'd into.
+    uint64_t mb_list_len;
+    uint64_t mb_list_cap;
+    mem_block **mb_list;
+
+    // Entry of the last block. (NULL if there are no blocks yet)
+    ms_mb_entry *tail;
+};
+
+mem_region *ms_region_begin(mem_space *ms) {
+    mem_region *mr = safe_malloc(get_chnl(ms), sizeof(mem_region));
+
+    *(mem_space **)&(mr->ms) = ms;
+
+    mr->mb_list_len = 0;
+    mr->mb_list_cap = 1;
+    mr->mb_list = safe_malloc(get_chnl(ms), sizeof(mem_block *) * mr->mb_list_cap);
+
+    mr->tail = NULL;
+
+    return mr;
+}
+
+malloc_res ms_region_malloc_p(mem_region *mr, uint64_t min_bytes, 
+        uint8_t hold) {
+    mem_space *ms = mr->ms;
+    malloc_res res = {
+        .vaddr = NULL_VADDR,
+        .paddr = NULL,
+    };
+
+    if (min_bytes == 0) {
+        return res;
+    }
+
+    mem_block *mb;
+
+    // Objects in a region all die together, so there is no point 
+    // in searching older blocks for space.
+    if (mr->mb_list_len > 0) {
+        mb = mr->mb_list[mr->mb_list_len - 1];
+        res = mb_malloc_and_hold(mb, min_bytes);
+
+        if (!null_adb_addr(res.vaddr)) {
+            ms_restat(ms, mr->tail);
+            return ms_interpret_malloc_res(ms, res, hold);
+        }
+    }
+
+    uint64_t req_bytes = min_bytes > ms->mb_min_bytes 
+        ? min_bytes : ms->mb_min_bytes;
+
+    mb = new_mem_block(get_chnl(ms), ms->adb, req_bytes);
+
+    // NOTE: this malloc should always work!
+    res = mb_malloc_and_hold(mb, min_bytes);
+
+    safe_wrlock(&(ms->mb_list_lck));
+    mr->tail = ms_index_add_unsafe(ms, mb, 1);
+    safe_rwlock_unlock(&(ms->mb_list_lck));
+
+    ms_restat(ms, mr->tail);
+
+    res = ms_interpret_malloc_res(ms, res, hold);
+
+    if (mr->mb_list_len == mr->mb_list_cap) {
+        mr->mb_list_cap *= 2;
+        mr->mb_list = safe_realloc(mr->mb_list, sizeof(mem_block *) * mr->mb_list_cap);
+    }
+
+    mr->mb_list[(mr->mb_list_len)++] = mb;
+
+    return res;
+}
+
+void ms_region_foreach(mem_region *mr, mb_vaddr_consumer c, void *ctx) {
+    uint64_t i;
+    for (i = 0; i < mr->mb_list_len; i++) {
+        mb_foreach_vaddr(mr->mb_list[i], c, ctx);
+    }
+}
+
+void ms_region_end(mem_region *mr) {
+    mem_space *ms = mr->ms;
+
+    uint64_t i;
+
+    safe_wrlock(&(ms->mb_list_lck));
+    for (i = 0; i < mr->mb_list_len; i++) {
+        ms_index_remove_unsafe(ms, mr->mb_list[i]);
+    }
+    safe_rwlock_unlock(&(ms->mb_list_lck));
+
+    // Deleting a block frees all of its vaddrs.
+    for (i = 0; i < mr->mb_list_len; i++) {
+        delete_mem_block(mr->mb_list[i]);
+    }
+
+    safe_free(mr->mb_list);
+    safe_free(mr);
+}
+
+void ms_free(mem_space *ms, addr_book_vaddr vaddr) {
+    ms_mb_entry *e;
+    void *paddr;
+
+    // The piece can be evacuated to another block between finding 
+    // its block and freeing it, in which case we just look again.
+    do {
+        paddr = adb_get_read(ms->adb, vaddr);
+        e = ms_find_entry(ms, paddr); // Get our corresponding memory block.
+        adb_unlock(ms->adb, vaddr);
+    } while (mb_free_if_owner(e->mb, vaddr));
+
+    // A large block only ever holds one piece.
+    if (e->large) {
+        ms_large_retire(ms, e);
+        return;
+    }
+
+    ms_reindex(ms, e);
+}
+
+typedef struct {
+    addr_book_vaddr vaddr;
+    uint64_t copy_bytes;
+
+    // Set by the placer on success.
+    void *paddr;
+} ms_move_ctx;
+
+static uint8_t ms_move_placer(mem_block *mb, uint64_t min_bytes, 
+        void *ctx) {
+    ms_move_ctx *mc = ctx;
+    mc->paddr = mb_malloc_into(mb, mc->vaddr, min_bytes, mc->copy_bytes);
+
+    return mc->paddr == NULL;
+}
+
+void *ms_realloc_held(mem_space *ms, addr_book_vaddr vaddr, void *paddr, 
+        uint64_t min_bytes) {
+    if (min_bytes == 0) {
+        return NULL;
+    }
+
+    // We hold vaddr's lock, so its piece can't be evacuated out from 
+    // under us.
+    ms_mb_entry *e = ms_find_entry(ms, paddr);
+
+    // A piece which shrinks out of its large block is moved, so that 
+    // the block's pages can be given back.
+    uint8_t leave_large = e->large && min_bytes < MS_LARGE_MIN_BYTES && 
+        !adb_pinned(ms->adb, vaddr);
+
+    if (!leave_large && !mb_realloc(e->mb, paddr, min_bytes)) {
+        ms_reindex(ms, e);
+        return paddr;
+    }
+
+    // Region pieces never leave their region, and pinned pieces never
+    // move.
+    if (e->region || adb_pinned(ms->adb, vaddr)) {
+        return NULL;
+    }
+
+    uint64_t piece_bytes = mb_piece_bytes(e->mb, paddr);
+
+    ms_move_ctx mc = {
+        .vaddr = vaddr,
+        .copy_bytes = piece_bytes < min_bytes ? piece_bytes : min_bytes,
+        .paddr = NULL,
+    };
+
+    ms_place(ms, min_bytes, ms_move_placer, &mc);
+
+    mb_free_moved(e->mb, paddr);
+
+    if (e->large) {
+        ms_large_retire(ms, e);
+    } else {
+        ms_reindex(ms, e);
+    }
+
+    return mc.paddr;
+}
+
+uint8_t ms_realloc(mem_space *ms, addr_book_vaddr vaddr, uint64_t min_bytes) {
+    void *paddr = adb_get_write(ms->adb, vaddr);
+    void *new_paddr = ms_realloc_held(ms, vaddr, paddr, min_bytes);
+    adb_unlock(ms->adb, vaddr);
+
+    return new_paddr == NULL;
+}
+
+uint8_t ms_allocated(mem_space *ms, addr_book_vaddr vaddr) {
+    return adb_allocated(ms->adb, vaddr);
+}
+
+uint64_t ms_piece_bytes(mem_space *ms, const void *paddr) {
+    return mb_piece_bytes(ms_find_entry(ms, paddr)->mb, paddr);
+}
+
+// The blocks of one full shift, shared by all threads doing the shift.
+typedef struct {
+    mem_space * const ms;
+
+    // Number of blocks in the mb_list when the shift started.
+    const uint64_t len;
+
+    // Index of the next block to be shifted.
+    //
+    // NOTE: this should only be accessed using atomics!
+    uint64_t next;
+} ms_shift_job;
+
+// Shift blocks of the job until there are none left.
+static void ms_shift_job_run(ms_shift_job *job) {
+    mem_space *ms = job->ms;
+    uint64_t i;
+
+    while ((i = __atomic_fetch_add(&(job->next), 1, __ATOMIC_RELAXED)) 
+            < job->len) {
+        safe_rdlock(&(ms->mb_list_lck));
+        mem_block *mb = ms->mb_list[i];
+        safe_rwlock_unlock(&(ms->mb_list_lck));
+
+        // Don't hold the lock while doing the mb shift...
+        // this could potentially take some time.
+        mb_try_full_shift(mb);
+        ms_reindex(ms, ms_find_entry(ms, mb));
+    }
+}
+
+static void *ms_shift_worker(void *arg) {
+    util_thread_spray_context *s_context = arg;
+    ms_shift_job_run(s_context->context);
+
+    return NULL;
+}
+
+void ms_try_full_shift(mem_space *ms) {
+    ms_try_parallel_shift(ms, 1);
+}
+
+void ms_try_parallel_shift(mem_space *ms, uint64_t threads) {
+    safe_rdlock(&(ms->mb_list_lck));
+
+    ms_shift_job job = {
+        .ms = ms,
+        .len = ms->mb_list_len,
+        .next = 0,
+    };
+
+    safe_rwlock_unlock(&(ms->mb_list_lck));
+
+    // No point in having more threads than blocks.
+    if (threads > job.len) {
+        threads = job.len;
+    }
+
+    // The calling thread is always one of the threads.
+    if (threads > 1) {
+        util_thread_spray_info *spray = util_thread_spray(get_chnl(ms), 
+                threads - 1, ms_shift_worker, &job);
+
+        ms_shift_job_run(&job);
+        util_thread_collect(spray);
+    } else {
+        ms_shift_job_run(&job);
+    }
+
+    ms_release_empty(ms);
+}
+
+typedef struct {
+    mem_block *mb;
+    uint64_t frag;
+} ms_frag_entry;
+
+// Most fragmented blocks first.
+static int ms_frag_entry_cmp(const void *a, const void *b) {
+    const ms_frag_entry *e_a = a;
+    const ms_frag_entry *e_b = b;
 
-    ms->mb_list_cap = 2;
-    ms->mb_list = safe_malloc(chnl, sizeof(mem_block *) * ms->mb_list_cap);   
+    return e_a->frag > e_b->frag ? -1 : (e_a->frag < e_b->frag ? 1 : 0);
+}
 
-    ms->mb_list_len = 1;
-    ms->mb_list[0] = new_mem_block(chnl, ms->adb, mb_m_bytes);
+// 1 if now is past deadline.
+static inline uint8_t ms_past_deadline(const struct timespec *deadline) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-    return ms;
+    return now.tv_sec > deadline->tv_sec || 
+        (now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
 }
 
-void delete_mem_space(mem_space *ms) {
-    // Not gonna delete the adb as it was given to us!
+uint64_t ms_try_compact(mem_space *ms, uint64_t min_frag, 
+        const struct timespec *budget) {
+    struct timespec deadline;
 
-    // Again, this is just for consistency.
-    // delete mem space should never be called in parallel
-    // with any other calls to the given ms. 
-    safe_wrlock(&(ms->mb_list_lck));
+    if (budget) {
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
 
-    uint64_t i;
-    for (i = 0; i < ms->mb_list_len; i++) {
-        delete_mem_block(ms->mb_list[i]);
+        deadline.tv_sec += budget->tv_sec;
+        deadline.tv_nsec += budget->tv_nsec;
+
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
     }
 
-    safe_free(ms->mb_list);
+    uint64_t len, i;
 
-    ms->mb_list_cap = 0;
-    ms->mb_list_len = 0;
-    ms->mb_list = NULL;
+    safe_rdlock(&(ms->mb_list_lck));
+
+    len = ms->mb_list_len;
+    ms_frag_entry *entries = 
+        safe_malloc(get_chnl(ms), sizeof(ms_frag_entry) * len);
+
+    for (i = 0; i < len; i++) {
+        entries[i].mb = ms->mb_list[i];
+    }
 
     safe_rwlock_unlock(&(ms->mb_list_lck));
 
-    // Must do this after deleting blocks.
-    delete_addr_book(ms->adb);
+    // Only keep the blocks worth shifting.
+    uint64_t frag_len = 0;
 
-    safe_rwlock_destroy(&(ms->mb_list_lck));
-    safe_mutex_destroy(&(ms->rnd_lck));
+    for (i = 0; i < len; i++) {
+        uint64_t frag = mb_fragmentation(entries[i].mb);
 
-    // finally, delete the memory space itself.
-    safe_free(ms);
-}
+        if (frag >= min_frag && frag > 0) {
+            entries[frag_len].mb = entries[i].mb;
+            entries[frag_len].frag = frag;
+            frag_len++;
+        }
+    }
 
-// When we malloc, we will additionally write the constant address
-// of the parent memory block into the allocated cell.
-// The memory block doesn't need to know about this.
+    qsort(entries, frag_len, sizeof(ms_frag_entry), ms_frag_entry_cmp);
 
-static inline uint64_t ms_next_rnd(mem_space *ms) {
-    uint64_t curr_seed;
+    uint64_t shifted = 0;
 
-    safe_mutex_lock(&(ms->rnd_lck));
-    ms->seed++;
-    
-    if (ms->seed == 0) {
-        ms->seed = 1;
+    for (i = 0; i < frag_len; i++) {
+        if (budget && ms_past_deadline(&deadline)) {
+            break;
+        }
+
+        mb_try_full_shift(entries[i].mb);
+        ms_reindex(ms, ms_find_entry(ms, entries[i].mb));
+
+        shifted++;
     }
 
-    curr_seed = ms->seed;
-    safe_mutex_unlock(&(ms->rnd_lck));
+    safe_free(entries);
 
-    // NOTE: Here is my very simple algorithm.
-    // Hopefully one day I could read more on how
-    // to make this more effective.
-    
-    uint64_t a = curr_seed * 15485863;
-    uint64_t b = curr_seed * 2038074743;
+    ms_release_empty(ms);
 
-    return (a * a * a) + (b * b);
+    return shifted;
 }
 
-// This assumes the malloc succeeded and is holding the corresponding paddr.
-static inline malloc_res ms_interpret_malloc_res(mem_space *ms, mem_block *mb,
-        malloc_res res, uint8_t hold) {
-    mem_space_malloc_header *ms_mh = res.paddr; 
-    ms_mh->mb = mb;
+// Number of empty blocks which are kept ready to use. Only empty blocks
+// beyond these are released, so a space which frees and mallocs a block's
+// worth of memory over and over doesn't fault its pages back in each time.
+static const uint64_t MS_SPARE_BLOCKS = 2;
 
-    if (hold) {
-        res.paddr = ms_mh + 1;
-    } else {
-        res.paddr = NULL;
-        adb_unlock(ms->adb, res.vaddr);
-    }
+uint64_t ms_release_empty(mem_space *ms) {
+    uint64_t len, i;
 
-    return res;
-}
+    safe_rdlock(&(ms->mb_list_lck));
+    len = ms->mb_list_len;
+    safe_rwlock_unlock(&(ms->mb_list_lck));
 
-// We attempt to malloc into (len / search_divisor) memory blocks.
-static const uint64_t SEARCH_DIV = 3;
+    uint64_t spare = 0;
+    uint64_t released = 0;
 
-malloc_res ms_malloc_p(mem_space *ms, uint64_t min_bytes, uint8_t hold) {
-    uint64_t padded_bytes = min_bytes + sizeof(mem_space_malloc_header);
+    for (i = 0; i < len; i++) {
+        safe_rdlock(&(ms->mb_list_lck));
+        mem_block *mb = ms->mb_list[i];
+        safe_rwlock_unlock(&(ms->mb_list_lck));
 
-    malloc_res res = {
-        .vaddr = NULL_VADDR,
-        .paddr = NULL,
-    };
+        if (mb_released_bytes(mb) > 0 || !mb_is_empty(mb)) {
+            continue;
+        }
 
-    if (min_bytes == 0) {
-        return res;
+        if (spare < MS_SPARE_BLOCKS) {
+            spare++;
+            continue;
+        }
+
+        uint64_t mb_released = mb_release(mb);
+
+        if (mb_released > 0) {
+            ms_restat(ms, ms_find_entry(ms, mb));
+            released += mb_released;
+        }
     }
 
-    // NOTE: Here comes a nice random algorithm for the boys back at 
-    // Rice. (This may make testing a little tricky...)
-    
+    return released;
+}
+
+uint64_t ms_released_bytes(mem_space *ms) {
+    uint64_t len, i;
+
     safe_rdlock(&(ms->mb_list_lck));
-    uint64_t num_throws = ms->mb_list_len / SEARCH_DIV;
+    len = ms->mb_list_len;
     safe_rwlock_unlock(&(ms->mb_list_lck));
 
-    // Make sure to try at least one memory block.
-    if (num_throws == 0) {
-        num_throws = 1;
-    }
-    
-    uint64_t throw, dart;
-    mem_block *mb;
+    uint64_t released = 0;
 
-    for (throw = 0; throw < num_throws; throw++) {
+    for (i = 0; i < len; i++) {
         safe_rdlock(&(ms->mb_list_lck));
-        dart = ms_next_rnd(ms) % ms->mb_list_len;
-        mb = ms->mb_list[dart]; 
+        mem_block *mb = ms->mb_list[i];
         safe_rwlock_unlock(&(ms->mb_list_lck));
 
-        res = mb_malloc_and_hold(mb, padded_bytes);
+        released += mb_released_bytes(mb);
+    }
 
-        // Here, our malloc was a success!
-        if (!null_adb_addr(res.vaddr)) {
-            return ms_interpret_malloc_res(ms, mb, res, hold);
-        }
+    // Idle large blocks are released as soon as they go idle.
+    safe_rdlock(&(ms->mb_list_lck));
+
+    ms_mb_entry *e = ms->idle_large;
+    for (i = 0; i < ms->idle_large_len; i++, e = e->next) {
+        released += mb_released_bytes(e->mb);
     }
 
-    // This is when we never founnd space for
-    // our malloc.
-    // Determine if we request a size greater than the default
-    // mem block size.
-    uint64_t req_bytes = padded_bytes > ms->mb_min_bytes 
-        ? padded_bytes : ms->mb_min_bytes;
+    e = ms->doomed_large;
+    for (i = 0; i < ms->doomed_large_len; i++, e = e->next) {
+        released += mb_released_bytes(e->mb);
+    }
 
-    mb = new_mem_block(get_chnl(ms), ms->adb, req_bytes);
+    safe_rwlock_unlock(&(ms->mb_list_lck));
 
-    // NOTE: this malloc should always work!
-    res = mb_malloc_and_hold(mb, padded_bytes);
-    res = ms_interpret_malloc_res(ms, mb, res, hold);
+    return released;
+}
 
-    // Finally, after our successful malloc, add mb to the mb_list.
+uint64_t ms_trim_idle_large(mem_space *ms) {
     safe_wrlock(&(ms->mb_list_lck));
 
-    if (ms->mb_list_len == ms->mb_list_cap) {
-        // NOTE: One day we may want to check for overflow...
-        // However, I think we'd run out of memory before this occurs.
-        ms->mb_list_cap *= 2;
-        ms->mb_list = safe_realloc(ms->mb_list, sizeof(mem_block *) * ms->mb_list_cap);
+    uint64_t len = ms->doomed_large_len;
+    // (+ 1, so this is never a 0 byte malloc)
+    mem_block **trimmed = safe_malloc(get_chnl(ms), 
+            sizeof(mem_block *) * (len + 1));
+
+    uint64_t trimmed_len = 0;
+
+    ms_mb_entry *e = ms->doomed_large;
+    uint64_t i;
+    for (i = 0; i < len; i++) {
+        ms_mb_entry *next = e->next;
+
+        // Blocks doomed since the last trim wait for the next one.
+        if (e->doomed_at < ms->trims) {
+            ms_large_unlink_unsafe(&(ms->doomed_large), e);
+            ms->doomed_large_len--;
+
+            trimmed[trimmed_len++] = e->mb;
+            ms_index_remove_unsafe(ms, e->mb);
+        }
+
+        e = next;
     }
 
-    // Add our memory block to the end of the list.
-    ms->mb_list[(ms->mb_list_len)++] = mb;
-    
+    ms->trims++;
+
     safe_rwlock_unlock(&(ms->mb_list_lck));
-    
-    return res;
+
+    for (i = 0; i < trimmed_len; i++) {
+        delete_mem_block(trimmed[i]);
+    }
+
+    safe_free(trimmed);
+
+    return trimmed_len;
 }
 
-void ms_free(mem_space *ms, addr_book_vaddr vaddr) {
+typedef struct {
     mem_block *mb;
+    uint64_t used;
+    uint64_t cap;
+} ms_evac_entry;
 
-    mem_space_malloc_header *ms_mh = adb_get_read(ms->adb, vaddr);
-    mb = ms_mh->mb; // Get our corresponding memory block.
-    adb_unlock(ms->adb, vaddr);
+// Sparsest blocks first.
+static int ms_evac_entry_cmp(const void *a, const void *b) {
+    const ms_evac_entry *e_a = a;
+    const ms_evac_entry *e_b = b;
 
-    mb_free(mb, vaddr);
-}
+    // Compare used / cap without dividing.
+    __uint128_t l = (__uint128_t)e_a->used * e_b->cap;
+    __uint128_t r = (__uint128_t)e_b->used * e_a->cap;
 
-uint8_t ms_allocated(mem_space *ms, addr_book_vaddr vaddr) {
-    return adb_allocated(ms->adb, vaddr);
+    return l < r ? -1 : (l > r ? 1 : 0);
 }
 
-void ms_try_full_shift(mem_space *ms) {
+// Blocks which are less than (1 / EVAC_SPARSE_DIV) full are evacuated.
+static const uint64_t EVAC_SPARSE_DIV = 4;
+
+uint64_t ms_try_evacuate(mem_space *ms) {
     uint64_t len, i;
 
     safe_rdlock(&(ms->mb_list_lck));
+
     len = ms->mb_list_len;
+    ms_evac_entry *entries = 
+        safe_malloc(get_chnl(ms), sizeof(ms_evac_entry) * len);
+
+    for (i = 0; i < len; i++) {
+        entries[i].mb = ms->mb_list[i];
+    }
+
     safe_rwlock_unlock(&(ms->mb_list_lck));
 
+    // Slab blocks can't be evacuated. (See mb_evacuate)
+    uint64_t evac_len = 0;
+
     for (i = 0; i < len; i++) {
-        safe_rdlock(&(ms->mb_list_lck));
-        mem_block *mb = ms->mb_list[i];
-        safe_rwlock_unlock(&(ms->mb_list_lck));
+        if (mb_cell_bytes(entries[i].mb) > 0) {
+            continue;
+        }
 
-        // Don't hold the lock while doing the mb shift...
-        // this could potentially take some time.
-        mb_try_full_shift(mb);
+        entries[evac_len].mb = entries[i].mb;
+        entries[evac_len].used = mb_used_space(entries[i].mb);
+        entries[evac_len].cap = mb_capacity(entries[i].mb);
+        evac_len++;
+    }
+
+    len = evac_len;
+
+    qsort(entries, len, sizeof(ms_evac_entry), ms_evac_entry_cmp);
+
+    uint64_t moved = 0;
+
+    // Sources are taken from the sparse end, destinations from the 
+    // dense end. A destination is dropped once a piece doesn't fit in 
+    // it. A source is done once it has no pieces left which could be 
+    // moved. (Locked or pinned pieces stay behind)
+    uint64_t lo = 0;
+    uint64_t hi = len;
+
+    while (lo + 1 < hi) {
+        mem_block *src = entries[lo].mb;
+
+        // Pieces may have been moved into src since it was measured.
+        uint64_t used = mb_used_space(src);
+
+        if (used == 0) {
+            lo++;
+            continue;
+        }
+
+        if (used * EVAC_SPARSE_DIV >= entries[lo].cap) {
+            break;
+        }
+
+        uint8_t full;
+        moved += mb_evacuate(src, entries[hi - 1].mb, &full);
+
+        ms_reindex(ms, ms_find_entry(ms, src));
+        ms_reindex(ms, ms_find_entry(ms, entries[hi - 1].mb));
+
+        if (full) {
+            hi--;
+        } else {
+            lo++;
+        }
     }
+
+    safe_free(entries);
+
+    ms_release_empty(ms);
+
+    return moved;
 }
 
 void *ms_get_write(mem_space *ms, addr_book_vaddr vaddr) {
-    return (mem_space_malloc_header *)adb_get_write(ms->adb, vaddr) + 1;
+    return adb_get_write(ms->adb, vaddr);
+}
+
+void *ms_try_get_write(mem_space *ms, addr_book_vaddr vaddr) {
+    return adb_try_get_write(ms->adb, vaddr);
 }
 
 void *ms_get_read(mem_space *ms,addr_book_vaddr vaddr) {
-    return (mem_space_malloc_header *)adb_get_read(ms->adb, vaddr) + 1;
+    return adb_get_read(ms->adb, vaddr);
 }
 
 void ms_unlock(mem_space *ms,addr_book_vaddr vaddr) {
     adb_unlock(ms->adb, vaddr);
 }
 
+adt_opt_read_res ms_opt_read_begin(mem_space *ms, addr_book_vaddr vaddr) {
+    return adb_opt_read_begin(ms->adb, vaddr);
+}
+
+uint8_t ms_opt_read_validate(mem_space *ms, addr_book_vaddr vaddr,
+        uint64_t version) {
+    return adb_opt_read_validate(ms->adb, vaddr, version);
+}
+
+void *ms_atomic_begin(mem_space *ms, addr_book_vaddr vaddr) {
+    return adb_atomic_begin(ms->adb, vaddr);
+}
+
+void ms_atomic_end(mem_space *ms, addr_book_vaddr vaddr) {
+    adb_atomic_end(ms->adb, vaddr);
+}
+
+void *ms_pin(mem_space *ms, addr_book_vaddr vaddr) {
+    mem_block *mb;
+    void *paddr;
+
+    while (1) {
+        mb = ms_find_entry(ms, adb_get_read(ms->adb, vaddr))->mb;
+        adb_unlock(ms->adb, vaddr);
+
+        paddr = mb_pin(mb, vaddr);
+
+        // Once pinned, the piece can't be evacuated. So, if it is still
+        // in mb, the pin was counted in the right block.
+        if (mb_contains(mb, paddr)) {
+            return paddr;
+        }
+
+        mb_unpin(mb, vaddr);
+    }
+}
+
+void ms_unpin(mem_space *ms, addr_book_vaddr vaddr) {
+    mem_block *mb = ms_find_entry(ms, adb_get_read(ms->adb, vaddr))->mb;
+    adb_unlock(ms->adb, vaddr);
+
+    mb_unpin(mb, vaddr);
+}
+
+uint64_t ms_pinned(mem_space *ms, addr_book_vaddr vaddr) {
+    return adb_pinned(ms->adb, vaddr);
+}
+
+void *ms_get_pinned(mem_space *ms, addr_book_vaddr vaddr) {
+    return adb_get_pinned(ms->adb, vaddr);
+}
+
 typedef void (*mb_consumer)(mem_block *mb, void *ctx);
 
 static void ms_foreach_mb(mem_space *ms, mb_consumer c, void *ctx) {
@@ -271,27 +1806,13 @@ static void ms_foreach_mb(mem_space *ms, mb_consumer c, void *ctx) {
     }
 }
 
-typedef struct {
-    adb_cell_consumer c;
-    void *og_ctx;
-} ms_foreach_mp_consumer_context;
-
-static void ms_foreach_mp_consumer(addr_book_vaddr v, void *paddr, void *ctx) {
-    ms_foreach_mp_consumer_context *ms_f_mp_c_ctx = ctx;
-
-    // Skip over malloced header.
-    void *new_paddr = (mem_space_malloc_header *)paddr + 1;
-
-    ms_f_mp_c_ctx->c(v, new_paddr, ms_f_mp_c_ctx->og_ctx);
-}
-
 void ms_foreach(mem_space *ms, adb_cell_consumer c, void *ctx, uint8_t wr) {
-    ms_foreach_mp_consumer_context ms_f_mp_c_ctx = {
-        .c = c,
-        .og_ctx = ctx,
-    };
+    adb_foreach(ms->adb, c, ctx, wr);
+}
 
-    adb_foreach(ms->adb, ms_foreach_mp_consumer, &ms_f_mp_c_ctx, wr);
+void ms_foreach_defer(mem_space *ms, adb_cell_consumer c, 
+        adb_cell_busy_consumer busy, void *ctx) {
+    adb_foreach_defer(ms->adb, c, busy, ctx);
 }
 
 typedef struct {
@@ -331,20 +1852,165 @@ uint64_t ms_filter(mem_space *ms, adb_cell_predicate pred, void *ctx) {
 
     delete_broken_collection(remove_stack);
 
+    ms_release_empty(ms);
+
     return filtered;
 }
 
 
-static void mp_count_consumer(addr_book_vaddr v, void *paddr, void *ctx) {
-    (*(uint64_t *)ctx)++;
+uint64_t ms_count(mem_space *ms) {
+    // Every allocated vaddr of the book belongs to one of our pieces.
+    return adb_get_fill(ms->adb);
 }
 
-uint64_t ms_count(mem_space *ms) {
-    uint64_t count = 0; 
+mem_stats ms_get_stats(mem_space *ms) {
+    mem_stats *t = &(ms->totals);
+
+    mem_stats stats = {
+        .blocks = __atomic_load_n(&(t->blocks), __ATOMIC_RELAXED),
+        .live_count = ms_count(ms),
+        .live_bytes = __atomic_load_n(&(t->live_bytes), __ATOMIC_RELAXED),
+        .free_bytes = __atomic_load_n(&(t->free_bytes), __ATOMIC_RELAXED),
+        .max_free = 0,
+        .released_bytes = 
+            __atomic_load_n(&(t->released_bytes), __ATOMIC_RELAXED),
+    };
+
+    safe_mutex_lock(&(ms->bucket_lck));
+
+    // A block's bucket is the highest bit of its max_free, so the block 
+    // with the largest max_free is always in the highest bucket.
+    if (ms->bucket_bits) {
+        uint64_t b = 63 - (uint64_t)__builtin_clzll(ms->bucket_bits);
+
+        ms_mb_entry *e = ms->buckets[b];
+        do {
+            safe_mutex_lock(&(e->stat_lck));
+
+            if (e->stats.max_free > stats.max_free) {
+                stats.max_free = e->stats.max_free;
+            }
+
+            safe_mutex_unlock(&(e->stat_lck));
+
+            e = e->next;
+        } while (e != ms->buckets[b]);
+    }
+
+    // A slab with a free cell can hold one of its cell size.
+    uint64_t sc;
+    for (sc = 0; sc < MS_NUM_SLAB_CLASSES; sc++) {
+        if (ms->slabs[sc] && (sc + 1) * 8 > stats.max_free) {
+            stats.max_free = (sc + 1) * 8;
+        }
+    }
+
+    safe_mutex_unlock(&(ms->bucket_lck));
+
+    return stats;
+}
+
+// Every image starts with this value.
+static const uint64_t MS_IMAGE_MAGIC = 0x4348564D4D530004;
+
+typedef struct {
+    uint64_t magic;
+    uint64_t adb_t_cap;
+
+    // Number of tables in the address book. No saved vaddr can have a 
+    // table index past this. (See adb_restore_begin)
+    uint64_t adb_len;
+
+    uint64_t mb_min_bytes;
+
+    // Large blocks included. (See mb_is_large)
+    uint64_t mb_list_len;
+} ms_image_header;
+
+int ms_save_image(mem_space *ms, int fd) {
+    int res = 0;
+
+    safe_rdlock(&(ms->mb_list_lck));
+
+    ms_image_header ms_ih = {
+        .magic = MS_IMAGE_MAGIC,
+        .adb_t_cap = adb_get_table_cap(ms->adb),
+        .adb_len = adb_get_book_len(ms->adb),
+        .mb_min_bytes = ms->mb_min_bytes,
+        .mb_list_len = ms->mb_list_len + ms->large_len,
+    };
+
+    res = safe_write(fd, &ms_ih, sizeof(ms_image_header));
 
-    ms_foreach(ms, mp_count_consumer, &count, 0);
+    uint64_t i;
+    for (i = 0; !res && i < ms->mb_list_len; i++) {
+        res = mb_save(ms->mb_list[i], fd);
+    }
+
+    ms_mb_entry *e = ms->large;
+    for (i = 0; !res && i < ms->large_len; i++, e = e->next) {
+        res = mb_save(e->mb, fd);
+    }
+
+    safe_rwlock_unlock(&(ms->mb_list_lck));
+
+    return res;
+}
+
+mem_space *ms_load_image(uint64_t chnl, int fd) {
+    ms_image_header ms_ih;
+    size_t left;
+
+    // Every saved block takes up at least a word of the file.
+    if (safe_read(fd, &ms_ih, sizeof(ms_image_header)) || 
+            ms_ih.magic != MS_IMAGE_MAGIC || ms_ih.adb_t_cap == 0 ||
+            ms_ih.mb_min_bytes == 0 || ms_ih.mb_list_len == 0 ||
+            safe_bytes_left(fd, &left) || 
+            ms_ih.mb_list_len > left / sizeof(uint64_t)) {
+        return NULL;
+    }
+
+    mem_space *ms = new_mem_space_empty(chnl, ms_ih.adb_t_cap, 
+            ms_ih.mb_min_bytes, ms_ih.mb_list_len);
+
+    if (!ms) {
+        return NULL;
+    }
+
+    if (adb_restore_begin(ms->adb, ms_ih.adb_len)) {
+        delete_mem_space(ms);
+        return NULL;
+    }
 
-    return count;
+    mem_block *mb;
+
+    uint64_t i;
+    for (i = 0; i < ms_ih.mb_list_len; i++) {
+        mb = mb_load(chnl, ms->adb, fd, NULL, NULL);
+
+        if (!mb) {
+            break;
+        }
+
+        if (mb_is_large(mb)) {
+            ms_restat(ms, ms_large_add_unsafe(ms, mb));
+            continue;
+        }
+
+        ms->mb_list[(ms->mb_list_len)++] = mb;
+        ms_reindex(ms, ms_index_add_unsafe(ms, mb, 0));
+    }
+
+    // Must be done before the address book is used in any way.
+    // (Including during deletion)
+    adb_restore_finish(ms->adb);
+
+    if (i < ms_ih.mb_list_len) {
+        delete_mem_space(ms);
+        return NULL;
+    }
+
+    return ms;
 }
 
 void ms_print(mem_space *ms) {
@@ -358,6 +2024,12 @@ void ms_print(mem_space *ms) {
         mb_print(ms->mb_list[i]);
     }
 
+    ms_mb_entry *e = ms->large;
+    for (i = 0; i < ms->large_len; i++, e = e->next) {
+        safe_printf("Large Block %" PRIu64 " :\n", i);
+        mb_print(e->mb);
+    }
+
     safe_rwlock_unlock(&(ms->mb_list_lck));
 }
 
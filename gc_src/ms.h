@@ -8,21 +8,24 @@
 typedef struct mem_space_struct mem_space;
 
 // Mem spaces will have their own address books!
-mem_space *new_mem_space_seed(uint64_t chnl, uint64_t seed, 
-        uint64_t adb_t_cap, uint64_t mb_m_bytes);
-
-static inline mem_space *new_mem_space(uint64_t chnl, uint64_t adb_t_cap, 
-        uint64_t mb_m_bytes) {
-    return  new_mem_space_seed(chnl, time(NULL), adb_t_cap, mb_m_bytes);
-}
+mem_space *new_mem_space(uint64_t chnl, uint64_t adb_t_cap, 
+        uint64_t mb_m_bytes);
 
 void delete_mem_space(mem_space *ms);
 
-// This is something the users will see.
-typedef struct {
-    mem_block *mb;
-} mem_space_malloc_header;
-
+// Each thread keeps mallocing into the same home block until it fills,
+// so objects made together by one thread sit together.
+//
+// Small mallocs (64 bytes or less) skip the home block. They go to slab 
+// blocks instead, one set of slabs per size rounded up to 8 bytes.
+// (See new_mem_block_arr)
+//
+// Large mallocs, (Larger than the default block size and at least a 
+// page) each get a large block of their own. (See new_mem_block_large)
+// These blocks are never picked, shifted or evacuated. Once its piece 
+// is freed, a large block's pages are given back to the OS right away, 
+// but it stays mapped for a while, so optimistic readers never fault. 
+// Later large mallocs which fit reuse it. (See ms_trim_idle_large)
 malloc_res ms_malloc_p(mem_space *ms, uint64_t min_bytes, uint8_t hold);
 
 static inline addr_book_vaddr ms_malloc(mem_space *ms, uint64_t min_bytes) {
@@ -36,26 +39,212 @@ static inline malloc_res ms_malloc_and_hold(mem_space *ms,
 
 void ms_free(mem_space *ms, addr_book_vaddr vaddr);
 
+// Resize vaddr's piece to hold at least min_bytes. The piece is grown or
+// shrunk in place when its block allows it. Otherwise, it is moved to a
+// new piece which keeps the same vaddr, and the first min_bytes of its 
+// data. (Any bytes past the old size are left uninitialized)
+//
+// Region pieces and pinned pieces are only ever resized in place.
+// Shrinking a piece never fails.
+//
+// The caller must hold vaddr's write lock, and paddr must be the
+// paddr given by that lock. Returns the piece's new paddr, NULL if 
+// the piece could not be resized. (In which case it is left as is)
+void *ms_realloc_held(mem_space *ms, addr_book_vaddr vaddr, void *paddr, 
+        uint64_t min_bytes);
+
+// Same as ms_realloc_held, but vaddr's write lock is acquired for you.
+// Returns 0 on success, 1 on failure.
+uint8_t ms_realloc(mem_space *ms, addr_book_vaddr vaddr, uint64_t min_bytes);
+
+// Regions.
+//
+// A region owns private memory blocks which are never used by ms_malloc 
+// and are never shifted. ms_region_end frees every piece left in the 
+// region at once by deleting these blocks.
+//
+// Region pieces use the memory space's address book, so all other calls
+// work on them as usual. (Including ms_free)
+//
+// NOTE: A region should only be used by one thread at a time, and no
+// piece of the region can be in use when the region is ended.
+//
+// NOTE: Region pieces are not included in images. (See ms_save_image)
+typedef struct mem_region_struct mem_region;
+
+mem_region *ms_region_begin(mem_space *ms);
+
+malloc_res ms_region_malloc_p(mem_region *mr, uint64_t min_bytes, 
+        uint8_t hold);
+
+// Call c on the vaddr of every piece allocated in the region.
+// (See mb_foreach_vaddr)
+void ms_region_foreach(mem_region *mr, mb_vaddr_consumer c, void *ctx);
+
+void ms_region_end(mem_region *mr);
+
+// Thread local allocation buffers.
+//
+// A tlab holds a buffer reserved from one of the space's blocks. 
+// (See mb_buffer) Most calls to ms_tlab_malloc_p are served from this 
+// buffer without acquiring any block or space lock. When the buffer 
+// runs out, a new one is reserved. Requests too large for a buffer 
+// are given to ms_malloc_p.
+//
+// Tlab pieces are normal pieces of the space, so all other calls work
+// on them as usual. However, they are never shifted until flushed.
+//
+// NOTE: A tlab should only be used by one thread at a time. All tlabs 
+// must be ended before the space is saved or deleted.
+typedef struct mem_tlab_struct mem_tlab;
+
+mem_tlab *ms_tlab_begin(mem_space *ms);
+
+malloc_res ms_tlab_malloc_p(mem_tlab *tl, uint64_t min_bytes, uint8_t hold);
+
+// Give the unused space of the current buffer back to its block.
+void ms_tlab_flush(mem_tlab *tl);
+
+// Flush and delete the tlab. Its pieces are left as is.
+void ms_tlab_end(mem_tlab *tl);
+
+// Flush every tlab of the space which isn't in the middle of a call
+// right now. This way the space freed inside the buffers of idle 
+// threads is reclaimed too. Returns the number of buffers flushed.
+//
+// NOTE: A tlab's thread waits for this call to finish with its buffer.
+uint64_t ms_flush_idle_tlabs(mem_space *ms);
+
 uint8_t ms_allocated(mem_space *ms, addr_book_vaddr vaddr);
 
+// Number of bytes which can be used in the piece at paddr. 
+// (See mb_piece_bytes)
+//
+// NOTE: The piece's lock must be held when calling this.
+uint64_t ms_piece_bytes(mem_space *ms, const void *paddr);
+
 // This will call try full shift on all memory blocks
 // in the mem space at the time of the call.
 void ms_try_full_shift(mem_space *ms);
 
+// Same as ms_try_full_shift, but up to threads blocks are shifted at
+// once. Each block has its own lock, so shifts of different blocks never
+// wait on each other. The calling thread is one of the threads.
+void ms_try_parallel_shift(mem_space *ms, uint64_t threads);
+
+// Shift only the blocks whose fragmentation is at least min_frag, most
+// fragmented first. (See mb_fragmentation) No new blocks are shifted 
+// once budget has passed. (NULL for no time limit)
+//
+// Returns the number of blocks shifted.
+uint64_t ms_try_compact(mem_space *ms, uint64_t min_frag, 
+        const struct timespec *budget);
+
+// Give the pages of the space's empty blocks back to the OS. 
+// (See mb_release) A couple of empty blocks are always kept as spares.
+//
+// This is called at the end of ms_try_full_shift, ms_try_evacuate and
+// ms_filter.
+//
+// Returns the number of bytes released by this call.
+uint64_t ms_release_empty(mem_space *ms);
+
+// Number of bytes currently released across all of the space's blocks.
+uint64_t ms_released_bytes(mem_space *ms);
+
+// Only a few idle large blocks are kept for reuse, older ones are doomed.
+// This unmaps and forgets the blocks doomed before the last call. So, 
+// a doomed block outlives at least one full call interval, and any 
+// optimistic read of it started before it was doomed has long ended.
+//
+// This is called at the end of every collection. (See cs_collect_garbage)
+//
+// Returns the number of blocks unmapped.
+uint64_t ms_trim_idle_large(mem_space *ms);
+
+// Move the pieces of the space's sparsest blocks into its densest 
+// blocks, leaving the sparse blocks empty. (See mb_evacuate)
+// Region blocks are never touched.
+//
+// Returns the number of pieces moved.
+//
+// NOTE: Never call this in parallel with itself.
+uint64_t ms_try_evacuate(mem_space *ms);
+
 void *ms_get_write(mem_space *ms, addr_book_vaddr vaddr);
+
+// Returns NULL if the lock wasn't acquired.
+void *ms_try_get_write(mem_space *ms, addr_book_vaddr vaddr);
+
 void *ms_get_read(mem_space *ms, addr_book_vaddr vaddr);
 void ms_unlock(mem_space *ms, addr_book_vaddr vaddr);
 
+// Optimistic reads. (See adt_opt_read_begin)
+// The paddr returned points to the user's data, just like ms_get_read.
+adt_opt_read_res ms_opt_read_begin(mem_space *ms, addr_book_vaddr vaddr);
+uint8_t ms_opt_read_validate(mem_space *ms, addr_book_vaddr vaddr,
+        uint64_t version);
+
+// Atomic sections. (See adt_atomic_begin)
+// The paddr returned points to the user's data, just like ms_get_read.
+void *ms_atomic_begin(mem_space *ms, addr_book_vaddr vaddr);
+void ms_atomic_end(mem_space *ms, addr_book_vaddr vaddr);
+
+// Pinning. (See mb_pin)
+// The paddr returned points to the user's data, just like ms_get_read.
+void *ms_pin(mem_space *ms, addr_book_vaddr vaddr);
+void ms_unpin(mem_space *ms, addr_book_vaddr vaddr);
+uint64_t ms_pinned(mem_space *ms, addr_book_vaddr vaddr);
+void *ms_get_pinned(mem_space *ms, addr_book_vaddr vaddr);
+
 // NOTE:  While the below calls all are in a way "thread safe",
 // it doesn't really make sense to call them in parallel with any other
 // call.
 
 void ms_foreach(mem_space *ms, adb_cell_consumer c, void *ctx, uint8_t wr);
 
+// Write locks every piece like ms_foreach(..., 1), but never stalls on a 
+// busy piece while others are waiting. (See adt_foreach_defer)
+void ms_foreach_defer(mem_space *ms, adb_cell_consumer c, 
+        adb_cell_busy_consumer busy, void *ctx);
+
 // number of pieces deleted
 uint64_t ms_filter(mem_space *ms, adb_cell_predicate pred, void *ctx);
+
+// Number of pieces in the space. (Pieces in unflushed tlabs included)
+// This is read off of the address book's fill counters, so it never 
+// walks a block or the book's cells.
 uint64_t ms_count(mem_space *ms);
 
+// The stats of all of the space's blocks added up. Region blocks are
+// included. (See mb_get_stats)
+//
+// These are kept up to date as blocks change, so this is cheap enough 
+// to call often. live_count is always ms_count, so pieces in unflushed 
+// tlabs are counted. Their buffers' unused bytes are counted in 
+// live_bytes until they are flushed though. (See mb_buffer_flush)
+//
+// max_free is the largest max_free of the blocks ms_malloc can use, as of
+// each block's last change. Finding it walks the blocks of the highest 
+// bucket only. (See ms_pick_entry)
+mem_stats ms_get_stats(mem_space *ms);
+
+// Image calls. (See mb_save and mb_load)
+//
+// A saved memory space holds its construction parameters followed by
+// each of its memory blocks. Loading rebuilds the address book so that
+// every virtual address from the saved space refers to the same data in
+// the loaded space.
+//
+// NOTE: Never call ms_save_image in parallel with any other call to ms.
+
+// Returns 0 on success, -1 on error.
+int ms_save_image(mem_space *ms, int fd);
+
+// Returns NULL on error, or if the image is corrupt. fd must be a
+// regular file. (See mb_load)
+mem_space *ms_load_image(uint64_t chnl, int fd);
+
 void ms_print(mem_space *ms);
 
 #endif
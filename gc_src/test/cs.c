@@ -1,10 +1,13 @@
 #include "cs.h"
 #include "../../core_src/io.h"
+#include "../../core_src/mem.h"
 #include "../../testing_src/assert.h"
 #include "../../core_src/sys.h"
 
 #include "../../util_src/thread.h"
 
+#include <fcntl.h>
+#include <sched.h>
 #include <stdint.h>
 #include <string.h>
 #include <sys/_pthread/_pthread_rwlock_t.h>
@@ -12,7 +15,7 @@
 #include <unistd.h>
 
 static void test_new_collected_space(chunit_test_context *tc) {
-    collected_space *cs = new_collected_space_seed(1, 1, 10, 1000);
+    collected_space *cs = new_collected_space(1, 10, 1000);
 
     assert_eq_uint(tc, 0, cs_count(cs));
     
@@ -26,7 +29,7 @@ static const chunit_test CS_NEW = {
 };
 
 static void test_cs_new_obj(chunit_test_context *tc) {
-    collected_space *cs = new_collected_space_seed(1, 1, 10, 1000);
+    collected_space *cs = new_collected_space(1, 10, 1000);
 
     const uint64_t rt_len = 5;
     const uint64_t da_size = sizeof(uint64_t);
@@ -36,10 +39,8 @@ static void test_cs_new_obj(chunit_test_context *tc) {
     assert_false(tc, null_adb_addr(mor.vaddr));
     assert_non_null(tc, mor.i.h);
 
-    obj_header *obj_h = mor.i.h;
-
-    assert_eq_uint(tc, rt_len, obj_h->rt_len);
-    assert_eq_uint(tc, da_size, obj_h->da_size);
+    assert_eq_uint(tc, rt_len, mor.i.rt_len);
+    assert_eq_uint(tc, da_size, mor.i.da_size);
     cs_unlock(cs, mor.vaddr);
 
     delete_collected_space(cs);
@@ -52,7 +53,7 @@ static const chunit_test CS_NEW_OBJ = {
 };
 
 static void test_cs_new_root(chunit_test_context *tc) {
-    collected_space *cs = new_collected_space_seed(1, 1, 10, 1000);
+    collected_space *cs = new_collected_space(1, 10, 1000);
 
     const uint64_t roots = 8;
     cs_root_id root_ids[roots];
@@ -129,7 +130,7 @@ typedef struct {
 static const uint64_t CS_TEST_SIZE_MOD = 4; 
 
 static void run_cs_test(chunit_test_context *tc, const cs_test_blueprint *bp) {
-    collected_space *cs = new_collected_space_seed(1, 1, 10, 1000);
+    collected_space *cs = new_collected_space(1, 10, 1000);
 
     uint64_t *edges = safe_malloc(1, sizeof(uint64_t) * bp->num_objs);
 
@@ -228,7 +229,7 @@ static void run_cs_test(chunit_test_context *tc, const cs_test_blueprint *bp) {
     
         obj_index ind = cs_get_read_ind(cs, vaddrs[i]);
 
-        refs_len = ind.h->rt_len;
+        refs_len = ind.rt_len;
 
         // Copy references for post checking.
         refs = safe_malloc(1, sizeof(addr_book_vaddr) * refs_len);
@@ -616,7 +617,7 @@ typedef struct {
 
 static void cs_gc_multi_template(chunit_test_context *tc, uint8_t chnl,
         uint64_t num_threads, void *(*worker)(void *)) {
-    collected_space *cs = new_collected_space_seed(chnl, 1, 10, 1000);
+    collected_space *cs = new_collected_space(chnl, 10, 1000);
 
     cs_start_gc(cs, &CONSTANT_GC);   
     
@@ -759,6 +760,1091 @@ static const chunit_test CS_GC_MULTI_1 = {
     .timeout = 5,
 };
 
+static void test_cs_image(chunit_test_context *tc) {
+    char path[] = "/tmp/chvm_cs_image_XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(tc, fd != -1);
+    close(fd);
+
+    collected_space *cs = new_collected_space(1, 4, 400);
+
+    const uint64_t objs = 30;
+    addr_book_vaddr vaddrs[objs];
+
+    // Object i references object i + 1, only object 0 is rooted.
+    // Every third object also has a garbage neighbor.
+    uint64_t i;
+    for (i = 0; i < objs; i++) {
+        malloc_obj_res mor = cs_malloc_object_and_hold(cs, 1, sizeof(uint64_t));
+        *(uint64_t *)(mor.i.da) = i;
+        cs_unlock(cs, mor.vaddr);
+
+        vaddrs[i] = mor.vaddr;
+
+        if (i % 3 == 0) {
+            cs_malloc_object(cs, 0, sizeof(uint64_t) * 3);
+        }
+    }
+
+    for (i = 0; i < objs - 1; i++) {
+        obj_index ind = cs_get_write_ind(cs, vaddrs[i]);
+        ind.rt[0] = vaddrs[i + 1];
+        cs_unlock(cs, vaddrs[i]);
+    }
+
+    cs_root_id root_id = cs_root(cs, vaddrs[0]);
+    uint64_t count = cs_count(cs);
+
+    assert_false(tc, cs_save_image(cs, path));
+    delete_collected_space(cs);
+
+    cs = cs_load_image(1, path);
+    unlink(path);
+
+    assert_non_null(tc, cs);
+    assert_eq_uint(tc, count, cs_count(cs));
+
+    cs_get_root_res root_res = cs_get_root_vaddr(cs, root_id);
+    assert_eq_uint(tc, CS_SUCCESS, root_res.status_code);
+    assert_true(tc, eq_adb_addr(vaddrs[0], root_res.root_vaddr));
+
+    for (i = 0; i < objs; i++) {
+        obj_index ind = cs_get_read_ind(cs, vaddrs[i]);
+
+        assert_eq_uint(tc, i, *(uint64_t *)(ind.da));
+
+        if (i < objs - 1) {
+            assert_true(tc, eq_adb_addr(vaddrs[i + 1], ind.rt[0]));
+        } else {
+            assert_true(tc, null_adb_addr(ind.rt[0]));
+        }
+
+        cs_unlock(cs, vaddrs[i]);
+    }
+
+    // The loaded space should be fully usable.
+    assert_eq_uint(tc, count - objs, cs_collect_garbage(cs));
+
+    addr_book_vaddr new_vaddr = cs_malloc_object(cs, 0, 1);
+    assert_true(tc, cs_allocated(cs, new_vaddr));
+
+    for (i = 0; i < objs; i++) {
+        assert_false(tc, eq_adb_addr(vaddrs[i], new_vaddr));
+    }
+
+    cs_try_full_shift(cs);
+    assert_eq_uint(tc, objs + 1, cs_count(cs));
+
+    delete_collected_space(cs);
+}
+
+static const chunit_test CS_IMAGE = {
+    .name = "Collected Space Image",
+    .t = test_cs_image,
+    .timeout = 5,
+};
+
+typedef struct {
+    chunit_test_context * const tc;
+    collected_space * const cs;
+    const addr_book_vaddr vaddr;
+} cs_opt_read_arg;
+
+static void *cs_opt_read_worker(void *arg) {
+    util_thread_spray_context *s_ctx = arg;
+    cs_opt_read_arg *opt_arg = s_ctx->context;
+
+    uint64_t pair[2];
+
+    uint64_t i;
+    for (i = 0; i < 2000; i++) {
+        if (s_ctx->index == 0) {
+            // The first thread writes.
+            obj_index ind = cs_get_write_ind(opt_arg->cs, opt_arg->vaddr);
+            ((uint64_t *)(ind.da))[0] = i;
+            ((uint64_t *)(ind.da))[1] = i;
+            cs_unlock(opt_arg->cs, opt_arg->vaddr);
+        } else {
+            // The rest should never see a torn pair.
+            cs_read_da(opt_arg->cs, opt_arg->vaddr, 0, pair, sizeof(pair));
+            assert_eq_uint(opt_arg->tc, pair[0], pair[1]);
+        }
+    }
+
+    return NULL;
+}
+
+static void test_cs_opt_read(chunit_test_context *tc) {
+    collected_space *cs = new_collected_space(1, 10, 1000);
+
+    addr_book_vaddr child = cs_malloc_object(cs, 0, 1);
+
+    malloc_obj_res mor = cs_malloc_object_and_hold(cs, 1, 
+            sizeof(uint64_t) * 2);
+    mor.i.rt[0] = child;
+    ((uint64_t *)(mor.i.da))[0] = 7;
+    ((uint64_t *)(mor.i.da))[1] = 7;
+    cs_unlock(cs, mor.vaddr);
+
+    cs_opt_read_res res = cs_opt_read_begin(cs, mor.vaddr);
+    assert_non_null(tc, res.h);
+    assert_eq_uint(tc, 1, obj_h_to_index(res.h).rt_len);
+    assert_eq_uint(tc, sizeof(uint64_t) * 2, obj_h_to_index(res.h).da_size);
+    assert_true(tc, cs_opt_read_validate(cs, mor.vaddr, res.version));
+
+    assert_true(tc, eq_adb_addr(child, cs_read_rt(cs, mor.vaddr, 0)));
+
+    uint64_t val;
+    cs_read_da(cs, mor.vaddr, sizeof(uint64_t), &val, sizeof(uint64_t));
+    assert_eq_uint(tc, 7, val);
+
+    // Write locks force optimistic readers to retry.
+    cs_get_write(cs, mor.vaddr);
+    assert_eq_ptr(tc, NULL, cs_opt_read_begin(cs, mor.vaddr).h);
+    cs_unlock(cs, mor.vaddr);
+
+    assert_false(tc, cs_opt_read_validate(cs, mor.vaddr, res.version));
+
+    cs_opt_read_arg opt_arg = {
+        .tc = tc,
+        .cs = cs,
+        .vaddr = mor.vaddr,
+    };
+
+    util_thread_spray_info *spray = util_thread_spray(1, 4, 
+           cs_opt_read_worker, &opt_arg);
+    util_thread_collect(spray);
+
+    delete_collected_space(cs);
+}
+
+static const chunit_test CS_OPT_READ = {
+    .name = "Collected Space Optimistic Read",
+    .t = test_cs_opt_read,
+    .timeout = 5,
+};
+
+// Big enough for a large block of its own.
+#define CS_RESIZE_BIG_DA 100000
+
+typedef struct {
+    chunit_test_context * const tc;
+    collected_space * const cs;
+    const addr_book_vaddr vaddr;
+
+    // Set once the first thread is done resizing.
+    uint8_t done;
+} cs_opt_read_resize_arg;
+
+static void *cs_opt_read_resize_worker(void *arg) {
+    util_thread_spray_context *s_ctx = arg;
+    cs_opt_read_resize_arg *resize_arg = s_ctx->context;
+
+    if (s_ctx->index == 0) {
+        // The first thread moves the object out of its large block and 
+        // back in.
+        uint64_t i;
+        for (i = 0; i < 200; i++) {
+            assert_false(resize_arg->tc, cs_resize_object(resize_arg->cs, 
+                        resize_arg->vaddr, 0, sizeof(uint64_t)));
+
+            // Let the readers at the old block.
+            sched_yield();
+
+            assert_false(resize_arg->tc, cs_resize_object(resize_arg->cs, 
+                        resize_arg->vaddr, 0, CS_RESIZE_BIG_DA));
+
+            obj_index ind = cs_get_write_ind(resize_arg->cs, 
+                    resize_arg->vaddr);
+            ((uint64_t *)(ind.da))[(CS_RESIZE_BIG_DA / 8) - 1] = 7;
+            cs_unlock(resize_arg->cs, resize_arg->vaddr);
+
+            sched_yield();
+        }
+
+        __atomic_store_n(&(resize_arg->done), 1, __ATOMIC_RELEASE);
+
+        return NULL;
+    }
+
+    // The rest read the end of the big data array, which may be given
+    // back to the OS at any moment. A stale read must only ever fail 
+    // validation.
+    while (!__atomic_load_n(&(resize_arg->done), __ATOMIC_ACQUIRE)) {
+        cs_opt_read_res res = cs_opt_read_begin(resize_arg->cs, 
+                resize_arg->vaddr);
+
+        if (!res.h) {
+            sched_yield();
+            continue;
+        }
+
+        // Give the first thread a chance to move the object mid read.
+        sched_yield();
+
+        obj_index ind = obj_h_to_index(res.h);
+
+        if (ind.da_size != CS_RESIZE_BIG_DA) {
+            continue;
+        }
+
+        uint64_t val = __atomic_load_n(
+                (uint64_t *)(ind.da) + (CS_RESIZE_BIG_DA / 8) - 1, 
+                __ATOMIC_RELAXED);
+
+        if (cs_opt_read_validate(resize_arg->cs, resize_arg->vaddr, 
+                    res.version)) {
+            // (New data bytes are 0 until the first thread writes)
+            assert_true(resize_arg->tc, val == 0 || val == 7);
+        }
+    }
+
+    return NULL;
+}
+
+static void test_cs_opt_read_resize(chunit_test_context *tc) {
+    collected_space *cs = new_collected_space(1, 10, 1000);
+
+    addr_book_vaddr vaddr = cs_malloc_object(cs, 0, CS_RESIZE_BIG_DA);
+
+    cs_opt_read_resize_arg resize_arg = {
+        .tc = tc,
+        .cs = cs,
+        .vaddr = vaddr,
+        .done = 0,
+    };
+
+    util_thread_spray_info *spray = util_thread_spray(1, 4, 
+           cs_opt_read_resize_worker, &resize_arg);
+    util_thread_collect(spray);
+
+    assert_eq_uint(tc, CS_RESIZE_BIG_DA, 
+            cs_get_read_ind(cs, vaddr).da_size);
+    cs_unlock(cs, vaddr);
+
+    delete_collected_space(cs);
+}
+
+static const chunit_test CS_OPT_READ_RESIZE = {
+    .name = "Collected Space Optimistic Read Resize",
+    .t = test_cs_opt_read_resize,
+    .timeout = 5,
+};
+
+typedef struct {
+    collected_space * const cs;
+    const addr_book_vaddr *vaddrs;
+} cs_many_arg;
+
+static void *cs_many_worker(void *arg) {
+    util_thread_spray_context *s_ctx = arg;
+    cs_many_arg *many_arg = s_ctx->context;
+
+    // Each thread gives its objects in a different order, and the
+    // last thread gives a duplicate.
+    addr_book_vaddr vaddrs[3];
+    vaddrs[0] = many_arg->vaddrs[s_ctx->index % 3];
+    vaddrs[1] = many_arg->vaddrs[(s_ctx->index + 1) % 3];
+    vaddrs[2] = s_ctx->index == 3 ? vaddrs[0] 
+        : many_arg->vaddrs[(s_ctx->index + 2) % 3];
+
+    obj_header *hs[3];
+
+    uint64_t i;
+    for (i = 0; i < 500; i++) {
+        cs_get_write_many(many_arg->cs, vaddrs, 3, hs);
+
+        // Move a unit from the first object to the second.
+        (*(uint64_t *)(obj_h_to_index(hs[0]).da))--;
+        (*(uint64_t *)(obj_h_to_index(hs[1]).da))++;
+
+        cs_unlock_many(many_arg->cs, vaddrs, 3);
+    }
+
+    return NULL;
+}
+
+static void test_cs_get_write_many(chunit_test_context *tc) {
+    collected_space *cs = new_collected_space(1, 10, 1000);
+
+    addr_book_vaddr vaddrs[3];
+    obj_header *hs[3];
+
+    uint64_t i;
+    for (i = 0; i < 3; i++) {
+        vaddrs[i] = cs_get_root_vaddr(cs, 
+                cs_malloc_root(cs, 0, sizeof(uint64_t))).root_vaddr;
+    }
+
+    cs_get_write_many(cs, vaddrs, 3, hs);
+    for (i = 0; i < 3; i++) {
+        *(uint64_t *)(obj_h_to_index(hs[i]).da) = 1000;
+    }
+    cs_unlock_many(cs, vaddrs, 3);
+
+    // Every lock should have been released.
+    for (i = 0; i < 3; i++) {
+        assert_eq_ptr(tc, hs[i], cs_get_write(cs, vaddrs[i]));
+        cs_unlock(cs, vaddrs[i]);
+    }
+
+    cs_start_gc(cs, &CONSTANT_GC);   
+
+    cs_many_arg many_arg = {
+        .cs = cs,
+        .vaddrs = vaddrs,
+    };
+
+    util_thread_spray_info *spray = util_thread_spray(1, 4, 
+           cs_many_worker, &many_arg);
+    util_thread_collect(spray);
+
+    assert_false(tc, cs_stop_gc(cs));
+
+    uint64_t total = 0;
+    cs_get_write_many(cs, vaddrs, 3, hs);
+    for (i = 0; i < 3; i++) {
+        total += *(uint64_t *)(obj_h_to_index(hs[i]).da);
+    }
+    cs_unlock_many(cs, vaddrs, 3);
+
+    assert_eq_uint(tc, 3000, total);
+
+    delete_collected_space(cs);
+}
+
+static const chunit_test CS_GET_WRITE_MANY = {
+    .name = "Collected Space Get Write Many",
+    .t = test_cs_get_write_many,
+    .timeout = 5,
+};
+
+typedef struct {
+    collected_space * const cs;
+    const addr_book_vaddr vaddr;
+} cs_atomic_arg;
+
+static void *cs_atomic_worker(void *arg) {
+    util_thread_spray_context *s_ctx = arg;
+    cs_atomic_arg *atomic_arg = s_ctx->context;
+
+    uint64_t i;
+    for (i = 0; i < 2000; i++) {
+        if (s_ctx->index == 0 && i % 10 == 0) {
+            // Writers should never see an atomic update mid write.
+            obj_index ind = cs_get_write_ind(atomic_arg->cs, atomic_arg->vaddr);
+            ((uint64_t *)(ind.da))[0]++;
+            ((uint64_t *)(ind.da))[1]++;
+            cs_unlock(atomic_arg->cs, atomic_arg->vaddr);
+        } else {
+            cs_atomic_add_u64(atomic_arg->cs, atomic_arg->vaddr, 0, 1);
+            cs_atomic_add_u64(atomic_arg->cs, atomic_arg->vaddr, 
+                    sizeof(uint64_t), 1);
+        }
+    }
+
+    return NULL;
+}
+
+static void test_cs_atomic(chunit_test_context *tc) {
+    collected_space *cs = new_collected_space(1, 10, 1000);
+
+    addr_book_vaddr child0 = cs_malloc_object(cs, 0, 1);
+    addr_book_vaddr child1 = cs_malloc_object(cs, 0, 1);
+
+    cs_root_id root_id = cs_malloc_root(cs, 1, sizeof(uint64_t) * 2);
+    addr_book_vaddr vaddr = cs_get_root_vaddr(cs, root_id).root_vaddr;
+
+    assert_eq_uint(tc, 0, cs_atomic_load_u64(cs, vaddr, 0));
+    assert_eq_uint(tc, 5, cs_atomic_add_u64(cs, vaddr, 0, 5));
+    assert_false(tc, cs_atomic_cas_u64(cs, vaddr, 0, 4, 0));
+    assert_true(tc, cs_atomic_cas_u64(cs, vaddr, 0, 5, 0));
+    assert_eq_uint(tc, 0, cs_atomic_load_u64(cs, vaddr, 0));
+
+    assert_true(tc, cs_cas_ref(cs, vaddr, 0, NULL_VADDR, child0));
+    assert_false(tc, cs_cas_ref(cs, vaddr, 0, child1, child1));
+    assert_true(tc, eq_adb_addr(child0, cs_atomic_load_ref(cs, vaddr, 0)));
+
+    // child1 was never referenced.
+    assert_eq_uint(tc, 1, cs_collect_garbage(cs));
+    assert_true(tc, cs_allocated(cs, child0));
+
+    cs_start_gc(cs, &CONSTANT_GC);   
+
+    cs_atomic_arg atomic_arg = {
+        .cs = cs,
+        .vaddr = vaddr,
+    };
+
+    util_thread_spray_info *spray = util_thread_spray(1, 4, 
+           cs_atomic_worker, &atomic_arg);
+    util_thread_collect(spray);
+
+    assert_false(tc, cs_stop_gc(cs));
+
+    assert_eq_uint(tc, 8000, cs_atomic_load_u64(cs, vaddr, 0));
+    assert_eq_uint(tc, 8000, cs_atomic_load_u64(cs, vaddr, sizeof(uint64_t)));
+
+    delete_collected_space(cs);
+}
+
+static const chunit_test CS_ATOMIC = {
+    .name = "Collected Space Atomic",
+    .t = test_cs_atomic,
+    .timeout = 5,
+};
+
+typedef struct {
+    collected_space * const cs;
+    const addr_book_vaddr vaddr;
+
+    uint8_t held;
+} cs_hold_arg;
+
+static void *cs_hold_worker(void *arg) {
+    util_thread_spray_context *s_ctx = arg;
+    cs_hold_arg *hold_arg = s_ctx->context;
+
+    cs_get_write(hold_arg->cs, hold_arg->vaddr);
+    __atomic_store_n(&(hold_arg->held), 1, __ATOMIC_RELEASE);
+
+    // Only let go once the GC has had to defer us.
+    while (cs_gc_deferred(hold_arg->cs) == 0) {
+        sched_yield();
+    }
+
+    cs_unlock(hold_arg->cs, hold_arg->vaddr);
+
+    return NULL;
+}
+
+// Root -> {Held, Child0}, Held -> {Child1}
+static void test_cs_gc_deferred(chunit_test_context *tc) {
+    collected_space *cs = new_collected_space(1, 10, 1000);
+
+    addr_book_vaddr garbage = cs_malloc_object(cs, 0, 8);
+    addr_book_vaddr child0 = cs_malloc_object(cs, 0, 1);
+    addr_book_vaddr child1 = cs_malloc_object(cs, 0, 1);
+
+    malloc_obj_res held = cs_malloc_object_and_hold(cs, 1, 0);
+    held.i.rt[0] = child1;
+    cs_unlock(cs, held.vaddr);
+
+    malloc_obj_res root = cs_malloc_object_and_hold(cs, 2, 0);
+    root.i.rt[0] = held.vaddr;
+    root.i.rt[1] = child0;
+    cs_unlock(cs, root.vaddr);
+
+    cs_root(cs, root.vaddr);
+
+    cs_hold_arg hold_arg = {
+        .cs = cs,
+        .vaddr = held.vaddr,
+        .held = 0,
+    };
+
+    util_thread_spray_info *spray = util_thread_spray(1, 1, 
+           cs_hold_worker, &hold_arg);
+
+    while (!__atomic_load_n(&(hold_arg.held), __ATOMIC_ACQUIRE)) {
+        sched_yield();
+    }
+
+    // Held is busy when the GC gets to it, so it must be deferred.
+    assert_eq_uint(tc, 0, cs_gc_deferred(cs));
+    assert_eq_uint(tc, 1, cs_collect_garbage(cs));
+    assert_true(tc, cs_gc_deferred(cs) > 0);
+
+    util_thread_collect(spray);
+
+    assert_false(tc, cs_allocated(cs, garbage));
+    assert_true(tc, cs_allocated(cs, held.vaddr));
+    assert_true(tc, cs_allocated(cs, child0));
+    assert_true(tc, cs_allocated(cs, child1));
+
+    delete_collected_space(cs);
+}
+
+static const chunit_test CS_GC_DEFERRED = {
+    .name = "Collected Space Collect Garbage Deferred",
+    .t = test_cs_gc_deferred,
+    .timeout = 5,
+};
+
+static void test_cs_region(chunit_test_context *tc) {
+    collected_space *cs = new_collected_space(1, 10, 1000);
+
+    addr_book_vaddr outside = cs_malloc_object(cs, 0, 1);
+    cs_root_id root_id = cs_malloc_root(cs, 1, 0);
+    addr_book_vaddr root = cs_get_root_vaddr(cs, root_id).root_vaddr;
+
+    cs_region *r = cs_region_begin(cs);
+
+    // Enough objects to span many blocks.
+    addr_book_vaddr vaddrs[100];
+
+    uint64_t i;
+    for (i = 0; i < 100; i++) {
+        malloc_obj_res mor = cs_region_malloc_object_and_hold(r, 2, 16);
+        mor.i.rt[0] = i > 0 ? vaddrs[i - 1] : NULL_VADDR;
+        mor.i.rt[1] = outside;
+        cs_unlock(cs, mor.vaddr);
+
+        vaddrs[i] = mor.vaddr;
+    }
+
+    assert_eq_uint(tc, 102, cs_count(cs));
+
+    // Region objects are never collected, and they keep what they
+    // reference alive.
+    assert_eq_uint(tc, 0, cs_collect_garbage(cs));
+    cs_try_full_shift(cs);
+
+    // References within a region are fine, as are references from
+    // inside the region which are removed before it ends.
+    obj_index ind = cs_get_write_ind(cs, root);
+    ind.rt[0] = vaddrs[99];
+    cs_unlock(cs, root);
+
+    assert_eq_uint(tc, 0, cs_collect_garbage(cs));
+
+    ind = cs_get_write_ind(cs, root);
+    ind.rt[0] = NULL_VADDR;
+    cs_unlock(cs, root);
+
+    // Garbage which hasn't been collected yet may still point into the
+    // region. So may objects only reachable through the region.
+    addr_book_vaddr dead = cs_malloc_object(cs, 1, 0);
+    ind = cs_get_write_ind(cs, dead);
+    ind.rt[0] = vaddrs[50];
+    cs_unlock(cs, dead);
+
+    addr_book_vaddr back = cs_malloc_object(cs, 1, 0);
+    ind = cs_get_write_ind(cs, back);
+    ind.rt[0] = vaddrs[0];
+    cs_unlock(cs, back);
+
+    ind = cs_get_write_ind(cs, vaddrs[99]);
+    ind.rt[1] = back;
+    cs_unlock(cs, vaddrs[99]);
+
+    cs_region_end(r);
+
+    assert_eq_uint(tc, 4, cs_count(cs));
+
+    for (i = 0; i < 100; i++) {
+        assert_false(tc, cs_allocated(cs, vaddrs[i]));
+    }
+
+    // Without the region, outside, dead and back are garbage.
+    assert_eq_uint(tc, 3, cs_collect_garbage(cs));
+    assert_false(tc, cs_allocated(cs, outside));
+    assert_false(tc, cs_allocated(cs, dead));
+    assert_false(tc, cs_allocated(cs, back));
+
+    delete_collected_space(cs);
+}
+
+static const chunit_test CS_REGION = {
+    .name = "Collected Space Region",
+    .t = test_cs_region,
+    .timeout = 5,
+};
+
+static void test_cs_region_escape(chunit_test_context *tc) {
+    collected_space *cs = new_collected_space(1, 10, 1000);
+
+    cs_root_id root_id = cs_malloc_root(cs, 1, 0);
+    addr_book_vaddr root = cs_get_root_vaddr(cs, root_id).root_vaddr;
+
+    cs_region *r = cs_region_begin(cs);
+
+    addr_book_vaddr child = cs_malloc_object(cs, 1, 0);
+
+    obj_index ind = cs_get_write_ind(cs, child);
+    ind.rt[0] = cs_region_malloc_object(r, 0, 8);
+    cs_unlock(cs, child);
+
+    ind = cs_get_write_ind(cs, root);
+    ind.rt[0] = child;
+    cs_unlock(cs, root);
+
+    // A reachable object still references a region object.
+    cs_region_end(r);
+
+    delete_collected_space(cs);
+}
+
+static const chunit_test CS_REGION_ESCAPE = {
+    .name = "Collected Space Region Escape",
+    .t = test_cs_region_escape,
+    .timeout = 5,
+    .should_fail = 1,
+};
+
+static void test_cs_pin(chunit_test_context *tc) {
+    collected_space *cs = new_collected_space(1, 10, 1000);
+
+    addr_book_vaddr garbage = cs_malloc_object(cs, 0, 8);
+
+    // A pinned object with a single child, neither are rooted.
+    addr_book_vaddr child = cs_malloc_object(cs, 0, 1);
+    malloc_obj_res mor = cs_malloc_object_and_hold(cs, 1, sizeof(uint64_t));
+    mor.i.rt[0] = child;
+    cs_unlock(cs, mor.vaddr);
+
+    obj_index ind = cs_pin_ind(cs, mor.vaddr);
+    *(uint64_t *)(ind.da) = 7;
+
+    // Only the garbage should be collected.
+    assert_eq_uint(tc, 1, cs_collect_garbage(cs));
+    assert_false(tc, cs_allocated(cs, garbage));
+    assert_true(tc, cs_allocated(cs, child));
+
+    // The pinned object shouldn't move.
+    cs_try_full_shift(cs);
+    assert_eq_ptr(tc, ind.h, cs_get_read(cs, mor.vaddr));
+    cs_unlock(cs, mor.vaddr);
+
+    assert_eq_uint(tc, 7, *(uint64_t *)(ind.da));
+
+    cs_unpin(cs, mor.vaddr);
+
+    // Now everything is garbage.
+    assert_eq_uint(tc, 2, cs_collect_garbage(cs));
+
+    delete_collected_space(cs);
+}
+
+static const chunit_test CS_PIN = {
+    .name = "Collected Space Pin",
+    .t = test_cs_pin,
+    .timeout = 5,
+};
+
+static void test_cs_freeze(chunit_test_context *tc) {
+    char path[] = "/tmp/chvm_cs_freeze_XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(tc, fd != -1);
+    close(fd);
+
+    collected_space *cs = new_collected_space(1, 10, 1000);
+
+    addr_book_vaddr garbage = cs_malloc_object(cs, 0, 8);
+
+    addr_book_vaddr child = cs_malloc_object(cs, 0, 1);
+    malloc_obj_res mor = cs_malloc_object_and_hold(cs, 1, sizeof(uint64_t));
+    mor.i.rt[0] = child;
+    *(uint64_t *)(mor.i.da) = 7;
+    cs_unlock(cs, mor.vaddr);
+
+    cs_root_id root_id = cs_root(cs, mor.vaddr);
+
+    assert_false(tc, cs_frozen(cs, mor.vaddr));
+    cs_freeze(cs, mor.vaddr);
+    cs_freeze(cs, mor.vaddr);
+    assert_true(tc, cs_frozen(cs, mor.vaddr));
+
+    // Reading a frozen object takes no lock, so the GC and shifts should
+    // be able to run while we hold it.
+    obj_index ind = cs_get_read_ind(cs, mor.vaddr);
+
+    assert_eq_uint(tc, 1, cs_collect_garbage(cs));
+    assert_false(tc, cs_allocated(cs, garbage));
+    assert_true(tc, cs_allocated(cs, child));
+
+    cs_try_full_shift(cs);
+
+    assert_eq_ptr(tc, ind.h, cs_get_read(cs, mor.vaddr));
+    assert_eq_uint(tc, 7, *(uint64_t *)(ind.da));
+    assert_true(tc, eq_adb_addr(child, ind.rt[0]));
+
+    cs_unlock(cs, mor.vaddr);
+    cs_unlock(cs, mor.vaddr);
+
+    // Frozen objects survive images.
+    assert_false(tc, cs_save_image(cs, path));
+    delete_collected_space(cs);
+
+    cs = cs_load_image(1, path);
+    unlink(path);
+
+    assert_non_null(tc, cs);
+    assert_true(tc, cs_frozen(cs, mor.vaddr));
+    assert_false(tc, cs_frozen(cs, child));
+
+    // Freezing doesn't root.
+    cs_deroot(cs, root_id);
+    assert_eq_uint(tc, 2, cs_collect_garbage(cs));
+
+    delete_collected_space(cs);
+}
+
+static const chunit_test CS_FREEZE = {
+    .name = "Collected Space Freeze",
+    .t = test_cs_freeze,
+    .timeout = 5,
+};
+
+#define CS_FREEZE_BLOCKED_ROUNDS 50
+
+typedef struct {
+    collected_space * const cs;
+    addr_book_vaddr vaddr;
+} cs_freeze_blocked_arg;
+
+static void *cs_freeze_blocked_worker(void *arg) {
+    util_thread_spray_context *s_ctx = arg;
+    cs_freeze_blocked_arg *fb_arg = s_ctx->context;
+
+    if (s_ctx->index == 0) {
+        cs_freeze(fb_arg->cs, fb_arg->vaddr);
+
+        return NULL;
+    }
+
+    // The rest keep reading, so some may be blocked right as the object
+    // is frozen.
+    uint64_t i;
+    for (i = 0; i < 20; i++) {
+        cs_get_read(fb_arg->cs, fb_arg->vaddr);
+        cs_unlock(fb_arg->cs, fb_arg->vaddr);
+
+        sched_yield();
+    }
+
+    return NULL;
+}
+
+static void test_cs_freeze_blocked(chunit_test_context *tc) {
+    collected_space *cs = new_collected_space(1, 10, 1000);
+
+    cs_root_id root_id = cs_malloc_root(cs, CS_FREEZE_BLOCKED_ROUNDS, 0);
+    addr_book_vaddr root = cs_get_root_vaddr(cs, root_id).root_vaddr;
+
+    uint64_t i;
+    for (i = 0; i < CS_FREEZE_BLOCKED_ROUNDS; i++) {
+        cs_freeze_blocked_arg fb_arg = {
+            .cs = cs,
+            .vaddr = cs_malloc_object(cs, 0, 8),
+        };
+
+        obj_index ind = cs_get_write_ind(cs, root);
+        ind.rt[i] = fb_arg.vaddr;
+        cs_unlock(cs, root);
+
+        // The freezer and the readers queue up behind our write lock.
+        // Whichever gets the object first, no reader may be left 
+        // holding a lock.
+        cs_get_write(cs, fb_arg.vaddr);
+
+        util_thread_spray_info *spray = util_thread_spray(1, 4, 
+               cs_freeze_blocked_worker, &fb_arg);
+
+        uint64_t y;
+        for (y = 0; y < 100; y++) {
+            sched_yield();
+        }
+
+        cs_unlock(cs, fb_arg.vaddr);
+        util_thread_collect(spray);
+
+        assert_true(tc, cs_frozen(cs, fb_arg.vaddr));
+    }
+
+    // These need the write lock of every object, a leaked read lock 
+    // would block them forever.
+    assert_eq_uint(tc, 0, cs_collect_garbage(cs));
+    cs_try_full_shift(cs);
+
+    delete_collected_space(cs);
+}
+
+static const chunit_test CS_FREEZE_BLOCKED = {
+    .name = "Collected Space Freeze With Blocked Reader",
+    .t = test_cs_freeze_blocked,
+    .timeout = 5,
+};
+
+static void test_cs_shape(chunit_test_context *tc) {
+    char path[] = "/tmp/chvm_cs_shape_XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(tc, fd != -1);
+    close(fd);
+
+    cs_shape_id pair = cs_register_shape(2, sizeof(uint64_t) * 2, 7);
+    cs_shape_id leaf = cs_register_shape(0, sizeof(uint64_t), 0);
+
+    assert_true(tc, pair != CS_NO_SHAPE);
+    assert_true(tc, leaf != CS_NO_SHAPE && leaf != pair);
+
+    cs_shape shape = cs_get_shape(pair);
+    assert_eq_uint(tc, 2, shape.rt_len);
+    assert_eq_uint(tc, sizeof(uint64_t) * 2, shape.da_size);
+    assert_eq_uint(tc, 7, shape.flags);
+
+    collected_space *cs = new_collected_space(1, 10, 1000);
+
+    cs_root_id root_id = cs_malloc_root(cs, 1, 0);
+    addr_book_vaddr root = cs_get_root_vaddr(cs, root_id).root_vaddr;
+
+    addr_book_vaddr garbage = cs_malloc_shaped_object(cs, leaf);
+
+    malloc_obj_res child = cs_malloc_shaped_object_and_hold(cs, leaf);
+    assert_eq_uint(tc, 0, child.i.rt_len);
+    assert_eq_uint(tc, sizeof(uint64_t), child.i.da_size);
+    *(uint64_t *)(child.i.da) = 5;
+    cs_unlock(cs, child.vaddr);
+
+    malloc_obj_res mor = cs_malloc_shaped_object_and_hold(cs, pair);
+    assert_eq_uint(tc, pair, obj_h_shape(mor.i.h));
+    assert_eq_uint(tc, 2, mor.i.rt_len);
+    assert_true(tc, null_adb_addr(mor.i.rt[0]));
+    assert_true(tc, null_adb_addr(mor.i.rt[1]));
+    mor.i.rt[1] = child.vaddr;
+    ((uint64_t *)(mor.i.da))[1] = 9;
+    cs_unlock(cs, mor.vaddr);
+
+    obj_index ind = cs_get_write_ind(cs, root);
+    assert_eq_uint(tc, CS_NO_SHAPE, obj_h_shape(ind.h));
+    ind.rt[0] = mor.vaddr;
+    cs_unlock(cs, root);
+
+    assert_eq_uint(tc, 1, cs_collect_garbage(cs));
+    assert_false(tc, cs_allocated(cs, garbage));
+    cs_try_full_shift(cs);
+
+    // Shaped objects should survive an image round trip.
+    assert_false(tc, cs_save_image(cs, path));
+    delete_collected_space(cs);
+
+    cs = cs_load_image(1, path);
+    unlink(path);
+    assert_non_null(tc, cs);
+
+    uint64_t val;
+    cs_read_da(cs, mor.vaddr, sizeof(uint64_t), &val, sizeof(uint64_t));
+    assert_eq_uint(tc, 9, val);
+    assert_true(tc, eq_adb_addr(child.vaddr, cs_read_rt(cs, mor.vaddr, 1)));
+
+    ind = cs_get_read_ind(cs, child.vaddr);
+    assert_eq_uint(tc, leaf, obj_h_shape(ind.h));
+    assert_eq_uint(tc, 5, *(uint64_t *)(ind.da));
+    cs_unlock(cs, child.vaddr);
+
+    delete_collected_space(cs);
+}
+
+static const chunit_test CS_SHAPE = {
+    .name = "Collected Space Shape",
+    .t = test_cs_shape,
+    .timeout = 5,
+};
+
+static void test_cs_tlab(chunit_test_context *tc) {
+    collected_space *cs = new_collected_space(1, 10, 4000);
+
+    cs_root_id root_id = cs_malloc_root(cs, 1, 0);
+    addr_book_vaddr root = cs_get_root_vaddr(cs, root_id).root_vaddr;
+
+    cs_tlab *t = cs_tlab_begin(cs);
+
+    // A list hanging off of the root, with garbage in between.
+    addr_book_vaddr head = NULL_VADDR;
+
+    uint64_t i;
+    for (i = 0; i < 200; i++) {
+        malloc_obj_res mor = cs_tlab_malloc_object_and_hold(t, 1, 8);
+        mor.i.rt[0] = head;
+        *(uint64_t *)(mor.i.da) = i;
+        cs_unlock(cs, mor.vaddr);
+
+        head = mor.vaddr;
+
+        cs_tlab_malloc_object(t, 0, 8);
+    }
+
+    obj_index ind = cs_get_write_ind(cs, root);
+    ind.rt[0] = head;
+    cs_unlock(cs, root);
+
+    assert_eq_uint(tc, 401, cs_count(cs));
+    assert_eq_uint(tc, 200, cs_collect_garbage(cs));
+
+    // The tlab was idle, so the collection flushed its buffer. Only the
+    // survivors are left.
+    assert_eq_uint(tc, 201, cs_get_stats(cs).live_count);
+    cs_try_full_shift(cs);
+
+    addr_book_vaddr iter = head;
+    for (i = 200; i > 0; i--) {
+        ind = cs_get_read_ind(cs, iter);
+        assert_eq_uint(tc, i - 1, *(uint64_t *)(ind.da));
+        addr_book_vaddr next = ind.rt[0];
+        cs_unlock(cs, iter);
+
+        iter = next;
+    }
+
+    assert_true(tc, null_adb_addr(iter));
+
+    cs_tlab_end(t);
+
+    ind = cs_get_write_ind(cs, root);
+    ind.rt[0] = NULL_VADDR;
+    cs_unlock(cs, root);
+
+    assert_eq_uint(tc, 200, cs_collect_garbage(cs));
+    assert_eq_uint(tc, 1, cs_count(cs));
+
+    delete_collected_space(cs);
+}
+
+static const chunit_test CS_TLAB = {
+    .name = "Collected Space Tlab",
+    .t = test_cs_tlab,
+    .timeout = 5,
+};
+
+static void test_cs_resize(chunit_test_context *tc) {
+    collected_space *cs = new_collected_space(1, 10, 1000);
+
+    cs_root_id root_id = cs_malloc_root(cs, 1, 0);
+    addr_book_vaddr root = cs_get_root_vaddr(cs, root_id).root_vaddr;
+
+    addr_book_vaddr child = cs_malloc_object(cs, 0, 8);
+
+    malloc_obj_res mor = cs_malloc_object_and_hold(cs, 1, 8);
+    mor.i.rt[0] = child;
+    *(uint64_t *)(mor.i.da) = 42;
+    cs_unlock(cs, mor.vaddr);
+
+    obj_index ind = cs_get_write_ind(cs, root);
+    ind.rt[0] = mor.vaddr;
+    cs_unlock(cs, root);
+
+    // Too large to grow in place, the object must move.
+    assert_false(tc, cs_resize_object(cs, mor.vaddr, 3, 2000));
+
+    ind = cs_get_read_ind(cs, mor.vaddr);
+    assert_eq_uint(tc, 3, ind.rt_len);
+    assert_eq_uint(tc, 2000, ind.da_size);
+    assert_true(tc, eq_adb_addr(child, ind.rt[0]));
+    assert_true(tc, null_adb_addr(ind.rt[1]));
+    assert_true(tc, null_adb_addr(ind.rt[2]));
+    assert_eq_uint(tc, 42, *(uint64_t *)(ind.da));
+    assert_eq_uint(tc, 0, ind.da[1999]);
+    cs_unlock(cs, mor.vaddr);
+
+    assert_eq_uint(tc, 0, cs_collect_garbage(cs));
+    cs_try_full_shift(cs);
+
+    // Dropping the reference table drops child.
+    assert_false(tc, cs_resize_object(cs, mor.vaddr, 0, sizeof(uint64_t)));
+
+    ind = cs_get_read_ind(cs, mor.vaddr);
+    assert_eq_uint(tc, 0, ind.rt_len);
+    assert_eq_uint(tc, sizeof(uint64_t), ind.da_size);
+    assert_eq_uint(tc, 42, *(uint64_t *)(ind.da));
+    cs_unlock(cs, mor.vaddr);
+
+    assert_eq_uint(tc, 1, cs_collect_garbage(cs));
+    assert_false(tc, cs_allocated(cs, child));
+
+    delete_collected_space(cs);
+}
+
+static const chunit_test CS_RESIZE = {
+    .name = "Collected Space Resize",
+    .t = test_cs_resize,
+    .timeout = 5,
+};
+
+static void write_image_bytes(const char *path, const uint8_t *buf, 
+        uint64_t len) {
+    int fd = open(path, O_WRONLY | O_TRUNC);
+    safe_write(fd, buf, len);
+    close(fd);
+}
+
+static void test_cs_image_corrupt(chunit_test_context *tc) {
+    char path[] = "/tmp/chvm_cs_corrupt_XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(tc, fd != -1);
+    close(fd);
+
+    collected_space *cs = new_collected_space(1, 4, 400);
+
+    cs_root_id root_id = cs_malloc_root(cs, 1, 0);
+    addr_book_vaddr prev = cs_get_root_vaddr(cs, root_id).root_vaddr;
+
+    uint64_t i;
+    for (i = 0; i < 20; i++) {
+        malloc_obj_res mor = cs_malloc_object_and_hold(cs, 1, 8 * (i % 3));
+        cs_unlock(cs, mor.vaddr);
+
+        obj_index ind = cs_get_write_ind(cs, prev);
+        ind.rt[0] = mor.vaddr;
+        cs_unlock(cs, prev);
+
+        prev = mor.vaddr;
+    }
+
+    assert_false(tc, cs_save_image(cs, path));
+    delete_collected_space(cs);
+
+    fd = open(path, O_RDONLY);
+    uint64_t len = (uint64_t)lseek(fd, 0, SEEK_END);
+    lseek(fd, 0, SEEK_SET);
+
+    uint8_t *image = safe_malloc(1, len);
+    uint8_t *copy = safe_malloc(1, len);
+    assert_false(tc, safe_read(fd, image, len));
+    close(fd);
+
+    // Every cut short image is rejected.
+    uint64_t cut;
+    for (cut = 0; cut < len; cut += 8) {
+        write_image_bytes(path, image, cut);
+        assert_true(tc, cs_load_image(1, path) == NULL);
+    }
+
+    // A corrupt word is either rejected, or lands somewhere harmless.
+    // Either way, loading never exits.
+    uint64_t off;
+    for (off = 0; off + 8 <= len; off += 8) {
+        memcpy(copy, image, len);
+        *(uint64_t *)(copy + off) = ~*(uint64_t *)(copy + off);
+        write_image_bytes(path, copy, len);
+
+        cs = cs_load_image(1, path);
+
+        if (cs) {
+            cs_collect_garbage(cs);
+            delete_collected_space(cs);
+        }
+    }
+
+    // The untouched image is still fine.
+    write_image_bytes(path, image, len);
+    cs = cs_load_image(1, path);
+    unlink(path);
+
+    assert_non_null(tc, cs);
+    assert_eq_uint(tc, 21, cs_count(cs));
+    assert_eq_uint(tc, 0, cs_collect_garbage(cs));
+
+    delete_collected_space(cs);
+
+    safe_free(image);
+    safe_free(copy);
+}
+
+static const chunit_test CS_IMAGE_CORRUPT = {
+    .name = "Collected Space Image Corrupt",
+    .t = test_cs_image_corrupt,
+    .timeout = 5,
+};
 
 const chunit_test_suite GC_TEST_SUITE_CS = {
     .name = "Collected Space Test Suite",
@@ -785,6 +1871,22 @@ const chunit_test_suite GC_TEST_SUITE_CS = {
         &CS_GC_13,
         &CS_GC_MULTI_0,
         &CS_GC_MULTI_1,
+
+        &CS_IMAGE,
+        &CS_OPT_READ,
+        &CS_OPT_READ_RESIZE,
+        &CS_PIN,
+        &CS_FREEZE,
+        &CS_FREEZE_BLOCKED,
+        &CS_GET_WRITE_MANY,
+        &CS_ATOMIC,
+        &CS_GC_DEFERRED,
+        &CS_REGION,
+        &CS_REGION_ESCAPE,
+        &CS_SHAPE,
+        &CS_TLAB,
+        &CS_RESIZE,
+        &CS_IMAGE_CORRUPT,
     },
-    .tests_len = 19,
+    .tests_len = 34,
 };
@@ -6,4 +6,10 @@
 
 extern const chunit_test_suite GC_TEST_SUITE_CS;
 
+// Number of times the collector found an object locked by a user and 
+// came back to it later, over the life of the space.
+//
+// NOTE: This is only meant for tests, so it isn't part of cs.h.
+uint64_t cs_gc_deferred(collected_space *cs);
+
 #endif
@@ -667,6 +667,667 @@ static const chunit_test MB_COUNT = {
     .timeout = 5,
 };
 
+static void test_mb_pin(chunit_test_context *tc) {
+    addr_book *adb = new_addr_book(1, 10);
+    mem_block *mb = new_mem_block(1, adb, 1000);
+
+    addr_book_vaddr v1 = mb_malloc(mb, sizeof(int));
+    addr_book_vaddr v2 = mb_malloc(mb, sizeof(int));
+    addr_book_vaddr v3 = mb_malloc(mb, sizeof(int));
+
+    int *paddr = mb_pin(mb, v2);
+    *paddr = -5;
+
+    assert_eq_uint(tc, 1, mb_pinned_count(mb));
+    assert_true(tc, adb_pinned(adb, v2));
+    assert_false(tc, adb_pinned(adb, v3));
+
+    // Pins nest.
+    assert_eq_ptr(tc, paddr, mb_pin(mb, v2));
+    assert_eq_uint(tc, 2, mb_pinned_count(mb));
+
+    mb_free(mb, v1);
+
+    // v2 sits right after the only hole, so no shifting is possible.
+    assert_eq_uint(tc, MB_BUSY, mb_try_shift(mb));
+    assert_eq_ptr(tc, paddr, adb_get_read(adb, v2));
+    adb_unlock(adb, v2);
+
+    mb_unpin(mb, v2);
+    assert_true(tc, adb_pinned(adb, v2));
+
+    mb_unpin(mb, v2);
+    assert_false(tc, adb_pinned(adb, v2));
+    assert_eq_uint(tc, 0, mb_pinned_count(mb));
+
+    // Once unpinned, the piece can move again.
+    mb_try_full_shift(mb);
+    assert_eq_uint(tc, MB_NOT_NEEDED, mb_try_shift(mb));
+
+    paddr = adb_get_read(adb, v2);
+    assert_eq_int(tc, -5, *paddr);
+    adb_unlock(adb, v2);
+
+    delete_mem_block(mb);
+    delete_addr_book(adb);
+}
+
+static const chunit_test MB_PIN = {
+    .name = "Memory Block Pin",
+    .t = test_mb_pin,
+    .timeout = 5,
+};
+
+static void test_mb_piece_overhead(chunit_test_context *tc) {
+    addr_book *adb = new_addr_book(1, 10);
+    mem_block *mb = new_mem_block(1, adb, 1000);
+
+    const uint64_t free_space = mb_free_space(mb);
+    assert_eq_uint(tc, 1000, free_space);
+
+    // An occupied piece only costs a header and a vaddr.
+    const uint64_t overhead = sizeof(uint64_t) + sizeof(addr_book_vaddr);
+
+    addr_book_vaddr v1 = mb_malloc(mb, 24);
+    assert_eq_uint(tc, free_space - (24 + overhead), mb_free_space(mb));
+
+    // Sizes are rounded up to a multiple of 8.
+    addr_book_vaddr v2 = mb_malloc(mb, 20);
+    assert_eq_uint(tc, free_space - (48 + (2 * overhead)), mb_free_space(mb));
+
+    addr_book_vaddr v3 = mb_malloc(mb, 24);
+
+    // Freeing in any order must coalesce back into a single piece.
+    mb_free(mb, v2);
+    mb_free(mb, v1);
+    assert_eq_uint(tc, MB_SHIFT_SUCCESS, mb_try_shift(mb));
+    mb_free(mb, v3);
+
+    assert_eq_uint(tc, free_space, mb_free_space(mb));
+    assert_eq_uint(tc, MB_NOT_NEEDED, mb_try_shift(mb));
+
+    delete_mem_block(mb);
+    delete_addr_book(adb);
+}
+
+static const chunit_test MB_PIECE_OVERHEAD = {
+    .name = "Memory Block Piece Overhead",
+    .t = test_mb_piece_overhead,
+    .timeout = 5,
+};
+
+static void test_mb_best_fit(chunit_test_context *tc) {
+    addr_book *adb = new_addr_book(1, 10);
+    mem_block *mb = new_mem_block(1, adb, 4000);
+
+    // Holes of different sizes separated by occupied pieces.
+    malloc_res small = mb_malloc_and_hold(mb, 64);
+    adb_unlock(adb, small.vaddr);
+    mb_malloc(mb, 8);
+
+    malloc_res big = mb_malloc_and_hold(mb, 600);
+    adb_unlock(adb, big.vaddr);
+    mb_malloc(mb, 8);
+
+    mb_free(mb, big.vaddr);
+    mb_free(mb, small.vaddr);
+
+    // Each request should land in the smallest hole which fits it,
+    // not in the large free piece at the end of the block.
+    malloc_res res = mb_malloc_and_hold(mb, 64);
+    adb_unlock(adb, res.vaddr);
+    assert_eq_ptr(tc, small.paddr, res.paddr);
+
+    res = mb_malloc_and_hold(mb, 400);
+    adb_unlock(adb, res.vaddr);
+    assert_eq_ptr(tc, big.paddr, res.paddr);
+
+    delete_mem_block(mb);
+    delete_addr_book(adb);
+}
+
+static const chunit_test MB_BEST_FIT = {
+    .name = "Memory Block Best Fit",
+    .t = test_mb_best_fit,
+    .timeout = 5,
+};
+
+static void test_mb_bump(chunit_test_context *tc) {
+    addr_book *adb = new_addr_book(1, 10);
+    mem_block *mb = new_mem_block(1, adb, 1000);
+
+    const uint64_t free_space = mb_free_space(mb);
+
+    // Header and vaddr of each 24 byte piece.
+    const uint64_t piece_size = 24 + sizeof(uint64_t) + sizeof(addr_book_vaddr);
+
+    malloc_res r1 = mb_malloc_and_hold(mb, 24);
+    adb_unlock(adb, r1.vaddr);
+    malloc_res r2 = mb_malloc_and_hold(mb, 24);
+    adb_unlock(adb, r2.vaddr);
+
+    assert_eq_ptr(tc, (uint8_t *)r1.paddr + piece_size, r2.paddr);
+
+    mb_free(mb, r1.vaddr);
+    mb_try_full_shift(mb);
+    assert_eq_uint(tc, MB_NOT_NEEDED, mb_try_shift(mb));
+
+    // r2 now sits at the start, new pieces are bumped right after it.
+    assert_eq_ptr(tc, r1.paddr, adb_get_read(adb, r2.vaddr));
+    adb_unlock(adb, r2.vaddr);
+
+    malloc_res r3 = mb_malloc_and_hold(mb, 24);
+    adb_unlock(adb, r3.vaddr);
+    assert_eq_ptr(tc, r2.paddr, r3.paddr);
+
+    // Freeing the last piece gives its space back to the bump region.
+    mb_free(mb, r3.vaddr);
+    assert_eq_uint(tc, free_space - piece_size, mb_free_space(mb));
+    assert_eq_uint(tc, MB_NOT_NEEDED, mb_try_shift(mb));
+
+    mb_free(mb, r2.vaddr);
+    assert_eq_uint(tc, free_space, mb_free_space(mb));
+
+    delete_mem_block(mb);
+    delete_addr_book(adb);
+}
+
+static const chunit_test MB_BUMP = {
+    .name = "Memory Block Bump",
+    .t = test_mb_bump,
+    .timeout = 5,
+};
+
+static void test_mb_buffer(chunit_test_context *tc) {
+    addr_book *adb = new_addr_book(1, 10);
+    mem_block *mb = new_mem_block(1, adb, 2000);
+
+    const uint64_t free_space = mb_free_space(mb);
+    const uint64_t piece_size = 24 + sizeof(uint64_t) + sizeof(addr_book_vaddr);
+
+    mb_buffer buf;
+    assert_false(tc, mb_buffer_reserve(mb, 10 * piece_size, &buf));
+
+    // Outside of the buffer, the block works as usual.
+    addr_book_vaddr outside = mb_malloc(mb, 24);
+    assert_false(tc, null_adb_addr(outside));
+
+    malloc_res res[10];
+
+    uint64_t i;
+    for (i = 0; i < 10; i++) {
+        res[i] = mb_buffer_malloc_p(&buf, 24, 1);
+        assert_false(tc, null_adb_addr(res[i].vaddr));
+
+        *(uint64_t *)(res[i].paddr) = i;
+        adb_unlock(adb, res[i].vaddr);
+
+        if (i > 0) {
+            assert_eq_ptr(tc, (uint8_t *)res[i - 1].paddr + piece_size, 
+                    res[i].paddr);
+        }
+    }
+
+    // The buffer is full.
+    assert_true(tc, null_adb_addr(mb_buffer_malloc_p(&buf, 24, 0).vaddr));
+
+    // Buffered pieces are only seen by the block once flushed.
+    assert_eq_uint(tc, 1, mb_count(mb));
+
+    mb_free(mb, res[3].vaddr);
+    mb_free(mb, res[4].vaddr);
+    mb_free(mb, res[9].vaddr);
+
+    // Buffered pieces are never shifted.
+    mb_try_full_shift(mb);
+
+    mb_buffer_flush(&buf);
+    assert_eq_uint(tc, 8, mb_count(mb));
+
+    mb_try_full_shift(mb);
+    assert_eq_uint(tc, MB_NOT_NEEDED, mb_try_shift(mb));
+
+    for (i = 0; i < 10; i++) {
+        if (i == 3 || i == 4 || i == 9) {
+            continue;
+        }
+
+        assert_eq_uint(tc, i, *(uint64_t *)adb_get_read(adb, res[i].vaddr));
+        adb_unlock(adb, res[i].vaddr);
+
+        mb_free(mb, res[i].vaddr);
+    }
+
+    mb_free(mb, outside);
+    assert_eq_uint(tc, free_space, mb_free_space(mb));
+
+    delete_mem_block(mb);
+    delete_addr_book(adb);
+}
+
+static const chunit_test MB_BUFFER = {
+    .name = "Memory Block Buffer",
+    .t = test_mb_buffer,
+    .timeout = 5,
+};
+
+static void test_mb_full_shift(chunit_test_context *tc) {
+    addr_book *adb = new_addr_book(1, 100);
+    mem_block *mb = new_mem_block(1, adb, 8000);
+
+    uint64_t free_space = mb_free_space(mb);
+
+    const uint64_t num_mallocs = 60;
+    const uint64_t locked = 33;
+
+    addr_book_vaddr vaddrs[num_mallocs];
+
+    uint64_t i;
+    for (i = 0; i < num_mallocs; i++) {
+        uint64_t min_size = 8 * ((i % 5) + 1);
+        malloc_res res = mb_malloc_and_hold(mb, min_size);
+        write_test_bytes(res.paddr, min_size, vaddr_to_unique_byte(res.vaddr));
+        adb_unlock(adb, res.vaddr);
+
+        vaddrs[i] = res.vaddr;
+    }
+
+    // Free runs of pieces of different lengths.
+    for (i = 0; i < num_mallocs; i++) {
+        if (i % 7 == 0 || i % 7 == 3 || i % 7 == 4) {
+            mb_free(mb, vaddrs[i]);
+            vaddrs[i] = NULL_VADDR;
+        }
+    }
+
+    // The hole in front of a locked piece must stay put.
+    uint8_t *locked_paddr = adb_get_write(adb, vaddrs[locked]);
+    assert_eq_uint(tc, MB_BUSY, mb_try_full_shift(mb));
+    adb_unlock(adb, vaddrs[locked]);
+
+    assert_eq_ptr(tc, locked_paddr, adb_get_read(adb, vaddrs[locked]));
+    adb_unlock(adb, vaddrs[locked]);
+
+    assert_eq_uint(tc, MB_SHIFT_SUCCESS, mb_try_full_shift(mb));
+    assert_eq_uint(tc, MB_NOT_NEEDED, mb_try_shift(mb));
+    assert_eq_uint(tc, MB_NOT_NEEDED, mb_try_full_shift(mb));
+
+    // Every survivor should be packed in address order, data intact.
+    uint8_t *prev_paddr = NULL;
+
+    for (i = 0; i < num_mallocs; i++) {
+        if (null_adb_addr(vaddrs[i])) {
+            continue;
+        }
+
+        uint64_t min_size = 8 * ((i % 5) + 1);
+        uint8_t *paddr = adb_get_read(adb, vaddrs[i]);
+        check_test_bytes(tc, paddr, min_size, vaddr_to_unique_byte(vaddrs[i]));
+        adb_unlock(adb, vaddrs[i]);
+
+        assert_true(tc, prev_paddr < paddr);
+        prev_paddr = paddr;
+    }
+
+    for (i = 0; i < num_mallocs; i++) {
+        if (!null_adb_addr(vaddrs[i])) {
+            mb_free(mb, vaddrs[i]);
+        }
+    }
+
+    assert_eq_uint(tc, free_space, mb_free_space(mb));
+
+    delete_mem_block(mb);
+    delete_addr_book(adb);
+}
+
+static const chunit_test MB_FULL_SHIFT = {
+    .name = "Memory Block Full Shift",
+    .t = test_mb_full_shift,
+    .timeout = 5,
+};
+
+static void test_mb_evacuate(chunit_test_context *tc) {
+    addr_book *adb = new_addr_book(1, 100);
+    mem_block *src = new_mem_block(1, adb, 4000);
+    mem_block *dest = new_mem_block(1, adb, 1000);
+
+    uint64_t free_space = mb_free_space(src);
+
+    const uint64_t num_mallocs = 50;
+
+    addr_book_vaddr vaddrs[num_mallocs];
+
+    uint64_t i;
+    for (i = 0; i < num_mallocs; i++) {
+        uint64_t min_size = 8 * ((i % 3) + 1);
+        malloc_res res = mb_malloc_and_hold(src, min_size);
+        write_test_bytes(res.paddr, min_size, vaddr_to_unique_byte(res.vaddr));
+        adb_unlock(adb, res.vaddr);
+
+        vaddrs[i] = res.vaddr;
+    }
+
+    for (i = 0; i < num_mallocs; i++) {
+        if (i % 5) {
+            mb_free(src, vaddrs[i]);
+            vaddrs[i] = NULL_VADDR;
+        }
+    }
+
+    addr_book_vaddr outside = mb_malloc(dest, 8);
+
+    // Locked pieces are left behind.
+    adb_get_read(adb, vaddrs[5]);
+    uint8_t full;
+    assert_eq_uint(tc, 9, mb_evacuate(src, dest, &full));
+    assert_false(tc, full);
+    adb_unlock(adb, vaddrs[5]);
+
+    assert_eq_uint(tc, 1, mb_count(src));
+    assert_eq_uint(tc, 10, mb_count(dest));
+
+    assert_eq_uint(tc, 1, mb_evacuate(src, dest, NULL));
+    assert_eq_uint(tc, 0, mb_count(src));
+    assert_eq_uint(tc, 0, mb_used_space(src));
+    assert_eq_uint(tc, free_space, mb_free_space(src));
+
+    for (i = 0; i < num_mallocs; i += 5) {
+        uint64_t min_size = 8 * ((i % 3) + 1);
+        uint8_t *paddr = adb_get_read(adb, vaddrs[i]);
+        assert_true(tc, mb_contains(dest, paddr));
+        check_test_bytes(tc, paddr, min_size, vaddr_to_unique_byte(vaddrs[i]));
+        adb_unlock(adb, vaddrs[i]);
+
+        // The piece isn't in src anymore.
+        assert_true(tc, mb_free_if_owner(src, vaddrs[i]));
+        assert_false(tc, mb_free_if_owner(dest, vaddrs[i]));
+    }
+
+    // A piece which doesn't fit means the destination is full.
+    addr_book_vaddr big = mb_malloc(src, 2000);
+    assert_eq_uint(tc, 0, mb_evacuate(src, dest, &full));
+    assert_true(tc, full);
+    mb_free(src, big);
+
+    mb_free(dest, outside);
+    assert_eq_uint(tc, 0, mb_used_space(dest));
+
+    delete_mem_block(src);
+    delete_mem_block(dest);
+    delete_addr_book(adb);
+}
+
+static const chunit_test MB_EVACUATE = {
+    .name = "Memory Block Evacuate",
+    .t = test_mb_evacuate,
+    .timeout = 5,
+};
+
+static void test_mb_fragmentation(chunit_test_context *tc) {
+    addr_book *adb = new_addr_book(1, 100);
+    mem_block *mb = new_mem_block(1, adb, 8000);
+
+    assert_eq_uint(tc, 0, mb_fragmentation(mb));
+
+    const uint64_t num_mallocs = 200;
+    addr_book_vaddr vaddrs[num_mallocs];
+
+    uint64_t i, n;
+    for (n = 0; n < num_mallocs; n++) {
+        vaddrs[n] = mb_malloc(mb, 64);
+
+        if (null_adb_addr(vaddrs[n])) {
+            break;
+        }
+    }
+
+    // The block is full, nothing to be fragmented.
+    assert_eq_uint(tc, 0, mb_fragmentation(mb));
+
+    // Lots of small holes.
+    for (i = 0; i < n; i += 2) {
+        mb_free(mb, vaddrs[i]);
+    }
+
+    assert_true(tc, mb_fragmentation(mb) > 90);
+
+    // All holes join the bump region.
+    assert_eq_uint(tc, MB_SHIFT_SUCCESS, mb_try_full_shift(mb));
+    assert_eq_uint(tc, 0, mb_fragmentation(mb));
+
+    delete_mem_block(mb);
+    delete_addr_book(adb);
+}
+
+static const chunit_test MB_FRAGMENTATION = {
+    .name = "Memory Block Fragmentation",
+    .t = test_mb_fragmentation,
+    .timeout = 5,
+};
+
+static void assert_mb_stats(chunit_test_context *tc, mem_block *mb, 
+        uint64_t live_count) {
+    mem_stats stats = mb_get_stats(mb);
+
+    assert_eq_uint(tc, 1, stats.blocks);
+    assert_eq_uint(tc, live_count, stats.live_count);
+    assert_eq_uint(tc, mb_count(mb), stats.live_count);
+    assert_eq_uint(tc, mb_used_space(mb), stats.live_bytes);
+    assert_eq_uint(tc, mb_capacity(mb), stats.live_bytes + stats.free_bytes);
+    assert_true(tc, stats.max_free <= mb_free_space(mb));
+}
+
+static void test_mb_stats(chunit_test_context *tc) {
+    addr_book *adb = new_addr_book(1, 100);
+    mem_block *mb = new_mem_block(1, adb, 8000);
+
+    assert_mb_stats(tc, mb, 0);
+    assert_eq_uint(tc, mb_free_space(mb), mb_get_stats(mb).max_free);
+
+    const uint64_t num_mallocs = 50;
+    addr_book_vaddr vaddrs[num_mallocs];
+
+    uint64_t i;
+    for (i = 0; i < num_mallocs; i++) {
+        vaddrs[i] = mb_malloc(mb, 8 * ((i % 4) + 1));
+    }
+
+    assert_mb_stats(tc, mb, 50);
+
+    for (i = 0; i < num_mallocs; i += 3) {
+        mb_free(mb, vaddrs[i]);
+    }
+
+    assert_mb_stats(tc, mb, 33);
+
+    // Buffered pieces only count once flushed.
+    mb_buffer buf;
+    assert_false(tc, mb_buffer_reserve(mb, 500, &buf));
+
+    addr_book_vaddr buffered[5];
+    for (i = 0; i < 5; i++) {
+        buffered[i] = mb_buffer_malloc_p(&buf, 24, 0).vaddr;
+    }
+
+    mb_free(mb, buffered[2]);
+    assert_mb_stats(tc, mb, 33);
+
+    mb_buffer_flush(&buf);
+    assert_mb_stats(tc, mb, 37);
+
+    assert_eq_uint(tc, MB_SHIFT_SUCCESS, mb_try_full_shift(mb));
+    assert_mb_stats(tc, mb, 37);
+
+    // After a full shift, all free space is in the bump region.
+    assert_eq_uint(tc, mb_free_space(mb), mb_get_stats(mb).max_free);
+
+    delete_mem_block(mb);
+    delete_addr_book(adb);
+}
+
+static const chunit_test MB_STATS = {
+    .name = "Memory Block Stats",
+    .t = test_mb_stats,
+    .timeout = 5,
+};
+
+static void test_mb_slab(chunit_test_context *tc) {
+    addr_book *adb = new_addr_book(1, 100);
+
+    const uint64_t num_cells = 100;
+    const uint64_t cell_bytes = 24;
+    mem_block *mb = new_mem_block_arr(1, adb, cell_bytes, num_cells);
+
+    assert_eq_uint(tc, cell_bytes, mb_cell_bytes(mb));
+    assert_eq_uint(tc, cell_bytes, mb_free_space(mb));
+
+    // No tags, a cell is just a vaddr and a body.
+    assert_eq_uint(tc, num_cells * (cell_bytes + sizeof(addr_book_vaddr)), 
+            mb_capacity(mb));
+
+    assert_true(tc, null_adb_addr(mb_malloc(mb, cell_bytes + 1)));
+
+    addr_book_vaddr vaddrs[num_cells];
+
+    uint64_t i;
+    for (i = 0; i < num_cells; i++) {
+        vaddrs[i] = mb_malloc(mb, 8 * ((i % 3) + 1));
+        assert_false(tc, null_adb_addr(vaddrs[i]));
+
+        fill_unique(adb, vaddrs[i], 8);
+    }
+
+    assert_true(tc, null_adb_addr(mb_malloc(mb, 8)));
+    assert_eq_uint(tc, 0, mb_free_space(mb));
+    assert_mb_stats(tc, mb, num_cells);
+
+    for (i = 0; i < num_cells; i += 2) {
+        mb_free(mb, vaddrs[i]);
+    }
+
+    assert_mb_stats(tc, mb, num_cells / 2);
+
+    // Every free cell is as good as any other.
+    assert_eq_uint(tc, 0, mb_fragmentation(mb));
+    assert_eq_uint(tc, MB_NOT_NEEDED, mb_try_full_shift(mb));
+
+    mb_buffer buf;
+    assert_true(tc, mb_buffer_reserve(mb, 8, &buf));
+
+    // Freed cells are used again.
+    for (i = 0; i < num_cells; i += 2) {
+        vaddrs[i] = mb_malloc(mb, cell_bytes);
+        assert_false(tc, null_adb_addr(vaddrs[i]));
+
+        fill_unique(adb, vaddrs[i], cell_bytes);
+    }
+
+    assert_true(tc, null_adb_addr(mb_malloc(mb, 8)));
+
+    for (i = 0; i < num_cells; i++) {
+        check_unique_vaddr_body(tc, adb, vaddrs[i], i % 2 ? 8 : cell_bytes);
+    }
+
+    delete_mem_block(mb);
+    delete_addr_book(adb);
+}
+
+static const chunit_test MB_SLAB = {
+    .name = "Memory Block Slab",
+    .t = test_mb_slab,
+    .timeout = 5,
+};
+
+static void test_mb_realloc(chunit_test_context *tc) {
+    addr_book *adb = new_addr_book(1, 100);
+    mem_block *mb = new_mem_block(1, adb, 2000);
+
+    addr_book_vaddr a = mb_malloc(mb, 32);
+    addr_book_vaddr b = mb_malloc(mb, 32);
+    addr_book_vaddr c = mb_malloc(mb, 32);
+
+    fill_unique(adb, a, 32);
+    fill_unique(adb, b, 32);
+    fill_unique(adb, c, 32);
+
+    // c is right before the bump region.
+    void *paddr = adb_get_write(adb, c);
+    assert_false(tc, mb_realloc(mb, paddr, 200));
+    assert_true(tc, mb_piece_bytes(mb, paddr) >= 200);
+    adb_unlock(adb, c);
+
+    check_unique_vaddr_body(tc, adb, c, 32);
+    fill_unique(adb, c, 200);
+
+    // a is stuck behind b.
+    paddr = adb_get_write(adb, a);
+    assert_true(tc, mb_realloc(mb, paddr, 64));
+    adb_unlock(adb, a);
+
+    // Until b is freed.
+    mb_free(mb, b);
+
+    paddr = adb_get_write(adb, a);
+    assert_false(tc, mb_realloc(mb, paddr, 64));
+    assert_true(tc, mb_piece_bytes(mb, paddr) >= 64);
+    adb_unlock(adb, a);
+
+    check_unique_vaddr_body(tc, adb, a, 32);
+    fill_unique(adb, a, 64);
+
+    // Shrinking gives space back.
+    uint64_t free_space = mb_free_space(mb);
+
+    paddr = adb_get_write(adb, c);
+    assert_false(tc, mb_realloc(mb, paddr, 8));
+    adb_unlock(adb, c);
+
+    assert_true(tc, mb_free_space(mb) > free_space);
+    check_unique_vaddr_body(tc, adb, c, 8);
+    assert_mb_stats(tc, mb, 2);
+
+    // Moving a to another block keeps its vaddr and data.
+    mem_block *mb2 = new_mem_block(1, adb, 2000);
+
+    paddr = adb_get_write(adb, a);
+    void *new_paddr = mb_malloc_into(mb2, a, 100, 64);
+    assert_non_null(tc, new_paddr);
+    mb_free_moved(mb, paddr);
+    adb_unlock(adb, a);
+
+    assert_true(tc, mb_contains(mb2, new_paddr));
+    check_unique_vaddr_body(tc, adb, a, 64);
+
+    assert_mb_stats(tc, mb, 1);
+    assert_mb_stats(tc, mb2, 1);
+
+    mb_free(mb2, a);
+    mb_free(mb, c);
+
+    // A cell can only be "resized" within its cell.
+    mem_block *slab = new_mem_block_arr(1, adb, 24, 10);
+    addr_book_vaddr s = mb_malloc(slab, 8);
+
+    paddr = adb_get_write(adb, s);
+    assert_false(tc, mb_realloc(slab, paddr, 24));
+    assert_true(tc, mb_realloc(slab, paddr, 32));
+    adb_unlock(adb, s);
+
+    mb_free(slab, s);
+
+    delete_mem_block(slab);
+    delete_mem_block(mb2);
+    delete_mem_block(mb);
+    delete_addr_book(adb);
+}
+
+static const chunit_test MB_REALLOC = {
+    .name = "Memory Block Realloc",
+    .t = test_mb_realloc,
+    .timeout = 5,
+};
+
 const chunit_test_suite GC_TEST_SUITE_MB = {
     .name = "Memory Block Test Suite",
     .tests = {
@@ -690,6 +1351,17 @@ const chunit_test_suite GC_TEST_SUITE_MB = {
 
         &MB_MALLOC_AND_HOLD,
         &MB_COUNT,
+        &MB_PIN,
+        &MB_PIECE_OVERHEAD,
+        &MB_BEST_FIT,
+        &MB_BUMP,
+        &MB_BUFFER,
+        &MB_FULL_SHIFT,
+        &MB_EVACUATE,
+        &MB_FRAGMENTATION,
+        &MB_STATS,
+        &MB_SLAB,
+        &MB_REALLOC,
     },
-    .tests_len = 17,
+    .tests_len = 28,
 };
@@ -8,9 +8,11 @@
 #include "../../util_src/thread.h"
 #include <stdint.h>
 #include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
 
 static void test_new_mem_space(chunit_test_context *tc) {
-    mem_space *ms = new_mem_space_seed(1, 1, 10, 10);
+    mem_space *ms = new_mem_space(1, 10, 10);
     delete_mem_space(ms);
 }
 
@@ -21,7 +23,7 @@ const chunit_test MS_NEW = {
 };
 
 static void test_ms_maf_0(chunit_test_context *tc) {
-    mem_space *ms = new_mem_space_seed(1, 1, 10, sizeof(int));
+    mem_space *ms = new_mem_space(1, 10, sizeof(int));
 
     addr_book_vaddr vaddr = ms_malloc(ms, sizeof(int));
 
@@ -47,7 +49,7 @@ const chunit_test MS_MAF_0 = {
 static void test_ms_maf_1(chunit_test_context *tc) {
     const char *msg = "Hello";
 
-    mem_space *ms = new_mem_space_seed(1, 1, 10, sizeof(int));
+    mem_space *ms = new_mem_space(1, 10, sizeof(int));
     addr_book_vaddr vaddr = ms_malloc(ms, strlen(msg) + 1);
 
     char *paddr = ms_get_write(ms, vaddr);
@@ -73,8 +75,8 @@ typedef struct {
 
     uint8_t vaddr_chnl;
 
-    // Whether or not we should shift after
-    // freeing.
+    // Number of threads to shift with after
+    // freeing. (0 for no shift)
     uint8_t shift;
 
     uint64_t num_mallocs; 
@@ -115,8 +117,10 @@ static void ms_chop_and_check(ms_chop_args *args) {
         vaddrs[i] = NULL_VADDR;
     }
 
-    if (args->shift) {
+    if (args->shift == 1) {
         ms_try_full_shift(args->ms);
+    } else if (args->shift > 1) {
+        ms_try_parallel_shift(args->ms, args->shift);
     }
 
     for (i = 0; i < args->num_mallocs; i++) {
@@ -139,7 +143,7 @@ static void ms_chop_and_check(ms_chop_args *args) {
 }
 
 static void test_ms_maf_2(chunit_test_context *tc) {
-    mem_space *ms = new_mem_space_seed(1, 1, 10, sizeof(int) * 40);
+    mem_space *ms = new_mem_space(1, 10, sizeof(int) * 40);
 
     ms_chop_args args = {
         .tc = tc,
@@ -167,7 +171,7 @@ const chunit_test MS_MAF_2 = {
 };
 
 static void test_ms_maf_shift(chunit_test_context *tc) {
-    mem_space *ms = new_mem_space_seed(1, 1, 10, sizeof(int) * 200);
+    mem_space *ms = new_mem_space(1, 10, sizeof(int) * 200);
 
     ms_chop_args args = {
         .tc = tc,
@@ -195,6 +199,35 @@ const chunit_test MS_MAF_SHIFT = {
     .timeout = 5
 };
 
+static void test_ms_maf_parallel_shift(chunit_test_context *tc) {
+    mem_space *ms = new_mem_space(1, 10, sizeof(int) * 200);
+
+    ms_chop_args args = {
+        .tc = tc,
+        .ms = ms,
+
+        .vaddr_chnl = 1,
+
+        .shift = 4,
+
+        .num_mallocs = 600,
+        .free_mod = 3,
+
+        .size_factor = sizeof(int),
+        .size_mod = 5,
+    };
+
+    ms_chop_and_check(&args);
+
+    delete_mem_space(ms);
+}
+
+const chunit_test MS_MAF_PARALLEL_SHIFT = {
+    .name = "Memory Space Malloc, Free, and Parallel Shift",
+    .t = test_ms_maf_parallel_shift,
+    .timeout = 5
+};
+
 static void *test_ms_worker(void *arg) {
     util_thread_spray_context *s_context = arg;
     ms_chop_args *m_ca = s_context->context;
@@ -205,7 +238,7 @@ static void *test_ms_worker(void *arg) {
 }
 
 static void test_ms_multi_maf(chunit_test_context *tc) {
-    mem_space *ms = new_mem_space_seed(1, 1, 10, sizeof(int) * 300);
+    mem_space *ms = new_mem_space(1, 10, sizeof(int) * 300);
 
     ms_chop_args m_ca = {
         .tc = tc,
@@ -237,7 +270,7 @@ const chunit_test MS_MULTI_MAF = {
 };
 
 static void test_ms_multi_maf_shift(chunit_test_context *tc) {
-    mem_space *ms = new_mem_space_seed(1, 1, 10, sizeof(int) * 1000);
+    mem_space *ms = new_mem_space(1, 10, sizeof(int) * 1000);
 
     ms_chop_args m_ca = {
         .tc = tc,
@@ -269,7 +302,7 @@ const chunit_test MS_MULTI_MAF_SHIFT = {
 };
 
 static void test_ms_malloc_and_hold(chunit_test_context *tc) {
-    mem_space *ms = new_mem_space_seed(1, 1, 10, 100);
+    mem_space *ms = new_mem_space(1, 10, 100);
 
     malloc_res res = ms_malloc_and_hold(ms, 10);
 
@@ -291,7 +324,7 @@ static void ms_summer(addr_book_vaddr v, void *paddr, void *ctx) {
 }
 
 static void test_ms_foreach(chunit_test_context *tc) {
-    mem_space *ms = new_mem_space_seed(1, 1, 10, 100);
+    mem_space *ms = new_mem_space(1, 10, 100);
 
     uint64_t expected_sum = 0;
 
@@ -322,7 +355,7 @@ const chunit_test MS_FOREACH = {
 };
 
 static void test_ms_count(chunit_test_context *tc) {
-    mem_space *ms = new_mem_space_seed(1, 1, 10, 100);
+    mem_space *ms = new_mem_space(1, 10, 100);
 
     const uint64_t mallocs = 30;
     addr_book_vaddr vaddrs[mallocs];
@@ -373,7 +406,7 @@ static void mp_is_three_mult_checker(addr_book_vaddr v, void *paddr, void *ctx)
 }
 
 static void test_ms_filter(chunit_test_context *tc) {
-    mem_space *ms = new_mem_space_seed(1, 1, 10, 100);
+    mem_space *ms = new_mem_space(1, 10, 100);
 
     const uint64_t num_mallocs = 45;
     uint64_t i;
@@ -403,6 +436,709 @@ static const chunit_test MS_FILTER = {
     .timeout = 5,
 };
 
+static void test_ms_tlab(chunit_test_context *tc) {
+    mem_space *ms = new_mem_space(1, 10, 4096);
+    mem_tlab *tl = ms_tlab_begin(ms);
+
+    const uint64_t num_mallocs = 200;
+    addr_book_vaddr vaddrs[200];
+
+    uint64_t i;
+    for (i = 0; i < num_mallocs; i++) {
+        uint64_t min_size = 8 * ((i % 4) + 1);
+        malloc_res res = ms_tlab_malloc_p(tl, min_size, 1);
+
+        assert_false(tc, null_adb_addr(res.vaddr));
+        write_test_bytes(res.paddr, min_size, vaddr_to_unique_byte(res.vaddr));
+        ms_unlock(ms, res.vaddr);
+
+        vaddrs[i] = res.vaddr;
+    }
+
+    for (i = 0; i < num_mallocs; i += 3) {
+        ms_free(ms, vaddrs[i]);
+        vaddrs[i] = NULL_VADDR;
+    }
+
+    // Buffered pieces are counted the same before and after a flush.
+    assert_eq_uint(tc, num_mallocs - 67, ms_count(ms));
+    assert_eq_uint(tc, num_mallocs - 67, ms_get_stats(ms).live_count);
+
+    ms_tlab_flush(tl);
+    assert_eq_uint(tc, num_mallocs - 67, ms_count(ms));
+    assert_eq_uint(tc, num_mallocs - 67, ms_get_stats(ms).live_count);
+
+    ms_try_full_shift(ms);
+
+    for (i = 0; i < num_mallocs; i++) {
+        if (null_adb_addr(vaddrs[i])) {
+            continue;
+        }
+
+        uint64_t min_size = 8 * ((i % 4) + 1);
+        uint8_t *ptr = ms_get_read(ms, vaddrs[i]);
+        check_test_bytes(tc, ptr, min_size, vaddr_to_unique_byte(vaddrs[i]));
+        ms_unlock(ms, vaddrs[i]);
+    }
+
+    ms_tlab_end(tl);
+    delete_mem_space(ms);
+}
+
+static const chunit_test MS_TLAB = {
+    .name = "Memory Space Tlab",
+    .t = test_ms_tlab,
+    .timeout = 5,
+};
+
+static void test_ms_evacuate(chunit_test_context *tc) {
+    mem_space *ms = new_mem_space(1, 100, 1000);
+
+    const uint64_t num_mallocs = 400;
+    const uint64_t keep_mod = 10;
+
+    // Small pieces would go to slab blocks, which are never evacuated.
+    const uint64_t piece_size = 100;
+
+    addr_book_vaddr vaddrs[400];
+
+    uint64_t i;
+    for (i = 0; i < num_mallocs; i++) {
+        malloc_res res = ms_malloc_and_hold(ms, piece_size);
+        write_test_bytes(res.paddr, piece_size, vaddr_to_unique_byte(res.vaddr));
+        ms_unlock(ms, res.vaddr);
+
+        vaddrs[i] = res.vaddr;
+    }
+
+    // Leave every block mostly empty.
+    for (i = 0; i < num_mallocs; i++) {
+        if (i % keep_mod) {
+            ms_free(ms, vaddrs[i]);
+        }
+    }
+
+    assert_true(tc, ms_try_evacuate(ms) > 0);
+    assert_eq_uint(tc, num_mallocs / keep_mod, ms_count(ms));
+
+    for (i = 0; i < num_mallocs; i += keep_mod) {
+        uint8_t *ptr = ms_get_read(ms, vaddrs[i]);
+        check_test_bytes(tc, ptr, piece_size, vaddr_to_unique_byte(vaddrs[i]));
+        ms_unlock(ms, vaddrs[i]);
+
+        // Evacuated pieces must be freed from their new block.
+        ms_free(ms, vaddrs[i]);
+    }
+
+    assert_eq_uint(tc, 0, ms_count(ms));
+
+    delete_mem_space(ms);
+}
+
+static const chunit_test MS_EVACUATE = {
+    .name = "Memory Space Evacuate",
+    .t = test_ms_evacuate,
+    .timeout = 5,
+};
+
+static void test_ms_evacuate_pinned(chunit_test_context *tc) {
+    // Each block holds exactly 17 pieces of this size.
+    mem_space *ms = new_mem_space(1, 100, 2048);
+
+    const uint64_t per_block = 17;
+    const uint64_t num_mallocs = 8 * 17;
+    addr_book_vaddr vaddrs[8 * 17];
+
+    uint64_t i;
+    for (i = 0; i < num_mallocs; i++) {
+        vaddrs[i] = ms_malloc(ms, 100);
+    }
+
+    assert_eq_uint(tc, 8, ms_get_stats(ms).blocks);
+
+    // The first 4 blocks keep one pinned piece each, which makes them
+    // the sparsest. The rest keep two pieces each.
+    for (i = 0; i < num_mallocs; i++) {
+        uint64_t off = i % per_block;
+
+        if (i < 4 * per_block && off == 0) {
+            ms_pin(ms, vaddrs[i]);
+        } else if (!(i >= 4 * per_block && off < 2)) {
+            ms_free(ms, vaddrs[i]);
+            vaddrs[i] = NULL_VADDR;
+        }
+    }
+
+    // Pinned sources are skipped without dropping the destination, 
+    // so the other sources still get moved.
+    assert_eq_uint(tc, 6, ms_try_evacuate(ms));
+    assert_eq_uint(tc, 12, ms_count(ms));
+
+    for (i = 0; i < num_mallocs; i++) {
+        if (null_adb_addr(vaddrs[i])) {
+            continue;
+        }
+
+        if (i < 4 * per_block) {
+            ms_unpin(ms, vaddrs[i]);
+        }
+
+        ms_free(ms, vaddrs[i]);
+    }
+
+    assert_eq_uint(tc, 0, ms_count(ms));
+
+    delete_mem_space(ms);
+}
+
+static const chunit_test MS_EVACUATE_PINNED = {
+    .name = "Memory Space Evacuate Pinned",
+    .t = test_ms_evacuate_pinned,
+    .timeout = 5,
+};
+
+static void test_ms_release(chunit_test_context *tc) {
+    mem_space *ms = new_mem_space(1, 100, 1 << 16);
+
+    const uint64_t num_mallocs = 400;
+    addr_book_vaddr vaddrs[400];
+
+    uint64_t i;
+    for (i = 0; i < num_mallocs; i++) {
+        vaddrs[i] = ms_malloc(ms, 1000);
+    }
+
+    assert_eq_uint(tc, 0, ms_release_empty(ms));
+    assert_eq_uint(tc, 0, ms_released_bytes(ms));
+
+    for (i = 0; i < num_mallocs; i++) {
+        ms_free(ms, vaddrs[i]);
+    }
+
+    // Every block is empty now, all but the spares are released.
+    ms_try_full_shift(ms);
+
+    uint64_t released = ms_released_bytes(ms);
+    assert_true(tc, released > 0);
+    assert_eq_uint(tc, 0, ms_release_empty(ms));
+
+    // Released blocks are still usable.
+    for (i = 0; i < num_mallocs; i++) {
+        vaddrs[i] = ms_malloc(ms, 1000);
+        assert_false(tc, null_adb_addr(vaddrs[i]));
+    }
+
+    assert_true(tc, ms_released_bytes(ms) < released);
+
+    delete_mem_space(ms);
+}
+
+static const chunit_test MS_RELEASE = {
+    .name = "Memory Space Release",
+    .t = test_ms_release,
+    .timeout = 5,
+};
+
+static void test_ms_release_spare(chunit_test_context *tc) {
+    // Each block holds exactly 64 pieces of this size.
+    mem_space *ms = new_mem_space(1, 100, 1 << 16);
+
+    const uint64_t num_mallocs = 192;
+    addr_book_vaddr vaddrs[192];
+
+    uint64_t i;
+    for (i = 0; i < num_mallocs; i++) {
+        vaddrs[i] = ms_malloc(ms, 1000);
+    }
+
+    assert_eq_uint(tc, 3, ms_get_stats(ms).blocks);
+
+    // Free two blocks worth, both empty blocks are kept as spares. 
+    // (See MS_SPARE_BLOCKS)
+    for (i = 0; i < 128; i++) {
+        ms_free(ms, vaddrs[i]);
+    }
+
+    assert_eq_uint(tc, 0, ms_release_empty(ms));
+    assert_eq_uint(tc, 0, ms_get_stats(ms).released_bytes);
+
+    // Only the third empty block is released.
+    for (; i < num_mallocs; i++) {
+        ms_free(ms, vaddrs[i]);
+    }
+
+    uint64_t released = ms_release_empty(ms);
+    assert_true(tc, released > 0);
+    assert_true(tc, released <= (1 << 16));
+
+    mem_stats stats = ms_get_stats(ms);
+    assert_eq_uint(tc, 3, stats.blocks);
+    assert_eq_uint(tc, released, stats.released_bytes);
+    assert_true(tc, released <= stats.free_bytes);
+
+    assert_eq_uint(tc, 0, ms_release_empty(ms));
+
+    delete_mem_space(ms);
+}
+
+static const chunit_test MS_RELEASE_SPARE = {
+    .name = "Memory Space Release Spare",
+    .t = test_ms_release_spare,
+    .timeout = 5,
+};
+
+static void test_ms_pick(chunit_test_context *tc) {
+    // Each block holds exactly 64 pieces of this size.
+    mem_space *ms = new_mem_space(1, 100, 1 << 16);
+
+    const uint64_t num_mallocs = 256;
+    void *paddrs[256];
+    addr_book_vaddr vaddrs[256];
+
+    uint64_t i, j;
+    for (i = 0; i < num_mallocs; i++) {
+        malloc_res res = ms_malloc_and_hold(ms, 1000);
+        paddrs[i] = res.paddr;
+        vaddrs[i] = res.vaddr;
+        ms_unlock(ms, res.vaddr);
+    }
+
+    for (i = 0; i < num_mallocs; i++) {
+        ms_free(ms, vaddrs[i]);
+    }
+
+    // Every block has room again, so no new block should be made.
+    for (i = 0; i < num_mallocs; i++) {
+        malloc_res res = ms_malloc_and_hold(ms, 1000);
+        ms_unlock(ms, res.vaddr);
+
+        for (j = 0; j < num_mallocs && paddrs[j] != res.paddr; j++);
+
+        assert_true(tc, j < num_mallocs);
+    }
+
+    delete_mem_space(ms);
+}
+
+static const chunit_test MS_PICK = {
+    .name = "Memory Space Pick",
+    .t = test_ms_pick,
+    .timeout = 5,
+};
+
+static void test_ms_home(chunit_test_context *tc) {
+    // Each block holds exactly 64 pieces of this size.
+    mem_space *ms = new_mem_space(1, 100, 1 << 16);
+
+    const uint64_t num_mallocs = 256;
+    void *paddrs[256];
+    addr_book_vaddr vaddrs[256];
+
+    uint64_t i, j;
+    for (i = 0; i < num_mallocs; i++) {
+        malloc_res res = ms_malloc_and_hold(ms, 1000);
+        paddrs[i] = res.paddr;
+        vaddrs[i] = res.vaddr;
+        ms_unlock(ms, res.vaddr);
+    }
+
+    // Every block has the same holes now.
+    for (i = 0; i < num_mallocs; i += 2) {
+        ms_free(ms, vaddrs[i]);
+    }
+
+    // So, all new pieces should go to the same block.
+    uint64_t home = num_mallocs;
+
+    for (i = 0; i < 32; i++) {
+        malloc_res res = ms_malloc_and_hold(ms, 1000);
+        ms_unlock(ms, res.vaddr);
+
+        for (j = 0; j < num_mallocs && paddrs[j] != res.paddr; j++);
+
+        if (home == num_mallocs) {
+            home = j / 64;
+        }
+
+        assert_eq_uint(tc, home, j / 64);
+    }
+
+    delete_mem_space(ms);
+}
+
+static const chunit_test MS_HOME = {
+    .name = "Memory Space Home",
+    .t = test_ms_home,
+    .timeout = 5,
+};
+
+static void test_ms_compact(chunit_test_context *tc) {
+    // Each block holds exactly 64 pieces of this size.
+    mem_space *ms = new_mem_space(1, 100, 1 << 16);
+
+    const uint64_t num_mallocs = 256;
+    addr_book_vaddr vaddrs[256];
+
+    uint64_t i;
+    for (i = 0; i < num_mallocs; i++) {
+        vaddrs[i] = ms_malloc(ms, 1000);
+
+        uint8_t *ptr = ms_get_write(ms, vaddrs[i]);
+        write_test_bytes(ptr, 1000, vaddr_to_unique_byte(vaddrs[i]));
+        ms_unlock(ms, vaddrs[i]);
+    }
+
+    // Only the first two blocks get holes.
+    for (i = 0; i < 128; i += 2) {
+        ms_free(ms, vaddrs[i]);
+        vaddrs[i] = NULL_VADDR;
+    }
+
+    // No time to do anything.
+    const struct timespec no_time = {0, 0};
+    assert_eq_uint(tc, 0, ms_try_compact(ms, 50, &no_time));
+
+    assert_eq_uint(tc, 2, ms_try_compact(ms, 50, NULL));
+    assert_eq_uint(tc, 0, ms_try_compact(ms, 50, NULL));
+
+    for (i = 0; i < num_mallocs; i++) {
+        if (null_adb_addr(vaddrs[i])) {
+            continue;
+        }
+
+        uint8_t *ptr = ms_get_read(ms, vaddrs[i]);
+        check_test_bytes(tc, ptr, 1000, vaddr_to_unique_byte(vaddrs[i]));
+        ms_unlock(ms, vaddrs[i]);
+    }
+
+    delete_mem_space(ms);
+}
+
+static const chunit_test MS_COMPACT = {
+    .name = "Memory Space Compact",
+    .t = test_ms_compact,
+    .timeout = 5,
+};
+
+static void test_ms_stats(chunit_test_context *tc) {
+    // Each block holds exactly 64 pieces of this size.
+    mem_space *ms = new_mem_space(1, 100, 1 << 16);
+
+    mem_stats stats = ms_get_stats(ms);
+    assert_eq_uint(tc, 1, stats.blocks);
+    assert_eq_uint(tc, 0, stats.live_count);
+
+    const uint64_t num_mallocs = 200;
+    addr_book_vaddr vaddrs[200];
+
+    uint64_t i;
+    for (i = 0; i < num_mallocs; i++) {
+        vaddrs[i] = ms_malloc(ms, 1000);
+    }
+
+    for (i = 0; i < num_mallocs; i += 4) {
+        ms_free(ms, vaddrs[i]);
+    }
+
+    stats = ms_get_stats(ms);
+    assert_eq_uint(tc, 4, stats.blocks);
+    assert_eq_uint(tc, 150, stats.live_count);
+    assert_eq_uint(tc, ms_count(ms), stats.live_count);
+    // Each piece holds 1000 bytes plus its headers.
+    assert_eq_uint(tc, 150 * (1000 + 16), stats.live_bytes);
+
+    // The freed pieces can be malloc'd again.
+    assert_true(tc, stats.max_free >= 1000);
+
+    // Region blocks count too.
+    mem_region *mr = ms_region_begin(ms);
+    ms_region_malloc_p(mr, 1000, 0);
+
+    stats = ms_get_stats(ms);
+    assert_eq_uint(tc, 5, stats.blocks);
+    assert_eq_uint(tc, 151, stats.live_count);
+
+    ms_region_end(mr);
+
+    stats = ms_get_stats(ms);
+    assert_eq_uint(tc, 4, stats.blocks);
+    assert_eq_uint(tc, 150, stats.live_count);
+
+    delete_mem_space(ms);
+}
+
+static const chunit_test MS_STATS = {
+    .name = "Memory Space Stats",
+    .t = test_ms_stats,
+    .timeout = 5,
+};
+
+static void test_ms_slab(chunit_test_context *tc) {
+    mem_space *ms = new_mem_space(1, 100, 1 << 12);
+
+    // The first slab of a class is small. (See MS_SLAB_FIRST_CELLS)
+    mem_stats before = ms_get_stats(ms);
+    addr_book_vaddr first = ms_malloc(ms, 16);
+    mem_stats after = ms_get_stats(ms);
+
+    assert_eq_uint(tc, before.blocks + 1, after.blocks);
+    assert_eq_uint(tc, 32 * (16 + 8), 
+            (after.live_bytes + after.free_bytes) - 
+            (before.live_bytes + before.free_bytes));
+
+    ms_free(ms, first);
+
+    const uint64_t num_mallocs = 1000;
+    addr_book_vaddr vaddrs[1000];
+
+    uint64_t i;
+    for (i = 0; i < num_mallocs; i++) {
+        malloc_res res = ms_malloc_and_hold(ms, 16 + (8 * (i % 2)));
+        write_test_bytes(res.paddr, 16, vaddr_to_unique_byte(res.vaddr));
+        ms_unlock(ms, res.vaddr);
+
+        vaddrs[i] = res.vaddr;
+    }
+
+    // Each piece only costs its vaddr on top of its body. 
+    mem_stats stats = ms_get_stats(ms);
+    assert_eq_uint(tc, num_mallocs, stats.live_count);
+    assert_eq_uint(tc, (500 * (16 + 8)) + (500 * (24 + 8)), stats.live_bytes);
+
+    uint64_t blocks = stats.blocks;
+
+    for (i = 0; i < num_mallocs; i += 2) {
+        ms_free(ms, vaddrs[i]);
+    }
+
+    // The freed cells are filled before any new slab is made.
+    for (i = 0; i < num_mallocs; i += 2) {
+        malloc_res res = ms_malloc_and_hold(ms, 9);
+        write_test_bytes(res.paddr, 9, vaddr_to_unique_byte(res.vaddr));
+        ms_unlock(ms, res.vaddr);
+
+        vaddrs[i] = res.vaddr;
+    }
+
+    assert_eq_uint(tc, blocks, ms_get_stats(ms).blocks);
+    assert_eq_uint(tc, num_mallocs, ms_count(ms));
+
+    // Slabs never need to be shifted or evacuated.
+    ms_try_full_shift(ms);
+    assert_eq_uint(tc, 0, ms_try_evacuate(ms));
+
+    for (i = 0; i < num_mallocs; i++) {
+        uint8_t *ptr = ms_get_read(ms, vaddrs[i]);
+        check_test_bytes(tc, ptr, 9, vaddr_to_unique_byte(vaddrs[i]));
+        ms_unlock(ms, vaddrs[i]);
+
+        ms_free(ms, vaddrs[i]);
+    }
+
+    assert_eq_uint(tc, 0, ms_get_stats(ms).live_count);
+
+    delete_mem_space(ms);
+}
+
+static const chunit_test MS_SLAB = {
+    .name = "Memory Space Slab",
+    .t = test_ms_slab,
+    .timeout = 5,
+};
+
+static void test_ms_large(chunit_test_context *tc) {
+    mem_space *ms = new_mem_space(1, 100, 1 << 12);
+
+    const uint64_t num_mallocs = 10;
+    const uint64_t piece_size = 100000;
+    addr_book_vaddr vaddrs[10];
+
+    uint64_t i;
+    for (i = 0; i < num_mallocs; i++) {
+        malloc_res res = ms_malloc_and_hold(ms, piece_size);
+        write_test_bytes(res.paddr, piece_size, vaddr_to_unique_byte(res.vaddr));
+        ms_unlock(ms, res.vaddr);
+
+        vaddrs[i] = res.vaddr;
+    }
+
+    // One block per large piece, plus the starting block.
+    assert_eq_uint(tc, num_mallocs + 1, ms_get_stats(ms).blocks);
+
+    // Large blocks are left alone by all of these.
+    ms_try_full_shift(ms);
+    assert_eq_uint(tc, 0, ms_try_evacuate(ms));
+    assert_eq_uint(tc, 0, ms_release_empty(ms));
+
+    // Freed large blocks stay mapped, but their pages go right back to 
+    // the OS. (All but the edges of each block)
+    for (i = 0; i < num_mallocs; i += 2) {
+        ms_free(ms, vaddrs[i]);
+    }
+
+    assert_eq_uint(tc, num_mallocs + 1, ms_get_stats(ms).blocks);
+
+    uint64_t released = ms_released_bytes(ms);
+    assert_true(tc, released >= (num_mallocs / 2) * (piece_size - 8192));
+
+    // A large malloc which fits reuses a freed block.
+    malloc_res res = ms_malloc_and_hold(ms, piece_size);
+    write_test_bytes(res.paddr, piece_size, vaddr_to_unique_byte(res.vaddr));
+    ms_unlock(ms, res.vaddr);
+
+    assert_eq_uint(tc, num_mallocs + 1, ms_get_stats(ms).blocks);
+    assert_true(tc, ms_released_bytes(ms) < released);
+
+    ms_free(ms, res.vaddr);
+    assert_eq_uint(tc, released, ms_released_bytes(ms));
+
+    // Large blocks survive images. (Freed ones are not saved)
+    char path[] = "/tmp/chvm_ms_large_XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(tc, fd != -1);
+
+    assert_false(tc, ms_save_image(ms, fd));
+    delete_mem_space(ms);
+
+    lseek(fd, 0, SEEK_SET);
+    ms = ms_load_image(1, fd);
+
+    close(fd);
+    unlink(path);
+
+    assert_non_null(tc, ms);
+    assert_eq_uint(tc, (num_mallocs / 2) + 1, ms_get_stats(ms).blocks);
+
+    for (i = 1; i < num_mallocs; i += 2) {
+        uint8_t *ptr = ms_get_read(ms, vaddrs[i]);
+        check_test_bytes(tc, ptr, piece_size, vaddr_to_unique_byte(vaddrs[i]));
+        ms_unlock(ms, vaddrs[i]);
+
+        ms_free(ms, vaddrs[i]);
+    }
+
+    assert_eq_uint(tc, (num_mallocs / 2) + 1, ms_get_stats(ms).blocks);
+    assert_eq_uint(tc, 0, ms_get_stats(ms).live_count);
+
+    // Only 4 idle blocks are kept, the fifth was doomed. It outlives the
+    // first trim, and is unmapped by the second.
+    assert_eq_uint(tc, 0, ms_trim_idle_large(ms));
+    assert_eq_uint(tc, (num_mallocs / 2) + 1, ms_get_stats(ms).blocks);
+
+    assert_eq_uint(tc, 1, ms_trim_idle_large(ms));
+    assert_eq_uint(tc, num_mallocs / 2, ms_get_stats(ms).blocks);
+
+    // The kept blocks are still reused.
+    res = ms_malloc_and_hold(ms, piece_size);
+    write_test_bytes(res.paddr, piece_size, vaddr_to_unique_byte(res.vaddr));
+    ms_unlock(ms, res.vaddr);
+
+    assert_eq_uint(tc, num_mallocs / 2, ms_get_stats(ms).blocks);
+    ms_free(ms, res.vaddr);
+
+    delete_mem_space(ms);
+}
+
+static const chunit_test MS_LARGE = {
+    .name = "Memory Space Large",
+    .t = test_ms_large,
+    .timeout = 5,
+};
+
+static void fill_ms_unique(mem_space *ms, addr_book_vaddr vaddr, 
+        uint64_t size) {
+    uint8_t *ptr = ms_get_write(ms, vaddr);
+    write_test_bytes(ptr, size, vaddr_to_unique_byte(vaddr));
+    ms_unlock(ms, vaddr);
+}
+
+static void check_ms_unique(chunit_test_context *tc, mem_space *ms, 
+        addr_book_vaddr vaddr, uint64_t size) {
+    uint8_t *ptr = ms_get_read(ms, vaddr);
+    check_test_bytes(tc, ptr, size, vaddr_to_unique_byte(vaddr));
+    ms_unlock(ms, vaddr);
+}
+
+static void test_ms_realloc(chunit_test_context *tc) {
+    mem_space *ms = new_mem_space(1, 100, 2000);
+
+    addr_book_vaddr a = ms_malloc(ms, 100);
+    fill_ms_unique(ms, a, 100);
+
+    // Grown in place into the bump region.
+    void *paddr = ms_get_read(ms, a);
+    ms_unlock(ms, a);
+
+    assert_false(tc, ms_realloc(ms, a, 200));
+
+    assert_true(tc, paddr == ms_get_read(ms, a));
+    ms_unlock(ms, a);
+
+    check_ms_unique(tc, ms, a, 100);
+    fill_ms_unique(ms, a, 200);
+
+    // Now a can't grow in place, so it is moved.
+    addr_book_vaddr b = ms_malloc(ms, 100);
+    fill_ms_unique(ms, b, 100);
+
+    assert_false(tc, ms_realloc(ms, a, 1000));
+    check_ms_unique(tc, ms, a, 200);
+    fill_ms_unique(ms, a, 1000);
+
+    // Pinned pieces never move.
+    ms_pin(ms, b);
+    assert_true(tc, ms_realloc(ms, b, 1500));
+    ms_unpin(ms, b);
+
+    check_ms_unique(tc, ms, b, 100);
+
+    // From a slab cell to a normal block, then to a large block.
+    addr_book_vaddr c = ms_malloc(ms, 16);
+    fill_ms_unique(ms, c, 16);
+
+    assert_false(tc, ms_realloc(ms, c, 500));
+    check_ms_unique(tc, ms, c, 16);
+
+    uint64_t blocks = ms_get_stats(ms).blocks;
+
+    assert_false(tc, ms_realloc(ms, c, 100000));
+    check_ms_unique(tc, ms, c, 16);
+    assert_eq_uint(tc, blocks + 1, ms_get_stats(ms).blocks);
+
+    // Shrinking out of the large block gives its pages back to the OS.
+    fill_ms_unique(ms, c, 100000);
+
+    // (c goes back to its old slab)
+    assert_false(tc, ms_realloc(ms, c, 16));
+    check_ms_unique(tc, ms, c, 16);
+    assert_eq_uint(tc, blocks + 1, ms_get_stats(ms).blocks);
+    assert_true(tc, ms_released_bytes(ms) > 0);
+
+    // Growing again reuses the same block.
+    assert_false(tc, ms_realloc(ms, c, 100000));
+    assert_eq_uint(tc, blocks + 1, ms_get_stats(ms).blocks);
+
+    assert_false(tc, ms_realloc(ms, c, 16));
+    check_ms_unique(tc, ms, c, 16);
+
+    assert_eq_uint(tc, 3, ms_get_stats(ms).live_count);
+    assert_eq_uint(tc, 3, ms_count(ms));
+
+    ms_free(ms, a);
+    ms_free(ms, b);
+    ms_free(ms, c);
+
+    assert_eq_uint(tc, 0, ms_get_stats(ms).live_count);
+
+    delete_mem_space(ms);
+}
+
+static const chunit_test MS_REALLOC = {
+    .name = "Memory Space Realloc",
+    .t = test_ms_realloc,
+    .timeout = 5,
+};
+
 const chunit_test_suite GC_TEST_SUITE_MS = {
     .name = "Memory Space Test Suite",
     .tests = {
@@ -411,6 +1147,7 @@ const chunit_test_suite GC_TEST_SUITE_MS = {
         &MS_MAF_1,
         &MS_MAF_2,
         &MS_MAF_SHIFT,
+        &MS_MAF_PARALLEL_SHIFT,
 
         &MS_MULTI_MAF,
         &MS_MULTI_MAF_SHIFT,
@@ -419,6 +1156,18 @@ const chunit_test_suite GC_TEST_SUITE_MS = {
         &MS_COUNT,
 
         &MS_FILTER,
+        &MS_TLAB,
+        &MS_EVACUATE,
+        &MS_EVACUATE_PINNED,
+        &MS_RELEASE,
+        &MS_RELEASE_SPARE,
+        &MS_PICK,
+        &MS_HOME,
+        &MS_COMPACT,
+        &MS_STATS,
+        &MS_SLAB,
+        &MS_LARGE,
+        &MS_REALLOC,
     },
-    .tests_len = 11,
+    .tests_len = 24,
 };
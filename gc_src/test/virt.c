@@ -831,6 +831,99 @@ static const chunit_test ADB_FOREACH = {
     .timeout = 5,
 };
 
+static void test_adb_opt_read(chunit_test_context *tc) {
+    addr_book *adb = new_addr_book(1, 1);
+
+    uint64_t slots[2] = {1, 2};
+
+    // Use a few tables so the book has to grow.
+    addr_book_vaddr v0 = adb_put(adb, slots);
+    addr_book_vaddr v1 = adb_put(adb, slots + 1);
+    adb_put(adb, NULL);
+
+    adt_opt_read_res res = adb_opt_read_begin(adb, v1);
+    assert_eq_ptr(tc, slots + 1, res.paddr);
+    assert_true(tc, adb_opt_read_validate(adb, v1, res.version));
+
+    // Readers should not interfere with optimistic reads.
+    adb_get_read(adb, v1);
+    assert_true(tc, adb_opt_read_validate(adb, v1, res.version));
+    adb_unlock(adb, v1);
+    assert_true(tc, adb_opt_read_validate(adb, v1, res.version));
+
+    // Writers should.
+    adb_get_write(adb, v1);
+    assert_false(tc, adb_opt_read_validate(adb, v1, res.version));
+    assert_eq_ptr(tc, NULL, adb_opt_read_begin(adb, v1).paddr);
+    adb_unlock(adb, v1);
+    assert_false(tc, adb_opt_read_validate(adb, v1, res.version));
+
+    // So should moves.
+    res = adb_opt_read_begin(adb, v0);
+    assert_eq_ptr(tc, slots, res.paddr);
+    adb_move(adb, v0, slots + 1, sizeof(uint64_t));
+    assert_false(tc, adb_opt_read_validate(adb, v0, res.version));
+
+    res = adb_opt_read_begin(adb, v0);
+    assert_eq_ptr(tc, slots + 1, res.paddr);
+    assert_true(tc, adb_opt_read_validate(adb, v0, res.version));
+
+    // And frees.
+    adb_free(adb, v0);
+    assert_false(tc, adb_opt_read_validate(adb, v0, res.version));
+    assert_eq_ptr(tc, NULL, adb_opt_read_begin(adb, v0).paddr);
+
+    // Bad addresses should never cause an exit.
+    addr_book_vaddr bad = {
+        .table_index = 100,
+        .cell_index = 0,
+    };
+
+    assert_eq_ptr(tc, NULL, adb_opt_read_begin(adb, bad).paddr);
+    assert_eq_ptr(tc, NULL, adb_opt_read_begin(adb, NULL_VADDR).paddr);
+
+    delete_addr_book(adb);
+}
+
+static const chunit_test ADB_OPT_READ = {
+    .name = "Address Book Optimistic Read",
+    .t = test_adb_opt_read,
+    .timeout = 5,
+};
+
+static void test_adb_packed_vaddr(chunit_test_context *tc) {
+    assert_eq_uint(tc, sizeof(uint64_t), sizeof(addr_book_vaddr));
+
+    // Caps which can't be indexed by a vaddr are refused.
+    assert_eq_ptr(tc, NULL, new_addr_book(1, 1ULL << 40));
+
+    addr_book *adb = new_addr_book(1, (1ULL << 40) - 1);
+    assert_non_null(tc, adb);
+    delete_addr_book(adb);
+
+    addr_book_vaddr v = {
+        .table_index = (1ULL << 24) - 2,
+        .cell_index = (1ULL << 40) - 2,
+    };
+
+    assert_false(tc, null_adb_addr(v));
+    assert_eq_uint(tc, (1ULL << 24) - 2, v.table_index);
+    assert_eq_uint(tc, (1ULL << 40) - 2, v.cell_index);
+
+    v.cell_index++;
+    assert_false(tc, null_adb_addr(v));
+    assert_true(tc, cmp_adb_addr(v, NULL_VADDR) < 0);
+
+    v.table_index++;
+    assert_true(tc, null_adb_addr(v));
+}
+
+static const chunit_test ADB_PACKED_VADDR = {
+    .name = "Address Book Packed Vaddr",
+    .t = test_adb_packed_vaddr,
+    .timeout = 5
+};
+
 const chunit_test_suite GC_TEST_SUITE_ADB = {
     .name = "Address Book Test Suite",
     .tests = {
@@ -847,7 +940,9 @@ const chunit_test_suite GC_TEST_SUITE_ADB = {
         &ADB_PUT_AND_HOLD,
 
         &ADB_FOREACH,
+        &ADB_OPT_READ,
+        &ADB_PACKED_VADDR,
     },
-    .tests_len = 11
+    .tests_len = 13
 };
 
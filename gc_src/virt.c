@@ -34,8 +34,81 @@ typedef struct {
     pthread_rwlock_t lck; 
     uint8_t allocated; // Mainly for debugging.
     void *paddr;
+
+    // This is used for optimistic reads.
+    //
+    // The version is odd only while a writer holds lck, and it is 
+    // incremented each time a writer acquires and releases lck.
+    // So, if an optimistic reader sees the same even version before
+    // and after its reads, no writer could've touched the cell (or the 
+    // memory pointed to by paddr) in between.
+    //
+    // NOTE: this should only be accessed using atomics!
+    uint64_t version;
+
+    // Number of outstanding pins on this cell. While this is non-zero,
+    // paddr must never change. (See adt_pin)
+    //
+    // NOTE: this should only be accessed using atomics!
+    uint64_t pins;
+
+    // Number of atomic sections currently active on this cell.
+    // (See adt_atomic_begin)
+    //
+    // NOTE: this should only be accessed using atomics!
+    uint64_t atomics;
 } addr_table_cell;
 
+// Call right after acquiring the write lock of a cell.
+static inline void adt_cell_begin_write(addr_table_cell *cell) {
+    __atomic_store_n(&(cell->version), cell->version + 1, __ATOMIC_RELAXED);
+
+    // Make sure the odd version is visible before any of our writes.
+    // This must also be ordered before our check of atomics below.
+    // (adt_atomic_begin does the opposite)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    // No new atomic sections can start now that the version is odd. 
+    // Wait for the active ones to finish.
+    while (__atomic_load_n(&(cell->atomics), __ATOMIC_ACQUIRE)) {
+        // Atomic sections are only a few instructions long.
+    }
+}
+
+// Call right before releasing the lock on a cell.
+//
+// NOTE: The version can only be odd if the write lock is held.
+// Thus, if a reader calls this, the version will be left untouched.
+static inline void adt_cell_end_write(addr_table_cell *cell) {
+    uint64_t version = __atomic_load_n(&(cell->version), __ATOMIC_RELAXED);
+
+    if (version & 1) {
+        __atomic_store_n(&(cell->version), version + 1, __ATOMIC_RELEASE);
+    }
+}
+
+static inline void adt_cell_wrlock(addr_table_cell *cell) {
+    safe_wrlock(&(cell->lck));
+    adt_cell_begin_write(cell);
+}
+
+// Returns 0 if the write lock was acquired. (Just like safe_try_wrlock)
+static inline int adt_cell_try_wrlock(addr_table_cell *cell) {
+    if (safe_try_wrlock(&(cell->lck))) {
+        return 1;
+    }
+
+    adt_cell_begin_write(cell);
+
+    return 0;
+}
+
+// This can be used for both readers and writers.
+static inline void adt_cell_unlock(addr_table_cell *cell) {
+    adt_cell_end_write(cell);
+    safe_rwlock_unlock(&(cell->lck));
+}
+
 addr_table *new_addr_table(uint8_t chnl, uint64_t cap) {
     if (cap == 0) {
         error_logf(1, 1, "new_addr_table: cap must be non-zero");
@@ -71,6 +144,9 @@ addr_table *new_addr_table(uint8_t chnl, uint64_t cap) {
         safe_rwlock_init(&(table[i].lck), NULL);
         table[i].allocated = 0;
         table[i].paddr = NULL;  // Not necessary, but whatevs.
+        table[i].version = 0;
+        table[i].pins = 0;
+        table[i].atomics = 0;
     }
 
     return adt;
@@ -147,13 +223,13 @@ addr_table_put_res adt_put_p(addr_table *adt, void *paddr, uint8_t hold) {
 
     // We have aquired our free index...
     // Now to write to it.
-    safe_wrlock(&(table[free_ind].lck));
+    adt_cell_wrlock(table + free_ind);
     table[free_ind].allocated = 1;
     table[free_ind].paddr = paddr;
 
     // Only release lock when specified.
     if (!hold) {
-        safe_rwlock_unlock(&(table[free_ind].lck));
+        adt_cell_unlock(table + free_ind);
     }
 
     res.index = free_ind;
@@ -200,7 +276,7 @@ static inline void adt_validate_cell(uint8_t unlock, addr_table_cell *cell, uint
     if (!(cell->allocated)) {
         // This is a little overkill here, but whatever...
         if (unlock) {
-            safe_rwlock_unlock(&(cell->lck)); 
+            adt_cell_unlock(cell); 
         }
 
         error_logf(1, 1,
@@ -222,11 +298,20 @@ void adt_move_p(uint8_t lck, addr_table *adt, uint64_t cell_ind,
 
     // Lock on our cell. (if needed)
     if (lck) {
-        safe_wrlock(&(cell->lck));
+        adt_cell_wrlock(cell);
     }
 
     adt_validate_cell(lck, cell, cell_ind, "adt_move_p");
 
+    if (__atomic_load_n(&(cell->pins), __ATOMIC_RELAXED)) {
+        if (lck) {
+            adt_cell_unlock(cell);
+        }
+
+        error_logf(1, 1, "adt_move_p: pinned cell_ind given (%" PRIu64 ")",
+                cell_ind);
+    }
+
     uint8_t *old_paddr = cell->paddr;
 
     // NOTE: we use memmove here since there might be overlap.
@@ -238,7 +323,7 @@ void adt_move_p(uint8_t lck, addr_table *adt, uint64_t cell_ind,
     } 
 
     if (lck) {
-        safe_rwlock_unlock(&(cell->lck));
+        adt_cell_unlock(cell);
     }
 }
 
@@ -278,8 +363,8 @@ void *adt_get_write_p(addr_table *adt, uint64_t ind, uint8_t blk) {
     addr_table_cell *cell = table + ind;
 
     if (blk) {
-        safe_wrlock(&(cell->lck));
-    } else if (safe_try_wrlock(&(cell->lck))) {
+        adt_cell_wrlock(cell);
+    } else if (adt_cell_try_wrlock(cell)) {
         return NULL;
     }
 
@@ -297,7 +382,167 @@ void adt_unlock(addr_table *adt, uint64_t ind) {
 
     adt_validate_cell_ind(adt, ind, "adt_unlock");
 
+    adt_cell_unlock(cell);
+}
+
+adt_opt_read_res adt_opt_read_begin(addr_table *adt, uint64_t ind) {
+    adt_opt_read_res res = {
+        .version = 0,
+        .paddr = NULL,
+    };
+
+    addr_table_header *adt_h = (addr_table_header *)adt;
+
+    // NOTE: Unlike the locking calls, we don't exit on a bad index.
+    // The index given may have been read optimistically itself.
+    if (ind >= adt_h->cap) {
+        return res;
+    }
+
+    uint64_t *free_stack = (uint64_t *)(adt_h + 1);
+    addr_table_cell *table = (addr_table_cell *)(free_stack + adt_h->cap);
+    addr_table_cell *cell = table + ind;
+
+    res.version = __atomic_load_n(&(cell->version), __ATOMIC_ACQUIRE);
+
+    // A writer is active, don't even bother.
+    if (res.version & 1) {
+        return res;
+    }
+
+    // NOTE: paddr is NULL whenever the cell is not allocated.
+    res.paddr = __atomic_load_n(&(cell->paddr), __ATOMIC_RELAXED);
+
+    return res;
+}
+
+uint8_t adt_opt_read_validate(addr_table *adt, uint64_t ind, 
+        uint64_t version) {
+    addr_table_header *adt_h = (addr_table_header *)adt;
+
+    if (ind >= adt_h->cap) {
+        return 0;
+    }
+
+    uint64_t *free_stack = (uint64_t *)(adt_h + 1);
+    addr_table_cell *table = (addr_table_cell *)(free_stack + adt_h->cap);
+    addr_table_cell *cell = table + ind;
+
+    // Make sure all of the caller's reads happen before we
+    // check the version again.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return !(version & 1) && 
+        __atomic_load_n(&(cell->version), __ATOMIC_RELAXED) == version;
+}
+
+void *adt_pin(addr_table *adt, uint64_t ind) {
+    adt_validate_cell_ind(adt, ind, "adt_pin");
+
+    addr_table_header *adt_h = (addr_table_header *)adt;
+    uint64_t *free_stack = (uint64_t *)(adt_h + 1);
+    addr_table_cell *table = (addr_table_cell *)(free_stack + adt_h->cap);
+    addr_table_cell *cell = table + ind;
+
+    // The read lock guarantees we aren't mid move.
+    // Once pins is non-zero, no mover will touch paddr again.
+    safe_rdlock(&(cell->lck));
+    adt_validate_cell(1, cell, ind, "adt_pin");
+
+    __atomic_add_fetch(&(cell->pins), 1, __ATOMIC_RELAXED);
+    void *paddr = cell->paddr;
+
     safe_rwlock_unlock(&(cell->lck));
+
+    return paddr;
+}
+
+void adt_unpin(addr_table *adt, uint64_t ind) {
+    adt_validate_cell_ind(adt, ind, "adt_unpin");
+
+    addr_table_header *adt_h = (addr_table_header *)adt;
+    uint64_t *free_stack = (uint64_t *)(adt_h + 1);
+    addr_table_cell *table = (addr_table_cell *)(free_stack + adt_h->cap);
+    addr_table_cell *cell = table + ind;
+
+    uint64_t pins = __atomic_load_n(&(cell->pins), __ATOMIC_RELAXED);
+
+    do {
+        if (pins == 0) {
+            error_logf(1, 1, "adt_unpin: unpinned cell_ind given (%" PRIu64 ")",
+                    ind);
+        }
+    } while (!__atomic_compare_exchange_n(&(cell->pins), &pins, pins - 1, 
+                0, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void *adt_atomic_begin(addr_table *adt, uint64_t ind) {
+    addr_table_header *adt_h = (addr_table_header *)adt;
+
+    // NOTE: Like the optimistic reads, no exit on a bad index.
+    if (ind >= adt_h->cap) {
+        return NULL;
+    }
+
+    uint64_t *free_stack = (uint64_t *)(adt_h + 1);
+    addr_table_cell *table = (addr_table_cell *)(free_stack + adt_h->cap);
+    addr_table_cell *cell = table + ind;
+
+    // Announce ourselves before checking for writers. A writer makes
+    // the version odd before checking atomics, so either we will see
+    // the odd version, or the writer will see us and wait.
+    __atomic_add_fetch(&(cell->atomics), 1, __ATOMIC_SEQ_CST);
+
+    // NOTE: paddr is NULL whenever the cell is not allocated.
+    if (!(__atomic_load_n(&(cell->version), __ATOMIC_SEQ_CST) & 1)) {
+        void *paddr = __atomic_load_n(&(cell->paddr), __ATOMIC_RELAXED);
+
+        if (paddr) {
+            return paddr;
+        }
+    }
+
+    __atomic_sub_fetch(&(cell->atomics), 1, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+void adt_atomic_end(addr_table *adt, uint64_t ind) {
+    addr_table_header *adt_h = (addr_table_header *)adt;
+    uint64_t *free_stack = (uint64_t *)(adt_h + 1);
+    addr_table_cell *table = (addr_table_cell *)(free_stack + adt_h->cap);
+
+    __atomic_sub_fetch(&(table[ind].atomics), 1, __ATOMIC_RELEASE);
+}
+
+uint64_t adt_pinned(addr_table *adt, uint64_t ind) {
+    adt_validate_cell_ind(adt, ind, "adt_pinned");
+
+    addr_table_header *adt_h = (addr_table_header *)adt;
+    uint64_t *free_stack = (uint64_t *)(adt_h + 1);
+    addr_table_cell *table = (addr_table_cell *)(free_stack + adt_h->cap);
+
+    return __atomic_load_n(&(table[ind].pins), __ATOMIC_RELAXED);
+}
+
+void *adt_get_pinned(addr_table *adt, uint64_t ind) {
+    addr_table_header *adt_h = (addr_table_header *)adt;
+
+    // NOTE: Like the optimistic reads, no exit on a bad index.
+    if (ind >= adt_h->cap) {
+        return NULL;
+    }
+
+    uint64_t *free_stack = (uint64_t *)(adt_h + 1);
+    addr_table_cell *table = (addr_table_cell *)(free_stack + adt_h->cap);
+    addr_table_cell *cell = table + ind;
+
+    if (!__atomic_load_n(&(cell->pins), __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    // A pinned cell's paddr never changes, so no lock is needed here.
+    return __atomic_load_n(&(cell->paddr), __ATOMIC_RELAXED);
 }
 
 // NOTE: This call raises some security concerns.
@@ -319,11 +564,14 @@ addr_table_code adt_free(addr_table *adt, uint64_t index) {
 
     addr_table_code res_code;
 
-    safe_wrlock(&(table[index].lck));
+    adt_cell_wrlock(cell);
     adt_validate_cell(1, cell, index, "adt_free");
-    table[index].allocated = 0;
-    table[index].paddr = NULL;
-    safe_rwlock_unlock(&(table[index].lck));
+    cell->allocated = 0;
+    cell->paddr = NULL;
+
+    // Pins do not outlive the cell.
+    __atomic_store_n(&(cell->pins), 0, __ATOMIC_RELAXED);
+    adt_cell_unlock(cell);
 
     safe_wrlock(&(adt_h->free_stack_lck));
 
@@ -338,6 +586,58 @@ addr_table_code adt_free(addr_table *adt, uint64_t index) {
     return res_code;
 }
 
+uint8_t adt_restore(addr_table *adt, uint64_t cell_ind, void *paddr) {
+    addr_table_header *adt_h = (addr_table_header *)adt;
+
+    if (cell_ind >= adt_h->cap) {
+        return 1;
+    }
+
+    uint64_t *free_stack = (uint64_t *)(adt_h + 1);
+    addr_table_cell *table = (addr_table_cell *)(free_stack + adt_h->cap);
+    addr_table_cell *cell = table + cell_ind;
+
+    adt_cell_wrlock(cell);
+
+    if (cell->allocated) {
+        adt_cell_unlock(cell);
+        return 1;
+    }
+
+    cell->allocated = 1;
+    cell->paddr = paddr;
+
+    adt_cell_unlock(cell);
+
+    return 0;
+}
+
+uint64_t adt_rebuild_free_stack(addr_table *adt) {
+    addr_table_header *adt_h = (addr_table_header *)adt;
+    uint64_t *free_stack = (uint64_t *)(adt_h + 1);
+    addr_table_cell *table = (addr_table_cell *)(free_stack + adt_h->cap);
+
+    uint64_t fill;
+
+    safe_wrlock(&(adt_h->free_stack_lck));
+
+    adt_h->stack_fill = 0;
+
+    // Push in reverse so that lower indeces are popped first.
+    uint64_t i;
+    for (i = adt_h->cap; i > 0; i--) {
+        if (!(table[i - 1].allocated)) {
+            free_stack[(adt_h->stack_fill)++] = i - 1;
+        }
+    }
+
+    fill = adt_h->stack_fill;
+
+    safe_rwlock_unlock(&(adt_h->free_stack_lck));
+
+    return fill;
+}
+
 void adt_foreach(addr_table *adt, adt_cell_consumer c, void *ctx, uint8_t wr) {
     addr_table_header *adt_h = (addr_table_header *)adt;
     uint64_t *free_stack = (uint64_t *)(adt_h + 1);
@@ -350,7 +650,7 @@ void adt_foreach(addr_table *adt, adt_cell_consumer c, void *ctx, uint8_t wr) {
         cell = table + i;
 
         if (wr) {
-            safe_wrlock(&(cell->lck));
+            adt_cell_wrlock(cell);
         } else {
             safe_rdlock(&(cell->lck));
         }
@@ -359,7 +659,56 @@ void adt_foreach(addr_table *adt, adt_cell_consumer c, void *ctx, uint8_t wr) {
             c(i, cell->paddr, ctx);
         }
 
-        safe_rwlock_unlock(&(cell->lck));
+        adt_cell_unlock(cell);
+    }
+}
+
+// How many busy cells adt_foreach_defer remembers at once.
+// Past this, it just waits on the busy cell where it is.
+#define ADT_DEFER_CAP 64
+
+void adt_foreach_defer(addr_table *adt, adt_cell_consumer c, 
+        adt_cell_busy_consumer busy, void *ctx) {
+    addr_table_header *adt_h = (addr_table_header *)adt;
+    uint64_t *free_stack = (uint64_t *)(adt_h + 1);
+    addr_table_cell *table = (addr_table_cell *)(free_stack + adt_h->cap);
+
+    uint64_t deferred[ADT_DEFER_CAP];
+    uint64_t deferred_len = 0;
+
+    addr_table_cell *cell;
+
+    uint64_t i;
+    for (i = 0; i < adt_h->cap + deferred_len; i++) {
+        uint64_t ind; 
+
+        if (i < adt_h->cap) {
+            ind = i;
+            cell = table + ind;
+
+            if (adt_cell_try_wrlock(cell)) {
+                busy(ind, ctx);
+
+                if (deferred_len < ADT_DEFER_CAP) {
+                    deferred[deferred_len++] = ind;
+                    continue;
+                }
+
+                adt_cell_wrlock(cell);
+            }
+        } else {
+            // Come back to the busy cells, this time we wait.
+            ind = deferred[i - adt_h->cap];
+            cell = table + ind;
+
+            adt_cell_wrlock(cell);
+        }
+
+        if (cell->allocated) {
+            c(ind, cell->paddr, ctx);
+        }
+
+        adt_cell_unlock(cell);
     }
 }
 
@@ -399,9 +748,14 @@ void adt_print_p(addr_table *adt, const char *prefix) {
     }
 }
 
+// The largest table and cell index which fit in a vaddr. These are 
+// reserved for NULL_VADDR.
+static const uint64_t ADB_MAX_TABLE_INDEX = (1ULL << 24) - 1;
+static const uint64_t ADB_MAX_CELL_INDEX = (1ULL << 40) - 1;
+
 const addr_book_vaddr NULL_VADDR = {
-    .cell_index = UINT64_MAX,
-    .table_index = UINT64_MAX,
+    .cell_index = (1ULL << 40) - 1,
+    .table_index = (1ULL << 24) - 1,
 };
 
 static const uint64_t ADB_NULL_INDEX = UINT64_MAX;
@@ -433,10 +787,26 @@ typedef struct addr_book_struct {
     uint64_t book_len;
     uint64_t book_cap;
     addr_book_entry *book;
+
+    // NOTE: Optimistic readers look up tables without the book lock.
+    // To allow this, when the book grows, the old book is not freed right
+    // away, it is kept here until the address book is deleted.
+    //
+    // Since the book doubles in size each time it grows, 64 slots is 
+    // plenty, and the retired books take up no more space than the
+    // current book.
+    uint64_t retired_books_len;
+    addr_book_entry *retired_books[64];
+
+    // Max number of tables adb_restore can create. 
+    // (See adb_restore_begin)
+    uint64_t restore_len;
 } addr_book;
 
 addr_book *new_addr_book(uint8_t chnl, uint64_t table_cap) {
-    if (table_cap == 0) {
+    // NOTE: cells are indexed from 0, so a table_cap of 
+    // ADB_MAX_CELL_INDEX never gives out the NULL cell index.
+    if (table_cap == 0 || table_cap > ADB_MAX_CELL_INDEX) {
         return NULL;
     }
 
@@ -449,6 +819,8 @@ addr_book *new_addr_book(uint8_t chnl, uint64_t table_cap) {
     adb->free_list = ADB_NULL_INDEX;
 
     adb->book_len = 0;
+    adb->retired_books_len = 0;
+    adb->restore_len = ADB_MAX_TABLE_INDEX;
 
     // Allocate a single entry in the book.
     // Don't even initialize it yet though.
@@ -475,6 +847,10 @@ void delete_addr_book(addr_book *adb) {
         safe_free(adb->book);
     }
 
+    for (i = 0; i < adb->retired_books_len; i++) {
+        safe_free(adb->retired_books[i]);
+    }
+
     safe_rwlock_unlock(&(adb->lck));
 
     safe_free(adb);
@@ -498,22 +874,28 @@ static inline void unsafe_adb_push_free_list(addr_book *adb,
     entry->in_free_list = 1;
 }
 
-static inline void adb_try_expand(addr_book *adb) {
-    safe_wrlock(&(adb->lck));
-
-    // Only expand if we need to. (at the time of request)
-    if (adb->free_list != ADB_NULL_INDEX) {
+// Add a brand new table to the end of the book.
+// The new table is NOT added to the free list.
+// NOTE: we must have the write lock before calling this function!
+static inline uint64_t unsafe_adb_append_table(addr_book *adb) {
+    if (adb->book_len == ADB_MAX_TABLE_INDEX) {
         safe_rwlock_unlock(&(adb->lck));
-        return;
-    } 
-
-    // Expansion time!
+        error_logf(1, 1, "unsafe_adb_append_table: address book is full");
+    }
 
     // Expand book if we need to.
     if (adb->book_len == adb->book_cap) {
+        addr_book_entry *old_book = adb->book;
+        addr_book_entry *new_book = safe_malloc(get_chnl(adb), 
+                sizeof(addr_book_entry) * adb->book_cap * 2);
+
+        memcpy(new_book, old_book, sizeof(addr_book_entry) * adb->book_len);
+
+        // Optimistic readers may still be looking at the old book.
+        adb->retired_books[(adb->retired_books_len)++] = old_book;
+
         adb->book_cap *= 2;
-        adb->book = safe_realloc(adb->book, 
-                sizeof(addr_book_entry) * adb->book_cap);
+        __atomic_store_n(&(adb->book), new_book, __ATOMIC_RELEASE);
     }
 
     uint64_t table_index = adb->book_len;
@@ -521,7 +903,27 @@ static inline void adb_try_expand(addr_book *adb) {
 
     // Store our new table in the book!
     adb->book[table_index].adt = table;
-    (adb->book_len)++;
+    adb->book[table_index].in_free_list = 0;
+    adb->book[table_index].next = ADB_NULL_INDEX;
+    adb->book[table_index].prev = ADB_NULL_INDEX;
+
+    // Only publish the new length once the entry is fully written.
+    __atomic_store_n(&(adb->book_len), adb->book_len + 1, __ATOMIC_RELEASE);
+
+    return table_index;
+}
+
+static inline void adb_try_expand(addr_book *adb) {
+    safe_wrlock(&(adb->lck));
+
+    // Only expand if we need to. (at the time of request)
+    if (adb->free_list != ADB_NULL_INDEX) {
+        safe_rwlock_unlock(&(adb->lck));
+        return;
+    } 
+
+    // Expansion time!
+    uint64_t table_index = unsafe_adb_append_table(adb);
 
     // Push our new table onto the free list!
     unsafe_adb_push_free_list(adb, table_index);
@@ -586,6 +988,18 @@ static inline void adb_try_removal(addr_book *adb, uint64_t entry_index) {
     safe_rwlock_unlock(&(adb->lck));
 }
 
+uint64_t adb_get_table_cap(addr_book *adb) {
+    return adb->table_cap;
+}
+
+uint64_t adb_get_book_len(addr_book *adb) {
+    safe_rdlock(&(adb->lck));
+    uint64_t book_len = adb->book_len;
+    safe_rwlock_unlock(&(adb->lck));
+
+    return book_len;
+}
+
 addr_book_vaddr adb_put_p(addr_book *adb, void *paddr, uint8_t hold) {
     addr_book_vaddr vaddr;
 
@@ -718,6 +1132,95 @@ void adb_unlock(addr_book *adb, addr_book_vaddr vaddr) {
     adt_unlock(adt, vaddr.cell_index);
 }
 
+// Look up a table without the book lock.
+// Returns NULL if the table index is out of bounds.
+static inline addr_table *adb_opt_get_adt(addr_book *adb, 
+        uint64_t table_index) {
+    // NOTE: the length must be loaded before the book.
+    // If the book we load is newer than the length, that's fine,
+    // a book is never shorter than any length published before it.
+    uint64_t len = __atomic_load_n(&(adb->book_len), __ATOMIC_ACQUIRE);
+
+    if (table_index >= len) {
+        return NULL;
+    }
+
+    addr_book_entry *book = __atomic_load_n(&(adb->book), __ATOMIC_ACQUIRE);
+
+    // Entries are never edited after their adt is set, so this is safe
+    // even if book has been retired.
+    return book[table_index].adt;
+}
+
+adt_opt_read_res adb_opt_read_begin(addr_book *adb, addr_book_vaddr vaddr) {
+    addr_table *adt = adb_opt_get_adt(adb, vaddr.table_index);
+
+    if (!adt) {
+        adt_opt_read_res res = {
+            .version = 0,
+            .paddr = NULL,
+        };
+
+        return res;
+    }
+
+    return adt_opt_read_begin(adt, vaddr.cell_index);
+}
+
+uint8_t adb_opt_read_validate(addr_book *adb, addr_book_vaddr vaddr,
+        uint64_t version) {
+    addr_table *adt = adb_opt_get_adt(adb, vaddr.table_index);
+
+    if (!adt) {
+        return 0;
+    }
+
+    return adt_opt_read_validate(adt, vaddr.cell_index, version);
+}
+
+void *adb_pin(addr_book *adb, addr_book_vaddr vaddr) {
+    addr_table *adt = adb_get_adt(adb, vaddr.table_index, "adb_pin");
+
+    return adt_pin(adt, vaddr.cell_index);
+}
+
+void adb_unpin(addr_book *adb, addr_book_vaddr vaddr) {
+    addr_table *adt = adb_get_adt(adb, vaddr.table_index, "adb_unpin");
+
+    adt_unpin(adt, vaddr.cell_index);
+}
+
+
+uint64_t adb_pinned(addr_book *adb, addr_book_vaddr vaddr) {
+    addr_table *adt = adb_get_adt(adb, vaddr.table_index, "adb_pinned");
+
+    return adt_pinned(adt, vaddr.cell_index);
+}
+
+void *adb_get_pinned(addr_book *adb, addr_book_vaddr vaddr) {
+    addr_table *adt = adb_opt_get_adt(adb, vaddr.table_index);
+
+    if (!adt) {
+        return NULL;
+    }
+
+    return adt_get_pinned(adt, vaddr.cell_index);
+}
+
+void *adb_atomic_begin(addr_book *adb, addr_book_vaddr vaddr) {
+    addr_table *adt = adb_opt_get_adt(adb, vaddr.table_index);
+
+    if (!adt) {
+        return NULL;
+    }
+
+    return adt_atomic_begin(adt, vaddr.cell_index);
+}
+
+void adb_atomic_end(addr_book *adb, addr_book_vaddr vaddr) {
+    adt_atomic_end(adb_opt_get_adt(adb, vaddr.table_index), vaddr.cell_index);
+}
+
 static inline void adb_try_addition(addr_book *adb, uint64_t entry_index) {
     safe_wrlock(&(adb->lck));
     addr_book_entry *entry = &(adb->book[entry_index]);
@@ -760,6 +1263,66 @@ void adb_free(addr_book *adb, addr_book_vaddr vaddr) {
     }
 }
 
+uint8_t adb_restore_begin(addr_book *adb, uint64_t book_len) {
+    // unsafe_adb_append_table never grows the book past this.
+    if (book_len > ADB_MAX_TABLE_INDEX) {
+        return 1;
+    }
+
+    safe_wrlock(&(adb->lck));
+    adb->restore_len = book_len;
+    safe_rwlock_unlock(&(adb->lck));
+
+    return 0;
+}
+
+uint8_t adb_restore(addr_book *adb, addr_book_vaddr vaddr, void *paddr) {
+    addr_table *adt;
+
+    safe_wrlock(&(adb->lck));
+
+    if (vaddr.table_index >= adb->restore_len) {
+        safe_rwlock_unlock(&(adb->lck));
+        return 1;
+    }
+
+    // Tables created here will be placed in the free list
+    // (if needed) by adb_restore_finish.
+    while (adb->book_len <= vaddr.table_index) {
+        unsafe_adb_append_table(adb);
+    }
+
+    adt = adb->book[vaddr.table_index].adt;
+
+    safe_rwlock_unlock(&(adb->lck));
+
+    return adt_restore(adt, vaddr.cell_index, paddr);
+}
+
+void adb_restore_finish(addr_book *adb) {
+    safe_wrlock(&(adb->lck));
+
+    adb->restore_len = ADB_MAX_TABLE_INDEX;
+
+    adb->free_list = ADB_NULL_INDEX;
+
+    uint64_t i;
+    for (i = 0; i < adb->book_len; i++) {
+        adb->book[i].in_free_list = 0;
+        adb->book[i].next = ADB_NULL_INDEX;
+        adb->book[i].prev = ADB_NULL_INDEX;
+    }
+
+    // Push in reverse so that lower tables are used first.
+    for (i = adb->book_len; i > 0; i--) {
+        if (adt_rebuild_free_stack(adb->book[i - 1].adt) > 0) {
+            unsafe_adb_push_free_list(adb, i - 1);
+        }
+    }
+
+    safe_rwlock_unlock(&(adb->lck));
+}
+
 typedef void (*adt_consumer)(uint64_t table_ind, addr_table *adt, void *ctx);
 
 static void adb_foreach_adt(addr_book *adb, adt_consumer c, void *ctx) {
@@ -840,6 +1403,58 @@ void adb_foreach(addr_book *adb, adb_cell_consumer c, void *ctx, uint8_t wr) {
     adb_foreach_adt(adb, adb_foreach_adt_consumer, &(adb_f_adt_ctx));
 }
 
+typedef struct {
+    uint64_t table_ind; 
+
+    void *og_ctx;
+    adb_cell_consumer c;
+    adb_cell_busy_consumer busy;
+} adb_foreach_defer_cell_context;
+
+static void adb_foreach_defer_cell_consumer(uint64_t ind, void *paddr, 
+        void *ctx) {
+    adb_foreach_defer_cell_context *adb_f_d_c_ctx = ctx;
+
+    addr_book_vaddr vaddr = {
+        .table_index = adb_f_d_c_ctx->table_ind,
+        .cell_index = ind,
+    };
+
+    adb_f_d_c_ctx->c(vaddr, paddr, adb_f_d_c_ctx->og_ctx);
+}
+
+static void adb_foreach_defer_busy_consumer(uint64_t ind, void *ctx) {
+    adb_foreach_defer_cell_context *adb_f_d_c_ctx = ctx;
+
+    addr_book_vaddr vaddr = {
+        .table_index = adb_f_d_c_ctx->table_ind,
+        .cell_index = ind,
+    };
+
+    adb_f_d_c_ctx->busy(vaddr, adb_f_d_c_ctx->og_ctx);
+}
+
+static void adb_foreach_defer_adt_consumer(uint64_t table_ind, 
+        addr_table *adt, void *ctx) {
+    adb_foreach_defer_cell_context adb_f_d_c_ctx = 
+        *(adb_foreach_defer_cell_context *)ctx;
+    adb_f_d_c_ctx.table_ind = table_ind;
+
+    adt_foreach_defer(adt, adb_foreach_defer_cell_consumer, 
+            adb_foreach_defer_busy_consumer, &adb_f_d_c_ctx);
+}
+
+void adb_foreach_defer(addr_book *adb, adb_cell_consumer c, 
+        adb_cell_busy_consumer busy, void *ctx) {
+    adb_foreach_defer_cell_context adb_f_d_c_ctx = {
+        .og_ctx = ctx,
+        .c = c,
+        .busy = busy,
+    };
+
+    adb_foreach_adt(adb, adb_foreach_defer_adt_consumer, &adb_f_d_c_ctx);
+}
+
 void adb_print(addr_book *adb) {
     const char *prefix = "  ";
 
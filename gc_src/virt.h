@@ -10,9 +10,17 @@ typedef struct {} addr_table;
 // book vaddrs.
 typedef struct addr_book_struct addr_book;
 
+// A vaddr is packed into 64 bits, so that reference tables and GC stacks
+// take half the space, and so a vaddr can be swapped with a single 
+// hardware CAS.
+//
+// This limits an address book to 2^24 - 1 tables of at most 2^40 - 1 
+// cells each. (The all ones vaddr is reserved for NULL_VADDR)
+//
+// NOTE: When passing a vaddr field to printf, cast it to uint64_t first.
 typedef struct {
-    uint64_t table_index;
-    uint64_t cell_index;
+    uint64_t cell_index : 40;
+    uint64_t table_index : 24;
 } addr_book_vaddr;
 
 // The codes will give hints to the user about the state
@@ -132,6 +140,83 @@ static inline void *adt_try_get_write(addr_table *adt, uint64_t ind) {
 // Unlock the entry at index.  
 void adt_unlock(addr_table *adt, uint64_t ind);
 
+// Optimistic Reads.
+//
+// Each cell holds a version which is odd while a writer holds the cell
+// (this includes moves and frees) and is bumped each time a writer lets
+// go. This allows for seqlock style reads which never touch the cell's
+// lock.
+//
+// adt_opt_read_begin returns the current paddr of the cell along with the
+// version it was read under. paddr will be NULL if a writer currently holds
+// the cell, or if the cell isn't allocated. (In which case the caller
+// should retry or fall back to a normal read)
+//
+// The caller can then copy what it needs out of paddr, and afterwards call
+// adt_opt_read_validate. If validate returns 0, a writer raced the read and
+// everything copied must be thrown away.
+//
+// NOTE: Data read optimistically cannot be trusted until it is validated.
+// For example, a length read from paddr must not be used to index into
+// paddr without first validating.
+//
+// NOTE: Unlike the locking calls, these calls do not exit on bad indeces.
+// An invalid index just results in a NULL paddr/failed validation.
+typedef struct {
+    uint64_t version;
+    void *paddr;
+} adt_opt_read_res;
+
+adt_opt_read_res adt_opt_read_begin(addr_table *adt, uint64_t ind);
+uint8_t adt_opt_read_validate(addr_table *adt, uint64_t ind, 
+        uint64_t version);
+
+// Atomic sections.
+//
+// adt_atomic_begin returns the cell's physical address and guarantees no
+// writer (this includes movers and frees) will acquire the cell until the 
+// matching adt_atomic_end. Unlike a read lock, no lock is touched, writers
+// instead wait for active sections to finish.
+//
+// Many atomic sections (and readers) can be active on the same cell at 
+// once. So, memory pointed to by paddr must only be modified using 
+// hardware atomics during an atomic section.
+//
+// Returns NULL if a writer currently holds the cell, or if the cell isn't
+// allocated. (Or if ind is out of bounds) In this case, adt_atomic_end must
+// not be called, and the caller should fall back to adt_get_read.
+//
+// NOTE: Writers spin while atomic sections are active, so these sections
+// should be kept very short. Never acquire a lock inside of one.
+void *adt_atomic_begin(addr_table *adt, uint64_t ind);
+void adt_atomic_end(addr_table *adt, uint64_t ind);
+
+// Pinning.
+//
+// A pinned cell's physical address will never change. Any attempt to
+// move a pinned cell results in an exit. Movers (like memory block shifts)
+// should check adt_pinned while holding the cell's write lock and skip 
+// pinned cells.
+//
+// adt_pin returns the cell's physical address. The pointer is valid 
+// until the matching adt_unpin call. Pins nest.
+//
+// NOTE: a pin does not acquire the cell's lock, the caller must provide
+// their own synchronization when using the returned pointer.
+//
+// NOTE: freeing a cell discards all of its pins.
+void *adt_pin(addr_table *adt, uint64_t ind);
+
+// Exits if the cell is not pinned.
+void adt_unpin(addr_table *adt, uint64_t ind);
+
+// Returns the number of pins held on the cell.
+uint64_t adt_pinned(addr_table *adt, uint64_t ind);
+
+// Get the physical address of a pinned cell without acquiring any lock.
+// Returns NULL if the cell isn't pinned. (Or if ind is out of bounds)
+void *adt_get_pinned(addr_table *adt, uint64_t ind);
+
 // Free a specific index in the table.
 //
 // NOTE: If this is called while the user has the lock on
@@ -146,6 +231,30 @@ typedef void (*adt_cell_consumer)(uint64_t ind, void *paddr, void *ctx);
 // calling the consumer.
 void adt_foreach(addr_table *adt, adt_cell_consumer c, void *ctx, uint8_t wr);
 
+typedef void (*adt_cell_busy_consumer)(uint64_t ind, void *ctx);
+
+// Like adt_foreach with the write lock, except a cell locked by someone 
+// else is skipped at first and handed to busy. Once the rest of the table 
+// is done, the skipped cells are waited on and given to c if they are 
+// still allocated.
+void adt_foreach_defer(addr_table *adt, adt_cell_consumer c, 
+        adt_cell_busy_consumer busy, void *ctx);
+
+// NOTE: The below two calls are used when restoring an address table
+// from a saved image. They should never be called in parallel with
+// any other call to the given adt.
+
+// Mark cell_ind as allocated and pointing to paddr without touching
+// the free stack. 
+//
+// Returns 0 on success, 1 if cell_ind is out of bounds or already 
+// allocated. (Image data is never trusted)
+uint8_t adt_restore(addr_table *adt, uint64_t cell_ind, void *paddr);
+
+// Rebuild the free stack from the allocation flags of each cell.
+// Returns the number of free cells.
+uint64_t adt_rebuild_free_stack(addr_table *adt);
+
 void adt_print_p(addr_table *adt, const char *prefix);
 
 static inline void adt_print(addr_table *adt) {
@@ -162,14 +271,37 @@ static inline uint8_t eq_adb_addr(addr_book_vaddr v1,
         (v1.cell_index == v2.cell_index);
 }
 
+// Canonical ordering of vaddrs. (table_index first, then cell_index)
+// Returns negative if v1 < v2, 0 if equal, positive if v1 > v2.
+//
+// When locking more than one vaddr at once, always lock in this order.
+static inline int8_t cmp_adb_addr(addr_book_vaddr v1, 
+        addr_book_vaddr v2) {
+    if (v1.table_index != v2.table_index) {
+        return v1.table_index < v2.table_index ? -1 : 1;
+    }
+
+    if (v1.cell_index != v2.cell_index) {
+        return v1.cell_index < v2.cell_index ? -1 : 1;
+    }
+
+    return 0;
+}
+
 static inline uint8_t null_adb_addr(addr_book_vaddr v) {
     return v.table_index == NULL_VADDR.table_index &&
         v.cell_index == NULL_VADDR.cell_index;
 }
 
+// Returns NULL if table_cap is 0 or too large to be packed in a vaddr.
 addr_book *new_addr_book(uint8_t chnl, uint64_t table_cap);
 void delete_addr_book(addr_book *adb);
 
+uint64_t adb_get_table_cap(addr_book *adb);
+
+// Number of tables in the book.
+uint64_t adb_get_book_len(addr_book *adb);
+
 addr_book_vaddr adb_put_p(addr_book *adb, void *paddr, uint8_t hold);
 
 static inline addr_book_vaddr adb_put(addr_book *adb, void *paddr) {
@@ -205,8 +337,43 @@ void *adb_try_get_write(addr_book *adb, addr_book_vaddr vaddr);
 
 void adb_unlock(addr_book *adb, addr_book_vaddr vaddr);
 
+// Optimistic reads. (See adt_opt_read_begin)
+// These calls never acquire the book lock or the cell lock.
+adt_opt_read_res adb_opt_read_begin(addr_book *adb, addr_book_vaddr vaddr);
+uint8_t adb_opt_read_validate(addr_book *adb, addr_book_vaddr vaddr,
+        uint64_t version);
+
+// Atomic sections. (See adt_atomic_begin)
+// Like adb_opt_read_begin, these never acquire the book lock.
+void *adb_atomic_begin(addr_book *adb, addr_book_vaddr vaddr);
+void adb_atomic_end(addr_book *adb, addr_book_vaddr vaddr);
+
+// Pinning. (See adt_pin)
+void *adb_pin(addr_book *adb, addr_book_vaddr vaddr);
+void adb_unpin(addr_book *adb, addr_book_vaddr vaddr);
+uint64_t adb_pinned(addr_book *adb, addr_book_vaddr vaddr);
+
+// Like adb_opt_read_begin, this never acquires the book lock.
+void *adb_get_pinned(addr_book *adb, addr_book_vaddr vaddr);
+
 void adb_free(addr_book *adb, addr_book_vaddr vaddr);
 
+// Image restoration calls. (See adt_restore)
+//
+// adb_restore places paddr at exactly vaddr, creating tables as needed.
+// Once every vaddr has been restored, adb_restore_finish must be called
+// to rebuild the free stacks and free list of the book.
+//
+// adb_restore_begin limits restored vaddrs to the first book_len tables,
+// so that a corrupt vaddr can't make the book grow without bound.
+// Returns 1 if book_len is too large for the book.
+uint8_t adb_restore_begin(addr_book *adb, uint64_t book_len);
+
+// Returns 0 on success, 1 if vaddr is outside of the book's limits or
+// was already restored.
+uint8_t adb_restore(addr_book *adb, addr_book_vaddr vaddr, void *paddr);
+void adb_restore_finish(addr_book *adb);
+
 // NOTE: does not stop
 uint64_t adb_get_fill(addr_book *adb);
 
@@ -214,6 +381,12 @@ typedef void (*adb_cell_consumer)(addr_book_vaddr v, void *paddr, void *ctx);
 
 void adb_foreach(addr_book *adb, adb_cell_consumer c, void *ctx, uint8_t wr);
 
+typedef void (*adb_cell_busy_consumer)(addr_book_vaddr v, void *ctx);
+
+// (See adt_foreach_defer)
+void adb_foreach_defer(addr_book *adb, adb_cell_consumer c, 
+        adb_cell_busy_consumer busy, void *ctx);
+
 typedef uint8_t (*adb_cell_predicate)(addr_book_vaddr v, 
             void *paddr, void *ctx);
 